@@ -19,24 +19,56 @@
 #include "stm32.h"
 #include "usb.h"
 #include "usb_cdc.h"
+#include "usbd_cdc_acm.h"
 #include "usb_hid.h"
-#include "hid_usage_desktop.h"
-#include "hid_usage_button.h"
+#include "usbd_hid.h"
+#include "hid_mouse.h"
+#include "hid_mouse_layout.h"
 
 #define CDC_EP0_SIZE    0x08
-#define CDC_RXD_EP      0x01
-#define CDC_TXD_EP      0x81
+#if (USBD_HW_EPCOUNT > 5)
+#define CDC_PORTS       2       /* number of virtual COM ports, up to 6 */
+#else
+#define CDC_PORTS       1       /* OTG FS cores with 4 endpoints fit one port and HID */
+#endif
+#define CDC_DATA_EP     0x01    /* data endpoints of the first port */
 #define CDC_DATA_SZ     0x40
-#define CDC_NTF_EP      0x82
-#define CDC_NTF_SZ      0x08
-#define HID_RIN_EP      0x83
+#define CDC_POOL_BLKS   16      /* blocks shared by all ports */
+#define CDC_POOL_QUOTA  8       /* blocks one port may borrow for each direction */
 #define HID_RIN_SZ      0x10
+#define HID_RIN_INTERVAL 50     /* HID report interval in frames */
 
 #define CDC_LOOPBACK
 #define ENABLE_HID_COMBO
 
-//#define SIGNAL_MODEM  /* uncomment to signal modem capabilities */
-//#define CDC_USE_IRQ   /* uncomment to build interrupt-based demo */
+//#define SIGNAL_MODEM      /* uncomment to signal modem capabilities */
+//#define CDC_USE_IRQ       /* uncomment to build interrupt-based demo */
+//#define CDC_SHARED_NTF    /* uncomment to share one notification endpoint by all ports */
+
+/* data endpoints of the port 0 are used by the non-loopback test modes */
+#define CDC_RXD_EP      USBD_CDC_ACM_RX_EP(CDC_DATA_EP, 0)
+#define CDC_TXD_EP      USBD_CDC_ACM_TX_EP(CDC_DATA_EP, 0)
+
+/* notification endpoints follow the data endpoints */
+#if defined(CDC_SHARED_NTF)
+#define CDC_NTF_EPS     1
+#define CDC_NTF_EP(n)   (0x80 | (CDC_DATA_EP + CDC_PORTS))
+#else
+#define CDC_NTF_EPS     CDC_PORTS
+#define CDC_NTF_EP(n)   (0x80 | (CDC_DATA_EP + CDC_PORTS + (n)))
+#endif
+
+#define HID_RIN_EP      (0x80 | (CDC_DATA_EP + CDC_PORTS + CDC_NTF_EPS))
+#define HID_INTF        USBD_CDC_ACM_COMM_IF(0, CDC_PORTS)
+
+#if defined(ENABLE_HID_COMBO)
+#define CDC_LAST_EP     (HID_RIN_EP & 0x7F)
+#else
+#define CDC_LAST_EP     (CDC_DATA_EP + CDC_PORTS + CDC_NTF_EPS - 1)
+#endif
+#if (CDC_PORTS < 1) || (CDC_PORTS > 6) || (CDC_LAST_EP >= USBD_HW_EPCOUNT)
+    #error Not enough endpoints. Reduce CDC_PORTS or define CDC_SHARED_NTF
+#endif
 
 #if defined(SIGNAL_MODEM)
 #define CDC_PROTOCOL USB_CDC_PROTO_V25TER
@@ -44,19 +76,15 @@
 #define CDC_PROTOCOL USB_PROTO_NONE
 #endif
 
+#define CDC_PORT_DESC(n)    USBD_CDC_ACM_DESC(USBD_CDC_ACM_COMM_IF(0, n),\
+                                              USBD_CDC_ACM_RX_EP(CDC_DATA_EP, n),\
+                                              USBD_CDC_ACM_TX_EP(CDC_DATA_EP, n),\
+                                              CDC_NTF_EP(n), CDC_DATA_SZ, CDC_PROTOCOL)
+
 /* Declaration of the report descriptor */
 struct cdc_config {
     struct usb_config_descriptor        config;
-    struct usb_iad_descriptor           comm_iad;
-    struct usb_interface_descriptor     comm;
-    struct usb_cdc_header_desc          cdc_hdr;
-    struct usb_cdc_call_mgmt_desc       cdc_mgmt;
-    struct usb_cdc_acm_desc             cdc_acm;
-    struct usb_cdc_union_desc           cdc_union;
-    struct usb_endpoint_descriptor      comm_ep;
-    struct usb_interface_descriptor     data;
-    struct usb_endpoint_descriptor      data_eprx;
-    struct usb_endpoint_descriptor      data_eptx;
+    struct usbd_cdc_acm_desc            cdc[CDC_PORTS];
 #ifdef ENABLE_HID_COMBO
     struct usb_interface_descriptor     hid;
     struct usb_hid_descriptor           hid_desc;
@@ -64,35 +92,6 @@ struct cdc_config {
 #endif //ENABLE_HID_COMBO
 } __attribute__((packed));
 
-/* HID mouse report desscriptor. 2 axis 5 buttons */
-static const uint8_t hid_report_desc[] = {
-    HID_USAGE_PAGE(HID_PAGE_DESKTOP),
-    HID_USAGE(HID_DESKTOP_MOUSE),
-    HID_COLLECTION(HID_APPLICATION_COLLECTION),
-        HID_USAGE(HID_DESKTOP_POINTER),
-        HID_COLLECTION(HID_PHYSICAL_COLLECTION),
-            HID_USAGE(HID_DESKTOP_X),
-            HID_USAGE(HID_DESKTOP_Y),
-            HID_LOGICAL_MINIMUM(-127),
-            HID_LOGICAL_MAXIMUM(127),
-            HID_REPORT_SIZE(8),
-            HID_REPORT_COUNT(2),
-            HID_INPUT(HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_RELATIVE ),
-            HID_USAGE_PAGE(HID_PAGE_BUTTON),
-            HID_USAGE_MINIMUM(1),
-            HID_USAGE_MAXIMUM(5),
-            HID_LOGICAL_MINIMUM(0),
-            HID_LOGICAL_MAXIMUM(1),
-            HID_REPORT_SIZE(1),
-            HID_REPORT_COUNT(5),
-            HID_INPUT(HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE ),
-            HID_REPORT_SIZE(1),
-            HID_REPORT_COUNT(3),
-            HID_INPUT(HID_IOF_CONSTANT),
-        HID_END_COLLECTION,
-    HID_END_COLLECTION,
-};
-
 /* Device descriptor */
 static const struct usb_device_descriptor device_desc = {
     .bLength            = sizeof(struct usb_device_descriptor),
@@ -118,103 +117,38 @@ static const struct cdc_config config_desc = {
         .bDescriptorType        = USB_DTYPE_CONFIGURATION,
         .wTotalLength           = sizeof(struct cdc_config),
 #ifdef ENABLE_HID_COMBO
-        .bNumInterfaces         = 3,
+        .bNumInterfaces         = 2 * CDC_PORTS + 1,
 #else
-        .bNumInterfaces         = 2,
+        .bNumInterfaces         = 2 * CDC_PORTS,
 #endif //ENABLE_HID_COMBO
         .bConfigurationValue    = 1,
         .iConfiguration         = NO_DESCRIPTOR,
         .bmAttributes           = USB_CFG_ATTR_RESERVED | USB_CFG_ATTR_SELFPOWERED,
         .bMaxPower              = USB_CFG_POWER_MA(100),
     },
-    .comm_iad = {
-        .bLength = sizeof(struct usb_iad_descriptor),
-        .bDescriptorType        = USB_DTYPE_INTERFASEASSOC,
-        .bFirstInterface        = 0,
-        .bInterfaceCount        = 2,
-        .bFunctionClass         = USB_CLASS_CDC,
-        .bFunctionSubClass      = USB_CDC_SUBCLASS_ACM,
-        .bFunctionProtocol      = CDC_PROTOCOL,
-        .iFunction              = NO_DESCRIPTOR,
-    },
-    .comm = {
-        .bLength                = sizeof(struct usb_interface_descriptor),
-        .bDescriptorType        = USB_DTYPE_INTERFACE,
-        .bInterfaceNumber       = 0,
-        .bAlternateSetting      = 0,
-        .bNumEndpoints          = 1,
-        .bInterfaceClass        = USB_CLASS_CDC,
-        .bInterfaceSubClass     = USB_CDC_SUBCLASS_ACM,
-        .bInterfaceProtocol     = CDC_PROTOCOL,
-        .iInterface             = NO_DESCRIPTOR,
-    },
-    .cdc_hdr = {
-        .bFunctionLength        = sizeof(struct usb_cdc_header_desc),
-        .bDescriptorType        = USB_DTYPE_CS_INTERFACE,
-        .bDescriptorSubType     = USB_DTYPE_CDC_HEADER,
-        .bcdCDC                 = VERSION_BCD(1,1,0),
-    },
-    .cdc_mgmt = {
-        .bFunctionLength        = sizeof(struct usb_cdc_call_mgmt_desc),
-        .bDescriptorType        = USB_DTYPE_CS_INTERFACE,
-        .bDescriptorSubType     = USB_DTYPE_CDC_CALL_MANAGEMENT,
-        .bmCapabilities         = 0,
-        .bDataInterface         = 1,
-
-    },
-    .cdc_acm = {
-        .bFunctionLength        = sizeof(struct usb_cdc_acm_desc),
-        .bDescriptorType        = USB_DTYPE_CS_INTERFACE,
-        .bDescriptorSubType     = USB_DTYPE_CDC_ACM,
-        .bmCapabilities         = 0,
-    },
-    .cdc_union = {
-        .bFunctionLength        = sizeof(struct usb_cdc_union_desc),
-        .bDescriptorType        = USB_DTYPE_CS_INTERFACE,
-        .bDescriptorSubType     = USB_DTYPE_CDC_UNION,
-        .bMasterInterface0      = 0,
-        .bSlaveInterface0       = 1,
-    },
-    .comm_ep = {
-        .bLength                = sizeof(struct usb_endpoint_descriptor),
-        .bDescriptorType        = USB_DTYPE_ENDPOINT,
-        .bEndpointAddress       = CDC_NTF_EP,
-        .bmAttributes           = USB_EPTYPE_INTERRUPT,
-        .wMaxPacketSize         = CDC_NTF_SZ,
-        .bInterval              = 0xFF,
-    },
-    .data = {
-        .bLength                = sizeof(struct usb_interface_descriptor),
-        .bDescriptorType        = USB_DTYPE_INTERFACE,
-        .bInterfaceNumber       = 1,
-        .bAlternateSetting      = 0,
-        .bNumEndpoints          = 2,
-        .bInterfaceClass        = USB_CLASS_CDC_DATA,
-        .bInterfaceSubClass     = USB_SUBCLASS_NONE,
-        .bInterfaceProtocol     = USB_PROTO_NONE,
-        .iInterface             = NO_DESCRIPTOR,
-    },
-    .data_eprx = {
-        .bLength                = sizeof(struct usb_endpoint_descriptor),
-        .bDescriptorType        = USB_DTYPE_ENDPOINT,
-        .bEndpointAddress       = CDC_RXD_EP,
-        .bmAttributes           = USB_EPTYPE_BULK,
-        .wMaxPacketSize         = CDC_DATA_SZ,
-        .bInterval              = 0x01,
-    },
-    .data_eptx = {
-        .bLength                = sizeof(struct usb_endpoint_descriptor),
-        .bDescriptorType        = USB_DTYPE_ENDPOINT,
-        .bEndpointAddress       = CDC_TXD_EP,
-        .bmAttributes           = USB_EPTYPE_BULK,
-        .wMaxPacketSize         = CDC_DATA_SZ,
-        .bInterval              = 0x01,
+    .cdc = {
+        CDC_PORT_DESC(0),
+#if (CDC_PORTS > 1)
+        CDC_PORT_DESC(1),
+#endif
+#if (CDC_PORTS > 2)
+        CDC_PORT_DESC(2),
+#endif
+#if (CDC_PORTS > 3)
+        CDC_PORT_DESC(3),
+#endif
+#if (CDC_PORTS > 4)
+        CDC_PORT_DESC(4),
+#endif
+#if (CDC_PORTS > 5)
+        CDC_PORT_DESC(5),
+#endif
     },
 #ifdef ENABLE_HID_COMBO
     .hid = {
         .bLength                = sizeof(struct usb_interface_descriptor),
         .bDescriptorType        = USB_DTYPE_INTERFACE,
-        .bInterfaceNumber       = 2,
+        .bInterfaceNumber       = HID_INTF,
         .bAlternateSetting      = 0,
         .bNumEndpoints          = 1,
         .bInterfaceClass        = USB_CLASS_HID,
@@ -237,7 +171,7 @@ static const struct cdc_config config_desc = {
         .bEndpointAddress       = HID_RIN_EP,
         .bmAttributes           = USB_EPTYPE_INTERRUPT,
         .wMaxPacketSize         = HID_RIN_SZ,
-        .bInterval              = 50,
+        .bInterval              = HID_RIN_INTERVAL,
     },
 #endif // ENABLE_HID_COMBO
 };
@@ -253,21 +187,32 @@ static const struct usb_string_descriptor *const dtable[] = {
 
 usbd_device udev;
 uint32_t	ubuf[0x20];
-uint8_t     fifo[0x200];
-uint32_t    fpos = 0;
-
-static struct usb_cdc_line_coding cdc_line = {
-    .dwDTERate          = 38400,
-    .bCharFormat        = USB_CDC_1_STOP_BITS,
-    .bParityType        = USB_CDC_NO_PARITY,
-    .bDataBits          = 8,
-};
+uint8_t     cdc_buf[CDC_DATA_SZ];
+usbd_cdc_acm_blk    cdc_blk[CDC_POOL_BLKS];
+usbd_cdc_acm_pool   cdc_pool;
+usbd_cdc_acm        cdc_acm[CDC_PORTS];
 
-static struct {
-    int8_t      x;
-    int8_t      y;
-    uint8_t     buttons;
-} __attribute__((packed)) hid_report_data;
+#ifdef ENABLE_HID_COMBO
+/* fails if hid_mouse_layout.h is outdated. run "make hidlayout" */
+_Static_assert(sizeof(hid_report_desc) == HID_MOUSE_DESC_SIZE, "HID report layout is outdated");
+
+static uint8_t hid_report_data[HID_MOUSE_IN_SIZE];
+
+uint8_t     hid_queue[2 * sizeof(hid_report_data)];
+usbd_hid    hid;
+
+/* mouse report. X and Y are relative axes */
+static usbd_hid_report hid_reports[] = {
+    {
+        .id     = 0,
+        .size   = sizeof(hid_report_data),
+        .depth  = 1,
+        .rel8   = HID_MOUSE_IN_REL8,
+        .rel16  = HID_MOUSE_IN_REL16,
+        .buf    = hid_queue,
+    },
+};
+#endif //ENABLE_HID_COMBO
 
 static usbd_respond cdc_getdesc (usbd_ctlreq *req, void **address, uint16_t *length) {
     const uint8_t dtype = req->wValue >> 8;
@@ -302,38 +247,17 @@ static usbd_respond cdc_getdesc (usbd_ctlreq *req, void **address, uint16_t *len
 
 
 static usbd_respond cdc_control(usbd_device *dev, usbd_ctlreq *req, usbd_rqc_callback *callback) {
-    if (((USB_REQ_RECIPIENT | USB_REQ_TYPE) & req->bmRequestType) == (USB_REQ_INTERFACE | USB_REQ_CLASS)
-        && req->wIndex == 0 ) {
-        switch (req->bRequest) {
-        case USB_CDC_SET_CONTROL_LINE_STATE:
-            return usbd_ack;
-        case USB_CDC_SET_LINE_CODING:
-            memcpy( req->data, &cdc_line, sizeof(cdc_line));
-            return usbd_ack;
-        case USB_CDC_GET_LINE_CODING:
-            dev->status.data_ptr = &cdc_line;
-            dev->status.data_count = sizeof(cdc_line);
+    for (int i = 0; i < CDC_PORTS; i++) {
+        if (usbd_cdc_acm_control(&cdc_acm[i], req) == usbd_ack) {
             return usbd_ack;
-        default:
-            return usbd_fail;
         }
     }
 #ifdef ENABLE_HID_COMBO
-    if (((USB_REQ_RECIPIENT | USB_REQ_TYPE) & req->bmRequestType) == (USB_REQ_INTERFACE | USB_REQ_CLASS)
-        && req->wIndex == 2 ) {
-        switch (req->bRequest) {
-        case USB_HID_SETIDLE:
-            return usbd_ack;
-        case USB_HID_GETREPORT:
-            dev->status.data_ptr = &hid_report_data;
-            dev->status.data_count = sizeof(hid_report_data);
-            return usbd_ack;
-        default:
-            return usbd_fail;
-        }
+    if (usbd_hid_control(&hid, req) == usbd_ack) {
+        return usbd_ack;
     }
     if (((USB_REQ_RECIPIENT | USB_REQ_TYPE) & req->bmRequestType) == (USB_REQ_INTERFACE | USB_REQ_STANDARD)
-        && req->wIndex == 2
+        && req->wIndex == HID_INTF
         && req->bRequest == USB_STD_GET_DESCRIPTOR) {
         switch (req->wValue >> 8) {
         case USB_DTYPE_HID:
@@ -354,13 +278,13 @@ static usbd_respond cdc_control(usbd_device *dev, usbd_ctlreq *req, usbd_rqc_cal
 
 
 static void cdc_rxonly (usbd_device *dev, uint8_t event, uint8_t ep) {
-   usbd_ep_read(dev, ep, fifo, CDC_DATA_SZ);
+   usbd_ep_read(dev, ep, cdc_buf, CDC_DATA_SZ);
 }
 
 static void cdc_txonly(usbd_device *dev, uint8_t event, uint8_t ep) {
-    uint8_t _t = dev->driver->frame_no();
-    memset(fifo, _t, CDC_DATA_SZ);
-    usbd_ep_write(dev, ep, fifo, CDC_DATA_SZ);
+    uint8_t _t = usbd_hw_call(dev, frame_no);
+    memset(cdc_buf, _t, CDC_DATA_SZ);
+    usbd_ep_write(dev, ep, cdc_buf, CDC_DATA_SZ);
 }
 
 static void cdc_rxtx(usbd_device *dev, uint8_t event, uint8_t ep) {
@@ -371,54 +295,62 @@ static void cdc_rxtx(usbd_device *dev, uint8_t event, uint8_t ep) {
     }
 }
 
-/* HID mouse IN endpoint callback */
-static void hid_mouse_move(usbd_device *dev, uint8_t event, uint8_t ep) {
+#ifdef ENABLE_HID_COMBO
+/* HID mouse. Queues next move when previous one is taken by the HID function */
+static void hid_mouse_move(void) {
     static uint8_t t = 0;
     if (t < 0x10) {
-        hid_report_data.x = 1;
-        hid_report_data.y = 0;
+        hid_mouse_in_x_set(hid_report_data, 1);
+        hid_mouse_in_y_set(hid_report_data, 0);
     } else if (t < 0x20) {
-        hid_report_data.x = 1;
-        hid_report_data.y = 1;
+        hid_mouse_in_x_set(hid_report_data, 1);
+        hid_mouse_in_y_set(hid_report_data, 1);
     } else if (t < 0x30) {
-        hid_report_data.x = 0;
-        hid_report_data.y = 1;
+        hid_mouse_in_x_set(hid_report_data, 0);
+        hid_mouse_in_y_set(hid_report_data, 1);
     } else if (t < 0x40) {
-        hid_report_data.x = -1;
-        hid_report_data.y = 1;
+        hid_mouse_in_x_set(hid_report_data, -1);
+        hid_mouse_in_y_set(hid_report_data, 1);
     } else if (t < 0x50) {
-        hid_report_data.x = -1;
-        hid_report_data.y = 0;
+        hid_mouse_in_x_set(hid_report_data, -1);
+        hid_mouse_in_y_set(hid_report_data, 0);
     } else if (t < 0x60) {
-        hid_report_data.x = -1;
-        hid_report_data.y = -1;
+        hid_mouse_in_x_set(hid_report_data, -1);
+        hid_mouse_in_y_set(hid_report_data, -1);
     } else if (t < 0x70) {
-        hid_report_data.x = 0;
-        hid_report_data.y = -1;
+        hid_mouse_in_x_set(hid_report_data, 0);
+        hid_mouse_in_y_set(hid_report_data, -1);
     } else  {
-        hid_report_data.x = 1;
-        hid_report_data.y = -1;
+        hid_mouse_in_x_set(hid_report_data, 1);
+        hid_mouse_in_y_set(hid_report_data, -1);
     }
-    t = (t + 1) & 0x7F;
-    usbd_ep_write(dev, ep, &hid_report_data, sizeof(hid_report_data));
+    if (hid_reports[0].count == 0 && usbd_hid_send(&hid, 0, hid_report_data)) {
+        t = (t + 1) & 0x7F;
+    }
+    usbd_hid_poll(&hid);
 }
 
-/* CDC loop callback. Both for the Data IN and Data OUT endpoint */
-static void cdc_loopback(usbd_device *dev, uint8_t event, uint8_t ep) {
-    int _t;
-    if (fpos <= (sizeof(fifo) - CDC_DATA_SZ)) {
-        _t = usbd_ep_read(dev, CDC_RXD_EP, &fifo[fpos], CDC_DATA_SZ);
-        if (_t > 0) {
-            fpos += _t;
-        }
-    }
-    if (fpos > 0) {
-        _t = usbd_ep_write(dev, CDC_TXD_EP, &fifo[0], (fpos < CDC_DATA_SZ) ? fpos : CDC_DATA_SZ);
+#if defined(USBD_SCHED)
+static usbd_sched_job hid_job;
+
+/* frame scheduler job. Moves the mouse once per report interval */
+static void hid_mouse_job(usbd_device *dev, uint8_t event, uint8_t ep) {
+    hid_mouse_move();
+}
+#endif
+#endif //ENABLE_HID_COMBO
+
+/* CDC loop. Moves received data to the TX queue of the same port */
+static void cdc_loopback(void) {
+#if defined(CDC_LOOPBACK)
+    for (int i = 0; i < CDC_PORTS; i++) {
+        const uint8_t *_d;
+        uint16_t _t = usbd_cdc_acm_rx_peek(&cdc_acm[i], &_d);
         if (_t > 0) {
-            memmove(&fifo[0], &fifo[_t], fpos - _t);
-            fpos -= _t;
+            usbd_cdc_acm_rx_commit(&cdc_acm[i], usbd_cdc_acm_write(&cdc_acm[i], _d, _t));
         }
     }
+#endif
 }
 
 static usbd_respond cdc_setconf (usbd_device *dev, uint8_t cfg) {
@@ -426,23 +358,19 @@ static usbd_respond cdc_setconf (usbd_device *dev, uint8_t cfg) {
     case 0:
         /* deconfiguring device */
 #ifdef ENABLE_HID_COMBO
-        usbd_ep_deconfig(dev, HID_RIN_EP);
-        usbd_reg_endpoint(dev, HID_RIN_EP, 0);
+        usbd_hid_enable(&hid, false);
 #endif // ENABLE_HID_COMBO
-        usbd_ep_deconfig(dev, CDC_NTF_EP);
-        usbd_ep_deconfig(dev, CDC_TXD_EP);
-        usbd_ep_deconfig(dev, CDC_RXD_EP);
-        usbd_reg_endpoint(dev, CDC_RXD_EP, 0);
-        usbd_reg_endpoint(dev, CDC_TXD_EP, 0);
+        for (int i = 0; i < CDC_PORTS; i++) {
+            usbd_cdc_acm_enable(&cdc_acm[i], false);
+        }
         return usbd_ack;
     case 1:
         /* configuring device */
-        usbd_ep_config(dev, CDC_RXD_EP, USB_EPTYPE_BULK /*| USB_EPTYPE_DBLBUF*/, CDC_DATA_SZ);
-        usbd_ep_config(dev, CDC_TXD_EP, USB_EPTYPE_BULK /*| USB_EPTYPE_DBLBUF*/, CDC_DATA_SZ);
-        usbd_ep_config(dev, CDC_NTF_EP, USB_EPTYPE_INTERRUPT, CDC_NTF_SZ);
+        for (int i = 0; i < CDC_PORTS; i++) {
+            usbd_cdc_acm_enable(&cdc_acm[i], true);
+        }
 #if defined(CDC_LOOPBACK)
-        usbd_reg_endpoint(dev, CDC_RXD_EP, cdc_loopback);
-        usbd_reg_endpoint(dev, CDC_TXD_EP, cdc_loopback);
+        /* endpoints are served by CDC ACM function */
 #elif ((CDC_TXD_EP & 0x7F) == (CDC_RXD_EP & 0x7F))
         usbd_reg_endpoint(dev, CDC_RXD_EP, cdc_rxtx);
         usbd_reg_endpoint(dev, CDC_TXD_EP, cdc_rxtx);
@@ -451,22 +379,54 @@ static usbd_respond cdc_setconf (usbd_device *dev, uint8_t cfg) {
         usbd_reg_endpoint(dev, CDC_TXD_EP, cdc_txonly);
 #endif
 #ifdef ENABLE_HID_COMBO
-        usbd_ep_config(dev, HID_RIN_EP, USB_EPTYPE_INTERRUPT, HID_RIN_SZ);
-        usbd_reg_endpoint(dev, HID_RIN_EP, hid_mouse_move);
-        usbd_ep_write(dev, HID_RIN_EP, 0, 0);
+        usbd_hid_enable(&hid, true);
 #endif // ENABLE_HID_COMBO
+#if !defined(CDC_LOOPBACK)
         usbd_ep_write(dev, CDC_TXD_EP, 0, 0);
+#endif
         return usbd_ack;
     default:
         return usbd_fail;
     }
 }
 
+#if defined(USBD_CONST_CFG)
+static const usbd_config udev_cfg = {
+    .driver                 = &usbd_hw,
+#if defined(USBD_DRIVER_CTX)
+    .base                   = usbd_hw_base,
+#endif
+    .control_callback       = cdc_control,
+    .config_callback        = cdc_setconf,
+    .descriptor_callback    = cdc_getdesc,
+};
+#endif
+
 static void cdc_init_usbd(void) {
+#if defined(USBD_CONST_CFG)
+    usbd_init_cfg(&udev, &udev_cfg, CDC_EP0_SIZE, ubuf, sizeof(ubuf));
+#else
+#if defined(USBD_DRIVER_CTX)
+    usbd_init_ctx(&udev, &usbd_hw, usbd_hw_base, CDC_EP0_SIZE, ubuf, sizeof(ubuf));
+#else
     usbd_init(&udev, &usbd_hw, CDC_EP0_SIZE, ubuf, sizeof(ubuf));
+#endif
     usbd_reg_config(&udev, cdc_setconf);
     usbd_reg_control(&udev, cdc_control);
     usbd_reg_descr(&udev, cdc_getdesc);
+#endif
+    usbd_cdc_acm_pool_init(&cdc_pool, cdc_blk, CDC_POOL_BLKS);
+    for (int i = 0; i < CDC_PORTS; i++) {
+        usbd_cdc_acm_init_pool(&cdc_acm[i], &udev, USBD_CDC_ACM_COMM_IF(0, i),
+                               USBD_CDC_ACM_RX_EP(CDC_DATA_EP, i), USBD_CDC_ACM_TX_EP(CDC_DATA_EP, i),
+                               CDC_NTF_EP(i), CDC_DATA_SZ, &cdc_pool, CDC_POOL_QUOTA);
+    }
+#ifdef ENABLE_HID_COMBO
+    usbd_hid_init(&hid, &udev, HID_INTF, HID_RIN_EP, HID_RIN_SZ, hid_reports, 1);
+#if defined(USBD_SCHED)
+    usbd_sched_add(&udev, &hid_job, HID_RIN_EP, HID_RIN_INTERVAL, hid_mouse_job);
+#endif
+#endif //ENABLE_HID_COMBO
 }
 
 #if defined(CDC_USE_IRQ)
@@ -511,6 +471,14 @@ void main(void) {
     usbd_connect(&udev, true);
     while(1) {
         __WFI();
+        NVIC_DisableIRQ(USB_NVIC_IRQ);
+        cdc_loopback();
+#if defined(USBD_SCHED)
+        usbd_sched_poll(&udev);
+#elif defined(ENABLE_HID_COMBO)
+        hid_mouse_move();
+#endif
+        NVIC_EnableIRQ(USB_NVIC_IRQ);
     }
 }
 #else
@@ -520,6 +488,12 @@ void main(void) {
     usbd_connect(&udev, true);
     while(1) {
         usbd_poll(&udev);
+        cdc_loopback();
+#if defined(USBD_SCHED)
+        usbd_sched_poll(&udev);
+#elif defined(ENABLE_HID_COMBO)
+        hid_mouse_move();
+#endif
     }
 }
 #endif
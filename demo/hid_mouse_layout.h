@@ -0,0 +1,85 @@
+/* Generated by tools/hidlayout.c from demo/hid_mouse.h. Do not edit. */
+
+#ifndef _HID_MOUSE_LAYOUT_H_
+#define _HID_MOUSE_LAYOUT_H_
+
+#include <stdint.h>
+
+#define HID_MOUSE_DESC_SIZE 48
+
+/* IN report 0: 24 bits, 3 padding bits */
+#define HID_MOUSE_IN_SIZE 3
+#define HID_MOUSE_IN_X_OFFSET 0
+#define HID_MOUSE_IN_X_BITS 8
+#define HID_MOUSE_IN_Y_OFFSET 8
+#define HID_MOUSE_IN_Y_BITS 8
+#define HID_MOUSE_IN_BUTTON1_OFFSET 16
+#define HID_MOUSE_IN_BUTTON1_BITS 1
+#define HID_MOUSE_IN_BUTTON2_OFFSET 17
+#define HID_MOUSE_IN_BUTTON2_BITS 1
+#define HID_MOUSE_IN_BUTTON3_OFFSET 18
+#define HID_MOUSE_IN_BUTTON3_BITS 1
+#define HID_MOUSE_IN_BUTTON4_OFFSET 19
+#define HID_MOUSE_IN_BUTTON4_BITS 1
+#define HID_MOUSE_IN_BUTTON5_OFFSET 20
+#define HID_MOUSE_IN_BUTTON5_BITS 1
+#define HID_MOUSE_IN_REL8 0x00000003
+#define HID_MOUSE_IN_REL16 0x00000000
+inline static void hid_mouse_in_x_set(uint8_t *r, int32_t v) {
+    r[0] = (uint8_t)((uint32_t)v);
+}
+inline static int32_t hid_mouse_in_x_get(const uint8_t *r) {
+    uint32_t v = 0;
+    v |= (uint32_t)(r[0] & 0xFF);
+    return (int32_t)(v << 24) >> 24;
+}
+inline static void hid_mouse_in_y_set(uint8_t *r, int32_t v) {
+    r[1] = (uint8_t)((uint32_t)v);
+}
+inline static int32_t hid_mouse_in_y_get(const uint8_t *r) {
+    uint32_t v = 0;
+    v |= (uint32_t)(r[1] & 0xFF);
+    return (int32_t)(v << 24) >> 24;
+}
+inline static void hid_mouse_in_button1_set(uint8_t *r, int32_t v) {
+    r[2] = (r[2] & 0xFE) | (((uint32_t)v) & 0x01);
+}
+inline static int32_t hid_mouse_in_button1_get(const uint8_t *r) {
+    uint32_t v = 0;
+    v |= (uint32_t)(r[2] & 0x01);
+    return (int32_t)v;
+}
+inline static void hid_mouse_in_button2_set(uint8_t *r, int32_t v) {
+    r[2] = (r[2] & 0xFD) | (((uint32_t)v << 1) & 0x02);
+}
+inline static int32_t hid_mouse_in_button2_get(const uint8_t *r) {
+    uint32_t v = 0;
+    v |= (uint32_t)(r[2] & 0x02) >> 1;
+    return (int32_t)v;
+}
+inline static void hid_mouse_in_button3_set(uint8_t *r, int32_t v) {
+    r[2] = (r[2] & 0xFB) | (((uint32_t)v << 2) & 0x04);
+}
+inline static int32_t hid_mouse_in_button3_get(const uint8_t *r) {
+    uint32_t v = 0;
+    v |= (uint32_t)(r[2] & 0x04) >> 2;
+    return (int32_t)v;
+}
+inline static void hid_mouse_in_button4_set(uint8_t *r, int32_t v) {
+    r[2] = (r[2] & 0xF7) | (((uint32_t)v << 3) & 0x08);
+}
+inline static int32_t hid_mouse_in_button4_get(const uint8_t *r) {
+    uint32_t v = 0;
+    v |= (uint32_t)(r[2] & 0x08) >> 3;
+    return (int32_t)v;
+}
+inline static void hid_mouse_in_button5_set(uint8_t *r, int32_t v) {
+    r[2] = (r[2] & 0xEF) | (((uint32_t)v << 4) & 0x10);
+}
+inline static int32_t hid_mouse_in_button5_get(const uint8_t *r) {
+    uint32_t v = 0;
+    v |= (uint32_t)(r[2] & 0x10) >> 4;
+    return (int32_t)v;
+}
+
+#endif //_HID_MOUSE_LAYOUT_H_
@@ -24,6 +24,9 @@
 #include "usb_std.h"
 #endif
 
+/* USBD_HW_EPCOUNT is the number of endpoints, including the control endpoint 0, supported by
+ * the selected driver. Drivers do not check the endpoint number, so configurations should be
+ * checked against it at compile time. */
 #if defined(STM32L052xx) || defined(STM32L053xx) || \
     defined(STM32L062xx) || defined(STM32L063xx) || \
     defined(STM32L072xx) || defined(STM32L073xx) || \
@@ -33,6 +36,7 @@
     defined(STM32F072xB) || defined(STM32F078xx)
 
     #define USBD_STM32L052
+    #define USBD_HW_EPCOUNT     8
 
     #if !defined(__ASSEMBLER__)
     extern const struct usbd_driver usbd_devfs;
@@ -50,6 +54,7 @@
       defined(STM32G4)
 
     #define USBD_STM32L433
+    #define USBD_HW_EPCOUNT     8
 
     #if !defined(__ASSEMBLER__)
     extern const struct usbd_driver usbd_devfs;
@@ -64,6 +69,7 @@
 #elif defined(STM32L1)
 
     #define USBD_STM32L100
+    #define USBD_HW_EPCOUNT     8
 
     #if !defined(__ASSEMBLER__)
     extern const struct usbd_driver usbd_devfs;
@@ -78,11 +84,17 @@
 #elif defined(STM32L475xx) || defined(STM32L476xx)
 
     #define USBD_STM32L476
+    #define USBD_HW_EPCOUNT     6
 
     #if !defined(__ASSEMBLER__)
     extern const struct usbd_driver usbd_otgfs;
+    extern const struct usbd_driver usbd_otgfs_asm;
+    #if defined(USBD_ASM_DRIVER)
+    #define usbd_hw usbd_otgfs_asm
+    #else
     #define usbd_hw usbd_otgfs
     #endif
+    #endif
 
 #elif defined(STM32F405xx) || defined(STM32F415xx) || \
       defined(STM32F407xx) || defined(STM32F417xx) || \
@@ -91,12 +103,28 @@
 
     #define USBD_STM32F429FS
     #define USBD_STM32F429HS
+    #if defined(USBD_PRIMARY_OTGHS)
+    #define USBD_HW_EPCOUNT     6
+    #else
+    #define USBD_HW_EPCOUNT     4
+    #endif
 
     #if !defined(__ASSEMBLER__)
     extern const struct usbd_driver usbd_otgfs;
+    extern const struct usbd_driver usbd_otgfs_asm;
     extern const struct usbd_driver usbd_otghs;
+    extern const struct usbd_driver_ctx usbd_otgfs_ctx;
+    #if defined(USBD_DRIVER_CTX)
+    #define usbd_hw usbd_otgfs_ctx
     #if defined(USBD_PRIMARY_OTGHS)
+    #define usbd_hw_base ((void*)USB_OTG_HS_PERIPH_BASE)
+    #else
+    #define usbd_hw_base ((void*)USB_OTG_FS_PERIPH_BASE)
+    #endif
+    #elif defined(USBD_PRIMARY_OTGHS)
     #define usbd_hw usbd_otghs
+    #elif defined(USBD_ASM_DRIVER)
+    #define usbd_hw usbd_otgfs_asm
     #else
     #define usbd_hw usbd_otgfs
     #endif
@@ -105,20 +133,38 @@
 #elif defined(STM32F411xE)
 
     #define USBD_STM32F429FS
+    #define USBD_HW_EPCOUNT     4
     #if !defined(__ASSEMBLER__)
     extern const struct usbd_driver usbd_otgfs;
-    #endif
+    extern const struct usbd_driver usbd_otgfs_asm;
+    extern const struct usbd_driver_ctx usbd_otgfs_ctx;
+    #if defined(USBD_DRIVER_CTX)
+    #define usbd_hw usbd_otgfs_ctx
+    #define usbd_hw_base ((void*)USB_OTG_FS_PERIPH_BASE)
+    #elif defined(USBD_ASM_DRIVER)
+    #define usbd_hw usbd_otgfs_asm
+    #else
     #define usbd_hw usbd_otgfs
+    #endif
+    #endif
 
 #elif defined(STM32F446xx)
     #define USBD_STM32F446FS
     #define USBD_STM32F446HS
+    #if defined(USBD_PRIMARY_OTGHS)
+    #define USBD_HW_EPCOUNT     8   /* OTG HS has 9, the core addresses 8 */
+    #else
+    #define USBD_HW_EPCOUNT     6
+    #endif
 
     #if !defined(__ASSEMBLER__)
     extern const struct usbd_driver usbd_otgfs;
+    extern const struct usbd_driver usbd_otgfs_asm;
     extern const struct usbd_driver usbd_otghs;
     #if defined(USBD_PRIMARY_OTGHS)
     #define usbd_hw usbd_otghs
+    #elif defined(USBD_ASM_DRIVER)
+    #define usbd_hw usbd_otgfs_asm
     #else
     #define usbd_hw usbd_otgfs
     #endif
@@ -132,6 +178,7 @@
       defined(STM32F373xC)
 
     #define USBD_STM32F103
+    #define USBD_HW_EPCOUNT     8
 
     #if !defined(__ASSEMBLER__)
     extern const struct usbd_driver usbd_devfs;
@@ -145,16 +192,32 @@
 
 #elif defined(STM32F105xC) || defined(STM32F107xC)
     #define USBD_STM32F105
+    #define USBD_HW_EPCOUNT     4
 
     #if !defined(__ASSEMBLER__)
     extern const struct usbd_driver usbd_otgfs;
+    extern const struct usbd_driver usbd_otgfs_asm;
+    #if defined(USBD_ASM_DRIVER)
+    #define usbd_hw usbd_otgfs_asm
+    #else
     #define usbd_hw usbd_otgfs
     #endif
+    #endif
+
+#elif defined(USBD_VIRTUAL)
+    /* host build of the core. hardware driver is supplied by the application */
+    #define USBD_HW_EPCOUNT     8
 
 #else
     #error Unsupported STM32 family
 #endif
 
+/* only the OTG FS driver of the STM32F405-F439 and STM32F411 is built with the context call
+ * table and defines usbd_hw_base for usbd_init_ctx() */
+#if defined(USBD_DRIVER_CTX) && !defined(USBD_VIRTUAL) && !defined(__ASSEMBLER__) && !defined(usbd_hw_base)
+    #error USBD_DRIVER_CTX is not supported by the driver of this STM32 family
+#endif
+
 #if defined (__cplusplus)
     }
 #endif
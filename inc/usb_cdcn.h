@@ -0,0 +1,139 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**\ingroup USB_CDC
+ * \addtogroup USB_CDC_NCM USB CDC NCM subclass
+ * \brief USB CDC NCM subclass definitions
+ * \details This module based on "Universal Serial Bus Communications Class Subclass Specification for
+ * Network Control Model Devices Revision 1.0 (Errata 1)"
+ * @{ */
+
+#ifndef _USB_CDC_NCM_H_
+#define _USB_CDC_NCM_H_
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+/**\name Communications Class Subclass Codes
+ * @{ */
+#define USB_CDC_SUBCLASS_NCM                0x0D /**<\brief Network Control Model */
+/** @} */
+
+/**\name CDC NCM subclass specific Functional Descriptors codes
+ * @{ */
+#define USB_DTYPE_CDC_NCM                   0x1A /**<\brief NCM Functional Descriptor*/
+/** @} */
+
+/**\name CDC NCM subclass specific requests
+ * @{ */
+#define USB_CDC_GET_NTB_PARAMETERS          0x80 /**<\brief Requests the function to report
+                                                  * parameters that characterize the NTBs.*/
+#define USB_CDC_GET_NET_ADDRESS             0x81 /**<\brief Requests the current EUI-48 network
+                                                  * address.*/
+#define USB_CDC_SET_NET_ADDRESS             0x82 /**<\brief Changes the current EUI-48 network
+                                                  * address.*/
+#define USB_CDC_GET_NTB_FORMAT              0x83 /**<\brief Gets current NTB format.*/
+#define USB_CDC_SET_NTB_FORMAT              0x84 /**<\brief Selects 16 or 32 bit NTB format.*/
+#define USB_CDC_GET_NTB_INPUT_SIZE          0x85 /**<\brief Gets current IN NTB maximum size.*/
+#define USB_CDC_SET_NTB_INPUT_SIZE          0x86 /**<\brief Selects the maximum size of IN NTBs.*/
+#define USB_CDC_GET_MAX_DATAGRAM_SIZE       0x87 /**<\brief Gets current maximum datagram size.*/
+#define USB_CDC_SET_MAX_DATAGRAM_SIZE       0x88 /**<\brief Sets the maximum datagram size.*/
+#define USB_CDC_GET_CRC_MODE                0x89 /**<\brief Gets current CRC mode.*/
+#define USB_CDC_SET_CRC_MODE                0x8A /**<\brief Sets the CRC mode.*/
+/** @} */
+
+/**\name NCM network capabilities
+ * @{ */
+#define USB_CDC_NCM_CAP_FILTER              (1<<0) /**<\brief Supports SetEthernetPacketFilter.*/
+#define USB_CDC_NCM_CAP_NETADDR             (1<<1) /**<\brief Supports GetNetAddress and SetNetAddress.*/
+#define USB_CDC_NCM_CAP_ENCAP               (1<<2) /**<\brief Supports encapsulated commands.*/
+#define USB_CDC_NCM_CAP_MAXDGRAM            (1<<3) /**<\brief Supports GetMaxDatagramSize and
+                                                    * SetMaxDatagramSize.*/
+#define USB_CDC_NCM_CAP_CRC                 (1<<4) /**<\brief Supports GetCrcMode and SetCrcMode.*/
+#define USB_CDC_NCM_CAP_NTBSIZE8            (1<<5) /**<\brief Supports 8-byte SetNtbInputSize.*/
+/** @} */
+
+/**\name NTB formats
+ * @{ */
+#define USB_CDC_NCM_NTB16                   0x0000 /**<\brief NTB-16 format.*/
+#define USB_CDC_NCM_NTB32                   0x0001 /**<\brief NTB-32 format.*/
+#define USB_CDC_NCM_NTB16_SUPPORTED         (1<<0) /**<\brief NTB-16 format supported.*/
+#define USB_CDC_NCM_NTB32_SUPPORTED         (1<<1) /**<\brief NTB-32 format supported.*/
+/** @} */
+
+/**\name NTB signatures
+ * @{ */
+#define USB_CDC_NCM_NTH16_SIGN              0x484D434E /**<\brief "NCMH" NTH16 signature.*/
+#define USB_CDC_NCM_NDP16_NOCRC_SIGN        0x304D434E /**<\brief "NCM0" NDP16 signature without CRC.*/
+#define USB_CDC_NCM_NDP16_CRC_SIGN          0x314D434E /**<\brief "NCM1" NDP16 signature with CRC.*/
+/** @} */
+
+/**\brief NCM Functional Descriptor */
+struct usb_cdc_ncm_desc {
+    uint8_t     bFunctionLength;        /**<\brief Size of this functional descriptor, in bytes.*/
+    uint8_t     bDescriptorType;        /**<\brief CS_INTERFACE descriptor type.*/
+    uint8_t     bDescriptorSubType;     /**<\brief NCM Functional Descriptor.*/
+    uint16_t    bcdNcmVersion;          /**<\brief Release number of this specification in BCD.*/
+    uint8_t     bmNetworkCapabilities;  /**<\brief Specifies the capabilities of this function.*/
+} __attribute__ ((packed));
+
+/**\brief NTB Parameter Structure */
+struct usb_cdc_ncm_ntb_params {
+    uint16_t    wLength;                /**<\brief Size of this structure, in bytes.*/
+    uint16_t    bmNtbFormatsSupported;  /**<\brief Supported NTB formats.*/
+    uint32_t    dwNtbInMaxSize;         /**<\brief IN NTB Maximum Size in bytes.*/
+    uint16_t    wNdpInDivisor;          /**<\brief Divisor used for IN NTB Datagram payload alignment.*/
+    uint16_t    wNdpInPayloadRemainder; /**<\brief Remainder used to align input datagram payload.*/
+    uint16_t    wNdpInAlignment;        /**<\brief NDP alignment modulus for NTBs on the IN pipe.*/
+    uint16_t    wReserved;              /**<\brief Reserved.*/
+    uint32_t    dwNtbOutMaxSize;        /**<\brief OUT NTB Maximum Size.*/
+    uint16_t    wNdpOutDivisor;         /**<\brief OUT NTB Datagram alignment modulus.*/
+    uint16_t    wNdpOutPayloadRemainder;/**<\brief Remainder used to align output datagram payload.*/
+    uint16_t    wNdpOutAlignment;       /**<\brief NDP alignment modulus for use in NTBs on the OUT pipe.*/
+    uint16_t    wNtbOutMaxDatagrams;    /**<\brief Maximum number of datagrams in a single OUT NTB.
+                                         * Zero means no limit.*/
+} __attribute__ ((packed));
+
+/**\brief 16-bit NCM Transfer Header */
+struct usb_cdc_ncm_nth16 {
+    uint32_t    dwSignature;            /**<\brief "NCMH" signature.*/
+    uint16_t    wHeaderLength;          /**<\brief Size of this header, in bytes.*/
+    uint16_t    wSequence;              /**<\brief Sequence number.*/
+    uint16_t    wBlockLength;           /**<\brief Size of this NTB, in bytes.*/
+    uint16_t    wNdpIndex;              /**<\brief Offset of the first NDP.*/
+} __attribute__ ((packed));
+
+/**\brief 16-bit Datagram Pointer Entry */
+struct usb_cdc_ncm_dpe16 {
+    uint16_t    wDatagramIndex;         /**<\brief Offset of the datagram. Zero terminates the table.*/
+    uint16_t    wDatagramLength;        /**<\brief Length of the datagram. Zero terminates the table.*/
+} __attribute__ ((packed));
+
+/**\brief 16-bit NCM Datagram Pointer Table */
+struct usb_cdc_ncm_ndp16 {
+    uint32_t    dwSignature;            /**<\brief "NCM0" or "NCM1" signature.*/
+    uint16_t    wLength;                /**<\brief Size of this NDP, in bytes.*/
+    uint16_t    wNextNdpIndex;          /**<\brief Offset of the next NDP. Zero if none.*/
+    struct usb_cdc_ncm_dpe16 wDatagram[]; /**<\brief Datagram pointer entries.*/
+} __attribute__ ((packed));
+
+/** @} */
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif /* _USB_CDC_NCM_H_ */
@@ -81,6 +81,12 @@
 #define USB_HID_SETPROTOCOL         0x0B    /**<\brief Request to set the current HID report protocol mode.*/
 /** @} */
 
+/**\name USB HID protocol modes for GET_PROTOCOL and SET_PROTOCOL requests
+ * @{ */
+#define USB_HID_PROTOMODE_BOOT      0x00    /**<\brief Boot protocol mode.*/
+#define USB_HID_PROTOMODE_REPORT    0x01    /**<\brief Report protocol mode.*/
+/** @} */
+
 /**\name USB HID class-specified descriptor types
  * @{ */
 #define USB_DTYPE_HID               0x21    /**<\brief HID class HID descriptor type.*/
@@ -0,0 +1,117 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _USB_MSC_H_
+#define _USB_MSC_H_
+
+#if defined(__cplusplus)
+    extern "C" {
+#endif
+
+/**\addtogroup USB_MODULE_MSC USB MSC class
+ * \brief This module contains USB Mass Storage class definitions.
+ * \details This module based on
+ * + [USB Mass Storage Class Specification Overview, Revision 1.4]
+ * (https://www.usb.org/sites/default/files/Mass_Storage_Specification_Overview_v1.4_2-19-2010.pdf)
+ * + [USB Mass Storage Class Bulk-Only Transport, Revision 1.0]
+ * (https://www.usb.org/sites/default/files/usbmassbulk_10.pdf)
+ * @{ */
+
+/**\name USB MSC class subclass and protocol definitions
+ * @{ */
+#define USB_MSC_SUBCLASS_SCSI           0x06    /**<\brief SCSI transparent command set.*/
+#define USB_MSC_PROTO_BBB               0x50    /**<\brief Bulk-Only Transport protocol.*/
+/** @} */
+
+/**\name USB MSC class-specific requests
+ * @{ */
+#define USB_MSC_BOT_RESET               0xFF    /**<\brief Bulk-Only Mass Storage Reset.*/
+#define USB_MSC_GET_MAX_LUN             0xFE    /**<\brief Get Max LUN.*/
+/** @} */
+
+/**\name USB MSC Bulk-Only Transport wrappers
+ * @{ */
+#define USB_MSC_CBW_SIGNATURE           0x43425355  /**<\brief Command Block Wrapper signature "USBC".*/
+#define USB_MSC_CSW_SIGNATURE           0x53425355  /**<\brief Command Status Wrapper signature "USBS".*/
+#define USB_MSC_CBW_DIR_IN              0x80        /**<\brief Data-In from the device to the host.*/
+#define USB_MSC_CSW_PASSED              0x00        /**<\brief Command passed.*/
+#define USB_MSC_CSW_FAILED              0x01        /**<\brief Command failed.*/
+#define USB_MSC_CSW_PHASE_ERROR         0x02        /**<\brief Phase error.*/
+/** @} */
+
+/**\name SCSI commands
+ * @{ */
+#define USB_SCSI_TEST_UNIT_READY        0x00
+#define USB_SCSI_REQUEST_SENSE          0x03
+#define USB_SCSI_INQUIRY                0x12
+#define USB_SCSI_MODE_SENSE_6           0x1A
+#define USB_SCSI_START_STOP_UNIT        0x1B
+#define USB_SCSI_PREVENT_ALLOW_REMOVAL  0x1E
+#define USB_SCSI_READ_FORMAT_CAPACITIES 0x23
+#define USB_SCSI_READ_CAPACITY_10       0x25
+#define USB_SCSI_READ_10                0x28
+#define USB_SCSI_WRITE_10               0x2A
+#define USB_SCSI_VERIFY_10              0x2F
+#define USB_SCSI_SYNCHRONIZE_CACHE_10   0x35
+#define USB_SCSI_MODE_SENSE_10          0x5A
+/** @} */
+
+/**\name SCSI sense keys
+ * @{ */
+#define USB_SCSI_SENSE_NO_SENSE         0x00
+#define USB_SCSI_SENSE_NOT_READY        0x02
+#define USB_SCSI_SENSE_MEDIUM_ERROR     0x03
+#define USB_SCSI_SENSE_ILLEGAL_REQUEST  0x05
+#define USB_SCSI_SENSE_DATA_PROTECT     0x07
+/** @} */
+
+/**\name SCSI additional sense codes
+ * @{ */
+#define USB_SCSI_ASC_NONE               0x00
+#define USB_SCSI_ASC_WRITE_FAULT        0x03
+#define USB_SCSI_ASC_READ_ERROR         0x11
+#define USB_SCSI_ASC_INVALID_COMMAND    0x20
+#define USB_SCSI_ASC_LBA_OUT_OF_RANGE   0x21
+#define USB_SCSI_ASC_INVALID_FIELD      0x24
+#define USB_SCSI_ASC_LUN_NOT_SUPPORTED  0x25
+#define USB_SCSI_ASC_WRITE_PROTECTED    0x27
+#define USB_SCSI_ASC_MEDIUM_NOT_PRESENT 0x3A
+/** @} */
+
+/**\brief Command Block Wrapper */
+struct usb_msc_cbw {
+    uint32_t    dCBWSignature;          /**<\brief \ref USB_MSC_CBW_SIGNATURE */
+    uint32_t    dCBWTag;                /**<\brief Command block tag. Echoed in CSW.*/
+    uint32_t    dCBWDataTransferLength; /**<\brief Number of bytes host expects to transfer.*/
+    uint8_t     bmCBWFlags;             /**<\brief Data transfer direction.*/
+    uint8_t     bCBWLUN;                /**<\brief Logical unit number.*/
+    uint8_t     bCBWCBLength;           /**<\brief Length of the command block.*/
+    uint8_t     CBWCB[16];              /**<\brief Command block.*/
+} __attribute__((packed));
+
+/**\brief Command Status Wrapper */
+struct usb_msc_csw {
+    uint32_t    dCSWSignature;          /**<\brief \ref USB_MSC_CSW_SIGNATURE */
+    uint32_t    dCSWTag;                /**<\brief Tag of the associated CBW.*/
+    uint32_t    dCSWDataResidue;        /**<\brief Difference between expected and processed data.*/
+    uint8_t     bCSWStatus;             /**<\brief Command status.*/
+} __attribute__((packed));
+
+/** @} */
+
+#if defined(__cplusplus)
+    }
+#endif
+#endif /* _USB_MSC_H_ */
@@ -56,6 +56,7 @@ extern "C" {
  * @{ */
 #define USB_CFG_ATTR_RESERVED       0x80
 #define USB_CFG_ATTR_SELFPOWERED    0x40
+#define USB_CFG_ATTR_REMOTEWAKEUP   0x20
 /** @} */
 
 /** \anchor USB_ENDPOINT_DEF
@@ -126,6 +127,8 @@ extern "C" {
 #define USB_DTYPE_OTG               0x09    /**<\brief OTG descriptor.*/
 #define USB_DTYPE_DEBUG             0x0A    /**<\brief Debug descriptor.*/
 #define USB_DTYPE_INTERFASEASSOC    0x0B    /**<\brief Interface association descriptor.*/
+#define USB_DTYPE_BOS               0x0F    /**<\brief Binary device object store descriptor.*/
+#define USB_DTYPE_DEVCAPABILITY     0x10    /**<\brief Device capability descriptor.*/
 #define USB_DTYPE_CS_INTERFACE      0x24    /**<\brief Class specific interface descriptor.*/
 #define USB_DTYPE_CS_ENDPOINT       0x25    /**<\brief Class specific endpoint descriptor.*/
 /** @} */
@@ -160,6 +163,20 @@ extern "C" {
 #define USB_FEAT_DEBUG_MODE         0x06
 /** @} */
 
+/**\name USB device capability types and USB 2.0 extension attributes
+ * @{ */
+#define USB_DEVCAP_USB20EXT         0x02    /**<\brief USB 2.0 extension capability.*/
+#define USB_USB20EXT_LPM            (1 << 1)    /**<\brief Link power management supported.*/
+#define USB_USB20EXT_BESL           (1 << 2)    /**<\brief BESL and alternate HIRD definitions
+                                                 * supported.*/
+#define USB_USB20EXT_BASELINE_VALID (1 << 3)    /**<\brief Baseline BESL field is valid.*/
+#define USB_USB20EXT_DEEP_VALID     (1 << 4)    /**<\brief Deep BESL field is valid.*/
+/**\brief Macro to set recommended baseline BESL value for the \ref usb_usb20ext_descriptor */
+#define USB_USB20EXT_BASELINE(besl) (((besl) & 0x0F) << 8)
+/**\brief Macro to set recommended deep BESL value for the \ref usb_usb20ext_descriptor */
+#define USB_USB20EXT_DEEP(besl)     (((besl) & 0x0F) << 12)
+/** @} */
+
 /**\name USB Test mode Selectors
  * @{ */
 #define USB_TEST_J                  0x01    /**<\brief Test J.*/
@@ -452,6 +469,28 @@ struct usb_debug_descriptor {
     uint8_t  bDebugOutEndpoint;     /**<\brief Endpoint number of the Debug Data OUTendpoint.*/
 } __attribute__((packed));
 
+/**\brief USB binary device object store (BOS) descriptor
+ * \details The BOS descriptor is the root of the device capability descriptors. It is requested
+ * by the host when the device descriptor bcdUSB is 0x0201 or greater.*/
+struct usb_bos_descriptor {
+    uint8_t  bLength;               /**<\brief Size of the descriptor, in bytes.*/
+    uint8_t  bDescriptorType;       /**<\brief BOS descriptor type.*/
+    uint16_t wTotalLength;          /**<\brief Size of the BOS descriptor and all device
+                                     * capability descriptors.*/
+    uint8_t  bNumDeviceCaps;        /**<\brief Number of the device capability descriptors.*/
+} __attribute__((packed));
+
+/**\brief USB 2.0 extension device capability descriptor
+ * \details Indicates the device supports Link Power Management (L1 sleep state) and reports the
+ * recommended BESL values.*/
+struct usb_usb20ext_descriptor {
+    uint8_t  bLength;               /**<\brief Size of the descriptor, in bytes.*/
+    uint8_t  bDescriptorType;       /**<\brief Device capability descriptor type.*/
+    uint8_t  bDevCapabilityType;    /**<\brief \ref USB_DEVCAP_USB20EXT capability type.*/
+    uint32_t bmAttributes;          /**<\brief Capability attributes. Comprised of a mask of
+                                     * \c USB_USB20EXT_ macros.*/
+} __attribute__((packed));
+
 /** @} */
 
 #if defined (__cplusplus)
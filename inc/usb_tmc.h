@@ -49,6 +49,14 @@ extern "C" {
 #define USB_TMC_REQ_INDICATOR_PULSE             64
 /**@}*/
 
+/**@name USB488 subclass requests
+ * @{*/
+#define USB_TMC_USB488_REQ_READ_STATUS_BYTE     128
+#define USB_TMC_USB488_REQ_REN_CONTROL          160
+#define USB_TMC_USB488_REQ_GO_TO_LOCAL          161
+#define USB_TMC_USB488_REQ_LOCAL_LOCKOUT        162
+/**@}*/
+
 /**@name USBTMC status values
  * @{*/
 #define USB_TMC_STATUS_SUCCESS                  0x01
@@ -69,6 +77,40 @@ struct usb_tmc_get_capabilities_response {
     uint8_t Reserved1[18];
 } __attribute__((packed));
 
+/**@name USBTMC interface and device capabilities
+ * @{*/
+#define USB_TMC_CAP_LISTEN_ONLY             0x01 /**< Interface is listen-only. */
+#define USB_TMC_CAP_TALK_ONLY               0x02 /**< Interface is talk-only. */
+#define USB_TMC_CAP_INDICATOR_PULSE         0x04 /**< Interface accepts INDICATOR_PULSE. */
+#define USB_TMC_DEVCAP_TERM_CHAR            0x01 /**< Device supports TermChar. */
+/**@}*/
+
+/**@name USB488 interface and device capabilities
+ * @{*/
+#define USB_TMC_USB488_CAP_TRIGGER          0x01 /**< Interface accepts TRIGGER message. */
+#define USB_TMC_USB488_CAP_REN              0x02 /**< Interface accepts REN_CONTROL, GO_TO_LOCAL
+                                                  * and LOCAL_LOCKOUT. */
+#define USB_TMC_USB488_CAP_488_2            0x04 /**< Interface is USB488.2 interface. */
+#define USB_TMC_USB488_DEVCAP_DT1           0x01 /**< Device understands MsgID TRIGGER. */
+#define USB_TMC_USB488_DEVCAP_RL1           0x02 /**< Device understands remote/local control. */
+#define USB_TMC_USB488_DEVCAP_SR1           0x04 /**< Device supports service request. */
+#define USB_TMC_USB488_DEVCAP_SCPI          0x08 /**< Device understands all mandatory SCPI commands. */
+/**@}*/
+
+/** GET_CAPABILITIES request response for the USB488 subclass interface */
+struct usb_tmc_usb488_get_capabilities_response {
+    uint8_t USBTMC_status;
+    uint8_t Reserved0;
+    uint16_t bcdUSBTMC;
+    uint8_t InterfaceCapabilities;
+    uint8_t DeviceCapabilities;
+    uint8_t Reserved1[6];
+    uint16_t bcdUSB488;
+    uint8_t USB488InterfaceCapabilities;
+    uint8_t USB488DeviceCapabilities;
+    uint8_t Reserved2[8];
+} __attribute__((packed));
+
 /**@name MsgId values
  * @{*/
 #define USB_TMC_DEV_DEP_MSG_OUT             1
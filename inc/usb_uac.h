@@ -0,0 +1,196 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _USB_UAC_H_
+#define _USB_UAC_H_
+
+#if defined(__cplusplus)
+    extern "C" {
+#endif
+
+/**\addtogroup USB_MODULE_UAC USB Audio 2.0 class
+ * \brief This module contains USB Audio Device Class 2.0 definitions.
+ * \details This module based on
+ * + [Universal Serial Bus Device Class Definition for Audio Devices, Release 2.0]
+ * (https://www.usb.org/sites/default/files/Audio2.0_final.zip)
+ * @{ */
+
+/**\name USB Audio class subclass and protocol definitions
+ * @{ */
+#define USB_UAC_FUNC_CATEGORY_DESKTOP_SPEAKER   0x01    /**<\brief Desktop speaker function category.*/
+#define USB_UAC_FUNC_CATEGORY_HEADSET           0x04    /**<\brief Headset function category.*/
+#define USB_UAC_FUNC_CATEGORY_IO_BOX            0x08    /**<\brief I/O box function category.*/
+#define USB_UAC_FUNC_CATEGORY_OTHER             0xFF    /**<\brief Other function category.*/
+#define USB_UAC_SUBCLASS_AUDIOCONTROL           0x01    /**<\brief Audio Control interface subclass.*/
+#define USB_UAC_SUBCLASS_AUDIOSTREAMING         0x02    /**<\brief Audio Streaming interface subclass.*/
+#define USB_UAC_PROTO_IP_VERSION_02_00          0x20    /**<\brief Audio 2.0 interface protocol.*/
+/** @} */
+
+/**\name USB Audio class-specific Audio Control descriptor subtypes
+ * @{ */
+#define USB_DTYPE_UAC_HEADER                    0x01    /**<\brief Class-specific AC interface header.*/
+#define USB_DTYPE_UAC_INPUT_TERMINAL            0x02    /**<\brief Input terminal.*/
+#define USB_DTYPE_UAC_OUTPUT_TERMINAL           0x03    /**<\brief Output terminal.*/
+#define USB_DTYPE_UAC_FEATURE_UNIT              0x06    /**<\brief Feature unit.*/
+#define USB_DTYPE_UAC_CLOCK_SOURCE              0x0A    /**<\brief Clock source.*/
+/** @} */
+
+/**\name USB Audio class-specific Audio Streaming descriptor subtypes
+ * @{ */
+#define USB_DTYPE_UAC_AS_GENERAL                0x01    /**<\brief Class-specific AS interface.*/
+#define USB_DTYPE_UAC_FORMAT_TYPE               0x02    /**<\brief Format type.*/
+#define USB_DTYPE_UAC_EP_GENERAL                0x01    /**<\brief Class-specific isochronous
+                                                         * audio data endpoint.*/
+/** @} */
+
+/**\name USB Audio terminal types
+ * @{ */
+#define USB_UAC_TERMINAL_STREAMING              0x0101  /**<\brief USB streaming.*/
+#define USB_UAC_TERMINAL_MICROPHONE             0x0201  /**<\brief Microphone.*/
+#define USB_UAC_TERMINAL_SPEAKER                0x0301  /**<\brief Speaker.*/
+#define USB_UAC_TERMINAL_HEADPHONES             0x0302  /**<\brief Headphones.*/
+#define USB_UAC_TERMINAL_LINE                   0x0603  /**<\brief Line connector.*/
+/** @} */
+
+/**\name USB Audio format definitions
+ * @{ */
+#define USB_UAC_FORMAT_TYPE_I                   0x01    /**<\brief Format type I.*/
+#define USB_UAC_FORMAT_PCM                      0x00000001  /**<\brief Type I PCM format.*/
+/** @} */
+
+/**\name USB Audio clock source attributes
+ * @{ */
+#define USB_UAC_CLOCK_EXTERNAL                  0x00    /**<\brief External clock.*/
+#define USB_UAC_CLOCK_INTERNAL_FIXED            0x01    /**<\brief Internal fixed clock.*/
+#define USB_UAC_CLOCK_INTERNAL_VARIABLE         0x02    /**<\brief Internal variable clock.*/
+#define USB_UAC_CLOCK_INTERNAL_PROGRAMMABLE     0x03    /**<\brief Internal programmable clock.*/
+#define USB_UAC_CLOCK_SOF_SYNCED                0x04    /**<\brief Clock is synchronized to SOF.*/
+/** @} */
+
+/**\name USB Audio control bitmap values
+ * @{ */
+#define USB_UAC_CTRL_RO                         0x01    /**<\brief Control is read-only.*/
+#define USB_UAC_CTRL_RW                         0x03    /**<\brief Control is host programmable.*/
+/** @} */
+
+/**\name USB Audio class-specific requests
+ * @{ */
+#define USB_UAC_CUR                             0x01    /**<\brief Current setting attribute.*/
+#define USB_UAC_RANGE                           0x02    /**<\brief Range attribute.*/
+/** @} */
+
+/**\name USB Audio control selectors
+ * @{ */
+#define USB_UAC_CS_SAM_FREQ_CONTROL             0x01    /**<\brief Clock source sampling frequency.*/
+#define USB_UAC_CS_CLOCK_VALID_CONTROL          0x02    /**<\brief Clock source validity.*/
+#define USB_UAC_FU_MUTE_CONTROL                 0x01    /**<\brief Feature unit mute.*/
+#define USB_UAC_FU_VOLUME_CONTROL               0x02    /**<\brief Feature unit volume.*/
+/** @} */
+
+/**\brief Class-specific AC interface header descriptor */
+struct usb_uac_header_desc {
+    uint8_t     bLength;            /**<\brief Size of this descriptor in bytes.*/
+    uint8_t     bDescriptorType;    /**<\brief CS_INTERFACE descriptor type.*/
+    uint8_t     bDescriptorSubType; /**<\brief \ref USB_DTYPE_UAC_HEADER */
+    uint16_t    bcdADC;             /**<\brief Audio device class release number in BCD.*/
+    uint8_t     bCategory;          /**<\brief Primary use of this audio function.*/
+    uint16_t    wTotalLength;       /**<\brief Total size of class-specific AC descriptors.*/
+    uint8_t     bmControls;         /**<\brief Latency control bitmap.*/
+} __attribute__((packed));
+
+/**\brief Clock source descriptor */
+struct usb_uac_clock_source_desc {
+    uint8_t     bLength;            /**<\brief Size of this descriptor in bytes.*/
+    uint8_t     bDescriptorType;    /**<\brief CS_INTERFACE descriptor type.*/
+    uint8_t     bDescriptorSubType; /**<\brief \ref USB_DTYPE_UAC_CLOCK_SOURCE */
+    uint8_t     bClockID;           /**<\brief Clock source entity ID.*/
+    uint8_t     bmAttributes;       /**<\brief Clock type.*/
+    uint8_t     bmControls;         /**<\brief Frequency and validity controls bitmap.*/
+    uint8_t     bAssocTerminal;     /**<\brief Associated terminal ID.*/
+    uint8_t     iClockSource;       /**<\brief Index of the string descriptor.*/
+} __attribute__((packed));
+
+/**\brief Input terminal descriptor */
+struct usb_uac_input_terminal_desc {
+    uint8_t     bLength;            /**<\brief Size of this descriptor in bytes.*/
+    uint8_t     bDescriptorType;    /**<\brief CS_INTERFACE descriptor type.*/
+    uint8_t     bDescriptorSubType; /**<\brief \ref USB_DTYPE_UAC_INPUT_TERMINAL */
+    uint8_t     bTerminalID;        /**<\brief Terminal entity ID.*/
+    uint16_t    wTerminalType;      /**<\brief Terminal type.*/
+    uint8_t     bAssocTerminal;     /**<\brief Associated output terminal ID.*/
+    uint8_t     bCSourceID;         /**<\brief Clock source entity ID.*/
+    uint8_t     bNrChannels;        /**<\brief Number of logical output channels.*/
+    uint32_t    bmChannelConfig;    /**<\brief Spatial location of the channels.*/
+    uint8_t     iChannelNames;      /**<\brief Index of the first channel name string.*/
+    uint16_t    bmControls;         /**<\brief Terminal controls bitmap.*/
+    uint8_t     iTerminal;          /**<\brief Index of the string descriptor.*/
+} __attribute__((packed));
+
+/**\brief Output terminal descriptor */
+struct usb_uac_output_terminal_desc {
+    uint8_t     bLength;            /**<\brief Size of this descriptor in bytes.*/
+    uint8_t     bDescriptorType;    /**<\brief CS_INTERFACE descriptor type.*/
+    uint8_t     bDescriptorSubType; /**<\brief \ref USB_DTYPE_UAC_OUTPUT_TERMINAL */
+    uint8_t     bTerminalID;        /**<\brief Terminal entity ID.*/
+    uint16_t    wTerminalType;      /**<\brief Terminal type.*/
+    uint8_t     bAssocTerminal;     /**<\brief Associated input terminal ID.*/
+    uint8_t     bSourceID;          /**<\brief Connected unit or terminal ID.*/
+    uint8_t     bCSourceID;         /**<\brief Clock source entity ID.*/
+    uint16_t    bmControls;         /**<\brief Terminal controls bitmap.*/
+    uint8_t     iTerminal;          /**<\brief Index of the string descriptor.*/
+} __attribute__((packed));
+
+/**\brief Class-specific AS interface descriptor */
+struct usb_uac_as_general_desc {
+    uint8_t     bLength;            /**<\brief Size of this descriptor in bytes.*/
+    uint8_t     bDescriptorType;    /**<\brief CS_INTERFACE descriptor type.*/
+    uint8_t     bDescriptorSubType; /**<\brief \ref USB_DTYPE_UAC_AS_GENERAL */
+    uint8_t     bTerminalLink;      /**<\brief ID of the connected terminal.*/
+    uint8_t     bmControls;         /**<\brief Active alternate setting and valid alternate
+                                     * settings controls bitmap.*/
+    uint8_t     bFormatType;        /**<\brief \ref USB_UAC_FORMAT_TYPE_I */
+    uint32_t    bmFormats;          /**<\brief Supported audio data formats.*/
+    uint8_t     bNrChannels;        /**<\brief Number of physical channels.*/
+    uint32_t    bmChannelConfig;    /**<\brief Spatial location of the channels.*/
+    uint8_t     iChannelNames;      /**<\brief Index of the first channel name string.*/
+} __attribute__((packed));
+
+/**\brief Type I format type descriptor */
+struct usb_uac_format_type_i_desc {
+    uint8_t     bLength;            /**<\brief Size of this descriptor in bytes.*/
+    uint8_t     bDescriptorType;    /**<\brief CS_INTERFACE descriptor type.*/
+    uint8_t     bDescriptorSubType; /**<\brief \ref USB_DTYPE_UAC_FORMAT_TYPE */
+    uint8_t     bFormatType;        /**<\brief \ref USB_UAC_FORMAT_TYPE_I */
+    uint8_t     bSubslotSize;       /**<\brief Bytes occupied by one audio subslot.*/
+    uint8_t     bBitResolution;     /**<\brief Number of effectively used bits.*/
+} __attribute__((packed));
+
+/**\brief Class-specific isochronous audio data endpoint descriptor */
+struct usb_uac_iso_ep_desc {
+    uint8_t     bLength;            /**<\brief Size of this descriptor in bytes.*/
+    uint8_t     bDescriptorType;    /**<\brief CS_ENDPOINT descriptor type.*/
+    uint8_t     bDescriptorSubType; /**<\brief \ref USB_DTYPE_UAC_EP_GENERAL */
+    uint8_t     bmAttributes;       /**<\brief Bit 7 is MaxPacketsOnly.*/
+    uint8_t     bmControls;         /**<\brief Pitch, overrun and underrun controls bitmap.*/
+    uint8_t     bLockDelayUnits;    /**<\brief Units of the wLockDelay.*/
+    uint16_t    wLockDelay;         /**<\brief Time to lock the internal clock.*/
+} __attribute__((packed));
+
+/** @} */
+
+#if defined(__cplusplus)
+    }
+#endif
+#endif /* _USB_UAC_H_ */
@@ -0,0 +1,403 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _USBD_CDC_ACM_H_
+#define _USBD_CDC_ACM_H_
+#if defined(__cplusplus)
+    extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "usbd_core.h"
+#include "usb_cdc.h"
+
+/**\addtogroup USBD_CDC_ACM USB CDC ACM function
+ * \brief Virtual COM port function with the lock-free RX and TX ring buffers
+ * \details Ring buffers are single producer single consumer. RX buffer is filled by the USB
+ * event processing and drained by application. TX buffer is filled by application and drained
+ * by the USB event processing. Therefore \ref usbd_poll can be called from the USB interrupt
+ * while application uses read/write functions from the main loop.
+ *
+ * Functions called from the main loop touch the endpoints to start the transmission or to read
+ * the held packet. These accesses are done with the interrupts masked by \ref USBD_CDC_ACM_LOCK,
+ * so the driver is never reentered from the USB interrupt.
+ *
+ * Alternatively, the port may use the blocks of the \ref usbd_cdc_acm_pool shared by several
+ * ports instead of the dedicated ring buffers. Idle ports hold no memory, and a busy port borrows
+ * the blocks up to its quota. The pool free list and the block queues are not lock-free, so the
+ * pooled port must be served in the same context where \ref usbd_poll is called or with USB
+ * interrupt disabled.
+ *
+ * Enabled ports are kept in the list and found by the device and the endpoint number, so the
+ * ports of several devices may use the same endpoint numbers.
+ *
+ * Several ports may share one notification endpoint. It saves the IN endpoints, but
+ * the shared endpoint address appears in the several interfaces. Some hosts, e.g. Linux, accept
+ * this, other ones reject such configuration.
+ * \note Ring buffer size must be a power of 2 and not less than endpoint size.
+ * \note If RX buffer has no space for the next packet, this packet is left in the endpoint and
+ * will be read when application frees the buffer. OTG cores keep RX FIFO level interrupt
+ * pending while packet is held, so in the interrupt driven mode RX buffer should be drained by
+ * the same interrupt or \ref usbd_poll should be called from the main loop.
+ * @{ */
+
+#if !defined(USBD_CDC_ACM_NTF_SZ)
+/**\brief Notification endpoint size. Must be used in the notification endpoint descriptor.*/
+#define USBD_CDC_ACM_NTF_SZ     0x10
+#endif
+
+#if !defined(USBD_CDC_ACM_LOCK)
+#if defined(__arm__)
+/**\brief Masks interrupts before the endpoint access from the main loop
+ * \details Returns the previous interrupt mask for \ref USBD_CDC_ACM_UNLOCK. Uses PRIMASK by
+ * default. May be redefined together with \ref USBD_CDC_ACM_UNLOCK to mask the USB interrupt only.
+ * Host build has no interrupts and no masking.*/
+#define USBD_CDC_ACM_LOCK()     ({ uint32_t _m;\
+                                   __asm__ volatile ("mrs %0, primask\n\tcpsid i" : "=r" (_m) :: "memory");\
+                                   _m; })
+/**\brief Restores interrupt mask saved by \ref USBD_CDC_ACM_LOCK*/
+#define USBD_CDC_ACM_UNLOCK(m)  __asm__ volatile ("msr primask, %0" :: "r" (m) : "memory")
+#else
+#define USBD_CDC_ACM_LOCK()     0
+#define USBD_CDC_ACM_UNLOCK(m)  (void)(m)
+#endif
+#endif
+
+#if !defined(USBD_CDC_ACM_BLK_SZ)
+/**\brief Shared pool block size. Must be not less than the data endpoints size.*/
+#define USBD_CDC_ACM_BLK_SZ     0x40
+#endif
+
+/**\name Control line state bits
+ * @{ */
+#define USB_CDC_LINE_DTR        0x0001  /**<\brief Data terminal ready.*/
+#define USB_CDC_LINE_RTS        0x0002  /**<\brief Request to send (carrier activation).*/
+/** @} */
+
+/**\brief Single producer single consumer ring buffer.*/
+typedef struct {
+    uint8_t             *buf;       /**<\brief Pointer to buffer memory.*/
+    uint16_t            mask;       /**<\brief Buffer size - 1.*/
+    volatile uint16_t   head;       /**<\brief Free running write index. Changed by producer only.*/
+    volatile uint16_t   tail;       /**<\brief Free running read index. Changed by consumer only.*/
+} usbd_ring;
+
+/**\brief Shared pool memory block. Holds one packet.*/
+typedef struct {
+    uint8_t             data[USBD_CDC_ACM_BLK_SZ];  /**<\brief Packet data.*/
+    uint8_t             len;                        /**<\brief Packet length.*/
+    uint8_t             next;                       /**<\brief Next block index.*/
+} usbd_cdc_acm_blk;
+
+/**\brief Memory blocks pool shared by the CDC ACM ports.*/
+typedef struct {
+    usbd_cdc_acm_blk    *blk;       /**<\brief Pointer to blocks array.*/
+    uint8_t             count;      /**<\brief Number of blocks. Up to 254.*/
+    uint8_t             free;       /**<\brief Number of free blocks.*/
+    uint8_t             first;      /**<\brief First free block index.*/
+} usbd_cdc_acm_pool;
+
+/**\brief Queue of the pool blocks.*/
+typedef struct {
+    uint8_t             first;      /**<\brief First block index.*/
+    uint8_t             last;       /**<\brief Last block index.*/
+    uint8_t             count;      /**<\brief Number of blocks in queue.*/
+    uint8_t             off;        /**<\brief Read offset in the first block.*/
+} usbd_blkq;
+
+typedef struct _usbd_cdc_acm usbd_cdc_acm;
+
+/**\brief CDC ACM line coding or control line state changed callback
+ * \param acm pointer to CDC ACM function
+ */
+typedef void (*usbd_cdc_acm_callback)(usbd_cdc_acm *acm);
+
+/**\brief Represents CDC ACM function data.*/
+struct _usbd_cdc_acm {
+    usbd_device                 *dev;           /**<\brief USB device.*/
+    usbd_ring                   rx;             /**<\brief Data OUT ring buffer. Free running
+                                                 * indexes count bytes for the pooled port.*/
+    usbd_ring                   tx;             /**<\brief Data IN ring buffer. Free running
+                                                 * indexes count bytes for the pooled port.*/
+    usbd_cdc_acm_pool           *pool;          /**<\brief Shared pool. NULL for ring buffers.*/
+    usbd_blkq                   rxq;            /**<\brief Received blocks of the pooled port.*/
+    usbd_blkq                   txq;            /**<\brief Blocks to send of the pooled port.*/
+    uint8_t                     quota;          /**<\brief Maximum blocks in each queue.*/
+    struct usb_cdc_line_coding  line_coding;    /**<\brief Current line coding.*/
+    uint16_t                    line_state;     /**<\brief Current control line state.*/
+    uint16_t                    tx_len;         /**<\brief Size of the packet in the IN endpoint.*/
+    volatile uint8_t            tx_busy;        /**<\brief IN transfer is in progress.*/
+    volatile uint8_t            rx_hold;        /**<\brief OUT packet is holded due no space.*/
+    uint8_t                     comm_if;        /**<\brief Communication interface number.*/
+    uint8_t                     rx_ep;          /**<\brief Data OUT endpoint address.*/
+    uint8_t                     tx_ep;          /**<\brief Data IN endpoint address.*/
+    uint8_t                     ntf_ep;         /**<\brief Notification endpoint address.*/
+    uint8_t                     ep_size;        /**<\brief Size of the data endpoints.*/
+    usbd_cdc_acm_callback       line_callback;  /**<\brief Line coding or line state changed.*/
+    usbd_cdc_acm                *next;          /**<\brief Next enabled port. Internal use.*/
+};
+
+/**\brief Initializes CDC ACM function
+ * \details Must not be called for the enabled port.
+ * \param acm CDC ACM function
+ * \param dev USB device
+ * \param comm_if communication interface number
+ * \param rx_ep data OUT endpoint address
+ * \param tx_ep data IN endpoint address
+ * \param ntf_ep notification endpoint address
+ * \param ep_size data endpoints size (up to 64 bytes)
+ * \param rxbuf pointer to RX ring buffer memory
+ * \param rxsize size of RX ring buffer. Must be a power of 2.
+ * \param txbuf pointer to TX ring buffer memory
+ * \param txsize size of TX ring buffer. Must be a power of 2.
+ */
+void usbd_cdc_acm_init(usbd_cdc_acm *acm, usbd_device *dev, uint8_t comm_if,
+                       uint8_t rx_ep, uint8_t tx_ep, uint8_t ntf_ep, uint8_t ep_size,
+                       void *rxbuf, uint16_t rxsize, void *txbuf, uint16_t txsize);
+
+/**\brief Initializes shared blocks pool
+ * \param pool blocks pool
+ * \param blk pointer to blocks array
+ * \param count number of blocks. Up to 254.
+ */
+void usbd_cdc_acm_pool_init(usbd_cdc_acm_pool *pool, usbd_cdc_acm_blk *blk, uint8_t count);
+
+/**\brief Initializes CDC ACM function using the shared blocks pool
+ * \details Read, write, peek, commit and space functions of the pooled port may be called only
+ * in the same context where \ref usbd_poll is called or with USB interrupt disabled.
+ * \param acm CDC ACM function
+ * \param dev USB device
+ * \param comm_if communication interface number
+ * \param rx_ep data OUT endpoint address
+ * \param tx_ep data IN endpoint address
+ * \param ntf_ep notification endpoint address. May be shared with other ports.
+ * \param ep_size data endpoints size (up to \ref USBD_CDC_ACM_BLK_SZ)
+ * \param pool shared blocks pool
+ * \param quota maximum number of blocks borrowed for each direction
+ */
+void usbd_cdc_acm_init_pool(usbd_cdc_acm *acm, usbd_device *dev, uint8_t comm_if,
+                            uint8_t rx_ep, uint8_t tx_ep, uint8_t ntf_ep, uint8_t ep_size,
+                            usbd_cdc_acm_pool *pool, uint8_t quota);
+
+/**\brief Configures or deconfigures CDC ACM endpoints
+ * \details Should be called from \ref usbd_cfg_callback
+ * \param acm CDC ACM function
+ * \param enable configures endpoints if TRUE, deconfigures otherwise
+ */
+void usbd_cdc_acm_enable(usbd_cdc_acm *acm, bool enable);
+
+/**\brief Processes CDC ACM class requests
+ * \details Should be called from \ref usbd_ctl_callback
+ * \param acm CDC ACM function
+ * \param req control request
+ * \return usbd_fail if request is not belongs to this function or is not supported
+ */
+usbd_respond usbd_cdc_acm_control(usbd_cdc_acm *acm, usbd_ctlreq *req);
+
+/**\brief Reads received data
+ * \note Pooled port: \ref usbd_poll context only.
+ * \param acm CDC ACM function
+ * \param buf pointer to the destination buffer
+ * \param blen size of the buffer
+ * \return number of bytes was read
+ */
+uint16_t usbd_cdc_acm_read(usbd_cdc_acm *acm, void *buf, uint16_t blen);
+
+/**\brief Writes data for transmission
+ * \note Pooled port: \ref usbd_poll context only.
+ * \param acm CDC ACM function
+ * \param buf pointer to the data
+ * \param blen size of the data
+ * \return number of bytes was queued. Can be less than blen if TX buffer has no enough space.
+ */
+uint16_t usbd_cdc_acm_write(usbd_cdc_acm *acm, const void *buf, uint16_t blen);
+
+/**\brief Gets the received data without copying
+ * \note Pooled port: \ref usbd_poll context only.
+ * \param acm CDC ACM function
+ * \param[out] data pointer to the contiguous received data
+ * \return size of the contiguous received data
+ */
+uint16_t usbd_cdc_acm_rx_peek(usbd_cdc_acm *acm, const uint8_t **data);
+
+/**\brief Releases the data obtained by \ref usbd_cdc_acm_rx_peek
+ * \note Pooled port: \ref usbd_poll context only.
+ * \param acm CDC ACM function
+ * \param len number of bytes to release
+ */
+void usbd_cdc_acm_rx_commit(usbd_cdc_acm *acm, uint16_t len);
+
+/**\brief Gets the free space in TX buffer to write data directly
+ * \note Pooled port: \ref usbd_poll context only. The block is borrowed from the pool here.
+ * \param acm CDC ACM function
+ * \param[out] data pointer to the contiguous free space
+ * \return size of the contiguous free space
+ */
+uint16_t usbd_cdc_acm_tx_peek(usbd_cdc_acm *acm, uint8_t **data);
+
+/**\brief Queues data written to the space obtained by \ref usbd_cdc_acm_tx_peek
+ * \note Pooled port: \ref usbd_poll context only.
+ * \param acm CDC ACM function
+ * \param len number of bytes to queue
+ */
+void usbd_cdc_acm_tx_commit(usbd_cdc_acm *acm, uint16_t len);
+
+/**\brief Sends SERIAL_STATE notification
+ * \details May be called from the main loop. Endpoint is written with interrupts masked.
+ * \param acm CDC ACM function
+ * \param state UART state bitmap. Use USB_CDC_STATE_ macros.
+ * \return TRUE if notification was queued, FALSE if the notification endpoint is busy
+ * (possibly by another port sharing it)
+ */
+bool usbd_cdc_acm_serial_state(usbd_cdc_acm *acm, uint16_t state);
+
+/**\brief Returns number of bytes available for reading
+ * \param acm CDC ACM function
+ */
+inline static uint16_t usbd_cdc_acm_available(usbd_cdc_acm *acm) {
+    return (uint16_t)(acm->rx.head - acm->rx.tail);
+}
+
+/**\brief Returns free space in TX buffer
+ * \details For the pooled port this is the space which can be borrowed at the moment.
+ * \note Pooled port: \ref usbd_poll context only.
+ * \param acm CDC ACM function
+ */
+uint16_t usbd_cdc_acm_space(usbd_cdc_acm *acm);
+
+/**\name CDC ACM function numbering
+ * \details Port n of the function group uses communication interface base_if + 2n, data
+ * interface base_if + 2n + 1, and data endpoints base_ep + n.
+ * @{ */
+#define USBD_CDC_ACM_COMM_IF(base_if, n)    ((base_if) + 2 * (n))           /**<\brief Communication interface.*/
+#define USBD_CDC_ACM_DATA_IF(base_if, n)    ((base_if) + 2 * (n) + 1)       /**<\brief Data interface.*/
+#define USBD_CDC_ACM_RX_EP(base_ep, n)      ((base_ep) + (n))               /**<\brief Data OUT endpoint.*/
+#define USBD_CDC_ACM_TX_EP(base_ep, n)      (0x80 | ((base_ep) + (n)))      /**<\brief Data IN endpoint.*/
+/** @} */
+
+/**\brief CDC ACM function descriptors. IAD, communication and data interfaces.*/
+struct usbd_cdc_acm_desc {
+    struct usb_iad_descriptor           iad;
+    struct usb_interface_descriptor     comm;
+    struct usb_cdc_header_desc          hdr;
+    struct usb_cdc_call_mgmt_desc       mgmt;
+    struct usb_cdc_acm_desc             acm;
+    struct usb_cdc_union_desc           uni;
+    struct usb_endpoint_descriptor      ntf_ep;
+    struct usb_interface_descriptor     data;
+    struct usb_endpoint_descriptor      rx_ep;
+    struct usb_endpoint_descriptor      tx_ep;
+} __attribute__((packed));
+
+/**\brief Initializer of the \ref usbd_cdc_acm_desc
+ * \param _if communication interface number. Data interface is the next one.
+ * \param _rx data OUT endpoint address
+ * \param _tx data IN endpoint address
+ * \param _ntf notification endpoint address
+ * \param _sz data endpoints size
+ * \param _proto communication interface protocol
+ */
+#define USBD_CDC_ACM_DESC(_if, _rx, _tx, _ntf, _sz, _proto) {\
+    .iad = {\
+        .bLength            = sizeof(struct usb_iad_descriptor),\
+        .bDescriptorType    = USB_DTYPE_INTERFASEASSOC,\
+        .bFirstInterface    = (_if),\
+        .bInterfaceCount    = 2,\
+        .bFunctionClass     = USB_CLASS_CDC,\
+        .bFunctionSubClass  = USB_CDC_SUBCLASS_ACM,\
+        .bFunctionProtocol  = (_proto),\
+        .iFunction          = NO_DESCRIPTOR,\
+    },\
+    .comm = {\
+        .bLength            = sizeof(struct usb_interface_descriptor),\
+        .bDescriptorType    = USB_DTYPE_INTERFACE,\
+        .bInterfaceNumber   = (_if),\
+        .bAlternateSetting  = 0,\
+        .bNumEndpoints      = 1,\
+        .bInterfaceClass    = USB_CLASS_CDC,\
+        .bInterfaceSubClass = USB_CDC_SUBCLASS_ACM,\
+        .bInterfaceProtocol = (_proto),\
+        .iInterface         = NO_DESCRIPTOR,\
+    },\
+    .hdr = {\
+        .bFunctionLength    = sizeof(struct usb_cdc_header_desc),\
+        .bDescriptorType    = USB_DTYPE_CS_INTERFACE,\
+        .bDescriptorSubType = USB_DTYPE_CDC_HEADER,\
+        .bcdCDC             = VERSION_BCD(1,1,0),\
+    },\
+    .mgmt = {\
+        .bFunctionLength    = sizeof(struct usb_cdc_call_mgmt_desc),\
+        .bDescriptorType    = USB_DTYPE_CS_INTERFACE,\
+        .bDescriptorSubType = USB_DTYPE_CDC_CALL_MANAGEMENT,\
+        .bmCapabilities     = 0,\
+        .bDataInterface     = (_if) + 1,\
+    },\
+    .acm = {\
+        .bFunctionLength    = sizeof(struct usb_cdc_acm_desc),\
+        .bDescriptorType    = USB_DTYPE_CS_INTERFACE,\
+        .bDescriptorSubType = USB_DTYPE_CDC_ACM,\
+        .bmCapabilities     = 0,\
+    },\
+    .uni = {\
+        .bFunctionLength    = sizeof(struct usb_cdc_union_desc),\
+        .bDescriptorType    = USB_DTYPE_CS_INTERFACE,\
+        .bDescriptorSubType = USB_DTYPE_CDC_UNION,\
+        .bMasterInterface0  = (_if),\
+        .bSlaveInterface0   = (_if) + 1,\
+    },\
+    .ntf_ep = {\
+        .bLength            = sizeof(struct usb_endpoint_descriptor),\
+        .bDescriptorType    = USB_DTYPE_ENDPOINT,\
+        .bEndpointAddress   = (_ntf),\
+        .bmAttributes       = USB_EPTYPE_INTERRUPT,\
+        .wMaxPacketSize     = USBD_CDC_ACM_NTF_SZ,\
+        .bInterval          = 0xFF,\
+    },\
+    .data = {\
+        .bLength            = sizeof(struct usb_interface_descriptor),\
+        .bDescriptorType    = USB_DTYPE_INTERFACE,\
+        .bInterfaceNumber   = (_if) + 1,\
+        .bAlternateSetting  = 0,\
+        .bNumEndpoints      = 2,\
+        .bInterfaceClass    = USB_CLASS_CDC_DATA,\
+        .bInterfaceSubClass = USB_SUBCLASS_NONE,\
+        .bInterfaceProtocol = USB_PROTO_NONE,\
+        .iInterface         = NO_DESCRIPTOR,\
+    },\
+    .rx_ep = {\
+        .bLength            = sizeof(struct usb_endpoint_descriptor),\
+        .bDescriptorType    = USB_DTYPE_ENDPOINT,\
+        .bEndpointAddress   = (_rx),\
+        .bmAttributes       = USB_EPTYPE_BULK,\
+        .wMaxPacketSize     = (_sz),\
+        .bInterval          = 0x01,\
+    },\
+    .tx_ep = {\
+        .bLength            = sizeof(struct usb_endpoint_descriptor),\
+        .bDescriptorType    = USB_DTYPE_ENDPOINT,\
+        .bEndpointAddress   = (_tx),\
+        .bmAttributes       = USB_EPTYPE_BULK,\
+        .wMaxPacketSize     = (_sz),\
+        .bInterval          = 0x01,\
+    },\
+}
+
+/** @} */
+
+#if defined(__cplusplus)
+    }
+#endif
+#endif //_USBD_CDC_ACM_H_
@@ -0,0 +1,197 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _USBD_CDC_ECM_H_
+#define _USBD_CDC_ECM_H_
+#if defined(__cplusplus)
+    extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "usbd_core.h"
+#include "usb_cdc.h"
+#include "usb_cdce.h"
+
+/**\addtogroup USBD_CDC_ECM USB CDC ECM function
+ * \brief Ethernet over USB function with the zero-copy frame pool
+ * \details Received frames are read packet by packet directly to the frames of the RX pool and
+ * returned to application as pointers. Transmitted frames are sent directly from the application
+ * buffers. One frame is sent at a time, \ref usbd_cdc_ecm::tx_callback is called when the frame
+ * buffer may be reused.
+ * \note All functions, excepting \ref usbd_cdc_ecm_control, should be called in the same context
+ * where \ref usbd_poll is called or with USB interrupt disabled.
+ * \note Data interface must have alternate setting 0 without endpoints and alternate setting 1
+ * with bulk endpoints, as required by ECM specification.
+ * @{ */
+
+#if !defined(USBD_CDC_ECM_NTF_SZ)
+/**\brief Notification endpoint size. Must be used in the notification endpoint descriptor.*/
+#define USBD_CDC_ECM_NTF_SZ     0x10
+#endif
+
+/**\brief Size of the each frame in the RX pool.
+ * \details Maximum Ethernet frame without FCS rounded up to the multiple of 64 bytes.*/
+#define USBD_CDC_ECM_FRAME_SZ   1536
+
+/**\brief Maximum segment size for the Ethernet Networking Functional Descriptor.*/
+#define USBD_CDC_ECM_MAX_SEGMENT    1514
+
+/**\brief Statistics supported by the function.
+ * \details Use it as bmEthernetStatistics in the Ethernet Networking Functional Descriptor.*/
+#define USBD_CDC_ECM_STATS      (USB_ETH_XMIT_OK | USB_ETH_RCV_OK | USB_ETH_XMIT_ERROR | \
+                                 USB_ETH_RCV_ERROR | USB_ETH_RCV_NO_BUFFER | \
+                                 USB_ETH_DIRECTED_BYTES_XMIT | USB_ETH_DIRECTED_FRAMES_XMIT | \
+                                 USB_ETH_MULTICAST_BYTES_XMIT | USB_ETH_MULTICAST_FRAMES_XMIT | \
+                                 USB_ETH_BROADCAST_BYTES_XMIT | USB_ETH_BROADCAST_FRAMES_XMIT | \
+                                 USB_ETH_DIRECTED_BYTES_RCV | USB_ETH_DIRECTED_FRAMES_RCV | \
+                                 USB_ETH_MULTICAST_BYTES_RCV | USB_ETH_MULTICAST_FRAMES_RCV | \
+                                 USB_ETH_BROADCAST_BYTES_RCV | USB_ETH_BROADCAST_FRAMES_RCV)
+
+/**\brief Number of statistics counters.*/
+#define USBD_CDC_ECM_STATS_CNT  17
+
+typedef struct _usbd_cdc_ecm usbd_cdc_ecm;
+
+/**\brief CDC ECM frame callback
+ * \details Called from \ref usbd_poll context when frame is received or transmitted.
+ * \param ecm pointer to CDC ECM function
+ */
+typedef void (*usbd_cdc_ecm_callback)(usbd_cdc_ecm *ecm);
+
+/**\brief Represents CDC ECM function data.*/
+struct _usbd_cdc_ecm {
+    usbd_device                 *dev;           /**<\brief USB device.*/
+    uint8_t                     *pool;          /**<\brief RX frame pool.*/
+    const uint8_t               *tx_ptr;        /**<\brief Pointer to the data to be sent.*/
+    uint16_t                    *rx_flen;       /**<\brief Lengths of the received frames.*/
+    uint16_t                    rx_len;         /**<\brief Length of the frame being received.*/
+    uint16_t                    tx_len;         /**<\brief Length of the frame being transmitted.*/
+    uint16_t                    tx_remain;      /**<\brief Bytes of frame waiting to be sent.*/
+    uint16_t                    pkt_filter;     /**<\brief Ethernet packet filter.*/
+    uint32_t                    bitrate;        /**<\brief Link bitrate.*/
+    uint8_t                     frames;         /**<\brief Number of frames in the RX pool.*/
+    uint8_t                     rx_head;        /**<\brief Index of the frame being received.*/
+    uint8_t                     rx_tail;        /**<\brief Index of the oldest received frame.*/
+    uint8_t                     rx_count;       /**<\brief Number of received frames.*/
+    uint8_t                     rx_hold;        /**<\brief OUT packet is holded due no free frames.*/
+    uint8_t                     rx_drop;        /**<\brief Oversized frame is dropped.*/
+    uint8_t                     tx_busy;        /**<\brief IN transfer is in progress.*/
+    uint8_t                     tx_zlp;         /**<\brief Frame should be terminated by ZLP.*/
+    uint8_t                     ntf_pending;    /**<\brief Pending notifications.*/
+    uint8_t                     ntf_busy;       /**<\brief Notification transfer is in progress.*/
+    uint8_t                     link;           /**<\brief Link is up.*/
+    uint8_t                     alt;            /**<\brief Data interface alternate setting.*/
+    uint8_t                     comm_if;        /**<\brief Communication interface number.*/
+    uint8_t                     data_if;        /**<\brief Data interface number.*/
+    uint8_t                     rx_ep;          /**<\brief Data OUT endpoint address.*/
+    uint8_t                     tx_ep;          /**<\brief Data IN endpoint address.*/
+    uint8_t                     ntf_ep;         /**<\brief Notification endpoint address.*/
+    uint8_t                     ep_size;        /**<\brief Size of the data endpoints.*/
+    usbd_cdc_ecm_callback       rx_callback;    /**<\brief Frame received.*/
+    usbd_cdc_ecm_callback       tx_callback;    /**<\brief Frame transmitted.*/
+    uint32_t                    stats[USBD_CDC_ECM_STATS_CNT]; /**<\brief Statistics counters
+                                                 * in the feature selector order.*/
+};
+
+/**\brief Initializes CDC ECM function
+ * \param ecm CDC ECM function
+ * \param dev USB device
+ * \param comm_if communication interface number
+ * \param data_if data interface number
+ * \param rx_ep data OUT endpoint address
+ * \param tx_ep data IN endpoint address
+ * \param ntf_ep notification endpoint address
+ * \param ep_size data endpoints size
+ * \param pool pointer to RX frame pool. Must hold frames * \ref USBD_CDC_ECM_FRAME_SZ bytes.
+ * \param flen pointer to array of frames lengths. Must hold frames entries.
+ * \param frames number of frames in the RX pool
+ */
+void usbd_cdc_ecm_init(usbd_cdc_ecm *ecm, usbd_device *dev, uint8_t comm_if, uint8_t data_if,
+                       uint8_t rx_ep, uint8_t tx_ep, uint8_t ntf_ep, uint8_t ep_size,
+                       void *pool, uint16_t *flen, uint8_t frames);
+
+/**\brief Configures or deconfigures CDC ECM function
+ * \details Should be called from \ref usbd_cfg_callback. Data endpoints are configured when host
+ * selects alternate setting 1 of the data interface.
+ * \param ecm CDC ECM function
+ * \param enable configures notification endpoint if TRUE, deconfigures all endpoints otherwise
+ */
+void usbd_cdc_ecm_enable(usbd_cdc_ecm *ecm, bool enable);
+
+/**\brief Processes CDC ECM class requests and data interface alternate setting requests
+ * \details Should be called from \ref usbd_ctl_callback. With \ref USBD_ALTSETTINGS alternate
+ * setting requests are left to the core.
+ * \param ecm CDC ECM function
+ * \param req control request
+ * \return usbd_fail if request is not belongs to this function or is not supported
+ */
+usbd_respond usbd_cdc_ecm_control(usbd_cdc_ecm *ecm, usbd_ctlreq *req);
+
+#if defined(USBD_ALTSETTINGS)
+/**\brief Starts or stops the data interface after the core has selected its alternate setting
+ * \details Should be called from \ref usbd_alt_callback. Data endpoints are configured by the core
+ * from the alternate setting 1 endpoint descriptors.
+ * \param ecm CDC ECM function
+ * \param intf interface number
+ * \param alt selected alternate setting
+ */
+void usbd_cdc_ecm_altsetting(usbd_cdc_ecm *ecm, uint8_t intf, uint8_t alt);
+#endif
+
+/**\brief Gets the oldest received frame without copying
+ * \details Returns the same frame until \ref usbd_cdc_ecm_rx_release is called.
+ * \param ecm CDC ECM function
+ * \param[out] frame pointer to the frame in the RX pool
+ * \return frame length or 0 if no frames available
+ */
+uint16_t usbd_cdc_ecm_rx_frame(usbd_cdc_ecm *ecm, const uint8_t **frame);
+
+/**\brief Returns frame obtained by \ref usbd_cdc_ecm_rx_frame to the RX pool
+ * \param ecm CDC ECM function
+ */
+void usbd_cdc_ecm_rx_release(usbd_cdc_ecm *ecm);
+
+/**\brief Starts frame transmission from the application buffer
+ * \details Buffer must be kept unchanged until \ref usbd_cdc_ecm::tx_callback is called or
+ * \ref usbd_cdc_ecm_tx_busy returns FALSE.
+ * \param ecm CDC ECM function
+ * \param frame pointer to the frame
+ * \param len frame length
+ * \return TRUE if transmission is started
+ */
+bool usbd_cdc_ecm_tx_frame(usbd_cdc_ecm *ecm, const void *frame, uint16_t len);
+
+/**\brief Reports link state to the host
+ * \details Sends CONNECTION_SPEED_CHANGE and NETWORK_CONNECTION notifications.
+ * \param ecm CDC ECM function
+ * \param up TRUE if link is up
+ * \param bitrate link bitrate in bits per second
+ */
+void usbd_cdc_ecm_link(usbd_cdc_ecm *ecm, bool up, uint32_t bitrate);
+
+/**\brief Returns TRUE if frame transmission is in progress
+ * \param ecm CDC ECM function
+ */
+inline static bool usbd_cdc_ecm_tx_busy(usbd_cdc_ecm *ecm) {
+    return ecm->tx_busy != 0;
+}
+
+/** @} */
+
+#if defined(__cplusplus)
+    }
+#endif
+#endif //_USBD_CDC_ECM_H_
@@ -0,0 +1,189 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _USBD_CDC_NCM_H_
+#define _USBD_CDC_NCM_H_
+#if defined(__cplusplus)
+    extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "usbd_core.h"
+#include "usb_cdc.h"
+#include "usb_cdcn.h"
+
+/**\addtogroup USBD_CDC_NCM USB CDC NCM function
+ * \brief Ethernet over USB function with the 16-bit NTB aggregation
+ * \details Many Ethernet frames are packed into the one NCM Transfer Block (NTB) in both
+ * directions. Received datagrams are returned as pointers to the OUT NTB buffer. Transmitted
+ * datagrams are written by application directly to the IN NTB buffer. TX buffer is split into two
+ * NTBs. While one NTB is transmitted, the frames are collected to the another one and sent as soon
+ * as the IN endpoint becomes idle.
+ * \note All functions, excepting \ref usbd_cdc_ncm_control, should be called in the same context
+ * where \ref usbd_poll is called or with USB interrupt disabled.
+ * \note RX buffer size must be a multiple of the endpoint size. Both buffers should be 32-bit
+ * aligned. Common host drivers expect NTB size at least 2048 bytes.
+ * \note Data interface must have alternate setting 0 without endpoints and alternate setting 1
+ * with bulk endpoints, as required by NCM specification.
+ * @{ */
+
+#if !defined(USBD_CDC_NCM_NTF_SZ)
+/**\brief Notification endpoint size. Must be used in the notification endpoint descriptor.*/
+#define USBD_CDC_NCM_NTF_SZ     0x10
+#endif
+
+#if !defined(USBD_CDC_NCM_MAX_DGRAMS)
+/**\brief Maximum number of datagrams in the IN NTB.*/
+#define USBD_CDC_NCM_MAX_DGRAMS 16
+#endif
+
+#if !defined(USBD_CDC_NCM_DGRAM_SZ)
+/**\brief Default maximum datagram size.*/
+#define USBD_CDC_NCM_DGRAM_SZ   1514
+#endif
+
+typedef struct _usbd_cdc_ncm usbd_cdc_ncm;
+
+/**\brief CDC NCM OUT NTB received callback
+ * \details Called from \ref usbd_poll context when new datagrams are available.
+ * \param ncm pointer to CDC NCM function
+ */
+typedef void (*usbd_cdc_ncm_callback)(usbd_cdc_ncm *ncm);
+
+/**\brief Represents CDC NCM function data.*/
+struct _usbd_cdc_ncm {
+    usbd_device                 *dev;           /**<\brief USB device.*/
+    uint8_t                     *rxbuf;         /**<\brief OUT NTB buffer.*/
+    uint8_t                     *txbuf;         /**<\brief IN NTB buffers.*/
+    uint8_t                     *tx_ptr;        /**<\brief Pointer to the data to be sent.*/
+    uint16_t                    rxsize;         /**<\brief OUT NTB buffer size.*/
+    uint16_t                    rx_len;         /**<\brief Received OUT NTB length.*/
+    uint16_t                    rx_ndp;         /**<\brief Current NDP offset.*/
+    uint16_t                    rx_dpe;         /**<\brief Current datagram pointer entry.*/
+    uint16_t                    txsize;         /**<\brief Size of the each IN NTB buffer.*/
+    uint16_t                    tx_max;         /**<\brief Negotiated IN NTB size.*/
+    uint16_t                    tx_pos;         /**<\brief Write offset in the filled IN NTB.*/
+    uint16_t                    tx_remain;      /**<\brief Bytes of IN NTB waiting to be sent.*/
+    uint16_t                    tx_seq;         /**<\brief NTB sequence number.*/
+    uint16_t                    max_dgram;      /**<\brief Maximum datagram size.*/
+    uint16_t                    pkt_filter;     /**<\brief Ethernet packet filter.*/
+    uint32_t                    bitrate;        /**<\brief Link bitrate.*/
+    uint8_t                     rx_state;       /**<\brief OUT NTB state.*/
+    uint8_t                     rx_hold;        /**<\brief OUT packet is holded due busy buffer.*/
+    uint8_t                     tx_fill;        /**<\brief Index of the filled IN NTB.*/
+    uint8_t                     tx_cnt;         /**<\brief Datagrams in the filled IN NTB.*/
+    uint8_t                     tx_busy;        /**<\brief IN NTB transfer is in progress.*/
+    uint8_t                     tx_zlp;         /**<\brief IN NTB should be terminated by ZLP.*/
+    uint8_t                     ntf_pending;    /**<\brief Pending notifications.*/
+    uint8_t                     ntf_busy;       /**<\brief Notification transfer is in progress.*/
+    uint8_t                     link;           /**<\brief Link is up.*/
+    uint8_t                     alt;            /**<\brief Data interface alternate setting.*/
+    uint8_t                     comm_if;        /**<\brief Communication interface number.*/
+    uint8_t                     data_if;        /**<\brief Data interface number.*/
+    uint8_t                     rx_ep;          /**<\brief Data OUT endpoint address.*/
+    uint8_t                     tx_ep;          /**<\brief Data IN endpoint address.*/
+    uint8_t                     ntf_ep;         /**<\brief Notification endpoint address.*/
+    uint8_t                     ep_size;        /**<\brief Size of the data endpoints.*/
+    usbd_cdc_ncm_callback       rx_callback;    /**<\brief OUT NTB received.*/
+    struct usb_cdc_ncm_dpe16    tx_dpe[USBD_CDC_NCM_MAX_DGRAMS]; /**<\brief Datagrams in the filled IN NTB.*/
+};
+
+/**\brief Initializes CDC NCM function
+ * \param ncm CDC NCM function
+ * \param dev USB device
+ * \param comm_if communication interface number
+ * \param data_if data interface number
+ * \param rx_ep data OUT endpoint address
+ * \param tx_ep data IN endpoint address
+ * \param ntf_ep notification endpoint address
+ * \param ep_size data endpoints size
+ * \param rxbuf pointer to OUT NTB buffer
+ * \param rxsize size of OUT NTB buffer
+ * \param txbuf pointer to IN NTB buffers
+ * \param txsize size of IN NTB buffers. Splitted into two NTBs.
+ */
+void usbd_cdc_ncm_init(usbd_cdc_ncm *ncm, usbd_device *dev, uint8_t comm_if, uint8_t data_if,
+                       uint8_t rx_ep, uint8_t tx_ep, uint8_t ntf_ep, uint8_t ep_size,
+                       void *rxbuf, uint16_t rxsize, void *txbuf, uint16_t txsize);
+
+/**\brief Configures or deconfigures CDC NCM function
+ * \details Should be called from \ref usbd_cfg_callback. Data endpoints are configured when host
+ * selects alternate setting 1 of the data interface.
+ * \param ncm CDC NCM function
+ * \param enable configures notification endpoint if TRUE, deconfigures all endpoints otherwise
+ */
+void usbd_cdc_ncm_enable(usbd_cdc_ncm *ncm, bool enable);
+
+/**\brief Processes CDC NCM class requests and data interface alternate setting requests
+ * \details Should be called from \ref usbd_ctl_callback. With \ref USBD_ALTSETTINGS alternate
+ * setting requests are left to the core.
+ * \param ncm CDC NCM function
+ * \param req control request
+ * \return usbd_fail if request is not belongs to this function or is not supported
+ */
+usbd_respond usbd_cdc_ncm_control(usbd_cdc_ncm *ncm, usbd_ctlreq *req);
+
+#if defined(USBD_ALTSETTINGS)
+/**\brief Starts or stops the data interface after the core has selected its alternate setting
+ * \details Should be called from \ref usbd_alt_callback. Data endpoints are configured by the core
+ * from the alternate setting 1 endpoint descriptors.
+ * \param ncm CDC NCM function
+ * \param intf interface number
+ * \param alt selected alternate setting
+ */
+void usbd_cdc_ncm_altsetting(usbd_cdc_ncm *ncm, uint8_t intf, uint8_t alt);
+#endif
+
+/**\brief Gets the next received datagram without copying
+ * \details Returns the same datagram until \ref usbd_cdc_ncm_rx_release is called.
+ * \param ncm CDC NCM function
+ * \param[out] frame pointer to the datagram in the OUT NTB buffer
+ * \return datagram length or 0 if no datagrams available
+ */
+uint16_t usbd_cdc_ncm_rx_frame(usbd_cdc_ncm *ncm, const uint8_t **frame);
+
+/**\brief Releases datagram obtained by \ref usbd_cdc_ncm_rx_frame
+ * \param ncm CDC NCM function
+ */
+void usbd_cdc_ncm_rx_release(usbd_cdc_ncm *ncm);
+
+/**\brief Allocates space for the datagram in the IN NTB
+ * \param ncm CDC NCM function
+ * \param len datagram length
+ * \return pointer to write datagram to or NULL if no space available
+ */
+uint8_t *usbd_cdc_ncm_tx_alloc(usbd_cdc_ncm *ncm, uint16_t len);
+
+/**\brief Queues datagram written to the space obtained by \ref usbd_cdc_ncm_tx_alloc
+ * \param ncm CDC NCM function
+ * \param len datagram length. Must not exceed allocated length.
+ */
+void usbd_cdc_ncm_tx_commit(usbd_cdc_ncm *ncm, uint16_t len);
+
+/**\brief Reports link state to the host
+ * \details Sends CONNECTION_SPEED_CHANGE and NETWORK_CONNECTION notifications.
+ * \param ncm CDC NCM function
+ * \param up TRUE if link is up
+ * \param bitrate link bitrate in bits per second
+ */
+void usbd_cdc_ncm_link(usbd_cdc_ncm *ncm, bool up, uint32_t bitrate);
+
+/** @} */
+
+#if defined(__cplusplus)
+    }
+#endif
+#endif //_USBD_CDC_NCM_H_
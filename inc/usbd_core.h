@@ -32,9 +32,54 @@
 #define USBD_SOF_OUT        /**<\brief Enables SOF output pin for F4 OTGFS. */
 #define USBD_PRIMARY_OTGHS  /**<\brief Sets OTGHS as primary interface for F4*/
 #define USBD_USE_EXT_ULPI   /**<\brief Enables external ULPI interface for OTGHS */
+#define USBD_LPM_SUPPORT    /**<\brief Enables Link Power Management (L1) for L0/F0/L4/G4
+                              * devfs C drivers. Requires BOS descriptor with
+                              * \ref USB_USB20EXT_LPM attribute and bcdUSB 0x0201.*/
 #define USB_PMA_SIZE        /**<\brief PMA memoty size in bytes. Adjust this for
                               * the devices that shares PMA memory with CAN in case
                               * of both USB and CAN in use to avoid data corruption. */
+#define USBD_TRACE          /**<\brief Enables core event trace recorder. Value is the trace ring
+                              * size in records, power of 2. See \ref usbd_trace_buf */
+#define USBD_TRACE_SOF      /**<\brief Records SOF events to the trace. Disabled by default
+                              * because SOF floods the ring every frame.*/
+#define USBD_TRACE_TIME     /**<\brief Trace timestamp source macro with the device argument.
+                              * Driver frame number by default. A free running cycle counter
+                              * may be used for the microsecond resolution.*/
+#define USBD_TRACE_CLOCK    /**<\brief \ref USBD_TRACE_TIME ticks per second. 1000 by default.*/
+#define USBD_TRACE_MASK     /**<\brief \ref USBD_TRACE_TIME wrap mask. 0x7FF by default.*/
+#define USBD_VIRTUAL        /**<\brief Host build of the core without the hardware drivers. Driver
+                              * is supplied by the application, i.e. tools/enumbench.c */
+#define USBD_LATENCY        /**<\brief Enables latency histograms of the control stages, endpoint
+                              * and event callbacks. See \ref usbd_latency */
+#define USBD_LAT_CLOCK      /**<\brief Latency clock source macro. DWT cycle counter by default on
+                              * the cores that have it. Any free running 32-bit counter may be used,
+                              * so the same code runs on the host.*/
+#define USBD_LAT_SHIFT      /**<\brief log2 of the first histogram bin width in clock ticks.
+                              * 4 by default.*/
+#define USBD_LAT_BINS       /**<\brief Number of the histogram bins. 16 by default.*/
+#define USBD_EP_STATS       /**<\brief Enables per-endpoint statistics counters. See \ref usbd_stats */
+#define USBD_EP_STATS_REQ   /**<\brief Vendor device request code. If defined, the core returns
+                              * \ref usbd_stats by the IN request and clears it by the OUT request
+                              * with this code.*/
+#define USBD_SCHED          /**<\brief Enables SOF driven frame scheduler for the periodic endpoint
+                              * jobs. Value is the timer wheel size in frames, power of 2.
+                              * See \ref usbd_sched_add */
+#define USBD_BW_CHECK       /**<\brief Enables periodic bandwidth and endpoint buffer check of the
+                              * configuration descriptor on SET_CONFIGURATION. See \ref usbd_bw_check */
+#define USBD_BW_BUFSIZE     /**<\brief Endpoint buffer capacity of the driver in bytes available for
+                              * the non-control endpoints. Buffer is not checked if not defined.*/
+#define USBD_BW_WARN        /**<\brief Accepts configuration that fails the bandwidth check. Result is
+                              * kept in the \ref _usbd_device::bw_status "bw_status" field.*/
+#define USBD_BW_EPS         /**<\brief Endpoints in the \ref usbd_bw_report. 16 by default.*/
+#define USBD_ALTSETTINGS    /**<\brief Enables core managed interface alternate settings. Value is
+                              * the number of interfaces tracked. See \ref usbd_reg_altsetting */
+#define USBD_DRIVER_CTX     /**<\brief Builds the core and the drivers with the context driver call
+                              * table \ref usbd_driver_ctx. Every hook takes the peripheral base, so
+                              * one driver serves several peripheral instances. Supported by the
+                              * STM32F405-F439 and STM32F411 OTG FS driver. See \ref usbd_init_ctx */
+#define USBD_CONST_CFG      /**<\brief Keeps the driver and the control and event callbacks in the
+                              * constant \ref usbd_config in flash. Device RAM holds the status, the
+                              * endpoint callbacks and two pointers. See \ref usbd_init_cfg */
 /** @} */
 #endif
 
@@ -52,9 +97,19 @@
 #define usbd_evt_eprx       5   /**<\brief Data packet received.*/
 #define usbd_evt_epsetup    6   /**<\brief Setup packet received.*/
 #define usbd_evt_error      7   /**<\brief Data error.*/
-#define usbd_evt_count      8
+#define usbd_evt_l1sleep    8   /**<\brief LPM L1 sleep. ep parameter holds host BESL value. Exit
+                                 * from L1 state reported as \ref usbd_evt_wkup.*/
+#define usbd_evt_count      9
 /** @}*/
 
+/**\anchor USBD_TRACE_RECORDS
+ * \name Trace record types besides the \ref USB_EVENTS "USB device events"
+ * @{ */
+#define usbd_trc_read       0x0C    /**<\brief Endpoint data read. */
+#define usbd_trc_write      0x0D    /**<\brief Endpoint data written. */
+#define usbd_trc_stall      0x0E    /**<\brief Control endpoint STALL PID issued. */
+/** @} */
+
 /**\anchor USB_LANES_STATUS
  * \name USB lanes connection states
  * @{ */
@@ -77,6 +132,7 @@
 #define USBD_HW_SPEED_LS    (1 << 4)    /**<\brief Low speed */
 #define USBD_HW_SPEED_FS    (2 << 4)    /**<\brief Full speed */
 #define USBD_HW_SPEED_HS    (3 << 4)    /**<\brief High speed */
+#define USBD_HW_LPM         (1 << 6)    /**<\brief Link power management (L1) enabled.*/
 
 /** @} */
 /** @} */
@@ -152,6 +208,31 @@ typedef struct {
     uint8_t     data[];         /**<\brief Data payload.*/
 } usbd_ctlreq;
 
+#if defined(USBD_EP_STATS)
+/**\brief Endpoint statistics counters.*/
+typedef struct {
+    uint32_t    rx_packets;     /**<\brief Received packets. SETUP packets are not counted.*/
+    uint32_t    tx_packets;     /**<\brief Transmitted packets.*/
+    uint32_t    rx_bytes;       /**<\brief Bytes read from the endpoint.*/
+    uint32_t    tx_bytes;       /**<\brief Bytes written to the endpoint.*/
+    uint16_t    rx_busy;        /**<\brief Reads rejected by the driver.*/
+    uint16_t    tx_busy;        /**<\brief Writes rejected by the driver due to busy endpoint.*/
+    uint16_t    stalls;         /**<\brief Endpoint stalls by the device or by the host.*/
+    uint16_t    setups;         /**<\brief Received SETUP packets.*/
+} usbd_ep_stats;
+
+/**\brief Device statistics counters
+ * \details Counters are updated by the core in the \ref usbd_poll context. Layout is fixed, so
+ * the block may be sent to the host as is. See \ref USBD_EP_STATS_REQ */
+typedef struct {
+    usbd_ep_stats   ep[8];      /**<\brief Counters by the endpoint index.*/
+    uint16_t        resets;     /**<\brief Bus resets.*/
+    uint16_t        errors;     /**<\brief \ref usbd_evt_error events.*/
+    uint16_t        suspends;   /**<\brief Suspend events.*/
+    uint16_t        wakeups;    /**<\brief Wakeup events.*/
+} usbd_stats;
+#endif
+
 /** USB device status data.*/
 typedef struct {
     void        *data_buf;      /**<\brief Pointer to data buffer used for control requests.*/
@@ -162,6 +243,8 @@ typedef struct {
     uint8_t     device_cfg;     /**<\brief Current device configuration number.*/
     uint8_t     device_state;   /**<\brief Current \ref usbd_machine_state.*/
     uint8_t     control_state;  /**<\brief Current \ref usbd_ctl_state.*/
+    uint8_t     remote_wakeup;  /**<\brief DEVICE_REMOTE_WAKEUP feature enabled by host.*/
+    uint8_t     suspended;      /**<\brief Bus is suspended or in the LPM L1 state.*/
 } usbd_status;
 
 /**\brief Generic USB device event callback for events and endpoints processing
@@ -187,6 +270,7 @@ typedef void (*usbd_rqc_callback)(usbd_device *dev, usbd_ctlreq *req);
  *          - SET_CONFIGURATION (passes to \ref usbd_cfg_callback)
  *          - GET_DESCRIPTOR (passes to \ref usbd_dsc_callback)
  *          - GET_STATUS
+ *          - GET_INTERFACE, SET_INTERFACE (with \ref USBD_ALTSETTINGS)
  *          - SET_FEATURE, CLEAR_FEATURE (endpoints only)
  *          - SET_ADDRESS
  * \param[in] dev points to USB device
@@ -215,6 +299,17 @@ typedef usbd_respond (*usbd_dsc_callback)(usbd_ctlreq *req, void **address, uint
  */
 typedef usbd_respond (*usbd_cfg_callback)(usbd_device *dev, uint8_t cfg);
 
+/**\brief USB set interface callback function
+ * \details Called after SET_INTERFACE request is processed by the core. Endpoints of the previous
+ * alternate setting are already deconfigured and endpoints of the new one are configured.
+ * Also called with alternate setting 0 if the request failed and the previous setting could not
+ * be restored, so the interface is back to its default.
+ * \param[in] dev pointer to USB device
+ * \param[in] intf interface number
+ * \param[in] alt new alternate setting
+ */
+typedef void (*usbd_alt_callback)(usbd_device *dev, uint8_t intf, uint8_t alt);
+
 /** @} */
 
 /**\addtogroup USBD_HW
@@ -301,6 +396,12 @@ typedef uint16_t (*usbd_hw_get_frameno)(void);
  */
 typedef uint16_t (*usbd_hw_get_serialno)(void *buffer);
 
+/**\brief Starts or stops resume signalling on the bus
+ * \param resume Starts resume signalling if TRUE, stops otherwise.
+ * \note Exit from the LPM L1 state is timed by hardware. Stop has no effect in this case.
+ */
+typedef void (*usbd_hw_resume)(bool resume);
+
 /**\brief Represents a hardware USB driver call table.*/
 struct usbd_driver {
     usbd_hw_getinfo         getinfo;            /**<\copybrief usbd_hw_getinfo */
@@ -316,25 +417,455 @@ struct usbd_driver {
     usbd_hw_poll            poll;               /**<\copybrief usbd_hw_poll */
     usbd_hw_get_frameno     frame_no;           /**<\copybrief usbd_hw_get_frameno */
     usbd_hw_get_serialno    get_serialno_desc;  /**<\copybrief usbd_hw_get_serialno */
+    usbd_hw_resume          resume;             /**<\copybrief usbd_hw_resume */
+};
+
+/**\brief Represents a hardware USB driver call table with the peripheral context.
+ * \details Same hooks as \ref usbd_driver with the peripheral base address as the first
+ * argument. The driver keeps no state besides the peripheral registers, so the same table may
+ * serve several instances and may be tested against a register block in RAM.*/
+struct usbd_driver_ctx {
+    uint32_t    (*getinfo)(void *base);                                     /**<\copybrief usbd_hw_getinfo */
+    void        (*enable)(void *base, bool enable);                         /**<\copybrief usbd_hw_enable */
+    uint8_t     (*connect)(void *base, bool connect);                       /**<\copybrief usbd_hw_connect */
+    void        (*setaddr)(void *base, uint8_t address);                    /**<\copybrief usbd_hw_setaddr */
+    bool        (*ep_config)(void *base, uint8_t ep, uint8_t eptype, uint16_t epsize); /**<\copybrief usbd_hw_ep_config */
+    void        (*ep_deconfig)(void *base, uint8_t ep);                     /**<\copybrief usbd_hw_ep_deconfig */
+    int32_t     (*ep_read)(void *base, uint8_t ep, void *buf, uint16_t blen);   /**<\copybrief usbd_hw_ep_read */
+    int32_t     (*ep_write)(void *base, uint8_t ep, void *buf, uint16_t blen);  /**<\copybrief usbd_hw_ep_write */
+    void        (*ep_setstall)(void *base, uint8_t ep, bool stall);         /**<\copybrief usbd_hw_ep_setstall */
+    bool        (*ep_isstalled)(void *base, uint8_t ep);                    /**<\copybrief usbd_hw_ep_isstalled */
+    void        (*poll)(void *base, usbd_device *dev, usbd_evt_callback callback); /**<\copybrief usbd_hw_poll */
+    uint16_t    (*frame_no)(void *base);                                    /**<\copybrief usbd_hw_get_frameno */
+    uint16_t    (*get_serialno_desc)(void *base, void *buffer);             /**<\copybrief usbd_hw_get_serialno */
+    void        (*resume)(void *base, bool resume);                         /**<\copybrief usbd_hw_resume */
 };
 
+/**\brief Calls the driver hook of the device
+ * \details Passes the peripheral base with \ref USBD_DRIVER_CTX. Expands to the plain call of the
+ * static driver otherwise.
+ * \param dev usb device \ref _usbd_device
+ * \param hook \ref usbd_driver member
+ */
+#if defined(USBD_DRIVER_CTX)
+#define usbd_hw_call(dev, hook, ...)    (usbd_dev_cfg(dev)->driver->hook(usbd_dev_cfg(dev)->base, ##__VA_ARGS__))
+#else
+#define usbd_hw_call(dev, hook, ...)    (usbd_dev_cfg(dev)->driver->hook(__VA_ARGS__))
+#endif
+
 /** @} */
 
 /**\addtogroup USBD_CORE
  * @{ */
 
+#if defined(USBD_SCHED)
+#if (USBD_SCHED & (USBD_SCHED - 1))
+    #error USBD_SCHED must be a power of 2
+#endif
+/**\brief Periodic job of the frame scheduler
+ * \details Allocated by the caller and linked into the timer wheel by \ref usbd_sched_add.*/
+typedef struct _usbd_sched_job usbd_sched_job;
+
+struct _usbd_sched_job {
+    usbd_sched_job      *next;      /**<\brief Next job in the wheel slot.*/
+    usbd_evt_callback   callback;   /**<\brief Job callback. Called with \ref usbd_evt_sof event.*/
+    uint16_t            interval;   /**<\brief Period in frames.*/
+    uint16_t            rounds;     /**<\brief Wheel turns left before the job is due.*/
+    uint8_t             ep;         /**<\brief Endpoint passed to the callback.*/
+};
+
+/**\brief Frame scheduler timer wheel.*/
+typedef struct {
+    usbd_sched_job      *wheel[USBD_SCHED]; /**<\brief Jobs by the due frame modulo wheel size.*/
+    usbd_sched_job      *due;               /**<\brief Jobs of the running batch not called yet.*/
+    uint16_t            frame;              /**<\brief Last processed frame number.*/
+    uint16_t            jobs;               /**<\brief Number of the registered jobs.*/
+} usbd_sched;
+#endif
+
+#if defined(USBD_CONST_CFG)
+/**\brief Represents a constant USB device configuration.
+ * \details Driver and callbacks that are not changed at runtime. Should be declared \c const, so
+ * it is placed in flash. Unused callbacks are NULL.*/
+typedef struct {
+#if defined(USBD_DRIVER_CTX)
+    const struct usbd_driver_ctx *driver;               /**<\copybrief usbd_driver_ctx */
+    void                        *base;                  /**<\brief Peripheral base passed to the driver.*/
+#else
+    const struct usbd_driver    *driver;                /**<\copybrief usbd_driver */
+#endif
+    usbd_ctl_callback           control_callback;       /**<\copybrief usbd_ctl_callback */
+    usbd_cfg_callback           config_callback;        /**<\copybrief usbd_cfg_callback */
+    usbd_dsc_callback           descriptor_callback;    /**<\copybrief usbd_dsc_callback */
+#if defined(USBD_ALTSETTINGS)
+    usbd_alt_callback           alt_callback;           /**<\copybrief usbd_alt_callback */
+#endif
+    usbd_evt_callback           events[usbd_evt_count]; /**<\brief array of the event callbacks.*/
+} usbd_config;
+
+#define usbd_dev_cfg(dev)       ((dev)->cfg)
+#else
+#define usbd_dev_cfg(dev)       (dev)
+#endif
+
 /**\brief Represents a USB device data.*/
 struct _usbd_device {
+#if defined(USBD_CONST_CFG)
+    const usbd_config           *cfg;                   /**<\copybrief usbd_config */
+#else
+#if defined(USBD_DRIVER_CTX)
+    const struct usbd_driver_ctx *driver;               /**<\copybrief usbd_driver_ctx */
+    void                        *base;                  /**<\brief Peripheral base passed to the driver.*/
+#else
     const struct usbd_driver    *driver;                /**<\copybrief usbd_driver */
+#endif
     usbd_ctl_callback           control_callback;       /**<\copybrief usbd_ctl_callback */
-    usbd_rqc_callback           complete_callback;      /**<\copybrief usbd_rqc_callback */
     usbd_cfg_callback           config_callback;        /**<\copybrief usbd_cfg_callback */
     usbd_dsc_callback           descriptor_callback;    /**<\copybrief usbd_dsc_callback */
     usbd_evt_callback           events[usbd_evt_count]; /**<\brief array of the event callbacks.*/
+#endif
+    usbd_rqc_callback           complete_callback;      /**<\copybrief usbd_rqc_callback */
     usbd_evt_callback           endpoint[8];            /**<\brief array of the endpoint callbacks.*/
     usbd_status                 status;                 /**<\copybrief usbd_status */
+#if defined(USBD_EP_STATS)
+    usbd_stats                  stats;                  /**<\copybrief usbd_stats */
+#endif
+#if defined(USBD_SCHED)
+    usbd_sched                  sched;                  /**<\copybrief usbd_sched */
+#endif
+#if defined(USBD_ALTSETTINGS)
+#if !defined(USBD_CONST_CFG)
+    usbd_alt_callback           alt_callback;           /**<\copybrief usbd_alt_callback */
+#endif
+    uint8_t                     altsetting[USBD_ALTSETTINGS]; /**<\brief Current alternate
+                                                         * settings by the interface number.*/
+#endif
+#if defined(USBD_BW_CHECK)
+    uint8_t                     bw_status;              /**<\brief \ref USBD_BW_STATUS of the last
+                                                         * SET_CONFIGURATION request.*/
+#endif
+#if defined(USBD_LATENCY)
+    uint32_t                    lat_mark;               /**<\brief Start of the current control
+                                                         * transfer stage. \ref usbd_latency */
+#endif
 };
 
+#if defined(USBD_EP_STATS)
+/**\brief Counts endpoint data read or write
+ * \param dev usb device \ref _usbd_device
+ * \param ep endpoint address
+ * \param len data length returned by the driver. Negative if endpoint was busy.
+ */
+inline static void usbd_stats_data(usbd_device *dev, uint8_t ep, int32_t len) {
+    usbd_ep_stats *s = &dev->stats.ep[ep & 0x07];
+    if (ep & 0x80) {
+        if (len < 0) s->tx_busy++; else s->tx_bytes += len;
+    } else {
+        if (len < 0) s->rx_busy++; else s->rx_bytes += len;
+    }
+}
+
+/**\brief Counts endpoint stall
+ * \param dev usb device \ref _usbd_device
+ * \param ep endpoint address
+ */
+inline static void usbd_stats_stall(usbd_device *dev, uint8_t ep) {
+    dev->stats.ep[ep & 0x07].stalls++;
+}
+
+/**\brief Takes a snapshot of the statistics counters
+ * \param dev usb device \ref _usbd_device
+ * \param stats snapshot
+ * \note Should be called in the same context where \ref usbd_poll is called or with USB interrupt
+ * disabled to get a consistent snapshot.
+ */
+inline static void usbd_stats_get(usbd_device *dev, usbd_stats *stats) {
+    *stats = dev->stats;
+}
+
+/**\brief Clears the statistics counters
+ * \param dev usb device \ref _usbd_device
+ */
+inline static void usbd_stats_reset(usbd_device *dev) {
+    dev->stats = (usbd_stats){0};
+}
+#else
+#define usbd_stats_data(dev, ep, len) do {} while (0)
+#define usbd_stats_stall(dev, ep) do {} while (0)
+#endif
+
+#if defined(USBD_TRACE)
+#if (USBD_TRACE & (USBD_TRACE - 1))
+    #error USBD_TRACE must be a power of 2
+#endif
+#if !defined(USBD_TRACE_TIME)
+#define USBD_TRACE_TIME(dev)    usbd_hw_call(dev, frame_no)
+#if !defined(USBD_TRACE_MASK)
+#define USBD_TRACE_MASK         0x7FF
+#endif
+#endif
+#if !defined(USBD_TRACE_CLOCK)
+#define USBD_TRACE_CLOCK        1000
+#endif
+#if !defined(USBD_TRACE_MASK)
+#define USBD_TRACE_MASK         0xFFFFFFFF
+#endif
+
+#define USBD_TRACE_MAGIC        0x43525455  /**<\brief "UTRC" trace buffer signature.*/
+
+/**\brief Trace record.*/
+typedef struct {
+    uint32_t    time;       /**<\brief Timestamp. \ref USBD_TRACE_TIME */
+    uint8_t     evt;        /**<\brief \ref USB_EVENTS "Event" or \ref USBD_TRACE_RECORDS "record type"
+                             * in the low nibble, \ref usbd_ctl_state in the high nibble.*/
+    uint8_t     ep;         /**<\brief Endpoint address.*/
+    uint16_t    count;      /**<\brief Data byte count. 0xFFFF if the endpoint was busy.*/
+} usbd_trace_rec;
+
+/**\brief Trace ring buffer
+ * \details Holds the last \ref USBD_TRACE records. The buffer is found in a RAM dump by the
+ * signature and decoded by tools/usbtrace.c into a timeline with per-transfer latencies.*/
+typedef struct {
+    uint32_t            magic;      /**<\brief \ref USBD_TRACE_MAGIC */
+    uint16_t            size;       /**<\brief Ring size in records.*/
+    uint16_t            rec_size;   /**<\brief Record size in bytes.*/
+    uint32_t            clock;      /**<\brief Timestamp ticks per second.*/
+    uint32_t            mask;       /**<\brief Timestamp wrap mask.*/
+    volatile uint32_t   head;       /**<\brief Free running count of the records.*/
+    usbd_trace_rec      rec[USBD_TRACE];    /**<\brief Records ring.*/
+} usbd_trace_buf;
+
+/**\brief Event trace recorded by the core.
+ * \details Shared by all devices. Records of the several devices are interleaved.*/
+extern usbd_trace_buf usbd_trace;
+
+/**\brief Puts a record to the event trace
+ * \param dev usb device \ref _usbd_device
+ * \param evt \ref USB_EVENTS "event" or \ref USBD_TRACE_RECORDS "record type"
+ * \param ep endpoint address
+ * \param count data byte count
+ * \note Should be called in the same context where \ref usbd_poll is called.
+ */
+inline static void usbd_trace_put(usbd_device *dev, uint8_t evt, uint8_t ep, uint16_t count) {
+#if defined(__ARM_ARCH_6M__)
+    uint32_t _h = usbd_trace.head++;
+#else
+    /* record is reserved atomically, so the devices polled from the different interrupts
+     * may share the trace */
+    uint32_t _h = __atomic_fetch_add(&usbd_trace.head, 1, __ATOMIC_RELAXED);
+#endif
+    usbd_trace_rec *r = &usbd_trace.rec[_h & (USBD_TRACE - 1)];
+    r->time = USBD_TRACE_TIME(dev);
+    r->evt = evt | (dev->status.control_state << 4);
+    r->ep = ep;
+    r->count = count;
+}
+#else
+#define usbd_trace_put(dev, evt, ep, count) do {} while (0)
+#endif
+
+#if defined(USBD_LATENCY)
+#if !defined(USBD_LAT_CLOCK)
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__)
+#define USBD_LAT_DWT
+#define USBD_LAT_CLOCK()        (*(volatile uint32_t*)0xE0001004)   /* DWT->CYCCNT */
+#else
+    #error USBD_LAT_CLOCK must be defined for the cores without DWT cycle counter
+#endif
+#endif
+#if !defined(USBD_LAT_SHIFT)
+#define USBD_LAT_SHIFT          4
+#endif
+#if !defined(USBD_LAT_BINS)
+#define USBD_LAT_BINS           16
+#endif
+
+/**\anchor USBD_LAT_CTL
+ * \name Control transfer latency histograms
+ * @{ */
+#define usbd_lat_setup      0   /**<\brief SETUP packet processing, including the request handling
+                                 * and the first DATA IN packet.*/
+#define usbd_lat_data       1   /**<\brief From SETUP to the end of DATA stage.*/
+#define usbd_lat_status     2   /**<\brief From the end of DATA stage, or from SETUP if there is no
+                                 * DATA stage, to the end of STATUS stage.*/
+#define usbd_lat_ctl_count  3
+/** @} */
+
+/**\brief Log-scaled latency histogram
+ * \details Bin 0 counts durations below \f$2^{SHIFT+1}\f$ clock ticks, bin N counts durations
+ * from \f$2^{SHIFT+N}\f$ to \f$2^{SHIFT+N+1}\f$. The last bin also counts all longer ones.*/
+typedef struct {
+    uint32_t    bin[USBD_LAT_BINS]; /**<\brief Counters.*/
+    uint32_t    max;                /**<\brief Longest duration in clock ticks.*/
+} usbd_lat_histo;
+
+/**\brief Latency histograms collected by the core.*/
+typedef struct {
+    usbd_lat_histo  ctl[usbd_lat_ctl_count];        /**<\brief Control transfers by the
+                                                     * \ref USBD_LAT_CTL "stage". Stages are
+                                                     * timed between the event arrivals.*/
+    usbd_lat_histo  ep[8];                          /**<\brief Endpoint callbacks. Control endpoint
+                                                     * 0 is counted by \p ctl only.*/
+    usbd_lat_histo  evt[usbd_evt_count];            /**<\brief Event callbacks.*/
+} usbd_latency_buf;
+
+/**\brief Latency histograms. May be read at runtime.
+ * \details Shared by all devices. Counts may be lost if the devices are polled from the interrupts
+ * with different priorities.*/
+extern usbd_latency_buf usbd_latency;
+
+/**\brief Clears the latency histograms
+ * \details Also starts the DWT cycle counter if it is used as the latency clock.
+ * Should be called once before \ref usbd_enable.
+ */
+void usbd_lat_reset(void);
+
+/**\brief Adds duration to the latency histogram
+ * \param h histogram
+ * \param d duration in clock ticks
+ */
+inline static void usbd_lat_bin(usbd_lat_histo *h, uint32_t d) {
+    uint32_t _b = 31 - __builtin_clz((d >> USBD_LAT_SHIFT) | 1);
+    if (_b >= USBD_LAT_BINS) _b = USBD_LAT_BINS - 1;
+    h->bin[_b]++;
+    if (d > h->max) h->max = d;
+}
+
+/**\brief Adds duration from the start until now to the latency histogram
+ * \param h histogram
+ * \param start \ref USBD_LAT_CLOCK value at the start
+ */
+inline static void usbd_lat_add(usbd_lat_histo *h, uint32_t start) {
+    usbd_lat_bin(h, USBD_LAT_CLOCK() - start);
+}
+
+#define usbd_lat_clock()            USBD_LAT_CLOCK()
+#define usbd_lat_put(kind, idx, start) usbd_lat_add(&usbd_latency.kind[idx], start)
+#else
+#define usbd_lat_clock()            0
+#define usbd_lat_put(kind, idx, start) ((void)(idx), (void)(start))
+#endif
+
+#if defined(USBD_SCHED)
+/**\brief Registers periodic job in the frame scheduler
+ * \details Job callback is called with \ref usbd_evt_sof event every \p interval frames while
+ * the device is configured. All jobs due in the same frame are run in one batch. Periods due while
+ * the device is not configured are skipped.
+ * \param dev usb device \ref _usbd_device
+ * \param job job storage. Must be valid until \ref usbd_sched_remove.
+ * \param ep endpoint passed to the callback
+ * \param interval period in frames, 1 to 2047
+ * \param callback job callback \ref usbd_evt_callback
+ * \note Should be called in the same context where \ref usbd_poll is called.
+ */
+void usbd_sched_add(usbd_device *dev, usbd_sched_job *job, uint8_t ep, uint16_t interval,
+                    usbd_evt_callback callback);
+
+/**\brief Removes job from the frame scheduler
+ * \param dev usb device \ref _usbd_device
+ * \param job registered job
+ * \note May be called from the job callback, also for the other job of the same batch.
+ */
+void usbd_sched_remove(usbd_device *dev, usbd_sched_job *job);
+
+/**\brief Runs the frame scheduler
+ * \details Samples the driver frame number and runs the jobs due in the elapsed frames. The core
+ * calls it on every SOF event. With \ref USBD_SOF_DISABLED call it from the main loop instead, so
+ * SOF interrupts stay masked. A job runs once per call even if it is due several times.
+ * \param dev usb device \ref _usbd_device
+ */
+void usbd_sched_poll(usbd_device *dev);
+#endif
+
+#if defined(USBD_BW_CHECK)
+#if !defined(USBD_BW_EPS)
+#define USBD_BW_EPS         16
+#endif
+
+/**\anchor USBD_BW_STATUS
+ * \name Bandwidth check status flags
+ * @{ */
+#define USBD_BW_OVER_FRAME  (1 << 0)    /**<\brief Periodic endpoints exceed the frame budget.*/
+#define USBD_BW_OVER_BUF    (1 << 1)    /**<\brief Endpoints exceed the driver buffer capacity.*/
+#define USBD_BW_BAD_DESC    (1 << 2)    /**<\brief Broken configuration descriptor.*/
+/** @} */
+
+/**\brief Endpoint bandwidth and buffer demand.*/
+typedef struct {
+    uint8_t     ep;         /**<\brief Endpoint address.*/
+    uint8_t     type;       /**<\brief Endpoint type and sync attributes.*/
+    uint8_t     intf;       /**<\brief Interface number.*/
+    uint8_t     alt;        /**<\brief Alternate setting.*/
+    uint16_t    size;       /**<\brief Maximum payload per (micro)frame.*/
+    uint16_t    frame;      /**<\brief Worst-case bus bytes per (micro)frame including the protocol
+                             * overhead. 0 for the non-periodic endpoints.*/
+    uint16_t    buf;        /**<\brief Buffer bytes required by the driver.*/
+} usbd_bw_ep;
+
+/**\brief Bandwidth check report.*/
+typedef struct {
+    usbd_bw_ep  ep[USBD_BW_EPS];    /**<\brief Endpoints in the descriptor order.*/
+    uint8_t     count;              /**<\brief Number of the reported endpoints.*/
+    uint8_t     status;             /**<\brief \ref USBD_BW_STATUS flags.*/
+    uint32_t    frame;              /**<\brief Worst-case periodic bus bytes per (micro)frame.*/
+    uint16_t    budget;             /**<\brief Periodic bus bytes per (micro)frame allowed by the spec.*/
+    uint32_t    buf;                /**<\brief Worst-case endpoint buffer bytes.*/
+} usbd_bw_report;
+
+/**\brief Checks periodic bandwidth and endpoint buffers of the configuration
+ * \details Every interrupt and isochronous endpoint is counted as one transaction (or high bandwidth
+ * transactions at high speed) in every (micro)frame, because the host may schedule all of them in the
+ * same one. Alternate settings of the interface are exclusive, so the heaviest one is counted.
+ * Budget is 90% of the full speed frame or 80% of the high speed microframe. Isochronous endpoints
+ * need a double buffer.
+ * \param config configuration descriptor with all subordinate descriptors
+ * \param len length of the descriptor data. Descriptor is not read beyond it and shorter data than
+ * wTotalLength is reported as \ref USBD_BW_BAD_DESC
+ * \param hs high speed device
+ * \param bufsize driver buffer capacity in bytes. 0 disables the buffer check.
+ * \param rep report. May be NULL.
+ * \return \ref USBD_BW_STATUS flags. 0 if configuration fits.
+ */
+uint8_t usbd_bw_check(const void *config, uint16_t len, bool hs, uint16_t bufsize, usbd_bw_report *rep);
+#endif
+
+#if defined(USBD_CONST_CFG)
+/**\brief Initializes device structure with the constant configuration
+ * \param dev USB device that will be initialized
+ * \param cfg Pointer to the device configuration \ref usbd_config
+ * \param ep0size Control endpoint 0 size
+ * \param buffer Pointer to control request data buffer (32-bit aligned)
+ * \param bsize Size of the data buffer
+ */
+inline static void usbd_init_cfg(usbd_device *dev, const usbd_config *cfg,
+                                 const uint8_t ep0size, uint32_t *buffer, const uint16_t bsize) {
+    dev->cfg = cfg;
+    dev->status.ep0size = ep0size;
+    dev->status.data_ptr = buffer;
+    dev->status.data_buf = buffer;
+    dev->status.data_maxsize = bsize - __builtin_offsetof(usbd_ctlreq, data);
+}
+#elif defined(USBD_DRIVER_CTX)
+/**\brief Initializes device structure with the context driver
+ * \param dev USB device that will be initialized
+ * \param drv Pointer to hardware driver
+ * \param base Peripheral base address of the instance
+ * \param ep0size Control endpoint 0 size
+ * \param buffer Pointer to control request data buffer (32-bit aligned)
+ * \param bsize Size of the data buffer
+ * \note Only the OTG FS driver of the STM32F405-F439 and STM32F411 has the context call table.
+ * usb.h defines it as usbd_hw and the base of the selected core as usbd_hw_base.
+ */
+inline static void usbd_init_ctx(usbd_device *dev, const struct usbd_driver_ctx *drv, void *base,
+                                 const uint8_t ep0size, uint32_t *buffer, const uint16_t bsize) {
+    dev->driver = drv;
+    dev->base = base;
+    dev->status.ep0size = ep0size;
+    dev->status.data_ptr = buffer;
+    dev->status.data_buf = buffer;
+    dev->status.data_maxsize = bsize - __builtin_offsetof(usbd_ctlreq, data);
+}
+#else
 /**\brief Initializes device structure
  * \param dev USB device that will be initialized
  * \param drv Pointer to hardware driver
@@ -350,6 +881,7 @@ inline static void usbd_init(usbd_device *dev, const struct usbd_driver *drv,
     dev->status.data_buf = buffer;
     dev->status.data_maxsize = bsize - __builtin_offsetof(usbd_ctlreq, data);
 }
+#endif
 
 /**\brief Polls USB for events
  * \param dev Pointer to device structure
@@ -357,6 +889,7 @@ inline static void usbd_init(usbd_device *dev, const struct usbd_driver *drv,
  */
 void usbd_poll(usbd_device *dev);
 
+#if !defined(USBD_CONST_CFG)
 /**\brief Register callback for all control requests
  * \param dev usb device \ref _usbd_device
  * \param callback user control callback \ref usbd_ctl_callback
@@ -380,13 +913,32 @@ inline static void usbd_reg_config(usbd_device *dev, usbd_cfg_callback callback)
 inline static void usbd_reg_descr(usbd_device *dev, usbd_dsc_callback callback) {
     dev->descriptor_callback = callback;
 }
+#endif
+
+#if defined(USBD_ALTSETTINGS) && !defined(USBD_CONST_CFG)
+/**\brief Register callback for SET_INTERFACE control request
+ * \details Core tracks the alternate setting of every interface and reconfigures endpoints of the
+ * interface on SET_INTERFACE by the configuration descriptor. Endpoints of the alternate setting 0
+ * are configured by the \ref usbd_cfg_callback as usual. Requests handled by the
+ * \ref usbd_ctl_callback are not processed by the core.
+ * \note Endpoint numbers of the alternate settings must not be used by other interfaces, because
+ * \ref usbd_hw_ep_deconfig disables both directions. SET_INTERFACE of such an interface is stalled.
+ * \note C drivers place the endpoint buffers into the first free gap, so buffers of the
+ * deconfigured endpoints are reused. Assembly drivers reuse them only if they were allocated last.
+ * \param dev usb device \ref _usbd_device
+ * \param callback pointer to user \ref usbd_alt_callback
+ */
+inline static void usbd_reg_altsetting(usbd_device *dev, usbd_alt_callback callback) {
+    dev->alt_callback = callback;
+}
+#endif
 
 /**\brief Configure endpoint
  * \param dev dev usb device \ref _usbd_device
  * \copydetails usbd_hw_ep_config
  */
 inline static bool usbd_ep_config(usbd_device *dev, uint8_t ep, uint8_t eptype, uint16_t epsize) {
-    return dev->driver->ep_config(ep, eptype, epsize);
+    return usbd_hw_call(dev, ep_config, ep, eptype, epsize);
 }
 
 /**\brief Deconfigure endpoint
@@ -394,7 +946,7 @@ inline static bool usbd_ep_config(usbd_device *dev, uint8_t ep, uint8_t eptype,
  * \copydetails usbd_hw_ep_deconfig
  */
 inline static void usbd_ep_deconfig(usbd_device *dev, uint8_t ep) {
-    dev->driver->ep_deconfig(ep);
+    usbd_hw_call(dev, ep_deconfig, ep);
 }
 
 /**\brief Register endpoint callback
@@ -406,6 +958,7 @@ inline static void usbd_reg_endpoint(usbd_device *dev, uint8_t ep, usbd_evt_call
     dev->endpoint[ep & 0x07] = callback;
 }
 
+#if !defined(USBD_CONST_CFG)
 /**\brief Registers event callback
  * \param dev dev usb device \ref _usbd_device
  * \param evt device \ref USB_EVENTS "event" wants to be registered
@@ -414,13 +967,17 @@ inline static void usbd_reg_endpoint(usbd_device *dev, uint8_t ep, usbd_evt_call
 inline static void usbd_reg_event(usbd_device *dev, uint8_t evt, usbd_evt_callback callback) {
     dev->events[evt] = callback;
 }
+#endif
 
 /**\brief Write data to endpoint
  * \param dev dev usb device \ref _usbd_device
  * \copydetails usbd_hw_ep_write
  */
 inline static int32_t usbd_ep_write(usbd_device *dev, uint8_t ep, void *buf, uint16_t blen) {
-    return dev->driver->ep_write(ep, buf, blen);
+    int32_t _t = usbd_hw_call(dev, ep_write, ep, buf, blen);
+    usbd_trace_put(dev, usbd_trc_write, ep, _t);
+    usbd_stats_data(dev, ep, _t);
+    return _t;
 }
 
 /**\brief Read data from endpoint
@@ -428,7 +985,10 @@ inline static int32_t usbd_ep_write(usbd_device *dev, uint8_t ep, void *buf, uin
  * \copydetails usbd_hw_ep_read
  */
 inline static int32_t usbd_ep_read(usbd_device *dev, uint8_t ep, void *buf, uint16_t blen) {
-    return dev->driver->ep_read(ep, buf, blen);
+    int32_t _t = usbd_hw_call(dev, ep_read, ep, buf, blen);
+    usbd_trace_put(dev, usbd_trc_read, ep, _t);
+    usbd_stats_data(dev, ep, _t);
+    return _t;
 }
 
 /**\brief Stall endpoint
@@ -436,7 +996,8 @@ inline static int32_t usbd_ep_read(usbd_device *dev, uint8_t ep, void *buf, uint
  * \param ep endpoint address
  */
 inline static void usbd_ep_stall(usbd_device *dev, uint8_t ep) {
-    dev->driver->ep_setstall(ep, 1);
+    usbd_stats_stall(dev, ep);
+    usbd_hw_call(dev, ep_setstall, ep, 1);
 }
 
 /**\brief Unstall endpoint
@@ -444,7 +1005,7 @@ inline static void usbd_ep_stall(usbd_device *dev, uint8_t ep) {
  * \param ep endpoint address
  */
 inline static void usbd_ep_unstall(usbd_device *dev, uint8_t ep) {
-    dev->driver->ep_setstall(ep, 0);
+    usbd_hw_call(dev, ep_setstall, ep, 0);
 }
 
 /**\brief Enables or disables USB hardware
@@ -452,7 +1013,7 @@ inline static void usbd_ep_unstall(usbd_device *dev, uint8_t ep) {
  * \param enable Enables USB when TRUE disables otherwise
  */
 inline static void usbd_enable(usbd_device *dev, bool enable) {
-    dev->driver->enable(enable);
+    usbd_hw_call(dev, enable, enable);
 }
 
 /**\brief Connects or disconnects USB hardware to/from usb host
@@ -461,13 +1022,43 @@ inline static void usbd_enable(usbd_device *dev, bool enable) {
  * \return lanes connection status. \ref USB_LANES_STATUS
  */
 inline static uint8_t usbd_connect(usbd_device *dev, bool connect) {
-    return dev->driver->connect(connect);
+    return usbd_hw_call(dev, connect, connect);
+}
+
+/**\brief Starts or stops remote wakeup resume signalling
+ * \details Resume signalling must be started in suspended state and stopped after 1 to 15 ms.
+ * USB device event callbacks will not be called while the signalling is active.
+ * \param dev dev usb device \ref _usbd_device
+ * \param resume Starts resume signalling if TRUE, stops otherwise
+ * \return FALSE if remote wakeup is not enabled by the host or the device is not suspended
+ * \note Configuration descriptor must contain \ref USB_CFG_ATTR_REMOTEWAKEUP attribute. The core
+ * stalls SET_FEATURE(DEVICE_REMOTE_WAKEUP) otherwise.
+ */
+inline static bool usbd_remote_wakeup(usbd_device *dev, bool resume) {
+    if (resume) {
+        if (!dev->status.remote_wakeup || !dev->status.suspended) return false;
+        dev->status.suspended = 0;
+    }
+    usbd_hw_call(dev, resume, resume);
+    return true;
+}
+
+/**\brief Converts BESL value to the host resume duration.
+ * \param besl BESL value passed with \ref usbd_evt_l1sleep event
+ * \return time in microseconds the host drives resume signal after L1 exit. The device must
+ * be ready to operate before this time is expired.
+ */
+inline static uint16_t usbd_lpm_besl_us(uint8_t besl) {
+    besl &= 0x0F;
+    if (besl > 5) return (besl - 5) * 1000;
+    if (besl > 1) return besl * 100;
+    return 125 + besl * 25;
 }
 
 /**\brief Retrieves status and capabilities.
  * \return current HW status, enumeration speed and capabilities \ref USBD_HW_CAPS */
 inline static uint32_t usbd_getinfo(usbd_device *dev) {
-    return dev->driver->getinfo();
+    return usbd_hw_call(dev, getinfo);
 }
 
 #endif //(__ASSEMBLER__)
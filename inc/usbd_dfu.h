@@ -0,0 +1,126 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _USBD_DFU_H_
+#define _USBD_DFU_H_
+#if defined(__cplusplus)
+    extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "usbd_core.h"
+#include "usb_dfu.h"
+
+/**\addtogroup USBD_DFU USB DFU function
+ * \brief DFU 1.1 function with the pipelined erase and program
+ * \details Memory is accessed through the \ref usbd_dfu_backend. Backend operations are
+ * asynchronous: they are started by the function and polled by the \ref usbd_dfu_backend::status
+ * on every DFU_GETSTATUS request, and the remaining time reported by backend is returned to
+ * host as bwPollTimeout. When the block is programmed, erase of the page following the erased
+ * area is started in advance, so it runs while host transfers the next block.
+ * \note The pipelining gives effect only if USB code is not stalled by the flash erase, i.e.
+ * code runs from RAM or another flash bank.
+ * \note Erase in advance may erase one page following the downloaded image.
+ * \note Block numbers are mapped to addresses as start + wBlockNum * transfer size.
+ * DfuSe address commands are not supported.
+ * @{ */
+
+/**\brief DFU memory backend.
+ * \details All operations return DFU status code. Timeouts are in milliseconds.*/
+typedef struct {
+    uint32_t    start;          /**<\brief Start address of the memory.*/
+    uint32_t    size;           /**<\brief Size of the memory.*/
+    uint32_t    page_size;      /**<\brief Erase page size.*/
+    /**\brief Starts erase of the page.
+     * \param addr page address
+     * \param[out] timeout expected erase time
+     */
+    uint8_t     (*erase)(uint32_t addr, uint32_t *timeout);
+    /**\brief Starts programming of the data
+     * \param addr address to program
+     * \param data pointer to data. Valid until operation completes.
+     * \param len data length
+     * \param[out] timeout expected programming time
+     */
+    uint8_t     (*program)(uint32_t addr, const void *data, uint16_t len, uint32_t *timeout);
+    /**\brief Returns status of the last operation
+     * \param[out] timeout remaining time of the operation. 0 if operation is completed.
+     */
+    uint8_t     (*status)(uint32_t *timeout);
+    /**\brief Reads memory for upload
+     * \param addr address to read
+     * \param buf pointer to buffer
+     * \param len number of bytes to read
+     * \return number of bytes was read
+     */
+    uint16_t    (*read)(uint32_t addr, void *buf, uint16_t len);
+    /**\brief Starts manifestation. Optional.
+     * \param[out] timeout expected manifestation time
+     */
+    uint8_t     (*manifest)(uint32_t *timeout);
+} usbd_dfu_backend;
+
+typedef struct _usbd_dfu usbd_dfu;
+
+/**\brief DFU_DETACH callback
+ * \param dfu pointer to DFU function
+ * \param timeout detach timeout from the request
+ */
+typedef void (*usbd_dfu_detach_callback)(usbd_dfu *dfu, uint16_t timeout);
+
+/**\brief Represents DFU function data.*/
+struct _usbd_dfu {
+    usbd_device                 *dev;           /**<\brief USB device.*/
+    const usbd_dfu_backend      *backend;       /**<\brief Memory backend.*/
+    uint8_t                     *buf;           /**<\brief Block buffer.*/
+    usbd_dfu_detach_callback    detach_callback;/**<\brief DFU_DETACH handler.*/
+    uint32_t                    blk_addr;       /**<\brief Address of the pending block.*/
+    uint32_t                    erased_start;   /**<\brief Start of the erased area.*/
+    uint32_t                    erased_end;     /**<\brief End of the erased area.*/
+    uint16_t                    blk_len;        /**<\brief Length of the pending block.*/
+    uint16_t                    xfer_size;      /**<\brief Transfer size (wTransferSize).*/
+    uint8_t                     state;          /**<\brief DFU state.*/
+    uint8_t                     status;         /**<\brief DFU status.*/
+    uint8_t                     pending;        /**<\brief Block is waiting to be programmed.*/
+    uint8_t                     manifested;     /**<\brief Manifestation is started.*/
+    uint8_t                     intf;           /**<\brief DFU interface number.*/
+};
+
+/**\brief Initializes DFU function in DFU mode
+ * \param dfu DFU function
+ * \param dev USB device
+ * \param intf DFU interface number
+ * \param backend memory backend
+ * \param buf block buffer. Must hold xfer_size bytes.
+ * \param xfer_size transfer size. Must fit into the control buffer of the device.
+ */
+void usbd_dfu_init(usbd_dfu *dfu, usbd_device *dev, uint8_t intf,
+                   const usbd_dfu_backend *backend, void *buf, uint16_t xfer_size);
+
+/**\brief Processes DFU class requests
+ * \details Should be called from \ref usbd_ctl_callback
+ * \param dfu DFU function
+ * \param req control request
+ * \return usbd_fail if request is not belongs to this function or is not supported
+ */
+usbd_respond usbd_dfu_control(usbd_dfu *dfu, usbd_ctlreq *req);
+
+/** @} */
+
+#if defined(__cplusplus)
+    }
+#endif
+#endif //_USBD_DFU_H_
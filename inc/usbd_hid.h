@@ -0,0 +1,134 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _USBD_HID_H_
+#define _USBD_HID_H_
+#if defined(__cplusplus)
+    extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "usbd_core.h"
+#include "usb_hid.h"
+
+/**\addtogroup USBD_HID USB HID function
+ * \brief HID function with the input report queues, idle rate and report coalescing
+ * \details Each input report ID has its own bounded queue. Queued reports are sent through the
+ * interrupt IN endpoint, report IDs with pending reports are served in round robin order.
+ * A new report is merged with the newest queued one if all fields excepting relative axes are
+ * equal and the sums of relative axes fit the field. So the motion is accumulated while host
+ * polls slower than application produces reports, but no button edges are lost.
+ * Idle rate is timed by the frame number, last report is repeated by \ref usbd_hid_poll with
+ * relative axes zeroed.
+ * \note All functions, excepting \ref usbd_hid_control, should be called in the same context
+ * where \ref usbd_poll is called or with USB interrupt disabled.
+ * \note Idle rate timing assumes full speed 1ms frames.
+ * @{ */
+
+/**\brief Input report and its queue.
+ * \details Fields up to \ref usbd_hid_report::buf are set by application.
+ * Offsets of the relative axes are counted from the start of report data, excluding report ID.*/
+typedef struct {
+    uint8_t     id;         /**<\brief Report ID or 0 if report IDs are not used.*/
+    uint8_t     size;       /**<\brief Report data size, excluding report ID.*/
+    uint8_t     depth;      /**<\brief Queue depth.*/
+    uint32_t    rel8;       /**<\brief Bitmap of the offsets of signed 8-bit relative axes.*/
+    uint32_t    rel16;      /**<\brief Bitmap of the offsets of signed 16-bit relative axes.*/
+    uint8_t     *buf;       /**<\brief Queue storage. Must hold (depth + 1) * size bytes. Last slot
+                             * holds the last sent report.*/
+    uint8_t     head;       /**<\brief Index of the oldest queued report.*/
+    uint8_t     count;      /**<\brief Number of queued reports.*/
+    uint8_t     idle;       /**<\brief Idle rate in 4ms units. 0 means infinite.*/
+    uint8_t     sent;       /**<\brief Report was sent since endpoint is configured.*/
+    uint16_t    sent_frame; /**<\brief Frame number when report was sent last time.*/
+} usbd_hid_report;
+
+typedef struct _usbd_hid usbd_hid;
+
+/**\brief SET_REPORT callback
+ * \param hid pointer to HID function
+ * \param type report type \ref USB_HID_REPORT_OUT or \ref USB_HID_REPORT_FEATURE
+ * \param id report ID
+ * \param data pointer to report as received from host
+ * \param len report length
+ * \return usbd_ack if report is accepted
+ */
+typedef usbd_respond (*usbd_hid_setreport_callback)(usbd_hid *hid, uint8_t type, uint8_t id,
+                                                    const uint8_t *data, uint16_t len);
+
+/**\brief Represents HID function data.*/
+struct _usbd_hid {
+    usbd_device                 *dev;           /**<\brief USB device.*/
+    usbd_hid_report             *reports;       /**<\brief Input reports.*/
+    usbd_hid_setreport_callback setreport_callback; /**<\brief SET_REPORT handler.*/
+    uint8_t                     nreports;       /**<\brief Number of input reports.*/
+    uint8_t                     rr;             /**<\brief Report to be checked first.*/
+    uint8_t                     tx_busy;        /**<\brief IN transfer is in progress or endpoint
+                                                 * is not configured.*/
+    uint8_t                     protocol;       /**<\brief Protocol mode selected by host.*/
+    uint8_t                     intf;           /**<\brief HID interface number.*/
+    uint8_t                     ep;             /**<\brief Interrupt IN endpoint address.*/
+    uint8_t                     ep_size;        /**<\brief Size of the IN endpoint.*/
+};
+
+/**\brief Initializes HID function
+ * \param hid HID function
+ * \param dev USB device
+ * \param intf HID interface number
+ * \param ep interrupt IN endpoint address
+ * \param ep_size IN endpoint size (up to 64 bytes)
+ * \param reports array of input reports
+ * \param nreports number of input reports
+ */
+void usbd_hid_init(usbd_hid *hid, usbd_device *dev, uint8_t intf, uint8_t ep, uint8_t ep_size,
+                   usbd_hid_report *reports, uint8_t nreports);
+
+/**\brief Configures or deconfigures HID endpoint
+ * \details Should be called from \ref usbd_cfg_callback. Flushes queues and resets idle rates
+ * and protocol.
+ * \param hid HID function
+ * \param enable configures endpoint if TRUE, deconfigures otherwise
+ */
+void usbd_hid_enable(usbd_hid *hid, bool enable);
+
+/**\brief Processes HID class requests
+ * \details Should be called from \ref usbd_ctl_callback
+ * \param hid HID function
+ * \param req control request
+ * \return usbd_fail if request is not belongs to this function or is not supported
+ */
+usbd_respond usbd_hid_control(usbd_hid *hid, usbd_ctlreq *req);
+
+/**\brief Queues input report
+ * \param hid HID function
+ * \param id report ID
+ * \param report pointer to report data, excluding report ID
+ * \return TRUE if report is queued or merged, FALSE if queue is full
+ */
+bool usbd_hid_send(usbd_hid *hid, uint8_t id, const void *report);
+
+/**\brief Serves idle rate
+ * \details Should be called periodically, at least once per 4ms, e.g. from main loop or SOF event.
+ * \param hid HID function
+ */
+void usbd_hid_poll(usbd_hid *hid);
+
+/** @} */
+
+#if defined(__cplusplus)
+    }
+#endif
+#endif //_USBD_HID_H_
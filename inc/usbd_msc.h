@@ -0,0 +1,154 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _USBD_MSC_H_
+#define _USBD_MSC_H_
+#if defined(__cplusplus)
+    extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "usbd_core.h"
+#include "usb_msc.h"
+
+/**\addtogroup USBD_MSC USB MSC function
+ * \brief Mass Storage Bulk-Only Transport function with the double-buffered block streaming
+ * \details SCSI transparent command set subset for the single LUN block device. READ(10) and
+ * WRITE(10) data is streamed through two block buffers: while one block is transferred through
+ * the bulk endpoint, the backend reads or writes the other one. While both buffers are busy
+ * the endpoints are NAKed, never stalled.
+ * The bulk IN endpoint is configured as double-buffered if the bulk endpoints have different
+ * numbers.
+ * \note All functions, excepting \ref usbd_msc_control, should be called in the same context
+ * where \ref usbd_poll is called or with USB interrupt disabled.
+ * @{ */
+
+#if !defined(USBD_MSC_VENDOR)
+/**\brief INQUIRY vendor identification. 8 characters.*/
+#define USBD_MSC_VENDOR     "libusb  "
+#endif
+
+#if !defined(USBD_MSC_PRODUCT)
+/**\brief INQUIRY product identification. 16 characters.*/
+#define USBD_MSC_PRODUCT    "Mass Storage    "
+#endif
+
+#if !defined(USBD_MSC_REVISION)
+/**\brief INQUIRY product revision level. 4 characters.*/
+#define USBD_MSC_REVISION   "1.00"
+#endif
+
+/**\name Backend operation status
+ * @{ */
+#define USBD_MSC_OK         0x00    /**<\brief Operation completed.*/
+#define USBD_MSC_BUSY       0x01    /**<\brief Operation in progress.*/
+#define USBD_MSC_ERROR      0x02    /**<\brief Operation failed.*/
+/** @} */
+
+/**\brief MSC block device backend.
+ * \details Read and write operations may be asynchronous. The function polls the
+ * \ref usbd_msc_backend::status until operation completes.*/
+typedef struct {
+    uint32_t    block_count;    /**<\brief Number of blocks.*/
+    uint16_t    block_size;     /**<\brief Block size. Must be a multiple of the endpoint size.*/
+    /**\brief Returns TRUE if medium is present. Optional.*/
+    bool        (*ready)(void);
+    /**\brief Starts block reading
+     * \param lba block address
+     * \param buf buffer for the block
+     * \return \ref USBD_MSC_OK, \ref USBD_MSC_BUSY or \ref USBD_MSC_ERROR
+     */
+    uint8_t     (*read)(uint32_t lba, void *buf);
+    /**\brief Starts block writing. Optional, medium is write protected if not set.
+     * \param lba block address
+     * \param buf block data. Valid until operation completes.
+     * \return \ref USBD_MSC_OK, \ref USBD_MSC_BUSY or \ref USBD_MSC_ERROR
+     */
+    uint8_t     (*write)(uint32_t lba, const void *buf);
+    /**\brief Returns status of the last operation
+     * \return \ref USBD_MSC_OK, \ref USBD_MSC_BUSY or \ref USBD_MSC_ERROR
+     */
+    uint8_t     (*status)(void);
+} usbd_msc_backend;
+
+/**\brief Represents MSC function data.*/
+typedef struct {
+    usbd_device             *dev;       /**<\brief USB device.*/
+    const usbd_msc_backend  *backend;   /**<\brief Block device backend.*/
+    uint8_t                 *buf;       /**<\brief Two block buffers.*/
+    const uint8_t           *tx_ptr;    /**<\brief Command response to be sent.*/
+    struct usb_msc_cbw      cbw;        /**<\brief Current command block wrapper.*/
+    uint32_t                residue;    /**<\brief Data residue of the current command.*/
+    uint32_t                lba;        /**<\brief Next block address for the backend.*/
+    uint16_t                io_left;    /**<\brief Blocks left for the backend.*/
+    uint16_t                usb_left;   /**<\brief Blocks left for the bulk endpoint.*/
+    uint16_t                usb_off;    /**<\brief Offset in the block being transferred.*/
+    uint16_t                tx_left;    /**<\brief Bytes of response left to send.*/
+    uint8_t                 head;       /**<\brief Buffer transferred by the bulk endpoint.*/
+    uint8_t                 tail;       /**<\brief Buffer processed by the backend.*/
+    uint8_t                 count;      /**<\brief Number of buffers holding the block.*/
+    uint8_t                 io_busy;    /**<\brief Backend operation is in progress.*/
+    uint8_t                 rx_hold;    /**<\brief OUT packet is holded.*/
+    uint8_t                 state;      /**<\brief Transport state.*/
+    uint8_t                 status;     /**<\brief Command status for CSW.*/
+    uint8_t                 sense_key;  /**<\brief SCSI sense key.*/
+    uint8_t                 asc;        /**<\brief SCSI additional sense code.*/
+    uint8_t                 intf;       /**<\brief MSC interface number.*/
+    uint8_t                 rx_ep;      /**<\brief Bulk OUT endpoint address.*/
+    uint8_t                 tx_ep;      /**<\brief Bulk IN endpoint address.*/
+    uint8_t                 ep_size;    /**<\brief Size of the bulk endpoints.*/
+} usbd_msc;
+
+/**\brief Initializes MSC function
+ * \param msc MSC function
+ * \param dev USB device
+ * \param intf MSC interface number
+ * \param rx_ep bulk OUT endpoint address
+ * \param tx_ep bulk IN endpoint address
+ * \param ep_size bulk endpoints size
+ * \param backend block device backend
+ * \param buf pointer to buffer for two blocks
+ */
+void usbd_msc_init(usbd_msc *msc, usbd_device *dev, uint8_t intf, uint8_t rx_ep, uint8_t tx_ep,
+                   uint8_t ep_size, const usbd_msc_backend *backend, void *buf);
+
+/**\brief Configures or deconfigures MSC endpoints
+ * \details Should be called from \ref usbd_cfg_callback
+ * \param msc MSC function
+ * \param enable configures endpoints if TRUE, deconfigures otherwise
+ */
+void usbd_msc_enable(usbd_msc *msc, bool enable);
+
+/**\brief Processes MSC class requests and clearing of the bulk endpoints halt
+ * \details Should be called from \ref usbd_ctl_callback
+ * \param msc MSC function
+ * \param req control request
+ * \return usbd_fail if request is not belongs to this function or is not supported
+ */
+usbd_respond usbd_msc_control(usbd_msc *msc, usbd_ctlreq *req);
+
+/**\brief Polls the backend and resumes NAKed transfers
+ * \details Should be called periodically if backend operations are asynchronous.
+ * \param msc MSC function
+ */
+void usbd_msc_poll(usbd_msc *msc);
+
+/** @} */
+
+#if defined(__cplusplus)
+    }
+#endif
+#endif //_USBD_MSC_H_
@@ -0,0 +1,150 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _USBD_TMC_H_
+#define _USBD_TMC_H_
+#if defined(__cplusplus)
+    extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "usbd_core.h"
+#include "usb_tmc.h"
+
+/**\addtogroup USBD_TMC USB TMC function
+ * \brief USBTMC and USB488 function with the streaming message transfers
+ * \details Bulk headers are parsed across the packet boundaries. DEV_DEP_MSG_OUT data is passed
+ * to \ref usbd_tmc::out_callback packet by packet. Response message size is announced by
+ * \ref usbd_tmc_respond and its content is pulled by \ref usbd_tmc::in_callback packet by packet
+ * as host requests it, so response of any size is never buffered whole.
+ * Abort and clear requests reset the transfer state without touching the endpoints.
+ * \note All functions, excepting \ref usbd_tmc_control, should be called in the same context
+ * where \ref usbd_poll is called or with USB interrupt disabled.
+ * @{ */
+
+#if !defined(USBD_TMC_USB488_CAPS)
+/**\brief USB488 interface capabilities reported by GET_CAPABILITIES.*/
+#define USBD_TMC_USB488_CAPS    (USB_TMC_USB488_CAP_488_2 | USB_TMC_USB488_CAP_REN)
+#endif
+
+#if !defined(USBD_TMC_USB488_DEVCAPS)
+/**\brief USB488 device capabilities reported by GET_CAPABILITIES.*/
+#define USBD_TMC_USB488_DEVCAPS (USB_TMC_USB488_DEVCAP_RL1 | USB_TMC_USB488_DEVCAP_SCPI)
+#endif
+
+/**\name TMC events
+ * @{ */
+#define USBD_TMC_EVT_CLEAR      0x00    /**<\brief INITIATE_CLEAR. Pending response is dropped.*/
+#define USBD_TMC_EVT_ABORT_OUT  0x01    /**<\brief DEV_DEP_MSG_OUT transfer aborted.*/
+#define USBD_TMC_EVT_ABORT_IN   0x02    /**<\brief DEV_DEP_MSG_IN transfer aborted. Pending
+                                         * response is dropped.*/
+#define USBD_TMC_EVT_PULSE      0x03    /**<\brief INDICATOR_PULSE.*/
+#define USBD_TMC_EVT_LOCAL      0x04    /**<\brief USB488 GO_TO_LOCAL.*/
+#define USBD_TMC_EVT_LOCKOUT    0x05    /**<\brief USB488 LOCAL_LOCKOUT.*/
+/** @} */
+
+typedef struct _usbd_tmc usbd_tmc;
+
+/**\brief DEV_DEP_MSG_OUT data callback
+ * \param tmc pointer to TMC function
+ * \param data pointer to message data
+ * \param len length of message data
+ * \param eom TRUE if this is the last data of the message
+ */
+typedef void (*usbd_tmc_out_callback)(usbd_tmc *tmc, const uint8_t *data, uint16_t len, bool eom);
+
+/**\brief DEV_DEP_MSG_IN data producer callback
+ * \details Must fill exactly len bytes of the next response message data.
+ * \param tmc pointer to TMC function
+ * \param buf pointer to buffer
+ * \param len number of bytes to fill
+ */
+typedef void (*usbd_tmc_in_callback)(usbd_tmc *tmc, uint8_t *buf, uint16_t len);
+
+/**\brief TMC event callback
+ * \param tmc pointer to TMC function
+ * \param event TMC event
+ */
+typedef void (*usbd_tmc_evt_callback)(usbd_tmc *tmc, uint8_t event);
+
+/**\brief Represents TMC function data.*/
+struct _usbd_tmc {
+    usbd_device             *dev;           /**<\brief USB device.*/
+    usbd_tmc_out_callback   out_callback;   /**<\brief DEV_DEP_MSG_OUT data consumer.*/
+    usbd_tmc_in_callback    in_callback;    /**<\brief DEV_DEP_MSG_IN data producer.*/
+    usbd_tmc_evt_callback   evt_callback;   /**<\brief TMC events handler.*/
+    uint32_t                out_remain;     /**<\brief Bytes left in the current OUT transfer.*/
+    uint32_t                out_rxd;        /**<\brief Bytes received in the current OUT transfer.*/
+    uint32_t                in_remain;      /**<\brief Bytes left in the response message.*/
+    uint32_t                in_max;         /**<\brief Transfer size requested by host.*/
+    uint32_t                in_size;        /**<\brief Message bytes in the current IN transfer.*/
+    uint32_t                in_total;       /**<\brief Total bytes of the current IN transfer.*/
+    uint32_t                in_sent;        /**<\brief Bytes sent in the current IN transfer.*/
+    uint8_t                 hdr[sizeof(struct usb_tmc_bulk_header)]; /**<\brief Bulk header.*/
+    uint8_t                 hdr_len;        /**<\brief Received bulk header bytes.*/
+    uint8_t                 out_state;      /**<\brief Bulk OUT state.*/
+    uint8_t                 out_tag;        /**<\brief bTag of the current OUT transfer.*/
+    uint8_t                 out_eom;        /**<\brief Current OUT transfer ends the message.*/
+    uint8_t                 in_state;       /**<\brief Bulk IN state.*/
+    uint8_t                 in_tag;         /**<\brief bTag of the current IN transfer.*/
+    uint8_t                 in_zlp;         /**<\brief IN transfer should be terminated by ZLP.*/
+    uint8_t                 status_byte;    /**<\brief USB488 status byte.*/
+    uint8_t                 ren;            /**<\brief USB488 remote enable state.*/
+    uint8_t                 intf;           /**<\brief TMC interface number.*/
+    uint8_t                 rx_ep;          /**<\brief Bulk OUT endpoint address.*/
+    uint8_t                 tx_ep;          /**<\brief Bulk IN endpoint address.*/
+    uint8_t                 ep_size;        /**<\brief Size of the bulk endpoints.*/
+};
+
+/**\brief Initializes TMC function
+ * \param tmc TMC function
+ * \param dev USB device
+ * \param intf TMC interface number
+ * \param rx_ep bulk OUT endpoint address
+ * \param tx_ep bulk IN endpoint address
+ * \param ep_size bulk endpoints size (16 up to 64 bytes)
+ */
+void usbd_tmc_init(usbd_tmc *tmc, usbd_device *dev, uint8_t intf,
+                   uint8_t rx_ep, uint8_t tx_ep, uint8_t ep_size);
+
+/**\brief Configures or deconfigures TMC endpoints
+ * \details Should be called from \ref usbd_cfg_callback
+ * \param tmc TMC function
+ * \param enable configures endpoints if TRUE, deconfigures otherwise
+ */
+void usbd_tmc_enable(usbd_tmc *tmc, bool enable);
+
+/**\brief Processes USBTMC and USB488 class requests
+ * \details Should be called from \ref usbd_ctl_callback
+ * \param tmc TMC function
+ * \param req control request
+ * \return usbd_fail if request is not belongs to this function or is not supported
+ */
+usbd_respond usbd_tmc_control(usbd_tmc *tmc, usbd_ctlreq *req);
+
+/**\brief Announces response message
+ * \details Message data will be requested by \ref usbd_tmc::in_callback when host reads it.
+ * \param tmc TMC function
+ * \param size response message size
+ */
+void usbd_tmc_respond(usbd_tmc *tmc, uint32_t size);
+
+/** @} */
+
+#if defined(__cplusplus)
+    }
+#endif
+#endif //_USBD_TMC_H_
@@ -0,0 +1,183 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _USBD_UAC_H_
+#define _USBD_UAC_H_
+#if defined(__cplusplus)
+    extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "usbd_core.h"
+#include "usb_uac.h"
+
+/**\addtogroup USBD_UAC USB Audio 2.0 function
+ * \brief Asynchronous USB Audio 2.0 streaming function with explicit feedback
+ * \details Isochronous OUT (playback) and IN (capture) streams are passed through the sample
+ * ring buffers. The audio codec consumes OUT samples by \ref usbd_uac_read and produces IN
+ * samples by \ref usbd_uac_write at its own clock.
+ *
+ * Feedback value is the number of samples consumed by the codec per 1ms full-speed frame in
+ * 16.16 format.
+ * It is measured by the \ref usbd_hw_get_frameno frame counter over \f$2^{refresh}\f$ frames,
+ * smoothed and corrected by the OUT ring buffer fill error, so the host clock follows the codec
+ * clock and the buffer fill stays around the half. Difference between the measured and the
+ * nominal rate is reported as the clock drift.
+ *
+ * Both streaming interfaces have two alternate settings: zero-bandwidth alternate setting 0
+ * and streaming alternate setting 1. Endpoints are configured once by \ref usbd_uac_enable and
+ * streaming is gated by the selected alternate setting. With \ref USBD_ALTSETTINGS the core
+ * configures the streaming endpoints from the alternate setting 1 descriptors and reports the
+ * selection through \ref usbd_uac_altsetting.
+ * \note Except \ref usbd_uac_read and \ref usbd_uac_write, all functions should be called in the
+ * same context where \ref usbd_poll is called or with USB interrupt disabled. Each ring buffer has
+ * a single producer and a single consumer, so \ref usbd_uac_read and \ref usbd_uac_write may be
+ * called from the codec DMA interrupt.
+ * @{ */
+
+#if !defined(USBD_UAC_MAX_PKT)
+/**\brief Maximum isochronous data packet size.*/
+#define USBD_UAC_MAX_PKT    0x100
+#endif
+
+/**\brief UAC function configuration. May be placed in the flash memory.*/
+typedef struct {
+    uint32_t    rate;           /**<\brief Sampling rate in Hz.*/
+    uint8_t     channels;       /**<\brief Number of channels.*/
+    uint8_t     subslot;        /**<\brief Bytes per sample.*/
+    uint8_t     intf_ac;        /**<\brief Audio control interface number.*/
+    uint8_t     intf_out;       /**<\brief Playback streaming interface number.*/
+    uint8_t     intf_in;        /**<\brief Capture streaming interface number.*/
+    uint8_t     clock_id;       /**<\brief Clock source entity ID.*/
+    uint8_t     fu_id;          /**<\brief Feature unit entity ID. 0 if not used.*/
+    uint8_t     ep_out;         /**<\brief Isochronous OUT endpoint address. 0 if no playback.*/
+    uint8_t     ep_fb;          /**<\brief Feedback endpoint address. 0 if not used.*/
+    uint8_t     ep_in;          /**<\brief Isochronous IN endpoint address. 0 if no capture.*/
+    uint16_t    ep_out_size;    /**<\brief OUT endpoint size.*/
+    uint16_t    ep_in_size;     /**<\brief IN endpoint size.*/
+    uint8_t     fb_size;        /**<\brief Feedback endpoint size. 3 for 10.14 format used by
+                                 * full-speed devices, 4 for 16.16 format.*/
+    uint8_t     refresh;        /**<\brief Feedback period as a power of 2 frames.*/
+} usbd_uac_config;
+
+/**\brief Sample ring buffer.
+ * \details Buffer is empty if head equals to tail. One sample frame is always kept free.*/
+typedef struct {
+    uint8_t             *buf;       /**<\brief Buffer memory.*/
+    uint16_t            size;       /**<\brief Buffer size. Multiple of the sample frame size.*/
+    volatile uint16_t   head;       /**<\brief Write offset. Changed by the producer only.*/
+    volatile uint16_t   tail;       /**<\brief Read offset. Changed by the consumer only.*/
+    volatile uint16_t   overruns;   /**<\brief Sample frames dropped due to buffer overrun.*/
+    volatile uint16_t   underruns;  /**<\brief Sample frames missed due to buffer underrun.*/
+    volatile uint8_t    primed;     /**<\brief Consumer started after the buffer was half filled.*/
+} usbd_uac_ring;
+
+/**\brief Represents UAC function data.*/
+typedef struct {
+    usbd_device             *dev;           /**<\brief USB device.*/
+    const usbd_uac_config   *cfg;           /**<\brief Function configuration.*/
+    usbd_uac_ring           out;            /**<\brief Playback samples ring buffer.*/
+    usbd_uac_ring           in;             /**<\brief Capture samples ring buffer.*/
+    uint32_t                nominal;        /**<\brief Nominal samples per frame. 16.16.*/
+    uint32_t                measured;       /**<\brief Smoothed measured samples per frame. 16.16.*/
+    uint32_t                rate_acc;       /**<\brief Measured rate filter state.*/
+    uint32_t                feedback;       /**<\brief Last feedback value. 16.16.*/
+    volatile uint32_t       consumed;       /**<\brief Free running count of consumed samples.*/
+    uint32_t                consumed_mark;  /**<\brief Consumed samples at the period start.*/
+    uint32_t                in_acc;         /**<\brief Capture packet size fraction. 16.16.*/
+    uint16_t                fb_frame;       /**<\brief Frame number at the period start.*/
+    int16_t                 volume;         /**<\brief Feature unit volume in 1/256 dB.*/
+    uint8_t                 mute;           /**<\brief Feature unit mute.*/
+    uint8_t                 frame_size;     /**<\brief Bytes per sample frame.*/
+    uint8_t                 alt_out;        /**<\brief Playback interface alternate setting.*/
+    uint8_t                 alt_in;         /**<\brief Capture interface alternate setting.*/
+} usbd_uac;
+
+/**\brief Initializes UAC function
+ * \param uac UAC function
+ * \param dev USB device
+ * \param cfg function configuration
+ * \param out_buf playback ring buffer memory
+ * \param out_size playback ring buffer size. Multiple of the sample frame size.
+ * \param in_buf capture ring buffer memory
+ * \param in_size capture ring buffer size. Multiple of the sample frame size.
+ */
+void usbd_uac_init(usbd_uac *uac, usbd_device *dev, const usbd_uac_config *cfg,
+                   void *out_buf, uint16_t out_size, void *in_buf, uint16_t in_size);
+
+/**\brief Configures or deconfigures UAC endpoints
+ * \details Should be called from \ref usbd_cfg_callback
+ * \param uac UAC function
+ * \param enable configures endpoints if TRUE, deconfigures otherwise
+ */
+void usbd_uac_enable(usbd_uac *uac, bool enable);
+
+/**\brief Processes UAC class requests and streaming interfaces alternate settings
+ * \details Should be called from \ref usbd_ctl_callback. With \ref USBD_ALTSETTINGS alternate
+ * setting requests are left to the core.
+ * \param uac UAC function
+ * \param req control request
+ * \return usbd_fail if request is not belongs to this function or is not supported
+ */
+usbd_respond usbd_uac_control(usbd_uac *uac, usbd_ctlreq *req);
+
+#if defined(USBD_ALTSETTINGS)
+/**\brief Starts or stops streaming after the core has selected the alternate setting
+ * \details Should be called from \ref usbd_alt_callback
+ * \param uac UAC function
+ * \param intf interface number
+ * \param alt selected alternate setting
+ */
+void usbd_uac_altsetting(usbd_uac *uac, uint8_t intf, uint8_t alt);
+#endif
+
+/**\brief Updates feedback and sends feedback and capture packets
+ * \details Should be called from the \ref usbd_evt_sof event callback or from the 1 frame
+ * interval \ref usbd_sched_add "frame scheduler" job.
+ * \param uac UAC function
+ */
+void usbd_uac_sof(usbd_uac *uac);
+
+/**\brief Takes playback samples for the codec
+ * \details Missing samples are filled with silence. All requested samples are counted as
+ * consumed by the codec clock.
+ * \param uac UAC function
+ * \param buf buffer for samples
+ * \param frames number of sample frames
+ * \return number of sample frames taken from the ring buffer
+ */
+uint16_t usbd_uac_read(usbd_uac *uac, void *buf, uint16_t frames);
+
+/**\brief Puts captured samples from the codec
+ * \param uac UAC function
+ * \param buf captured samples
+ * \param frames number of sample frames
+ * \return number of sample frames put into the ring buffer
+ */
+uint16_t usbd_uac_write(usbd_uac *uac, const void *buf, uint16_t frames);
+
+/**\brief Returns the codec clock drift against the host clock
+ * \param uac UAC function
+ * \return drift in ppm. Positive if the codec clock is faster.
+ */
+int32_t usbd_uac_drift(usbd_uac *uac);
+
+/** @} */
+
+#if defined(__cplusplus)
+    }
+#endif
+#endif //_USBD_UAC_H_
@@ -0,0 +1,518 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "usb.h"
+#include "usbd_cdc_acm.h"
+
+/* keeps buffer accesses on the right side of the index update */
+#define _BARRIER()  __asm__ volatile ("" ::: "memory")
+
+#define CDC_ACM_MAX_PKT     0x40
+
+#define CDC_ACM_NO_BLK      0xFF
+
+/* enabled ports of all devices. Endpoint callbacks has no user context, so the port is found
+ * by the device and the endpoint number */
+static usbd_cdc_acm *cdc_acm_ports;
+
+inline static uint16_t ring_count(const usbd_ring *r) {
+    return (uint16_t)(r->head - r->tail);
+}
+
+inline static uint16_t ring_free(const usbd_ring *r) {
+    return (uint16_t)(r->mask + 1 - ring_count(r));
+}
+
+/* copies data to the ring head and advances head */
+static void ring_put(usbd_ring *r, const uint8_t *data, uint16_t len) {
+    uint16_t _h = r->head & r->mask;
+    uint16_t _s = r->mask + 1 - _h;
+    if (_s > len) _s = len;
+    memcpy(&r->buf[_h], data, _s);
+    memcpy(&r->buf[0], data + _s, len - _s);
+    _BARRIER();
+    r->head += len;
+}
+
+/* copies data from the ring tail without advancing it */
+static void ring_copy(const usbd_ring *r, uint8_t *data, uint16_t len) {
+    uint16_t _t = r->tail & r->mask;
+    uint16_t _s = r->mask + 1 - _t;
+    if (_s > len) _s = len;
+    memcpy(data, &r->buf[_t], _s);
+    memcpy(data + _s, &r->buf[0], len - _s);
+}
+
+static uint8_t blk_alloc(usbd_cdc_acm_pool *pool) {
+    uint8_t _b = pool->first;
+    if (pool->free == 0) return CDC_ACM_NO_BLK;
+    pool->first = pool->blk[_b].next;
+    pool->free--;
+    pool->blk[_b].next = CDC_ACM_NO_BLK;
+    pool->blk[_b].len = 0;
+    return _b;
+}
+
+static void blk_free(usbd_cdc_acm_pool *pool, uint8_t b) {
+    pool->blk[b].next = pool->first;
+    pool->first = b;
+    pool->free++;
+}
+
+/* borrows a block for the port queue. fails if pool is empty or port quota is exceeded */
+static uint8_t blkq_get(usbd_cdc_acm *acm, usbd_blkq *q) {
+    if (q->count >= acm->quota) return CDC_ACM_NO_BLK;
+    return blk_alloc(acm->pool);
+}
+
+static void blkq_push(usbd_cdc_acm_pool *pool, usbd_blkq *q, uint8_t b) {
+    if (q->count == 0) {
+        q->first = b;
+        q->off = 0;
+    } else {
+        pool->blk[q->last].next = b;
+    }
+    q->last = b;
+    q->count++;
+}
+
+static void blkq_pop(usbd_cdc_acm_pool *pool, usbd_blkq *q) {
+    uint8_t _b = q->first;
+    q->first = pool->blk[_b].next;
+    q->count--;
+    q->off = 0;
+    blk_free(pool, _b);
+}
+
+static void blkq_flush(usbd_cdc_acm_pool *pool, usbd_blkq *q) {
+    while (q->count) blkq_pop(pool, q);
+}
+
+static usbd_cdc_acm *cdc_acm_find(usbd_device *dev, uint8_t event, uint8_t ep) {
+    for (usbd_cdc_acm *_a = cdc_acm_ports; _a; _a = _a->next) {
+        uint8_t _ep = (event == usbd_evt_eptx) ? _a->tx_ep : _a->rx_ep;
+        if (_a->dev == dev && ((_ep ^ ep) & 0x07) == 0) return _a;
+    }
+    return 0;
+}
+
+/* other enabled port of the same device using the same notification endpoint */
+static bool cdc_acm_ntf_shared(usbd_cdc_acm *acm) {
+    for (usbd_cdc_acm *_a = cdc_acm_ports; _a; _a = _a->next) {
+        if (_a != acm && _a->dev == acm->dev && ((_a->ntf_ep ^ acm->ntf_ep) & 0x07) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void cdc_acm_unlink(usbd_cdc_acm *acm) {
+    for (usbd_cdc_acm **_p = &cdc_acm_ports; *_p; _p = &(*_p)->next) {
+        if (*_p == acm) {
+            *_p = acm->next;
+            break;
+        }
+    }
+    acm->next = 0;
+}
+
+static void cdc_acm_rx(usbd_cdc_acm *acm);
+
+/* returned blocks may be borrowed by any port holding the packet due to empty pool */
+static void cdc_acm_pool_resume(usbd_cdc_acm_pool *pool) {
+    for (usbd_cdc_acm *_a = cdc_acm_ports; _a && pool->free; _a = _a->next) {
+        if (_a->pool == pool && _a->rx_hold && _a->rxq.count < _a->quota) {
+            cdc_acm_rx(_a);
+        }
+    }
+}
+
+static void cdc_acm_pool_rx(usbd_cdc_acm *acm) {
+    usbd_cdc_acm_pool *pool = acm->pool;
+    uint8_t _b = blkq_get(acm, &acm->rxq);
+    int32_t _t;
+    if (_b == CDC_ACM_NO_BLK) {
+        acm->rx_hold = 1;
+        return;
+    }
+    acm->rx_hold = 0;
+    _t = usbd_ep_read(acm->dev, acm->rx_ep, pool->blk[_b].data, acm->ep_size);
+    if (_t <= 0) {
+        blk_free(pool, _b);
+        return;
+    }
+    pool->blk[_b].len = _t;
+    blkq_push(pool, &acm->rxq, _b);
+    acm->rx.head += _t;
+}
+
+static void cdc_acm_pool_tx(usbd_cdc_acm *acm) {
+    usbd_cdc_acm_pool *pool = acm->pool;
+    usbd_cdc_acm_blk *_b;
+    /* last block may be empty after tx_peek */
+    if (acm->txq.count == 0 || pool->blk[acm->txq.first].len == 0) {
+        acm->tx_busy = 0;
+        return;
+    }
+    _b = &pool->blk[acm->txq.first];
+    acm->tx_busy = 1;
+    if (usbd_ep_write(acm->dev, acm->tx_ep, _b->data, _b->len) < 0) {
+        acm->tx_busy = 0;
+        return;
+    }
+    /* data is already in the endpoint buffer, return block to the pool */
+    acm->tx_len = _b->len;
+    acm->tx.tail += _b->len;
+    blkq_pop(pool, &acm->txq);
+    cdc_acm_pool_resume(pool);
+}
+
+static void cdc_acm_rx(usbd_cdc_acm *acm) {
+    usbd_ring *r = &acm->rx;
+    int32_t _t;
+    if (acm->pool) {
+        cdc_acm_pool_rx(acm);
+        return;
+    }
+    if (ring_free(r) < acm->ep_size) {
+        acm->rx_hold = 1;
+        return;
+    }
+    acm->rx_hold = 0;
+    uint16_t _h = r->head & r->mask;
+    if ((uint16_t)(r->mask + 1 - _h) >= acm->ep_size) {
+        /* read directly to the ring */
+        _t = usbd_ep_read(acm->dev, acm->rx_ep, &r->buf[_h], acm->ep_size);
+        if (_t > 0) {
+            _BARRIER();
+            r->head += _t;
+        }
+    } else {
+        uint8_t _b[CDC_ACM_MAX_PKT];
+        _t = usbd_ep_read(acm->dev, acm->rx_ep, _b, acm->ep_size);
+        if (_t > 0) ring_put(r, _b, _t);
+    }
+}
+
+static void cdc_acm_tx(usbd_cdc_acm *acm) {
+    usbd_ring *r = &acm->tx;
+    uint16_t _cnt = ring_count(r);
+    uint16_t _t = r->tail & r->mask;
+    int32_t _w;
+    if (acm->pool) {
+        cdc_acm_pool_tx(acm);
+        return;
+    }
+    if (_cnt == 0) {
+        acm->tx_busy = 0;
+        return;
+    }
+    if (_cnt > acm->ep_size) _cnt = acm->ep_size;
+    acm->tx_busy = 1;
+    if ((uint16_t)(r->mask + 1 - _t) >= _cnt) {
+        /* write directly from the ring */
+        _w = usbd_ep_write(acm->dev, acm->tx_ep, &r->buf[_t], _cnt);
+    } else {
+        uint8_t _b[CDC_ACM_MAX_PKT];
+        ring_copy(r, _b, _cnt);
+        _w = usbd_ep_write(acm->dev, acm->tx_ep, _b, _cnt);
+    }
+    if (_w < 0) {
+        acm->tx_busy = 0;
+        return;
+    }
+    /* data is already in the endpoint buffer, release ring space */
+    acm->tx_len = _cnt;
+    _BARRIER();
+    r->tail += _cnt;
+}
+
+static void cdc_acm_evt(usbd_device *dev, uint8_t event, uint8_t ep) {
+    usbd_cdc_acm *acm = cdc_acm_find(dev, event, ep);
+    if (acm == 0) return;
+    if (event == usbd_evt_eptx) {
+        if ((acm->tx_len == acm->ep_size) && (ring_count(&acm->tx) == 0)) {
+            /* terminate transfer with ZLP */
+            acm->tx_len = 0;
+            usbd_ep_write(dev, acm->tx_ep, 0, 0);
+        } else {
+            cdc_acm_tx(acm);
+        }
+    } else {
+        cdc_acm_rx(acm);
+    }
+}
+
+/* main loop side. The held packet is read and the transmission is started with interrupts
+ * masked, so the USB interrupt never enters the driver at the same time */
+static void cdc_acm_rx_resume(usbd_cdc_acm *acm) {
+    uint32_t _m = USBD_CDC_ACM_LOCK();
+    if (acm->pool) {
+        cdc_acm_pool_resume(acm->pool);
+    } else if (acm->rx_hold && (ring_free(&acm->rx) >= acm->ep_size)) {
+        cdc_acm_rx(acm);
+    }
+    USBD_CDC_ACM_UNLOCK(_m);
+}
+
+static void cdc_acm_tx_kick(usbd_cdc_acm *acm) {
+    uint32_t _m = USBD_CDC_ACM_LOCK();
+    if (!acm->tx_busy) {
+        cdc_acm_tx(acm);
+    }
+    USBD_CDC_ACM_UNLOCK(_m);
+}
+
+void usbd_cdc_acm_init(usbd_cdc_acm *acm, usbd_device *dev, uint8_t comm_if,
+                       uint8_t rx_ep, uint8_t tx_ep, uint8_t ntf_ep, uint8_t ep_size,
+                       void *rxbuf, uint16_t rxsize, void *txbuf, uint16_t txsize) {
+    memset(acm, 0, sizeof(usbd_cdc_acm));
+    acm->dev = dev;
+    acm->comm_if = comm_if;
+    acm->rx_ep = rx_ep;
+    acm->tx_ep = tx_ep;
+    acm->ntf_ep = ntf_ep;
+    acm->ep_size = (ep_size > CDC_ACM_MAX_PKT) ? CDC_ACM_MAX_PKT : ep_size;
+    acm->rx.buf = rxbuf;
+    acm->rx.mask = rxsize - 1;
+    acm->tx.buf = txbuf;
+    acm->tx.mask = txsize - 1;
+    acm->line_coding.dwDTERate = 115200;
+    acm->line_coding.bCharFormat = USB_CDC_1_STOP_BITS;
+    acm->line_coding.bParityType = USB_CDC_NO_PARITY;
+    acm->line_coding.bDataBits = 8;
+}
+
+void usbd_cdc_acm_pool_init(usbd_cdc_acm_pool *pool, usbd_cdc_acm_blk *blk, uint8_t count) {
+    pool->blk = blk;
+    pool->count = count;
+    pool->free = 0;
+    pool->first = CDC_ACM_NO_BLK;
+    for (int i = count - 1; i >= 0; i--) {
+        blk_free(pool, i);
+    }
+}
+
+void usbd_cdc_acm_init_pool(usbd_cdc_acm *acm, usbd_device *dev, uint8_t comm_if,
+                            uint8_t rx_ep, uint8_t tx_ep, uint8_t ntf_ep, uint8_t ep_size,
+                            usbd_cdc_acm_pool *pool, uint8_t quota) {
+    usbd_cdc_acm_init(acm, dev, comm_if, rx_ep, tx_ep, ntf_ep, ep_size, 0, 0, 0, 0);
+    if (acm->ep_size > USBD_CDC_ACM_BLK_SZ) acm->ep_size = USBD_CDC_ACM_BLK_SZ;
+    acm->pool = pool;
+    acm->quota = quota;
+}
+
+void usbd_cdc_acm_enable(usbd_cdc_acm *acm, bool enable) {
+    usbd_device *dev = acm->dev;
+    bool shared;
+    cdc_acm_unlink(acm);
+    shared = cdc_acm_ntf_shared(acm);
+    if (acm->pool) {
+        blkq_flush(acm->pool, &acm->rxq);
+        blkq_flush(acm->pool, &acm->txq);
+    }
+    if (enable) {
+        acm->rx.head = acm->rx.tail = 0;
+        acm->tx.head = acm->tx.tail = 0;
+        acm->tx_len = 0;
+        acm->tx_busy = 0;
+        acm->rx_hold = 0;
+        acm->next = cdc_acm_ports;
+        cdc_acm_ports = acm;
+        usbd_ep_config(dev, acm->rx_ep, USB_EPTYPE_BULK, acm->ep_size);
+        usbd_ep_config(dev, acm->tx_ep, USB_EPTYPE_BULK, acm->ep_size);
+        /* shared notification endpoint is configured by the first enabled port */
+        if (!shared) {
+            usbd_ep_config(dev, acm->ntf_ep, USB_EPTYPE_INTERRUPT, USBD_CDC_ACM_NTF_SZ);
+        }
+        usbd_reg_endpoint(dev, acm->rx_ep, cdc_acm_evt);
+        usbd_reg_endpoint(dev, acm->tx_ep, cdc_acm_evt);
+    } else {
+        /* and deconfigured by the last one */
+        if (!shared) {
+            usbd_ep_deconfig(dev, acm->ntf_ep);
+        }
+        usbd_ep_deconfig(dev, acm->tx_ep);
+        usbd_ep_deconfig(dev, acm->rx_ep);
+        usbd_reg_endpoint(dev, acm->rx_ep, 0);
+        usbd_reg_endpoint(dev, acm->tx_ep, 0);
+        acm->tx_busy = 0;
+        acm->line_state = 0;
+    }
+}
+
+usbd_respond usbd_cdc_acm_control(usbd_cdc_acm *acm, usbd_ctlreq *req) {
+    if (((USB_REQ_RECIPIENT | USB_REQ_TYPE) & req->bmRequestType) != (USB_REQ_INTERFACE | USB_REQ_CLASS)
+        || req->wIndex != acm->comm_if) return usbd_fail;
+    switch (req->bRequest) {
+    case USB_CDC_SET_CONTROL_LINE_STATE:
+        acm->line_state = req->wValue;
+        break;
+    case USB_CDC_SET_LINE_CODING:
+        if (req->wLength < sizeof(acm->line_coding)) return usbd_fail;
+        memcpy(&acm->line_coding, req->data, sizeof(acm->line_coding));
+        break;
+    case USB_CDC_GET_LINE_CODING:
+        acm->dev->status.data_ptr = &acm->line_coding;
+        acm->dev->status.data_count = sizeof(acm->line_coding);
+        return usbd_ack;
+    case USB_CDC_SEND_BREAK:
+        return usbd_ack;
+    default:
+        return usbd_fail;
+    }
+    if (acm->line_callback) {
+        acm->line_callback(acm);
+    }
+    return usbd_ack;
+}
+
+uint16_t usbd_cdc_acm_read(usbd_cdc_acm *acm, void *buf, uint16_t blen) {
+    usbd_ring *r = &acm->rx;
+    uint16_t _cnt = ring_count(r);
+    if (acm->pool) {
+        const uint8_t *_d;
+        uint16_t _t, _res = 0;
+        while (_res < blen && (_t = usbd_cdc_acm_rx_peek(acm, &_d)) > 0) {
+            if (_t > blen - _res) _t = blen - _res;
+            memcpy((uint8_t*)buf + _res, _d, _t);
+            usbd_cdc_acm_rx_commit(acm, _t);
+            _res += _t;
+        }
+        return _res;
+    }
+    if (blen > _cnt) blen = _cnt;
+    ring_copy(r, buf, blen);
+    _BARRIER();
+    r->tail += blen;
+    cdc_acm_rx_resume(acm);
+    return blen;
+}
+
+uint16_t usbd_cdc_acm_write(usbd_cdc_acm *acm, const void *buf, uint16_t blen) {
+    usbd_ring *r = &acm->tx;
+    uint16_t _free = ring_free(r);
+    if (acm->pool) {
+        uint8_t *_d;
+        uint16_t _t, _res = 0;
+        while (_res < blen && (_t = usbd_cdc_acm_tx_peek(acm, &_d)) > 0) {
+            if (_t > blen - _res) _t = blen - _res;
+            memcpy(_d, (const uint8_t*)buf + _res, _t);
+            usbd_cdc_acm_tx_commit(acm, _t);
+            _res += _t;
+        }
+        return _res;
+    }
+    if (blen > _free) blen = _free;
+    ring_put(r, buf, blen);
+    cdc_acm_tx_kick(acm);
+    return blen;
+}
+
+uint16_t usbd_cdc_acm_rx_peek(usbd_cdc_acm *acm, const uint8_t **data) {
+    usbd_ring *r = &acm->rx;
+    uint16_t _cnt = ring_count(r);
+    uint16_t _t = r->tail & r->mask;
+    uint16_t _s = r->mask + 1 - _t;
+    if (acm->pool) {
+        usbd_cdc_acm_blk *_b;
+        if (acm->rxq.count == 0) return 0;
+        _b = &acm->pool->blk[acm->rxq.first];
+        *data = &_b->data[acm->rxq.off];
+        return _b->len - acm->rxq.off;
+    }
+    *data = &r->buf[_t];
+    return (_cnt < _s) ? _cnt : _s;
+}
+
+void usbd_cdc_acm_rx_commit(usbd_cdc_acm *acm, uint16_t len) {
+    if (acm->pool) {
+        /* len never exceeds the first block data */
+        acm->rxq.off += len;
+        acm->rx.tail += len;
+        if (acm->rxq.off >= acm->pool->blk[acm->rxq.first].len) {
+            blkq_pop(acm->pool, &acm->rxq);
+        }
+        cdc_acm_rx_resume(acm);
+        return;
+    }
+    _BARRIER();
+    acm->rx.tail += len;
+    cdc_acm_rx_resume(acm);
+}
+
+uint16_t usbd_cdc_acm_tx_peek(usbd_cdc_acm *acm, uint8_t **data) {
+    usbd_ring *r = &acm->tx;
+    uint16_t _free = ring_free(r);
+    uint16_t _h = r->head & r->mask;
+    uint16_t _s = r->mask + 1 - _h;
+    if (acm->pool) {
+        usbd_cdc_acm_pool *pool = acm->pool;
+        usbd_blkq *q = &acm->txq;
+        if (q->count == 0 || pool->blk[q->last].len >= acm->ep_size) {
+            uint8_t _b = blkq_get(acm, q);
+            if (_b == CDC_ACM_NO_BLK) return 0;
+            blkq_push(pool, q, _b);
+        }
+        *data = &pool->blk[q->last].data[pool->blk[q->last].len];
+        return acm->ep_size - pool->blk[q->last].len;
+    }
+    *data = &r->buf[_h];
+    return (_free < _s) ? _free : _s;
+}
+
+void usbd_cdc_acm_tx_commit(usbd_cdc_acm *acm, uint16_t len) {
+    if (acm->pool) {
+        acm->pool->blk[acm->txq.last].len += len;
+        acm->tx.head += len;
+        cdc_acm_tx_kick(acm);
+        return;
+    }
+    _BARRIER();
+    acm->tx.head += len;
+    cdc_acm_tx_kick(acm);
+}
+
+uint16_t usbd_cdc_acm_space(usbd_cdc_acm *acm) {
+    if (acm->pool) {
+        usbd_cdc_acm_pool *pool = acm->pool;
+        usbd_blkq *q = &acm->txq;
+        uint16_t _n = acm->quota - q->count;
+        uint16_t _s = 0;
+        if (_n > pool->free) _n = pool->free;
+        if (q->count) _s = acm->ep_size - pool->blk[q->last].len;
+        return _s + _n * acm->ep_size;
+    }
+    return ring_free(&acm->tx);
+}
+
+bool usbd_cdc_acm_serial_state(usbd_cdc_acm *acm, uint16_t state) {
+    uint8_t _b[sizeof(struct usb_cdc_notification) + 2];
+    struct usb_cdc_notification *ntf = (void*)_b;
+    ntf->bmRequestType = USB_REQ_DEVTOHOST | USB_REQ_CLASS | USB_REQ_INTERFACE;
+    ntf->bNotificationType = USB_CDC_NTF_SERIAL_STATE;
+    ntf->wValue = 0;
+    ntf->wIndex = acm->comm_if;
+    ntf->wLength = 2;
+    ntf->Data[0] = state & 0xFF;
+    ntf->Data[1] = state >> 8;
+    uint32_t _m = USBD_CDC_ACM_LOCK();
+    bool _res = usbd_ep_write(acm->dev, acm->ntf_ep, _b, sizeof(_b)) == sizeof(_b);
+    USBD_CDC_ACM_UNLOCK(_m);
+    return _res;
+}
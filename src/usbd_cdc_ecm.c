@@ -0,0 +1,309 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "usb.h"
+#include "usbd_cdc_ecm.h"
+
+#define ECM_MAX_PKT         0x40
+#define ECM_MIN_FRAME       14
+
+#define ECM_NTF_SPEED       0x01
+#define ECM_NTF_CONN        0x02
+
+/* statistics counters indexes. feature selector - 1 */
+#define ECM_XMIT_OK         0
+#define ECM_RCV_OK          1
+#define ECM_XMIT_ERROR      2
+#define ECM_RCV_ERROR       3
+#define ECM_RCV_NO_BUFFER   4
+#define ECM_XMIT_BYTES      5
+#define ECM_RCV_BYTES       11
+
+/* endpoint callbacks has no user context, so map endpoint number to the function */
+static usbd_cdc_ecm *cdc_ecm_ep[8];
+
+/* counts directed, multicast or broadcast bytes and frames */
+static void ecm_count(usbd_cdc_ecm *ecm, const uint8_t *frame, uint16_t len, uint8_t base) {
+    if (frame[0] & 0x01) {
+        base += ((frame[0] & frame[1] & frame[2] & frame[3] & frame[4] & frame[5]) == 0xFF) ? 4 : 2;
+    }
+    ecm->stats[base] += len;
+    ecm->stats[base + 1]++;
+}
+
+inline static uint8_t *ecm_frame(usbd_cdc_ecm *ecm, uint8_t idx) {
+    return &ecm->pool[idx * USBD_CDC_ECM_FRAME_SZ];
+}
+
+static void ecm_rx(usbd_cdc_ecm *ecm) {
+    int32_t _t;
+    if (ecm->rx_count >= ecm->frames) {
+        /* no free frames. leave packet in the endpoint */
+        if (!ecm->rx_hold && ecm->rx_len == 0) ecm->stats[ECM_RCV_NO_BUFFER]++;
+        ecm->rx_hold = 1;
+        return;
+    }
+    ecm->rx_hold = 0;
+    if (ecm->rx_drop || (ecm->rx_len + ecm->ep_size) > USBD_CDC_ECM_FRAME_SZ) {
+        /* oversized frame. drop it until short packet */
+        uint8_t _b[ECM_MAX_PKT];
+        _t = usbd_ep_read(ecm->dev, ecm->rx_ep, _b, ecm->ep_size);
+        if (!ecm->rx_drop) ecm->stats[ECM_RCV_ERROR]++;
+        ecm->rx_drop = (_t == ecm->ep_size);
+        ecm->rx_len = 0;
+        return;
+    }
+    uint8_t *frame = ecm_frame(ecm, ecm->rx_head);
+    _t = usbd_ep_read(ecm->dev, ecm->rx_ep, &frame[ecm->rx_len], ecm->ep_size);
+    if (_t < 0) return;
+    ecm->rx_len += _t;
+    if (_t == ecm->ep_size) return;
+    /* short packet or ZLP terminates the frame */
+    if (ecm->rx_len < ECM_MIN_FRAME) {
+        if (ecm->rx_len) ecm->stats[ECM_RCV_ERROR]++;
+    } else {
+        ecm->rx_flen[ecm->rx_head] = ecm->rx_len;
+        ecm->stats[ECM_RCV_OK]++;
+        ecm_count(ecm, frame, ecm->rx_len, ECM_RCV_BYTES);
+        if (++ecm->rx_head == ecm->frames) ecm->rx_head = 0;
+        ecm->rx_count++;
+        if (ecm->rx_callback) ecm->rx_callback(ecm);
+    }
+    ecm->rx_len = 0;
+}
+
+static void ecm_tx_next(usbd_cdc_ecm *ecm) {
+    uint16_t _t = ecm->tx_remain;
+    if (_t == 0) {
+        if (ecm->tx_zlp) {
+            ecm->tx_zlp = 0;
+            usbd_ep_write(ecm->dev, ecm->tx_ep, 0, 0);
+            return;
+        }
+        ecm->tx_busy = 0;
+        ecm->stats[ECM_XMIT_OK]++;
+        ecm_count(ecm, ecm->tx_ptr - ecm->tx_len, ecm->tx_len, ECM_XMIT_BYTES);
+        if (ecm->tx_callback) ecm->tx_callback(ecm);
+        return;
+    }
+    if (_t > ecm->ep_size) _t = ecm->ep_size;
+    if (usbd_ep_write(ecm->dev, ecm->tx_ep, (void*)ecm->tx_ptr, _t) < 0) {
+        ecm->stats[ECM_XMIT_ERROR]++;
+        ecm->tx_remain = 0;
+        ecm->tx_zlp = 0;
+        ecm->tx_busy = 0;
+        return;
+    }
+    ecm->tx_ptr += _t;
+    ecm->tx_remain -= _t;
+}
+
+static void ecm_ntf_next(usbd_cdc_ecm *ecm) {
+    uint8_t _b[sizeof(struct usb_cdc_notification) + 8];
+    struct usb_cdc_notification *ntf = (void*)_b;
+    ntf->bmRequestType = USB_REQ_DEVTOHOST | USB_REQ_CLASS | USB_REQ_INTERFACE;
+    ntf->wIndex = ecm->comm_if;
+    if (ecm->ntf_pending & ECM_NTF_SPEED) {
+        ecm->ntf_pending &= ~ECM_NTF_SPEED;
+        ntf->bNotificationType = USB_CDC_NTF_SPEED_CHANGE;
+        ntf->wValue = 0;
+        ntf->wLength = 8;
+        memcpy(&ntf->Data[0], &ecm->bitrate, 4);
+        memcpy(&ntf->Data[4], &ecm->bitrate, 4);
+        ecm->ntf_busy = 1;
+        usbd_ep_write(ecm->dev, ecm->ntf_ep, _b, sizeof(_b));
+    } else if (ecm->ntf_pending & ECM_NTF_CONN) {
+        ecm->ntf_pending &= ~ECM_NTF_CONN;
+        ntf->bNotificationType = USB_CDC_NTF_NETWORK_CONNECTION;
+        ntf->wValue = ecm->link;
+        ntf->wLength = 0;
+        ecm->ntf_busy = 1;
+        usbd_ep_write(ecm->dev, ecm->ntf_ep, _b, sizeof(struct usb_cdc_notification));
+    } else {
+        ecm->ntf_busy = 0;
+    }
+}
+
+static void ecm_ntf_kick(usbd_cdc_ecm *ecm) {
+    if (ecm->alt && !ecm->ntf_busy) ecm_ntf_next(ecm);
+}
+
+static void cdc_ecm_evt(usbd_device *dev, uint8_t event, uint8_t ep) {
+    usbd_cdc_ecm *ecm = cdc_ecm_ep[ep & 0x07];
+    (void)dev;
+    if (ecm == 0) return;
+    if (event == usbd_evt_eptx) {
+        if ((ep & 0x07) == (ecm->ntf_ep & 0x07)) {
+            ecm_ntf_next(ecm);
+        } else {
+            ecm_tx_next(ecm);
+        }
+    } else {
+        ecm_rx(ecm);
+    }
+}
+
+/* selects data interface alternate setting. Endpoints are configured by the core with
+ * USBD_ALTSETTINGS, so only the callbacks are registered then */
+static void ecm_set_alt(usbd_cdc_ecm *ecm, uint8_t alt, bool endpoints) {
+    usbd_device *dev = ecm->dev;
+    ecm->alt = alt;
+    ecm->rx_head = ecm->rx_tail = ecm->rx_count = 0;
+    ecm->rx_len = 0;
+    ecm->rx_hold = 0;
+    ecm->rx_drop = 0;
+    ecm->tx_remain = 0;
+    ecm->tx_busy = 0;
+    ecm->tx_zlp = 0;
+    if (alt) {
+        if (endpoints) {
+            usbd_ep_config(dev, ecm->rx_ep, USB_EPTYPE_BULK, ecm->ep_size);
+            usbd_ep_config(dev, ecm->tx_ep, USB_EPTYPE_BULK, ecm->ep_size);
+        }
+        usbd_reg_endpoint(dev, ecm->rx_ep, cdc_ecm_evt);
+        usbd_reg_endpoint(dev, ecm->tx_ep, cdc_ecm_evt);
+        ecm->ntf_pending = ECM_NTF_SPEED | ECM_NTF_CONN;
+        ecm_ntf_kick(ecm);
+    } else {
+        if (endpoints) {
+            usbd_ep_deconfig(dev, ecm->tx_ep);
+            usbd_ep_deconfig(dev, ecm->rx_ep);
+        }
+        usbd_reg_endpoint(dev, ecm->rx_ep, 0);
+        usbd_reg_endpoint(dev, ecm->tx_ep, 0);
+    }
+}
+
+void usbd_cdc_ecm_init(usbd_cdc_ecm *ecm, usbd_device *dev, uint8_t comm_if, uint8_t data_if,
+                       uint8_t rx_ep, uint8_t tx_ep, uint8_t ntf_ep, uint8_t ep_size,
+                       void *pool, uint16_t *flen, uint8_t frames) {
+    memset(ecm, 0, sizeof(usbd_cdc_ecm));
+    ecm->dev = dev;
+    ecm->comm_if = comm_if;
+    ecm->data_if = data_if;
+    ecm->rx_ep = rx_ep;
+    ecm->tx_ep = tx_ep;
+    ecm->ntf_ep = ntf_ep;
+    ecm->ep_size = (ep_size > ECM_MAX_PKT) ? ECM_MAX_PKT : ep_size;
+    ecm->pool = pool;
+    ecm->rx_flen = flen;
+    ecm->frames = frames;
+}
+
+void usbd_cdc_ecm_enable(usbd_cdc_ecm *ecm, bool enable) {
+    usbd_device *dev = ecm->dev;
+    if (enable) {
+        cdc_ecm_ep[ecm->rx_ep & 0x07] = ecm;
+        cdc_ecm_ep[ecm->tx_ep & 0x07] = ecm;
+        cdc_ecm_ep[ecm->ntf_ep & 0x07] = ecm;
+        ecm->ntf_busy = 0;
+        usbd_ep_config(dev, ecm->ntf_ep, USB_EPTYPE_INTERRUPT, USBD_CDC_ECM_NTF_SZ);
+        usbd_reg_endpoint(dev, ecm->ntf_ep, cdc_ecm_evt);
+        ecm->alt = 0;
+    } else {
+        if (ecm->alt) ecm_set_alt(ecm, 0, true);
+        usbd_ep_deconfig(dev, ecm->ntf_ep);
+        usbd_reg_endpoint(dev, ecm->ntf_ep, 0);
+    }
+}
+
+#if !defined(USBD_ALTSETTINGS)
+static usbd_respond ecm_control_std(usbd_cdc_ecm *ecm, usbd_ctlreq *req) {
+    if (req->wIndex != ecm->data_if && req->wIndex != ecm->comm_if) return usbd_fail;
+    switch (req->bRequest) {
+    case USB_STD_GET_INTERFACE:
+        req->data[0] = (req->wIndex == ecm->data_if) ? ecm->alt : 0;
+        ecm->dev->status.data_count = 1;
+        return usbd_ack;
+    case USB_STD_SET_INTERFACE:
+        if (req->wIndex == ecm->comm_if) {
+            return (req->wValue == 0) ? usbd_ack : usbd_fail;
+        }
+        if (req->wValue > 1) return usbd_fail;
+        ecm_set_alt(ecm, req->wValue, true);
+        return usbd_ack;
+    default:
+        return usbd_fail;
+    }
+}
+#else
+void usbd_cdc_ecm_altsetting(usbd_cdc_ecm *ecm, uint8_t intf, uint8_t alt) {
+    if (intf == ecm->data_if) ecm_set_alt(ecm, alt, false);
+}
+#endif
+
+usbd_respond usbd_cdc_ecm_control(usbd_cdc_ecm *ecm, usbd_ctlreq *req) {
+    switch ((USB_REQ_RECIPIENT | USB_REQ_TYPE) & req->bmRequestType) {
+#if !defined(USBD_ALTSETTINGS)
+    case USB_REQ_INTERFACE | USB_REQ_STANDARD:
+        return ecm_control_std(ecm, req);
+#endif
+    case USB_REQ_INTERFACE | USB_REQ_CLASS:
+        if (req->wIndex == ecm->comm_if) break;
+        return usbd_fail;
+    default:
+        return usbd_fail;
+    }
+    switch (req->bRequest) {
+    case USB_CDC_SET_ETH_PACKET_FILTER:
+        ecm->pkt_filter = req->wValue;
+        return usbd_ack;
+    case USB_CDC_SET_ETH_MULTICAST_FILTERS:
+        /* no filtering. all multicast frames are passed to the application */
+        return usbd_ack;
+    case USB_CDC_GET_ETH_STATISTIC:
+        if (req->wValue == 0 || req->wValue > USBD_CDC_ECM_STATS_CNT) return usbd_fail;
+        memcpy(req->data, &ecm->stats[req->wValue - 1], 4);
+        ecm->dev->status.data_count = 4;
+        return usbd_ack;
+    default:
+        return usbd_fail;
+    }
+}
+
+uint16_t usbd_cdc_ecm_rx_frame(usbd_cdc_ecm *ecm, const uint8_t **frame) {
+    if (ecm->rx_count == 0) return 0;
+    *frame = ecm_frame(ecm, ecm->rx_tail);
+    return ecm->rx_flen[ecm->rx_tail];
+}
+
+void usbd_cdc_ecm_rx_release(usbd_cdc_ecm *ecm) {
+    if (ecm->rx_count == 0) return;
+    if (++ecm->rx_tail == ecm->frames) ecm->rx_tail = 0;
+    ecm->rx_count--;
+    if (ecm->rx_hold) ecm_rx(ecm);
+}
+
+bool usbd_cdc_ecm_tx_frame(usbd_cdc_ecm *ecm, const void *frame, uint16_t len) {
+    if (ecm->alt == 0 || ecm->tx_busy || len < ECM_MIN_FRAME) return false;
+    ecm->tx_ptr = frame;
+    ecm->tx_len = len;
+    ecm->tx_remain = len;
+    /* frame that is a multiple of endpoint size must be terminated by ZLP */
+    ecm->tx_zlp = ((len % ecm->ep_size) == 0);
+    ecm->tx_busy = 1;
+    ecm_tx_next(ecm);
+    return true;
+}
+
+void usbd_cdc_ecm_link(usbd_cdc_ecm *ecm, bool up, uint32_t bitrate) {
+    ecm->link = up ? 1 : 0;
+    ecm->bitrate = bitrate;
+    ecm->ntf_pending = ECM_NTF_SPEED | ECM_NTF_CONN;
+    ecm_ntf_kick(ecm);
+}
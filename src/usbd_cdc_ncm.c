@@ -0,0 +1,422 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "usb.h"
+#include "usb_cdce.h"
+#include "usbd_cdc_ncm.h"
+
+#define NCM_ALIGN           4
+#define NCM_ALIGNED(x)      (((x) + NCM_ALIGN - 1) & ~(NCM_ALIGN - 1))
+#define NCM_NDP_SIZE(n)     (sizeof(struct usb_cdc_ncm_ndp16) + ((n) + 1) * sizeof(struct usb_cdc_ncm_dpe16))
+#define NCM_MAX_PKT         0x40
+
+#define NCM_RX_RECV         0x00
+#define NCM_RX_READY        0x01
+#define NCM_RX_DROP         0x02
+
+#define NCM_NTF_SPEED       0x01
+#define NCM_NTF_CONN        0x02
+
+/* endpoint callbacks has no user context, so map endpoint number to the function */
+static usbd_cdc_ncm *cdc_ncm_ep[8];
+
+static void ncm_rx_reset(usbd_cdc_ncm *ncm) {
+    ncm->rx_len = 0;
+    ncm->rx_state = NCM_RX_RECV;
+}
+
+static void ncm_tx_reset(usbd_cdc_ncm *ncm) {
+    ncm->tx_pos = NCM_ALIGNED(sizeof(struct usb_cdc_ncm_nth16));
+    ncm->tx_cnt = 0;
+    ncm->tx_remain = 0;
+    ncm->tx_busy = 0;
+    ncm->tx_zlp = 0;
+}
+
+/* checks received NTB header and prepares datagrams walking */
+static bool ncm_rx_parse(usbd_cdc_ncm *ncm) {
+    const struct usb_cdc_ncm_nth16 *nth = (const void*)ncm->rxbuf;
+    if (ncm->rx_len < sizeof(struct usb_cdc_ncm_nth16)) return false;
+    if (nth->dwSignature != USB_CDC_NCM_NTH16_SIGN) return false;
+    if (nth->wHeaderLength != sizeof(struct usb_cdc_ncm_nth16)) return false;
+    if (nth->wBlockLength != 0 && nth->wBlockLength < ncm->rx_len) {
+        ncm->rx_len = nth->wBlockLength;
+    }
+    ncm->rx_ndp = nth->wNdpIndex;
+    ncm->rx_dpe = 0;
+    return true;
+}
+
+static void ncm_rx(usbd_cdc_ncm *ncm) {
+    const struct usb_cdc_ncm_nth16 *nth = (const void*)ncm->rxbuf;
+    int32_t _t;
+    if (ncm->rx_state == NCM_RX_READY) {
+        /* leave packet in the endpoint until NTB is released */
+        ncm->rx_hold = 1;
+        return;
+    }
+    ncm->rx_hold = 0;
+    if (ncm->rx_state == NCM_RX_DROP || ncm->rx_len >= ncm->rxsize) {
+        /* oversized NTB. drop it until end of transfer */
+        uint8_t _b[NCM_MAX_PKT];
+        _t = usbd_ep_read(ncm->dev, ncm->rx_ep, _b, ncm->ep_size);
+        ncm->rx_state = (_t < ncm->ep_size) ? NCM_RX_RECV : NCM_RX_DROP;
+        ncm->rx_len = 0;
+        return;
+    }
+    _t = usbd_ep_read(ncm->dev, ncm->rx_ep, &ncm->rxbuf[ncm->rx_len], ncm->ep_size);
+    if (_t < 0) return;
+    ncm->rx_len += _t;
+    /* NTB ends with the short packet or when the block length is reached */
+    if ((_t < ncm->ep_size) || (ncm->rx_len == ncm->rxsize) ||
+        ((ncm->rx_len >= sizeof(struct usb_cdc_ncm_nth16)) && (nth->wBlockLength != 0) &&
+         (ncm->rx_len >= nth->wBlockLength))) {
+        if ((_t == ncm->ep_size) && (nth->wBlockLength > ncm->rxsize)) {
+            /* buffer is full but the transfer continues. drop the rest of it */
+            ncm->rx_state = NCM_RX_DROP;
+            ncm->rx_len = 0;
+        } else if (ncm_rx_parse(ncm)) {
+            ncm->rx_state = NCM_RX_READY;
+            if (ncm->rx_callback) ncm->rx_callback(ncm);
+        } else {
+            ncm_rx_reset(ncm);
+        }
+    }
+}
+
+static void ncm_tx_next(usbd_cdc_ncm *ncm);
+
+/* completes filled IN NTB and starts its transmission */
+static void ncm_tx_flush(usbd_cdc_ncm *ncm) {
+    uint8_t *buf = &ncm->txbuf[ncm->tx_fill * ncm->txsize];
+    struct usb_cdc_ncm_nth16 *nth = (void*)buf;
+    struct usb_cdc_ncm_ndp16 *ndp = (void*)&buf[ncm->tx_pos];
+    uint16_t _ndplen = NCM_NDP_SIZE(ncm->tx_cnt);
+    uint16_t _blen = ncm->tx_pos + _ndplen;
+    ndp->dwSignature = USB_CDC_NCM_NDP16_NOCRC_SIGN;
+    ndp->wLength = _ndplen;
+    ndp->wNextNdpIndex = 0;
+    memcpy(ndp->wDatagram, ncm->tx_dpe, ncm->tx_cnt * sizeof(struct usb_cdc_ncm_dpe16));
+    ndp->wDatagram[ncm->tx_cnt].wDatagramIndex = 0;
+    ndp->wDatagram[ncm->tx_cnt].wDatagramLength = 0;
+    nth->dwSignature = USB_CDC_NCM_NTH16_SIGN;
+    nth->wHeaderLength = sizeof(struct usb_cdc_ncm_nth16);
+    nth->wSequence = ncm->tx_seq++;
+    nth->wBlockLength = _blen;
+    nth->wNdpIndex = ncm->tx_pos;
+    /* short NTB that is a multiple of endpoint size must be terminated by ZLP */
+    ncm->tx_zlp = ((_blen % ncm->ep_size) == 0) && (_blen < ncm->tx_max);
+    ncm->tx_ptr = buf;
+    ncm->tx_remain = _blen;
+    ncm->tx_busy = 1;
+    /* switch to another buffer */
+    ncm->tx_fill ^= 1;
+    ncm->tx_pos = NCM_ALIGNED(sizeof(struct usb_cdc_ncm_nth16));
+    ncm->tx_cnt = 0;
+    ncm_tx_next(ncm);
+}
+
+static void ncm_tx_next(usbd_cdc_ncm *ncm) {
+    uint16_t _t = ncm->tx_remain;
+    if (_t == 0) {
+        if (ncm->tx_zlp) {
+            ncm->tx_zlp = 0;
+            usbd_ep_write(ncm->dev, ncm->tx_ep, 0, 0);
+            return;
+        }
+        ncm->tx_busy = 0;
+        /* send datagrams collected while transmitting */
+        if (ncm->tx_cnt) ncm_tx_flush(ncm);
+        return;
+    }
+    if (_t > ncm->ep_size) _t = ncm->ep_size;
+    usbd_ep_write(ncm->dev, ncm->tx_ep, ncm->tx_ptr, _t);
+    ncm->tx_ptr += _t;
+    ncm->tx_remain -= _t;
+}
+
+static void ncm_ntf_next(usbd_cdc_ncm *ncm) {
+    uint8_t _b[sizeof(struct usb_cdc_notification) + 8];
+    struct usb_cdc_notification *ntf = (void*)_b;
+    ntf->bmRequestType = USB_REQ_DEVTOHOST | USB_REQ_CLASS | USB_REQ_INTERFACE;
+    ntf->wIndex = ncm->comm_if;
+    if (ncm->ntf_pending & NCM_NTF_SPEED) {
+        ncm->ntf_pending &= ~NCM_NTF_SPEED;
+        ntf->bNotificationType = USB_CDC_NTF_SPEED_CHANGE;
+        ntf->wValue = 0;
+        ntf->wLength = 8;
+        memcpy(&ntf->Data[0], &ncm->bitrate, 4);
+        memcpy(&ntf->Data[4], &ncm->bitrate, 4);
+        ncm->ntf_busy = 1;
+        usbd_ep_write(ncm->dev, ncm->ntf_ep, _b, sizeof(_b));
+    } else if (ncm->ntf_pending & NCM_NTF_CONN) {
+        ncm->ntf_pending &= ~NCM_NTF_CONN;
+        ntf->bNotificationType = USB_CDC_NTF_NETWORK_CONNECTION;
+        ntf->wValue = ncm->link;
+        ntf->wLength = 0;
+        ncm->ntf_busy = 1;
+        usbd_ep_write(ncm->dev, ncm->ntf_ep, _b, sizeof(struct usb_cdc_notification));
+    } else {
+        ncm->ntf_busy = 0;
+    }
+}
+
+static void ncm_ntf_kick(usbd_cdc_ncm *ncm) {
+    if (ncm->alt && !ncm->ntf_busy) ncm_ntf_next(ncm);
+}
+
+static void cdc_ncm_evt(usbd_device *dev, uint8_t event, uint8_t ep) {
+    usbd_cdc_ncm *ncm = cdc_ncm_ep[ep & 0x07];
+    (void)dev;
+    if (ncm == 0) return;
+    if (event == usbd_evt_eptx) {
+        if ((ep & 0x07) == (ncm->ntf_ep & 0x07)) {
+            ncm_ntf_next(ncm);
+        } else {
+            ncm_tx_next(ncm);
+        }
+    } else {
+        ncm_rx(ncm);
+    }
+}
+
+/* selects data interface alternate setting. Endpoints are configured by the core with
+ * USBD_ALTSETTINGS, so only the callbacks are registered then */
+static void ncm_set_alt(usbd_cdc_ncm *ncm, uint8_t alt, bool endpoints) {
+    usbd_device *dev = ncm->dev;
+    ncm->alt = alt;
+    ncm_rx_reset(ncm);
+    ncm_tx_reset(ncm);
+    ncm->rx_hold = 0;
+    if (alt) {
+        if (endpoints) {
+            usbd_ep_config(dev, ncm->rx_ep, USB_EPTYPE_BULK, ncm->ep_size);
+            usbd_ep_config(dev, ncm->tx_ep, USB_EPTYPE_BULK, ncm->ep_size);
+        }
+        usbd_reg_endpoint(dev, ncm->rx_ep, cdc_ncm_evt);
+        usbd_reg_endpoint(dev, ncm->tx_ep, cdc_ncm_evt);
+        ncm->ntf_pending = NCM_NTF_SPEED | NCM_NTF_CONN;
+        ncm_ntf_kick(ncm);
+    } else {
+        if (endpoints) {
+            usbd_ep_deconfig(dev, ncm->tx_ep);
+            usbd_ep_deconfig(dev, ncm->rx_ep);
+        }
+        usbd_reg_endpoint(dev, ncm->rx_ep, 0);
+        usbd_reg_endpoint(dev, ncm->tx_ep, 0);
+        /* NTB parameters are reset to defaults */
+        ncm->tx_max = ncm->txsize;
+        ncm->max_dgram = USBD_CDC_NCM_DGRAM_SZ;
+    }
+}
+
+void usbd_cdc_ncm_init(usbd_cdc_ncm *ncm, usbd_device *dev, uint8_t comm_if, uint8_t data_if,
+                       uint8_t rx_ep, uint8_t tx_ep, uint8_t ntf_ep, uint8_t ep_size,
+                       void *rxbuf, uint16_t rxsize, void *txbuf, uint16_t txsize) {
+    memset(ncm, 0, sizeof(usbd_cdc_ncm));
+    ncm->dev = dev;
+    ncm->comm_if = comm_if;
+    ncm->data_if = data_if;
+    ncm->rx_ep = rx_ep;
+    ncm->tx_ep = tx_ep;
+    ncm->ntf_ep = ntf_ep;
+    ncm->ep_size = (ep_size > NCM_MAX_PKT) ? NCM_MAX_PKT : ep_size;
+    ncm->rxbuf = rxbuf;
+    ncm->rxsize = rxsize;
+    ncm->txbuf = txbuf;
+    ncm->txsize = (txsize / 2) & ~(NCM_ALIGN - 1);
+    ncm->tx_max = ncm->txsize;
+    ncm->max_dgram = USBD_CDC_NCM_DGRAM_SZ;
+}
+
+void usbd_cdc_ncm_enable(usbd_cdc_ncm *ncm, bool enable) {
+    usbd_device *dev = ncm->dev;
+    if (enable) {
+        cdc_ncm_ep[ncm->rx_ep & 0x07] = ncm;
+        cdc_ncm_ep[ncm->tx_ep & 0x07] = ncm;
+        cdc_ncm_ep[ncm->ntf_ep & 0x07] = ncm;
+        ncm->ntf_busy = 0;
+        usbd_ep_config(dev, ncm->ntf_ep, USB_EPTYPE_INTERRUPT, USBD_CDC_NCM_NTF_SZ);
+        usbd_reg_endpoint(dev, ncm->ntf_ep, cdc_ncm_evt);
+        ncm->alt = 0;
+    } else {
+        if (ncm->alt) ncm_set_alt(ncm, 0, true);
+        usbd_ep_deconfig(dev, ncm->ntf_ep);
+        usbd_reg_endpoint(dev, ncm->ntf_ep, 0);
+    }
+}
+
+#if !defined(USBD_ALTSETTINGS)
+static usbd_respond ncm_control_std(usbd_cdc_ncm *ncm, usbd_ctlreq *req) {
+    if (req->wIndex != ncm->data_if && req->wIndex != ncm->comm_if) return usbd_fail;
+    switch (req->bRequest) {
+    case USB_STD_GET_INTERFACE:
+        req->data[0] = (req->wIndex == ncm->data_if) ? ncm->alt : 0;
+        ncm->dev->status.data_count = 1;
+        return usbd_ack;
+    case USB_STD_SET_INTERFACE:
+        if (req->wIndex == ncm->comm_if) {
+            return (req->wValue == 0) ? usbd_ack : usbd_fail;
+        }
+        if (req->wValue > 1) return usbd_fail;
+        ncm_set_alt(ncm, req->wValue, true);
+        return usbd_ack;
+    default:
+        return usbd_fail;
+    }
+}
+#else
+void usbd_cdc_ncm_altsetting(usbd_cdc_ncm *ncm, uint8_t intf, uint8_t alt) {
+    if (intf == ncm->data_if) ncm_set_alt(ncm, alt, false);
+}
+#endif
+
+usbd_respond usbd_cdc_ncm_control(usbd_cdc_ncm *ncm, usbd_ctlreq *req) {
+    usbd_device *dev = ncm->dev;
+    uint32_t _v;
+    switch ((USB_REQ_RECIPIENT | USB_REQ_TYPE) & req->bmRequestType) {
+#if !defined(USBD_ALTSETTINGS)
+    case USB_REQ_INTERFACE | USB_REQ_STANDARD:
+        return ncm_control_std(ncm, req);
+#endif
+    case USB_REQ_INTERFACE | USB_REQ_CLASS:
+        if (req->wIndex == ncm->comm_if) break;
+        return usbd_fail;
+    default:
+        return usbd_fail;
+    }
+    switch (req->bRequest) {
+    case USB_CDC_GET_NTB_PARAMETERS: {
+        struct usb_cdc_ncm_ntb_params *p = (void*)req->data;
+        p->wLength = sizeof(struct usb_cdc_ncm_ntb_params);
+        p->bmNtbFormatsSupported = USB_CDC_NCM_NTB16_SUPPORTED;
+        p->dwNtbInMaxSize = ncm->txsize;
+        p->wNdpInDivisor = NCM_ALIGN;
+        p->wNdpInPayloadRemainder = 0;
+        p->wNdpInAlignment = NCM_ALIGN;
+        p->wReserved = 0;
+        p->dwNtbOutMaxSize = ncm->rxsize;
+        p->wNdpOutDivisor = NCM_ALIGN;
+        p->wNdpOutPayloadRemainder = 0;
+        p->wNdpOutAlignment = NCM_ALIGN;
+        p->wNtbOutMaxDatagrams = 0;
+        dev->status.data_count = sizeof(struct usb_cdc_ncm_ntb_params);
+        return usbd_ack;
+    }
+    case USB_CDC_GET_NTB_FORMAT:
+    case USB_CDC_GET_CRC_MODE:
+        req->data[0] = 0;
+        req->data[1] = 0;
+        dev->status.data_count = 2;
+        return usbd_ack;
+    case USB_CDC_SET_NTB_FORMAT:
+        return (req->wValue == USB_CDC_NCM_NTB16) ? usbd_ack : usbd_fail;
+    case USB_CDC_SET_CRC_MODE:
+        return (req->wValue == 0) ? usbd_ack : usbd_fail;
+    case USB_CDC_GET_NTB_INPUT_SIZE:
+        _v = ncm->tx_max;
+        memcpy(req->data, &_v, 4);
+        dev->status.data_count = 4;
+        return usbd_ack;
+    case USB_CDC_SET_NTB_INPUT_SIZE:
+        if (req->wLength < 4) return usbd_fail;
+        memcpy(&_v, req->data, 4);
+        if (_v > ncm->txsize || _v < (NCM_ALIGNED(sizeof(struct usb_cdc_ncm_nth16)) + NCM_NDP_SIZE(1))) {
+            return usbd_fail;
+        }
+        ncm->tx_max = _v;
+        return usbd_ack;
+    case USB_CDC_GET_MAX_DATAGRAM_SIZE:
+        memcpy(req->data, &ncm->max_dgram, 2);
+        dev->status.data_count = 2;
+        return usbd_ack;
+    case USB_CDC_SET_MAX_DATAGRAM_SIZE:
+        if (req->wLength < 2) return usbd_fail;
+        memcpy(&ncm->max_dgram, req->data, 2);
+        return usbd_ack;
+    case USB_CDC_SET_ETH_PACKET_FILTER:
+        ncm->pkt_filter = req->wValue;
+        return usbd_ack;
+    default:
+        return usbd_fail;
+    }
+}
+
+uint16_t usbd_cdc_ncm_rx_frame(usbd_cdc_ncm *ncm, const uint8_t **frame) {
+    while (ncm->rx_state == NCM_RX_READY) {
+        const struct usb_cdc_ncm_ndp16 *ndp = (const void*)&ncm->rxbuf[ncm->rx_ndp];
+        if (ncm->rx_ndp < sizeof(struct usb_cdc_ncm_nth16) ||
+            (ncm->rx_ndp + sizeof(struct usb_cdc_ncm_ndp16)) > ncm->rx_len ||
+            ndp->dwSignature != USB_CDC_NCM_NDP16_NOCRC_SIGN ||
+            (ncm->rx_ndp + ndp->wLength) > ncm->rx_len) {
+            /* no more NDPs. release NTB */
+            ncm_rx_reset(ncm);
+            if (ncm->rx_hold) ncm_rx(ncm);
+            break;
+        }
+        uint16_t _n = (ndp->wLength - sizeof(struct usb_cdc_ncm_ndp16)) / sizeof(struct usb_cdc_ncm_dpe16);
+        if (ncm->rx_dpe < _n) {
+            const struct usb_cdc_ncm_dpe16 *dpe = &ndp->wDatagram[ncm->rx_dpe];
+            if (dpe->wDatagramIndex != 0 && dpe->wDatagramLength != 0) {
+                if ((uint32_t)(dpe->wDatagramIndex + dpe->wDatagramLength) > ncm->rx_len) {
+                    /* broken entry. skip it */
+                    ncm->rx_dpe++;
+                    continue;
+                }
+                *frame = &ncm->rxbuf[dpe->wDatagramIndex];
+                return dpe->wDatagramLength;
+            }
+        }
+        /* NDPs are walked in ascending order only to avoid loops */
+        if (ndp->wNextNdpIndex <= ncm->rx_ndp) {
+            ncm->rx_ndp = 0;
+        } else {
+            ncm->rx_ndp = ndp->wNextNdpIndex;
+        }
+        ncm->rx_dpe = 0;
+    }
+    return 0;
+}
+
+void usbd_cdc_ncm_rx_release(usbd_cdc_ncm *ncm) {
+    if (ncm->rx_state == NCM_RX_READY) ncm->rx_dpe++;
+}
+
+uint8_t *usbd_cdc_ncm_tx_alloc(usbd_cdc_ncm *ncm, uint16_t len) {
+    if (ncm->alt == 0 || len == 0) return 0;
+    if (ncm->tx_cnt >= USBD_CDC_NCM_MAX_DGRAMS ||
+        (uint32_t)(NCM_ALIGNED(ncm->tx_pos + len) + NCM_NDP_SIZE(ncm->tx_cnt + 1)) > ncm->tx_max) {
+        return 0;
+    }
+    return &ncm->txbuf[ncm->tx_fill * ncm->txsize + ncm->tx_pos];
+}
+
+void usbd_cdc_ncm_tx_commit(usbd_cdc_ncm *ncm, uint16_t len) {
+    ncm->tx_dpe[ncm->tx_cnt].wDatagramIndex = ncm->tx_pos;
+    ncm->tx_dpe[ncm->tx_cnt].wDatagramLength = len;
+    ncm->tx_cnt++;
+    ncm->tx_pos = NCM_ALIGNED(ncm->tx_pos + len);
+    if (!ncm->tx_busy) ncm_tx_flush(ncm);
+}
+
+void usbd_cdc_ncm_link(usbd_cdc_ncm *ncm, bool up, uint32_t bitrate) {
+    ncm->link = up ? 1 : 0;
+    ncm->bitrate = bitrate;
+    ncm->ntf_pending = NCM_NTF_SPEED | NCM_NTF_CONN;
+    ncm_ntf_kick(ncm);
+}
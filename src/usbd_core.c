@@ -19,6 +19,393 @@
 
 #define _MIN(a, b) ((a) < (b)) ? (a) : (b)
 
+#if defined(USBD_TRACE)
+usbd_trace_buf usbd_trace = {
+    .magic      = USBD_TRACE_MAGIC,
+    .size       = USBD_TRACE,
+    .rec_size   = sizeof(usbd_trace_rec),
+    .clock      = USBD_TRACE_CLOCK,
+    .mask       = USBD_TRACE_MASK,
+};
+#endif
+
+#if defined(USBD_LATENCY)
+usbd_latency_buf usbd_latency;
+
+void usbd_lat_reset(void) {
+#if defined(USBD_LAT_DWT)
+    *(volatile uint32_t*)0xE000EDFC |= (1 << 24);   /* CoreDebug->DEMCR TRCENA */
+    *(volatile uint32_t*)0xE0001000 |= (1 << 0);    /* DWT->CTRL CYCCNTENA */
+#endif
+    usbd_latency = (usbd_latency_buf){0};
+}
+
+/** \brief Times the control transfer stages
+ * \param dev usb device
+ * \param state control state before the event
+ * \param start event arrival time
+ */
+static void usbd_lat_ctl(usbd_device *dev, uint8_t state, uint32_t start) {
+    uint8_t _n = dev->status.control_state;
+    if (state == usbd_ctl_idle) {
+        usbd_lat_put(ctl, usbd_lat_setup, start);
+        dev->lat_mark = start;
+    } else if ((_n == usbd_ctl_statusin || _n == usbd_ctl_statusout) && _n != state) {
+        /* last DATA packet passed */
+        usbd_lat_bin(&usbd_latency.ctl[usbd_lat_data], start - dev->lat_mark);
+        dev->lat_mark = start;
+    } else if (_n == usbd_ctl_idle && (state == usbd_ctl_statusin || state == usbd_ctl_statusout)) {
+        usbd_lat_bin(&usbd_latency.ctl[usbd_lat_status], start - dev->lat_mark);
+    }
+}
+#else
+#define usbd_lat_ctl(dev, state, start) ((void)(state), (void)(start))
+#endif
+
+#if defined(USBD_SCHED)
+#define SCHED_FRAME_MASK    0x7FF
+
+/** \brief Links the job into the wheel slot of the due frame
+ * \param s scheduler
+ * \param job job to link
+ * \param due due frame number
+ */
+static void usbd_sched_link(usbd_sched *s, usbd_sched_job *job, uint16_t due) {
+    usbd_sched_job **slot = &s->wheel[due & (USBD_SCHED - 1)];
+    /* slot is visited every USBD_SCHED frames after the last processed one */
+    job->rounds = (((due - s->frame) & SCHED_FRAME_MASK) - 1) / USBD_SCHED;
+    job->next = *slot;
+    *slot = job;
+}
+
+void usbd_sched_add(usbd_device *dev, usbd_sched_job *job, uint8_t ep, uint16_t interval,
+                    usbd_evt_callback callback) {
+    usbd_sched *s = &dev->sched;
+    uint16_t now = usbd_hw_call(dev, frame_no) & SCHED_FRAME_MASK;
+    if (s->jobs++ == 0) s->frame = now;
+    if (interval == 0) interval = 1;
+    job->callback = callback;
+    job->interval = interval & SCHED_FRAME_MASK;
+    job->ep = ep;
+    usbd_sched_link(s, job, now + job->interval);
+}
+
+/** \brief Unlinks the job from the list
+ * \return true if the job was found
+ */
+static bool usbd_sched_unlink(usbd_sched_job **p, usbd_sched_job *job) {
+    for (; *p; p = &(*p)->next) {
+        if (*p == job) {
+            *p = job->next;
+            return true;
+        }
+    }
+    return false;
+}
+
+void usbd_sched_remove(usbd_device *dev, usbd_sched_job *job) {
+    usbd_sched *s = &dev->sched;
+    /* job may wait in the running batch of usbd_sched_poll */
+    bool found = usbd_sched_unlink(&s->due, job);
+    for (int i = 0; !found && i < USBD_SCHED; i++) {
+        found = usbd_sched_unlink(&s->wheel[i], job);
+    }
+    if (found) s->jobs--;
+}
+
+void usbd_sched_poll(usbd_device *dev) {
+    usbd_sched *s = &dev->sched;
+    uint16_t now = usbd_hw_call(dev, frame_no) & SCHED_FRAME_MASK;
+    bool run = (dev->status.device_state == usbd_state_configured);
+    if (s->jobs == 0) {
+        s->frame = now;
+        return;
+    }
+    /* collect jobs due in the elapsed frames. The wheel ages also while not configured, so the
+     * rounds stay relative to the last processed frame */
+    while (s->frame != now) {
+        s->frame = (s->frame + 1) & SCHED_FRAME_MASK;
+        usbd_sched_job **p = &s->wheel[s->frame & (USBD_SCHED - 1)];
+        while (*p) {
+            usbd_sched_job *job = *p;
+            if (job->rounds) {
+                job->rounds--;
+                p = &job->next;
+            } else {
+                *p = job->next;
+                job->next = s->due;
+                s->due = job;
+            }
+        }
+    }
+    /* rearm before the callback, so it may remove or reschedule the job. Callback may also
+     * remove the jobs still waiting in the batch */
+    while (s->due) {
+        usbd_sched_job *job = s->due;
+        s->due = job->next;
+        usbd_sched_link(s, job, now + job->interval);
+        if (run) job->callback(dev, usbd_evt_sof, job->ep);
+    }
+}
+#endif
+
+/** \brief Gets configuration descriptor from the application
+ * \param dev usb device
+ * \param config configuration number
+ * \param[out] size wTotalLength of the descriptor. May be NULL.
+ * \return pointer to the configuration descriptor or NULL if the application returned less data
+ * than wTotalLength
+ */
+static const struct usb_config_descriptor *usbd_config_desc(usbd_device *dev, uint8_t config,
+                                                            uint16_t *size) {
+    usbd_ctlreq req = {
+        .bmRequestType  = USB_REQ_DEVTOHOST | USB_REQ_STANDARD | USB_REQ_DEVICE,
+        .bRequest       = USB_STD_GET_DESCRIPTOR,
+        /* configuration index is assumed to be one less than the configuration value */
+        .wValue         = (USB_DTYPE_CONFIGURATION << 8) | (config - 1),
+    };
+    void *desc = ((usbd_ctlreq*)dev->status.data_buf)->data;
+    uint16_t len = dev->status.data_maxsize;
+    if (config == 0 || usbd_dev_cfg(dev)->descriptor_callback == 0) return 0;
+    if (usbd_dev_cfg(dev)->descriptor_callback(&req, &desc, &len) != usbd_ack) return 0;
+    if (len < sizeof(struct usb_config_descriptor)) return 0;
+    /* descriptor walks must not run beyond the returned data */
+    if (len < ((const struct usb_config_descriptor*)desc)->wTotalLength) return 0;
+    if (size) *size = ((const struct usb_config_descriptor*)desc)->wTotalLength;
+    return desc;
+}
+
+#if defined(USBD_BW_CHECK)
+/* protocol overhead of the periodic transaction in bytes. USB 2.0 5.11.3 */
+#define BW_FS_ISO_OVH       9
+#define BW_FS_INT_OVH       13
+#define BW_HS_ISO_OVH       38
+#define BW_HS_INT_OVH       55
+/* periodic budget. 90% of the FS frame and 80% of the HS microframe */
+#define BW_FS_BUDGET        1350
+#define BW_HS_BUDGET        6000
+
+/* sums of the large configurations exceed 16 bits */
+typedef struct {
+    uint32_t    frame;
+    uint32_t    buf;
+} usbd_bw_sum;
+
+static void usbd_bw_max(usbd_bw_sum *dst, const usbd_bw_sum *src) {
+    if (src->frame > dst->frame) dst->frame = src->frame;
+    if (src->buf > dst->buf) dst->buf = src->buf;
+}
+
+uint8_t usbd_bw_check(const void *config, uint16_t len, bool hs, uint16_t bufsize, usbd_bw_report *rep) {
+    const uint8_t *d = config;
+    const uint8_t *end = d + ((const struct usb_config_descriptor*)config)->wTotalLength;
+    usbd_bw_sum total = {0}, intf = {0}, alt = {0};
+    uint8_t inum = 0xFF, anum = 0, count = 0;
+    uint8_t status = 0;
+    if (len < sizeof(struct usb_config_descriptor) || d + len < end) {
+        status |= USBD_BW_BAD_DESC;
+        end = d + ((len < sizeof(struct usb_config_descriptor)) ? 0 : len);
+    }
+    for (; d < end; d += d[0]) {
+        if (d[0] < 2 || d + d[0] > end) {
+            status |= USBD_BW_BAD_DESC;
+            break;
+        }
+        if (d[1] == USB_DTYPE_INTERFACE) {
+            const struct usb_interface_descriptor *id = (const void*)d;
+            /* alternate settings of the same interface are exclusive */
+            usbd_bw_max(&intf, &alt);
+            alt = (usbd_bw_sum){0};
+            if (id->bInterfaceNumber != inum) {
+                total.frame += intf.frame;
+                total.buf += intf.buf;
+                intf = (usbd_bw_sum){0};
+                inum = id->bInterfaceNumber;
+            }
+            anum = id->bAlternateSetting;
+        } else if (d[1] == USB_DTYPE_ENDPOINT) {
+            const struct usb_endpoint_descriptor *ed = (const void*)d;
+            uint8_t type = ed->bmAttributes & 0x03;
+            uint16_t size = ed->wMaxPacketSize & 0x7FF;
+            uint16_t trans = 1;
+            uint16_t frame = 0;
+            if (hs && (type == USB_EPTYPE_ISOCHRONUS || type == USB_EPTYPE_INTERRUPT)) {
+                /* high bandwidth endpoint */
+                trans += (ed->wMaxPacketSize >> 11) & 0x03;
+            }
+            if (type == USB_EPTYPE_ISOCHRONUS) {
+                frame = trans * (size + (hs ? BW_HS_ISO_OVH : BW_FS_ISO_OVH));
+            } else if (type == USB_EPTYPE_INTERRUPT) {
+                frame = trans * (size + (hs ? BW_HS_INT_OVH : BW_FS_INT_OVH));
+            }
+            size *= trans;
+            alt.frame += frame;
+            alt.buf += (type == USB_EPTYPE_ISOCHRONUS) ? 2 * size : size;
+            if (rep && count < USBD_BW_EPS) {
+                rep->ep[count] = (usbd_bw_ep){
+                    .ep     = ed->bEndpointAddress,
+                    .type   = ed->bmAttributes,
+                    .intf   = inum,
+                    .alt    = anum,
+                    .size   = size,
+                    .frame  = frame,
+                    .buf    = (type == USB_EPTYPE_ISOCHRONUS) ? 2 * size : size,
+                };
+                count++;
+            }
+        }
+    }
+    usbd_bw_max(&intf, &alt);
+    total.frame += intf.frame;
+    total.buf += intf.buf;
+    if (total.frame > (hs ? BW_HS_BUDGET : BW_FS_BUDGET)) status |= USBD_BW_OVER_FRAME;
+    if (bufsize && total.buf > bufsize) status |= USBD_BW_OVER_BUF;
+    if (rep) {
+        rep->count = count;
+        rep->status = status;
+        rep->frame = total.frame;
+        rep->budget = hs ? BW_HS_BUDGET : BW_FS_BUDGET;
+        rep->buf = total.buf;
+    }
+    return status;
+}
+
+/** \brief Checks the configuration descriptor before the configuration
+ * \param dev usb device
+ * \param config configuration number
+ * \return \ref USBD_BW_STATUS flags
+ */
+static uint8_t usbd_bw_config(usbd_device *dev, uint8_t config) {
+    uint16_t len;
+    const struct usb_config_descriptor *desc = usbd_config_desc(dev, config, &len);
+    bool hs = (usbd_hw_call(dev, getinfo) & USBD_HW_SPEED_HS) == USBD_HW_SPEED_HS;
+#if !defined(USBD_BW_BUFSIZE)
+    const uint16_t bufsize = 0;
+#else
+    const uint16_t bufsize = USBD_BW_BUFSIZE;
+#endif
+    if (desc == 0) return 0;
+    return usbd_bw_check(desc, len, hs, bufsize, 0);
+}
+#endif
+
+#if defined(USBD_ALTSETTINGS)
+/** \brief Finds the interface alternate setting in the configuration descriptor
+ * \param cfg configuration descriptor
+ * \param len length of the descriptor data
+ * \param intf interface number
+ * \param alt alternate setting
+ * \return pointer to the interface descriptor or NULL
+ */
+static const uint8_t *usbd_alt_find(const struct usb_config_descriptor *cfg, uint16_t len,
+                                    uint8_t intf, uint8_t alt) {
+    const uint8_t *d = (const uint8_t*)cfg;
+    const uint8_t *end = d + len;
+    for (; d + 2 <= end && d[0] >= 2; d += d[0]) {
+        const struct usb_interface_descriptor *id = (const void*)d;
+        if (d[1] == USB_DTYPE_INTERFACE && id->bInterfaceNumber == intf &&
+            id->bAlternateSetting == alt) return d;
+    }
+    return 0;
+}
+
+/** \brief Checks if the alternate setting shares the endpoint number with other interfaces
+ * \details Drivers deconfigure both directions of the endpoint number, so switching such a
+ * setting would disable the endpoint of the other interface.
+ * \param cfg configuration descriptor
+ * \param len length of the descriptor data
+ * \param intf interface number
+ * \param alt alternate setting
+ * \return true if endpoint number is shared
+ */
+static bool usbd_alt_shared(const struct usb_config_descriptor *cfg, uint16_t len, uint8_t intf,
+                            uint8_t alt) {
+    const uint8_t *d = (const uint8_t*)cfg;
+    const uint8_t *end = d + len;
+    uint16_t own = 0, other = 0;
+    uint8_t inum = 0xFF, anum = 0;
+    for (; d + 2 <= end && d[0] >= 2; d += d[0]) {
+        if (d[1] == USB_DTYPE_INTERFACE) {
+            const struct usb_interface_descriptor *id = (const void*)d;
+            inum = id->bInterfaceNumber;
+            anum = id->bAlternateSetting;
+        } else if (d[1] == USB_DTYPE_ENDPOINT) {
+            const struct usb_endpoint_descriptor *ed = (const void*)d;
+            uint16_t mask = 1 << (ed->bEndpointAddress & 0x0F);
+            if (inum != intf) {
+                other |= mask;
+            } else if (anum == alt) {
+                own |= mask;
+            }
+        }
+    }
+    return (own & other) != 0;
+}
+
+/** \brief Configures or deconfigures endpoints of the interface alternate setting
+ * \param dev usb device
+ * \param cfg configuration descriptor
+ * \param len length of the descriptor data
+ * \param intf interface number
+ * \param alt alternate setting
+ * \param enable configure endpoints if true, deconfigure otherwise
+ * \return false if endpoint configuration failed
+ */
+static bool usbd_alt_endpoints(usbd_device *dev, const struct usb_config_descriptor *cfg, uint16_t len,
+                               uint8_t intf, uint8_t alt, bool enable) {
+    const uint8_t *d = usbd_alt_find(cfg, len, intf, alt);
+    const uint8_t *end = (const uint8_t*)cfg + len;
+    if (d == 0) return false;
+    /* endpoints follow the interface descriptor until the next one */
+    for (d += d[0]; d + 2 <= end && d[0] >= 2 && d[1] != USB_DTYPE_INTERFACE; d += d[0]) {
+        const struct usb_endpoint_descriptor *ed = (const void*)d;
+        if (d[1] != USB_DTYPE_ENDPOINT) continue;
+        if (!enable) {
+            usbd_ep_deconfig(dev, ed->bEndpointAddress);
+        } else if (!usbd_ep_config(dev, ed->bEndpointAddress, ed->bmAttributes & 0x03,
+                                   ed->wMaxPacketSize & 0x7FF)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** \brief SET_INTERFACE request processing
+ * \details Deconfigures endpoints of the current alternate setting and configures endpoints
+ * of the new one.
+ * \param dev usb device
+ * \param intf interface number
+ * \param alt new alternate setting
+ * \return usbd_ack if success
+ */
+static usbd_respond usbd_set_altsetting(usbd_device *dev, uint8_t intf, uint8_t alt) {
+    const struct usb_config_descriptor *cfg;
+    uint16_t len;
+    uint8_t cur;
+    if (dev->status.device_state != usbd_state_configured || intf >= USBD_ALTSETTINGS) return usbd_fail;
+    cfg = usbd_config_desc(dev, dev->status.device_cfg, &len);
+    if (cfg == 0 || usbd_alt_find(cfg, len, intf, alt) == 0) return usbd_fail;
+    cur = dev->altsetting[intf];
+    if (usbd_alt_shared(cfg, len, intf, cur) || usbd_alt_shared(cfg, len, intf, alt)) return usbd_fail;
+    usbd_alt_endpoints(dev, cfg, len, intf, cur, false);
+    if (!usbd_alt_endpoints(dev, cfg, len, intf, alt, true)) {
+        /* not enough endpoint buffers. going back to the current setting */
+        usbd_alt_endpoints(dev, cfg, len, intf, alt, false);
+        if (!usbd_alt_endpoints(dev, cfg, len, intf, cur, true) && cur != 0) {
+            /* current setting can't be restored either. falling back to the default one */
+            usbd_alt_endpoints(dev, cfg, len, intf, cur, false);
+            usbd_alt_endpoints(dev, cfg, len, intf, 0, true);
+            dev->altsetting[intf] = 0;
+            if (usbd_dev_cfg(dev)->alt_callback) usbd_dev_cfg(dev)->alt_callback(dev, intf, 0);
+        }
+        return usbd_fail;
+    }
+    dev->altsetting[intf] = alt;
+    if (usbd_dev_cfg(dev)->alt_callback) usbd_dev_cfg(dev)->alt_callback(dev, intf, alt);
+    return usbd_ack;
+}
+#endif
+
 static void usbd_process_ep0 (usbd_device *dev, uint8_t event, uint8_t ep);
 
 /** \brief Resets USB device state
@@ -29,9 +416,14 @@ static void usbd_process_reset(usbd_device *dev) {
     dev->status.device_state = usbd_state_default;
     dev->status.control_state = usbd_ctl_idle;
     dev->status.device_cfg = 0;
-    dev->driver->ep_config(0, USB_EPTYPE_CONTROL, dev->status.ep0size);
+    dev->status.remote_wakeup = 0;
+    dev->status.suspended = 0;
+#if defined(USBD_ALTSETTINGS)
+    for (int i = 0; i < USBD_ALTSETTINGS; i++) dev->altsetting[i] = 0;
+#endif
+    usbd_hw_call(dev, ep_config, 0, USB_EPTYPE_CONTROL, dev->status.ep0size);
     dev->endpoint[0] = usbd_process_ep0;
-    dev->driver->setaddr(0);
+    usbd_hw_call(dev, setaddr, 0);
 }
 
 /** \brief Callback that sets USB device address
@@ -40,7 +432,7 @@ static void usbd_process_reset(usbd_device *dev) {
  * \return none
  */
 static void usbd_set_address (usbd_device *dev, usbd_ctlreq *req) {
-    dev->driver->setaddr(req->wValue);
+    usbd_hw_call(dev, setaddr, req->wValue);
     dev->status.device_state = (req->wValue) ? usbd_state_addressed : usbd_state_default;
 }
 
@@ -61,8 +453,18 @@ static void usbd_process_callback (usbd_device *dev) {
  * \return usbd_ack if success
  */
 static usbd_respond usbd_configure(usbd_device *dev, uint8_t config) {
-    if (dev->config_callback) {
-        if (dev->config_callback(dev, config) == usbd_ack) {
+#if defined(USBD_BW_CHECK)
+    dev->bw_status = usbd_bw_config(dev, config);
+#if !defined(USBD_BW_WARN)
+    if (dev->bw_status) return usbd_fail;
+#endif
+#endif
+    if (usbd_dev_cfg(dev)->config_callback) {
+        if (usbd_dev_cfg(dev)->config_callback(dev, config) == usbd_ack) {
+#if defined(USBD_ALTSETTINGS)
+            /* configuration selects alternate setting 0 of every interface */
+            for (int i = 0; i < USBD_ALTSETTINGS; i++) dev->altsetting[i] = 0;
+#endif
             dev->status.device_cfg = config;
             dev->status.device_state = (config) ? usbd_state_configured : usbd_state_addressed;
             return usbd_ack;
@@ -80,23 +482,26 @@ static usbd_respond usbd_configure(usbd_device *dev, uint8_t config) {
 static usbd_respond usbd_process_devrq (usbd_device *dev, usbd_ctlreq *req) {
     switch (req->bRequest) {
     case USB_STD_CLEAR_FEATURE:
-        /* not yet supported */
+        if (req->wValue == USB_FEAT_REMOTE_WKUP) {
+            dev->status.remote_wakeup = 0;
+            return usbd_ack;
+        }
         break;
     case USB_STD_GET_CONFIG:
         req->data[0] = dev->status.device_cfg;
         return usbd_ack;
     case USB_STD_GET_DESCRIPTOR:
         if (req->wValue == ((USB_DTYPE_STRING << 8) | INTSERIALNO_DESCRIPTOR )) {
-            dev->status.data_count = dev->driver->get_serialno_desc(req->data);
+            dev->status.data_count = usbd_hw_call(dev, get_serialno_desc, req->data);
             return usbd_ack;
         } else {
-            if (dev->descriptor_callback) {
-                return dev->descriptor_callback(req, &(dev->status.data_ptr), &(dev->status.data_count));
+            if (usbd_dev_cfg(dev)->descriptor_callback) {
+                return usbd_dev_cfg(dev)->descriptor_callback(req, &(dev->status.data_ptr), &(dev->status.data_count));
             }
         }
         break;
     case USB_STD_GET_STATUS:
-        req->data[0] = 0;
+        req->data[0] = (dev->status.remote_wakeup) ? 0x02 : 0;
         req->data[1] = 0;
         return usbd_ack;
     case USB_STD_SET_ADDRESS:
@@ -112,7 +517,15 @@ static usbd_respond usbd_process_devrq (usbd_device *dev, usbd_ctlreq *req) {
         /* should be externally handled */
         break;
     case USB_STD_SET_FEATURE:
-        /* not yet supported */
+        if (req->wValue == USB_FEAT_REMOTE_WKUP) {
+            /* the feature is only supported by configurations declaring it.
+             * Addressed device is checked against the first configuration. */
+            const struct usb_config_descriptor *cfg =
+                usbd_config_desc(dev, dev->status.device_cfg ? dev->status.device_cfg : 1, 0);
+            if (cfg == 0 || !(cfg->bmAttributes & USB_CFG_ATTR_REMOTEWAKEUP)) break;
+            dev->status.remote_wakeup = 1;
+            return usbd_ack;
+        }
         break;
     default:
         break;
@@ -132,6 +545,16 @@ static usbd_respond usbd_process_intrq(usbd_device *dev, usbd_ctlreq *req) {
         req->data[0] = 0;
         req->data[1] = 0;
         return usbd_ack;
+#if defined(USBD_ALTSETTINGS)
+    case USB_STD_GET_INTERFACE:
+        if (dev->status.device_state != usbd_state_configured) break;
+        if ((req->wIndex & 0xFF) >= USBD_ALTSETTINGS) break;
+        req->data[0] = dev->altsetting[req->wIndex & 0xFF];
+        dev->status.data_count = 1;
+        return usbd_ack;
+    case USB_STD_SET_INTERFACE:
+        return usbd_set_altsetting(dev, req->wIndex & 0xFF, req->wValue & 0xFF);
+#endif
     default:
         break;
     }
@@ -146,13 +569,14 @@ static usbd_respond usbd_process_intrq(usbd_device *dev, usbd_ctlreq *req) {
 static usbd_respond usbd_process_eptrq(usbd_device *dev, usbd_ctlreq *req) {
     switch (req->bRequest) {
     case USB_STD_SET_FEATURE:
-        dev->driver->ep_setstall(req->wIndex, 1);
+        usbd_stats_stall(dev, req->wIndex);
+        usbd_hw_call(dev, ep_setstall, req->wIndex, 1);
         return usbd_ack;
     case USB_STD_CLEAR_FEATURE:
-        dev->driver->ep_setstall(req->wIndex, 0);
+        usbd_hw_call(dev, ep_setstall, req->wIndex, 0);
         return usbd_ack;
     case USB_STD_GET_STATUS:
-        req->data[0] = dev->driver->ep_isstalled(req->wIndex) ? 1 : 0;
+        req->data[0] = usbd_hw_call(dev, ep_isstalled, req->wIndex) ? 1 : 0;
         req->data[1] = 0;
         return usbd_ack;
     default:
@@ -161,6 +585,25 @@ static usbd_respond usbd_process_eptrq(usbd_device *dev, usbd_ctlreq *req) {
     return usbd_fail;
 }
 
+#if defined(USBD_EP_STATS) && defined(USBD_EP_STATS_REQ)
+/** \brief Vendor statistics request processing
+ * \param dev pointer to usb device
+ * \param req pointer to control request
+ * \return TRUE if request is handled
+ */
+static usbd_respond usbd_process_statsrq(usbd_device *dev, usbd_ctlreq *req) {
+    if (req->bRequest != USBD_EP_STATS_REQ) return usbd_fail;
+    if (req->bmRequestType & USB_REQ_DEVTOHOST) {
+        /* counters are sent directly, no room needed in the control buffer */
+        dev->status.data_ptr = &dev->stats;
+        dev->status.data_count = sizeof(usbd_stats);
+    } else {
+        usbd_stats_reset(dev);
+    }
+    return usbd_ack;
+}
+#endif
+
 /** \brief Processing control request
  * \param dev pointer to usb device
  * \param req pointer to usb control request
@@ -168,8 +611,8 @@ static usbd_respond usbd_process_eptrq(usbd_device *dev, usbd_ctlreq *req) {
  */
 static usbd_respond usbd_process_request(usbd_device *dev, usbd_ctlreq *req) {
     /* processing control request by callback */
-    if (dev->control_callback) {
-        usbd_respond r = dev->control_callback(dev, req, &(dev->complete_callback));
+    if (usbd_dev_cfg(dev)->control_callback) {
+        usbd_respond r = usbd_dev_cfg(dev)->control_callback(dev, req, &(dev->complete_callback));
         if (r != usbd_fail) return r;
     }
     /* continuing standard USB requests */
@@ -180,6 +623,10 @@ static usbd_respond usbd_process_request(usbd_device *dev, usbd_ctlreq *req) {
         return usbd_process_intrq(dev, req);
     case USB_REQ_STANDARD | USB_REQ_ENDPOINT:
         return usbd_process_eptrq(dev, req);
+#if defined(USBD_EP_STATS) && defined(USBD_EP_STATS_REQ)
+    case USB_REQ_VENDOR | USB_REQ_DEVICE:
+        return usbd_process_statsrq(dev, req);
+#endif
     default:
         break;
     }
@@ -192,8 +639,10 @@ static usbd_respond usbd_process_request(usbd_device *dev, usbd_ctlreq *req) {
  * \param ep endpoint number
  */
 static void usbd_stall_pid(usbd_device *dev, uint8_t ep) {
-    dev->driver->ep_setstall(ep & 0x7F, 1);
-    dev->driver->ep_setstall(ep | 0x80, 1);
+    usbd_trace_put(dev, usbd_trc_stall, ep, 0);
+    usbd_stats_stall(dev, ep);
+    usbd_hw_call(dev, ep_setstall, ep & 0x7F, 1);
+    usbd_hw_call(dev, ep_setstall, ep | 0x80, 1);
     dev->status.control_state = usbd_ctl_idle;
 }
 
@@ -208,7 +657,7 @@ static void usbd_process_eptx(usbd_device *dev, uint8_t ep) {
     case usbd_ctl_ztxdata:
     case usbd_ctl_txdata:
         _t = _MIN(dev->status.data_count, dev->status.ep0size);
-        dev->driver->ep_write(ep, dev->status.data_ptr, _t);
+        usbd_ep_write(dev, ep, dev->status.data_ptr, _t);
         dev->status.data_ptr += _t;
         dev->status.data_count -= _t;
         /* if all data is not sent */
@@ -242,7 +691,7 @@ static void usbd_process_eprx(usbd_device *dev, uint8_t ep) {
     switch (dev->status.control_state) {
     case usbd_ctl_idle:
         /* read SETUP packet, send STALL_PID if incorrect packet length */
-        if (0x08 !=  dev->driver->ep_read(ep, req, dev->status.data_maxsize)) {
+        if (0x08 !=  usbd_ep_read(dev, ep, req, dev->status.data_maxsize)) {
             return usbd_stall_pid(dev, ep);
         }
         dev->status.data_ptr = req->data;
@@ -258,7 +707,7 @@ static void usbd_process_eprx(usbd_device *dev, uint8_t ep) {
         return;
     case usbd_ctl_rxdata:
         /*receive DATA OUT packet(s) */
-        _t = dev->driver->ep_read(ep, dev->status.data_ptr, dev->status.data_count);
+        _t = usbd_ep_read(dev, ep, dev->status.data_ptr, dev->status.data_count);
         if (dev->status.data_count < _t) {
         /* if received packet is large than expected */
         /* Must be error. Let's drop this request */
@@ -272,7 +721,7 @@ static void usbd_process_eprx(usbd_device *dev, uint8_t ep) {
         break;
     case usbd_ctl_statusout:
         /* fake reading STATUS OUT */
-        dev->driver->ep_read(ep, 0, 0);
+        usbd_ep_read(dev, ep, 0, 0);
         dev->status.control_state = usbd_ctl_idle;
         return usbd_process_callback(dev);
     default:
@@ -298,7 +747,7 @@ static void usbd_process_eprx(usbd_device *dev, uint8_t ep) {
 
         } else {
             /* confirming by ZLP in STATUS_IN stage */
-            dev->driver->ep_write(ep | 0x80, 0, 0);
+            usbd_ep_write(dev, ep | 0x80, 0, 0);
             dev->status.control_state = usbd_ctl_statusin;
         }
         break;
@@ -315,42 +764,115 @@ static void usbd_process_eprx(usbd_device *dev, uint8_t ep) {
  * \param event endpoint event
  */
 static void usbd_process_ep0 (usbd_device *dev, uint8_t event, uint8_t ep) {
+    uint32_t _t = usbd_lat_clock();
+    uint8_t _s;
     switch (event) {
     case usbd_evt_epsetup:
         /* force switch to setup state */
         dev->status.control_state = usbd_ctl_idle;
         dev->complete_callback = 0;
     case usbd_evt_eprx:
-        return usbd_process_eprx(dev, ep);
+        _s = dev->status.control_state;
+        usbd_process_eprx(dev, ep);
+        break;
     case usbd_evt_eptx:
-        return usbd_process_eptx(dev, ep);
-    default:
+        _s = dev->status.control_state;
+        usbd_process_eptx(dev, ep);
         break;
+    default:
+        return;
     }
+    usbd_lat_ctl(dev, _s, _t);
 }
 
 
+#if defined(USBD_EP_STATS)
+/** \brief Counts device and endpoint events
+ * \param dev usb device
+ * \param evt usb event
+ * \param ep active endpoint
+ */
+static void usbd_stats_evt(usbd_device *dev, uint8_t evt, uint8_t ep) {
+    usbd_ep_stats *s = &dev->stats.ep[ep & 0x07];
+    switch (evt) {
+    case usbd_evt_reset:
+        dev->stats.resets++;
+        break;
+    case usbd_evt_susp:
+        dev->stats.suspends++;
+        break;
+    case usbd_evt_wkup:
+        dev->stats.wakeups++;
+        break;
+    case usbd_evt_error:
+        dev->stats.errors++;
+        break;
+    case usbd_evt_eptx:
+        s->tx_packets++;
+        break;
+    case usbd_evt_eprx:
+        s->rx_packets++;
+        break;
+    case usbd_evt_epsetup:
+        s->setups++;
+        break;
+    default:
+        break;
+    }
+}
+#endif
+
 /** \brief General event processing callback
  * \param dev usb device
  * \param evt usb event
  * \param ep active endpoint
  */
 static void usbd_process_evt(usbd_device *dev, uint8_t evt, uint8_t ep) {
+#if defined(USBD_TRACE_SOF)
+    usbd_trace_put(dev, evt, ep, 0);
+#else
+    if (evt != usbd_evt_sof) usbd_trace_put(dev, evt, ep, 0);
+#endif
+#if defined(USBD_EP_STATS)
+    usbd_stats_evt(dev, evt, ep);
+#endif
     switch (evt) {
     case usbd_evt_reset:
         usbd_process_reset(dev);
         break;
+    case usbd_evt_susp:
+    case usbd_evt_l1sleep:
+        dev->status.suspended = 1;
+        break;
+    case usbd_evt_wkup:
+        dev->status.suspended = 0;
+        break;
+#if defined(USBD_SCHED)
+    case usbd_evt_sof:
+        usbd_sched_poll(dev);
+        break;
+#endif
     case usbd_evt_eprx:
     case usbd_evt_eptx:
     case usbd_evt_epsetup:
-        if (dev->endpoint[ep & 0x07]) dev->endpoint[ep & 0x07](dev, evt, ep);
+        if (dev->endpoint[ep & 0x07]) {
+            uint32_t _t = usbd_lat_clock();
+            dev->endpoint[ep & 0x07](dev, evt, ep);
+            /* control endpoint is timed by the stages */
+            if (ep & 0x07) usbd_lat_put(ep, ep & 0x07, _t);
+        }
         break;
     default:
         break;
     }
-    if (dev->events[evt]) dev->events[evt](dev, evt, ep);
+    usbd_evt_callback _cb = usbd_dev_cfg(dev)->events[evt];
+    if (_cb) {
+        uint32_t _t = usbd_lat_clock();
+        _cb(dev, evt, ep);
+        usbd_lat_put(evt, evt, _t);
+    }
 }
 
  __attribute__((externally_visible)) void usbd_poll(usbd_device *dev) {
-    return dev->driver->poll(dev, usbd_process_evt);
+    return usbd_hw_call(dev, poll, dev, usbd_process_evt);
 }
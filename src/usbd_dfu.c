@@ -0,0 +1,242 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "usb.h"
+#include "usbd_dfu.h"
+
+static usbd_respond dfu_stall(usbd_dfu *dfu, uint8_t status) {
+    dfu->status = status;
+    dfu->state = USB_DFU_STATE_DFU_ERROR;
+    dfu->pending = 0;
+    return usbd_fail;
+}
+
+static uint32_t dfu_page(usbd_dfu *dfu, uint32_t addr) {
+    return addr - (addr - dfu->backend->start) % dfu->backend->page_size;
+}
+
+/* checks the backend operation. returns remaining time or 0 if backend is ready */
+static uint32_t dfu_wait(usbd_dfu *dfu) {
+    uint32_t tmo = 0;
+    uint8_t st = dfu->backend->status(&tmo);
+    if (st != USB_DFU_STATUS_OK) {
+        dfu_stall(dfu, st);
+        return 0;
+    }
+    return tmo;
+}
+
+/* starts the next erase or program operation of the pending block when backend is ready.
+ * returns remaining time of the running operation or 0 if block is programmed.
+ */
+static uint32_t dfu_download(usbd_dfu *dfu) {
+    const usbd_dfu_backend *be = dfu->backend;
+    uint32_t tmo;
+    uint8_t st;
+    for (;;) {
+        tmo = dfu_wait(dfu);
+        if (tmo || dfu->state == USB_DFU_STATE_DFU_ERROR) return tmo;
+        if (!dfu->pending) {
+            /* full block is programmed. erase the page that the next block will need now,
+             * so it runs while host is transferring that block */
+            if (dfu->blk_len == dfu->xfer_size &&
+                dfu->erased_end < dfu->blk_addr + dfu->blk_len + dfu->xfer_size &&
+                dfu->erased_end < be->start + be->size) {
+                st = be->erase(dfu->erased_end, &tmo);
+                dfu->erased_end += be->page_size;
+                if (st != USB_DFU_STATUS_OK) dfu_stall(dfu, st);
+            }
+            return 0;
+        }
+        tmo = 0;
+        if (dfu->erased_end < dfu->blk_addr + dfu->blk_len) {
+            st = be->erase(dfu->erased_end, &tmo);
+            dfu->erased_end += be->page_size;
+        } else {
+            st = be->program(dfu->blk_addr, dfu->buf, dfu->blk_len, &tmo);
+            dfu->pending = 0;
+        }
+        if (st != USB_DFU_STATUS_OK) {
+            dfu_stall(dfu, st);
+            return 0;
+        }
+        if (tmo) return tmo;
+    }
+}
+
+/* waits for the last operation and starts manifestation. returns remaining time */
+static uint32_t dfu_manifest(usbd_dfu *dfu) {
+    uint32_t tmo = dfu_wait(dfu);
+    if (tmo || dfu->state == USB_DFU_STATE_DFU_ERROR) return tmo;
+    if (!dfu->manifested && dfu->backend->manifest) {
+        uint8_t st = dfu->backend->manifest(&tmo);
+        if (st != USB_DFU_STATUS_OK) {
+            dfu_stall(dfu, st);
+            return 0;
+        }
+    }
+    dfu->manifested = 1;
+    return tmo;
+}
+
+static usbd_respond dfu_dnload(usbd_dfu *dfu, usbd_ctlreq *req) {
+    const usbd_dfu_backend *be = dfu->backend;
+    uint32_t addr;
+    if (req->wLength == 0) {
+        if (dfu->state != USB_DFU_STATE_DFU_DNLOADIDLE) {
+            return dfu_stall(dfu, USB_DFU_STATUS_ERR_NOTDONE);
+        }
+        dfu->manifested = 0;
+        dfu->state = USB_DFU_STATE_DFU_MANIFESTSYNC;
+        return usbd_ack;
+    }
+    if (dfu->state != USB_DFU_STATE_DFU_IDLE && dfu->state != USB_DFU_STATE_DFU_DNLOADIDLE) {
+        return dfu_stall(dfu, USB_DFU_STATUS_ERR_STALLEDPKT);
+    }
+    if (req->wLength > dfu->xfer_size) {
+        return dfu_stall(dfu, USB_DFU_STATUS_ERR_STALLEDPKT);
+    }
+    addr = be->start + (uint32_t)req->wValue * dfu->xfer_size;
+    if (addr + req->wLength > be->start + be->size || addr < be->start) {
+        return dfu_stall(dfu, USB_DFU_STATUS_ERR_ADDRESS);
+    }
+    /* pages ahead of the erased area are erased on demand. any other address
+     * starts new erased area */
+    if (dfu->state == USB_DFU_STATE_DFU_IDLE ||
+        addr < dfu->erased_start || addr > dfu->erased_end) {
+        dfu->erased_start = dfu->erased_end = dfu_page(dfu, addr);
+    }
+    /* control buffer will be reused by DFU_GETSTATUS, so keep the block */
+    memcpy(dfu->buf, req->data, req->wLength);
+    dfu->blk_addr = addr;
+    dfu->blk_len = req->wLength;
+    dfu->pending = 1;
+    dfu->state = USB_DFU_STATE_DFU_DNLOADSYNC;
+    /* start it now, host will poll the status anyway */
+    dfu_download(dfu);
+    return usbd_ack;
+}
+
+static usbd_respond dfu_upload(usbd_dfu *dfu, usbd_ctlreq *req) {
+    const usbd_dfu_backend *be = dfu->backend;
+    uint32_t addr, len;
+    if (be->read == 0 || req->wLength > dfu->xfer_size ||
+        (dfu->state != USB_DFU_STATE_DFU_IDLE && dfu->state != USB_DFU_STATE_DFU_UPLOADIDLE)) {
+        return dfu_stall(dfu, USB_DFU_STATUS_ERR_STALLEDPKT);
+    }
+    addr = (uint32_t)req->wValue * dfu->xfer_size;
+    len = (addr < be->size) ? be->size - addr : 0;
+    if (len > req->wLength) len = req->wLength;
+    if (len) len = be->read(be->start + addr, req->data, len);
+    dfu->dev->status.data_count = len;
+    /* short frame ends the upload */
+    dfu->state = (len < req->wLength) ? USB_DFU_STATE_DFU_IDLE : USB_DFU_STATE_DFU_UPLOADIDLE;
+    return usbd_ack;
+}
+
+static usbd_respond dfu_getstatus(usbd_dfu *dfu, usbd_ctlreq *req) {
+    struct usb_dfu_status *stat = (void*)req->data;
+    uint32_t tmo = 0;
+    uint8_t state;
+    switch (dfu->state) {
+    case USB_DFU_STATE_DFU_DNLOADSYNC:
+    case USB_DFU_STATE_DFU_DNBUSY:
+        tmo = dfu_download(dfu);
+        if (dfu->state != USB_DFU_STATE_DFU_ERROR) {
+            dfu->state = tmo ? USB_DFU_STATE_DFU_DNBUSY : USB_DFU_STATE_DFU_DNLOADIDLE;
+        }
+        break;
+    case USB_DFU_STATE_DFU_MANIFESTSYNC:
+    case USB_DFU_STATE_DFU_MANIFEST:
+        tmo = dfu_manifest(dfu);
+        if (dfu->state != USB_DFU_STATE_DFU_ERROR) {
+            dfu->state = tmo ? USB_DFU_STATE_DFU_MANIFEST : USB_DFU_STATE_DFU_IDLE;
+        }
+        break;
+    default:
+        break;
+    }
+    state = dfu->state;
+    /* DNBUSY and MANIFEST are left by host after the poll timeout */
+    if (state == USB_DFU_STATE_DFU_DNBUSY) dfu->state = USB_DFU_STATE_DFU_DNLOADSYNC;
+    if (state == USB_DFU_STATE_DFU_MANIFEST) dfu->state = USB_DFU_STATE_DFU_MANIFESTSYNC;
+    if (tmo > 0xFFFFFF) tmo = 0xFFFFFF;
+    stat->bStatus = dfu->status;
+    stat->bPollTimeout = tmo & 0xFF;
+    stat->wPollTimeout = tmo >> 8;
+    stat->bState = state;
+    stat->iString = 0;
+    dfu->dev->status.data_count = sizeof(struct usb_dfu_status);
+    return usbd_ack;
+}
+
+void usbd_dfu_init(usbd_dfu *dfu, usbd_device *dev, uint8_t intf,
+                   const usbd_dfu_backend *backend, void *buf, uint16_t xfer_size) {
+    memset(dfu, 0, sizeof(usbd_dfu));
+    dfu->dev = dev;
+    dfu->intf = intf;
+    dfu->backend = backend;
+    dfu->buf = buf;
+    dfu->xfer_size = xfer_size;
+    dfu->state = USB_DFU_STATE_DFU_IDLE;
+    dfu->status = USB_DFU_STATUS_OK;
+}
+
+usbd_respond usbd_dfu_control(usbd_dfu *dfu, usbd_ctlreq *req) {
+    if ((req->bmRequestType & (USB_REQ_TYPE | USB_REQ_RECIPIENT)) != (USB_REQ_CLASS | USB_REQ_INTERFACE) ||
+        req->wIndex != dfu->intf) {
+        return usbd_fail;
+    }
+    switch (req->bRequest) {
+    case USB_DFU_DETACH:
+        if (dfu->detach_callback) dfu->detach_callback(dfu, req->wValue);
+        return usbd_ack;
+    case USB_DFU_DNLOAD:
+        return dfu_dnload(dfu, req);
+    case USB_DFU_UPLOAD:
+        return dfu_upload(dfu, req);
+    case USB_DFU_GETSTATUS:
+        return dfu_getstatus(dfu, req);
+    case USB_DFU_CLRSTATUS:
+        if (dfu->state != USB_DFU_STATE_DFU_ERROR) {
+            return dfu_stall(dfu, USB_DFU_STATUS_ERR_STALLEDPKT);
+        }
+        dfu->state = USB_DFU_STATE_DFU_IDLE;
+        dfu->status = USB_DFU_STATUS_OK;
+        return usbd_ack;
+    case USB_DFU_GETSTATE:
+        req->data[0] = dfu->state;
+        dfu->dev->status.data_count = 1;
+        return usbd_ack;
+    case USB_DFU_ABORT:
+        switch (dfu->state) {
+        case USB_DFU_STATE_DFU_IDLE:
+        case USB_DFU_STATE_DFU_DNLOADSYNC:
+        case USB_DFU_STATE_DFU_DNLOADIDLE:
+        case USB_DFU_STATE_DFU_MANIFESTSYNC:
+        case USB_DFU_STATE_DFU_UPLOADIDLE:
+            dfu->pending = 0;
+            dfu->state = USB_DFU_STATE_DFU_IDLE;
+            return usbd_ack;
+        default:
+            return dfu_stall(dfu, USB_DFU_STATUS_ERR_STALLEDPKT);
+        }
+    default:
+        return dfu_stall(dfu, USB_DFU_STATUS_ERR_STALLEDPKT);
+    }
+}
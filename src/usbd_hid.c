@@ -0,0 +1,234 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "usb.h"
+#include "usbd_hid.h"
+
+#define HID_MAX_PKT         0x40
+#define HID_FRAME_MASK      0x7FF
+
+/* endpoint callbacks has no user context, so map endpoint number to the function */
+static usbd_hid *hid_ep[8];
+
+static uint8_t *hid_slot(usbd_hid_report *r, uint8_t idx) {
+    return r->buf + (uint16_t)idx * r->size;
+}
+
+/* last sent report lives in the extra slot after the queue */
+static uint8_t *hid_last(usbd_hid_report *r) {
+    return hid_slot(r, r->depth);
+}
+
+static usbd_hid_report *hid_find(usbd_hid *hid, uint8_t id) {
+    for (int i = 0; i < hid->nreports; i++) {
+        if (hid->reports[i].id == id) return &hid->reports[i];
+    }
+    return 0;
+}
+
+static int32_t hid_get16(const uint8_t *p) {
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+/* merges src into the queued dst report. fails if any non-relative field differs
+ * or relative axis sum does not fit the field */
+static bool hid_merge(usbd_hid_report *r, uint8_t *dst, const uint8_t *src) {
+    uint32_t rel = r->rel8 | r->rel16 | (r->rel16 << 1);
+    int32_t s;
+    for (int i = 0; i < r->size; i++) {
+        if (i < 32 && (rel & (1UL << i))) continue;
+        if (dst[i] != src[i]) return false;
+    }
+    for (int i = 0; i < r->size && i < 32; i++) {
+        if (r->rel8 & (1UL << i)) {
+            s = (int8_t)dst[i] + (int8_t)src[i];
+            if (s > 127 || s < -127) return false;
+        } else if (r->rel16 & (1UL << i)) {
+            s = hid_get16(&dst[i]) + hid_get16(&src[i]);
+            if (s > 32767 || s < -32767) return false;
+        }
+    }
+    for (int i = 0; i < r->size && i < 32; i++) {
+        if (r->rel8 & (1UL << i)) {
+            dst[i] = (int8_t)dst[i] + (int8_t)src[i];
+        } else if (r->rel16 & (1UL << i)) {
+            s = hid_get16(&dst[i]) + hid_get16(&src[i]);
+            dst[i] = s & 0xFF;
+            dst[i + 1] = (s >> 8) & 0xFF;
+        }
+    }
+    return true;
+}
+
+/* sends the last report slot */
+static void hid_write(usbd_hid *hid, usbd_hid_report *r) {
+    uint8_t _t[HID_MAX_PKT];
+    uint8_t *last = hid_last(r);
+    uint16_t len = 0;
+    if (r->id) _t[len++] = r->id;
+    memcpy(&_t[len], last, r->size);
+    len += r->size;
+    usbd_ep_write(hid->dev, hid->ep, _t, len);
+    hid->tx_busy = 1;
+    r->sent = 1;
+    r->sent_frame = usbd_hw_call(hid->dev, frame_no);
+    /* relative axes are not repeated by idle rate and GET_REPORT */
+    for (int i = 0; i < r->size && i < 32; i++) {
+        if (r->rel8 & (1UL << i)) last[i] = 0;
+        if (r->rel16 & (1UL << i)) last[i] = last[i + 1] = 0;
+    }
+}
+
+static void hid_tx(usbd_hid *hid) {
+    usbd_hid_report *r;
+    if (hid->tx_busy) return;
+    for (int i = 0; i < hid->nreports; i++) {
+        uint8_t idx = (hid->rr + i) % hid->nreports;
+        r = &hid->reports[idx];
+        if (r->count == 0) continue;
+        memcpy(hid_last(r), hid_slot(r, r->head), r->size);
+        r->head = (r->head + 1) % r->depth;
+        r->count--;
+        hid->rr = (idx + 1) % hid->nreports;
+        hid_write(hid, r);
+        return;
+    }
+}
+
+static void hid_txcb(usbd_device *dev, uint8_t event, uint8_t ep) {
+    usbd_hid *hid = hid_ep[ep & 0x07];
+    (void)dev;
+    (void)event;
+    hid->tx_busy = 0;
+    hid_tx(hid);
+}
+
+void usbd_hid_init(usbd_hid *hid, usbd_device *dev, uint8_t intf, uint8_t ep, uint8_t ep_size,
+                   usbd_hid_report *reports, uint8_t nreports) {
+    memset(hid, 0, sizeof(usbd_hid));
+    hid->dev = dev;
+    hid->intf = intf;
+    hid->ep = ep;
+    hid->ep_size = (ep_size > HID_MAX_PKT) ? HID_MAX_PKT : ep_size;
+    hid->reports = reports;
+    hid->nreports = nreports;
+    hid->protocol = USB_HID_PROTOMODE_REPORT;
+    hid->tx_busy = 1;
+}
+
+void usbd_hid_enable(usbd_hid *hid, bool enable) {
+    /* nothing is sent while endpoint is not configured */
+    hid->tx_busy = enable ? 0 : 1;
+    hid->rr = 0;
+    hid->protocol = USB_HID_PROTOMODE_REPORT;
+    for (int i = 0; i < hid->nreports; i++) {
+        usbd_hid_report *r = &hid->reports[i];
+        r->head = 0;
+        r->count = 0;
+        r->idle = 0;
+        r->sent = 0;
+        memset(hid_last(r), 0, r->size);
+    }
+    if (enable) {
+        hid_ep[hid->ep & 0x07] = hid;
+        usbd_ep_config(hid->dev, hid->ep, USB_EPTYPE_INTERRUPT, hid->ep_size);
+        usbd_reg_endpoint(hid->dev, hid->ep, hid_txcb);
+    } else {
+        usbd_ep_deconfig(hid->dev, hid->ep);
+        usbd_reg_endpoint(hid->dev, hid->ep, 0);
+        hid_ep[hid->ep & 0x07] = 0;
+    }
+}
+
+usbd_respond usbd_hid_control(usbd_hid *hid, usbd_ctlreq *req) {
+    usbd_hid_report *r;
+    uint8_t id = req->wValue & 0xFF;
+    if (((USB_REQ_RECIPIENT | USB_REQ_TYPE) & req->bmRequestType) != (USB_REQ_INTERFACE | USB_REQ_CLASS)
+        || req->wIndex != hid->intf) {
+        return usbd_fail;
+    }
+    switch (req->bRequest) {
+    case USB_HID_GETREPORT:
+        if ((req->wValue >> 8) != USB_HID_REPORT_IN) return usbd_fail;
+        r = hid_find(hid, id);
+        if (r == 0) return usbd_fail;
+        if (r->id) {
+            req->data[0] = r->id;
+            memcpy(&req->data[1], hid_last(r), r->size);
+        } else {
+            memcpy(req->data, hid_last(r), r->size);
+        }
+        hid->dev->status.data_count = r->size + (r->id ? 1 : 0);
+        return usbd_ack;
+    case USB_HID_SETREPORT:
+        if (hid->setreport_callback == 0) return usbd_fail;
+        return hid->setreport_callback(hid, req->wValue >> 8, id, req->data, req->wLength);
+    case USB_HID_GETIDLE:
+        r = (id || hid->nreports == 0) ? hid_find(hid, id) : &hid->reports[0];
+        if (r == 0) return usbd_fail;
+        req->data[0] = r->idle;
+        hid->dev->status.data_count = 1;
+        return usbd_ack;
+    case USB_HID_SETIDLE:
+        /* report ID 0 applies to all reports */
+        for (int i = 0; i < hid->nreports; i++) {
+            r = &hid->reports[i];
+            if (id == 0 || r->id == id) {
+                r->idle = req->wValue >> 8;
+                r->sent_frame = usbd_hw_call(hid->dev, frame_no);
+            }
+        }
+        return usbd_ack;
+    case USB_HID_GETPROTOCOL:
+        req->data[0] = hid->protocol;
+        hid->dev->status.data_count = 1;
+        return usbd_ack;
+    case USB_HID_SETPROTOCOL:
+        hid->protocol = req->wValue & 0xFF;
+        return usbd_ack;
+    default:
+        return usbd_fail;
+    }
+}
+
+bool usbd_hid_send(usbd_hid *hid, uint8_t id, const void *report) {
+    usbd_hid_report *r = hid_find(hid, id);
+    if (r == 0) return false;
+    if (r->count == 0 || !hid_merge(r, hid_slot(r, (r->head + r->count - 1) % r->depth), report)) {
+        if (r->count == r->depth) return false;
+        memcpy(hid_slot(r, (r->head + r->count) % r->depth), report, r->size);
+        r->count++;
+    }
+    hid_tx(hid);
+    return true;
+}
+
+void usbd_hid_poll(usbd_hid *hid) {
+    uint16_t now;
+    hid_tx(hid);
+    if (hid->tx_busy) return;
+    now = usbd_hw_call(hid->dev, frame_no);
+    for (int i = 0; i < hid->nreports; i++) {
+        usbd_hid_report *r = &hid->reports[i];
+        if (r->idle == 0 || r->sent == 0) continue;
+        if (((now - r->sent_frame) & HID_FRAME_MASK) >= r->idle * 4U) {
+            hid_write(hid, r);
+            return;
+        }
+    }
+}
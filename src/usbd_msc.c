@@ -0,0 +1,446 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "usb.h"
+#include "usbd_msc.h"
+
+#define MSC_CBW             0x00    /* waiting for CBW */
+#define MSC_DATA_IN         0x01    /* sending command response */
+#define MSC_READ            0x02    /* streaming READ(10) data */
+#define MSC_WRITE           0x03    /* streaming WRITE(10) data */
+#define MSC_CSW             0x04    /* CSW is waiting for free IN endpoint */
+#define MSC_STALL           0x05    /* CSW will be sent when host clears halt */
+#define MSC_RESET           0x06    /* invalid CBW, waiting for reset recovery */
+
+#define MSC_CBW_SZ          sizeof(struct usb_msc_cbw)
+
+/* endpoint callbacks has no user context, so map endpoint number to the function */
+static usbd_msc *msc_ep[8];
+
+static uint8_t *msc_buf(usbd_msc *msc, uint8_t idx) {
+    return msc->buf + (idx ? msc->backend->block_size : 0);
+}
+
+static uint32_t msc_get32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void msc_put32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void msc_csw(usbd_msc *msc) {
+    struct usb_msc_csw csw = {
+        .dCSWSignature   = USB_MSC_CSW_SIGNATURE,
+        .dCSWTag         = msc->cbw.dCBWTag,
+        .dCSWDataResidue = msc->residue,
+        .bCSWStatus      = msc->status,
+    };
+    if (usbd_ep_write(msc->dev, msc->tx_ep, &csw, sizeof(csw)) < 0) {
+        msc->state = MSC_CSW;
+    } else {
+        msc->state = MSC_CBW;
+    }
+}
+
+/* completes command. if host expects more data, halts the data endpoint first */
+static void msc_finish(usbd_msc *msc, bool stall) {
+    if (stall) {
+        if (msc->cbw.bmCBWFlags & USB_MSC_CBW_DIR_IN) {
+            usbd_ep_stall(msc->dev, msc->tx_ep);
+        } else {
+            usbd_ep_stall(msc->dev, msc->rx_ep);
+        }
+        msc->state = MSC_STALL;
+    } else {
+        msc_csw(msc);
+    }
+}
+
+static void msc_fail(usbd_msc *msc, uint8_t key, uint8_t asc) {
+    msc->sense_key = key;
+    msc->asc = asc;
+    msc->status = USB_MSC_CSW_FAILED;
+    msc_finish(msc, msc->residue != 0);
+}
+
+/* sends command response from the first block buffer */
+static void msc_respond(usbd_msc *msc, uint16_t len) {
+    if (len > msc->residue) len = msc->residue;
+    msc->tx_ptr = msc->buf;
+    msc->tx_left = len;
+    msc->state = MSC_DATA_IN;
+}
+
+static void msc_data_in(usbd_msc *msc) {
+    uint32_t sent;
+    while (msc->tx_left) {
+        uint16_t len = (msc->tx_left > msc->ep_size) ? msc->ep_size : msc->tx_left;
+        if (usbd_ep_write(msc->dev, msc->tx_ep, (void*)msc->tx_ptr, len) < 0) return;
+        msc->tx_ptr += len;
+        msc->tx_left -= len;
+        msc->residue -= len;
+    }
+    /* short packet terminates the data phase, otherwise halt is required */
+    sent = msc->cbw.dCBWDataTransferLength - msc->residue;
+    msc_finish(msc, msc->residue && (sent % msc->ep_size) == 0);
+}
+
+static void msc_read(usbd_msc *msc) {
+    const usbd_msc_backend *be = msc->backend;
+    bool progress;
+    do {
+        progress = false;
+        if (msc->io_busy) {
+            uint8_t st = be->status();
+            if (st != USBD_MSC_BUSY) {
+                msc->io_busy = 0;
+                if (st != USBD_MSC_OK) {
+                    msc_fail(msc, USB_SCSI_SENSE_MEDIUM_ERROR, USB_SCSI_ASC_READ_ERROR);
+                    return;
+                }
+                msc->count++;
+                msc->tail ^= 1;
+                progress = true;
+            }
+        }
+        /* read the next block while the current one is being sent */
+        if (!msc->io_busy && msc->io_left && msc->count < 2) {
+            if (be->read(msc->lba, msc_buf(msc, msc->tail)) == USBD_MSC_ERROR) {
+                msc_fail(msc, USB_SCSI_SENSE_MEDIUM_ERROR, USB_SCSI_ASC_READ_ERROR);
+                return;
+            }
+            msc->lba++;
+            msc->io_left--;
+            msc->io_busy = 1;
+            progress = true;
+        }
+        while (msc->count) {
+            if (usbd_ep_write(msc->dev, msc->tx_ep, msc_buf(msc, msc->head) + msc->usb_off, msc->ep_size) < 0) break;
+            progress = true;
+            msc->residue -= msc->ep_size;
+            msc->usb_off += msc->ep_size;
+            if (msc->usb_off >= be->block_size) {
+                msc->usb_off = 0;
+                msc->head ^= 1;
+                msc->count--;
+                msc->usb_left--;
+            }
+        }
+        if (msc->usb_left == 0) {
+            msc_csw(msc);
+            return;
+        }
+    } while (progress);
+}
+
+static void msc_write(usbd_msc *msc) {
+    const usbd_msc_backend *be = msc->backend;
+    bool progress;
+    do {
+        progress = false;
+        /* receive the next block while the previous one is being written */
+        if (msc->rx_hold && msc->usb_left && msc->count < 2) {
+            int32_t len = usbd_ep_read(msc->dev, msc->rx_ep, msc_buf(msc, msc->head) + msc->usb_off, msc->ep_size);
+            msc->rx_hold = 0;
+            if (len > 0) {
+                msc->residue -= len;
+                msc->usb_off += len;
+            }
+            if (msc->usb_off >= be->block_size) {
+                msc->usb_off = 0;
+                msc->head ^= 1;
+                msc->count++;
+                msc->usb_left--;
+            }
+            progress = true;
+        }
+        if (msc->io_busy) {
+            uint8_t st = be->status();
+            if (st != USBD_MSC_BUSY) {
+                msc->io_busy = 0;
+                if (st != USBD_MSC_OK) {
+                    msc_fail(msc, USB_SCSI_SENSE_MEDIUM_ERROR, USB_SCSI_ASC_WRITE_FAULT);
+                    return;
+                }
+                msc->count--;
+                msc->tail ^= 1;
+                msc->io_left--;
+                progress = true;
+            }
+        }
+        if (!msc->io_busy && msc->count) {
+            if (be->write(msc->lba, msc_buf(msc, msc->tail)) == USBD_MSC_ERROR) {
+                msc_fail(msc, USB_SCSI_SENSE_MEDIUM_ERROR, USB_SCSI_ASC_WRITE_FAULT);
+                return;
+            }
+            msc->lba++;
+            msc->io_busy = 1;
+            progress = true;
+        }
+        if (msc->io_left == 0) {
+            msc_csw(msc);
+            return;
+        }
+    } while (progress);
+}
+
+static void msc_rw(usbd_msc *msc, bool write) {
+    const usbd_msc_backend *be = msc->backend;
+    const uint8_t *cb = msc->cbw.CBWCB;
+    uint32_t lba = msc_get32(&cb[2]);
+    uint16_t blocks = (cb[7] << 8) | cb[8];
+    bool dir_in = (msc->cbw.bmCBWFlags & USB_MSC_CBW_DIR_IN) != 0;
+    if (write && be->write == 0) {
+        msc_fail(msc, USB_SCSI_SENSE_DATA_PROTECT, USB_SCSI_ASC_WRITE_PROTECTED);
+        return;
+    }
+    if (lba >= be->block_count || blocks > be->block_count - lba) {
+        msc_fail(msc, USB_SCSI_SENSE_ILLEGAL_REQUEST, USB_SCSI_ASC_LBA_OUT_OF_RANGE);
+        return;
+    }
+    if (blocks == 0) {
+        msc_finish(msc, msc->residue != 0);
+        return;
+    }
+    if ((uint32_t)blocks * be->block_size != msc->cbw.dCBWDataTransferLength || dir_in == write) {
+        msc->status = USB_MSC_CSW_PHASE_ERROR;
+        msc_finish(msc, msc->residue != 0);
+        return;
+    }
+    msc->lba = lba;
+    msc->io_left = blocks;
+    msc->usb_left = blocks;
+    msc->usb_off = 0;
+    msc->head = msc->tail = 0;
+    msc->count = 0;
+    msc->state = write ? MSC_WRITE : MSC_READ;
+}
+
+static void msc_scsi(usbd_msc *msc) {
+    const usbd_msc_backend *be = msc->backend;
+    const uint8_t *cb = msc->cbw.CBWCB;
+    uint8_t *d = msc->buf;
+    if (msc->cbw.bCBWLUN != 0) {
+        msc_fail(msc, USB_SCSI_SENSE_ILLEGAL_REQUEST, USB_SCSI_ASC_LUN_NOT_SUPPORTED);
+        return;
+    }
+    if (be->ready && !be->ready() &&
+        cb[0] != USB_SCSI_INQUIRY && cb[0] != USB_SCSI_REQUEST_SENSE) {
+        msc_fail(msc, USB_SCSI_SENSE_NOT_READY, USB_SCSI_ASC_MEDIUM_NOT_PRESENT);
+        return;
+    }
+    switch (cb[0]) {
+    case USB_SCSI_INQUIRY:
+        if (cb[1] & 0x01) {
+            /* no vital product data pages */
+            msc_fail(msc, USB_SCSI_SENSE_ILLEGAL_REQUEST, USB_SCSI_ASC_INVALID_FIELD);
+            return;
+        }
+        memset(d, 0, 36);
+        d[1] = 0x80;    /* removable */
+        d[2] = 0x04;    /* SPC-2 */
+        d[3] = 0x02;    /* response data format */
+        d[4] = 36 - 5;
+        memcpy(&d[8], USBD_MSC_VENDOR, 8);
+        memcpy(&d[16], USBD_MSC_PRODUCT, 16);
+        memcpy(&d[32], USBD_MSC_REVISION, 4);
+        msc_respond(msc, 36);
+        break;
+    case USB_SCSI_REQUEST_SENSE:
+        memset(d, 0, 18);
+        d[0] = 0x70;    /* current errors, fixed format */
+        d[2] = msc->sense_key;
+        d[7] = 18 - 8;
+        d[12] = msc->asc;
+        msc->sense_key = USB_SCSI_SENSE_NO_SENSE;
+        msc->asc = USB_SCSI_ASC_NONE;
+        msc_respond(msc, (cb[4] < 18) ? cb[4] : 18);
+        break;
+    case USB_SCSI_READ_CAPACITY_10:
+        msc_put32(&d[0], be->block_count - 1);
+        msc_put32(&d[4], be->block_size);
+        msc_respond(msc, 8);
+        break;
+    case USB_SCSI_READ_FORMAT_CAPACITIES:
+        memset(d, 0, 12);
+        d[3] = 8;       /* capacity list length */
+        msc_put32(&d[4], be->block_count);
+        msc_put32(&d[8], be->block_size);
+        d[8] = 0x02;    /* formatted media */
+        msc_respond(msc, 12);
+        break;
+    case USB_SCSI_MODE_SENSE_6:
+        memset(d, 0, 4);
+        d[0] = 4 - 1;
+        d[2] = be->write ? 0x00 : 0x80;
+        msc_respond(msc, 4);
+        break;
+    case USB_SCSI_MODE_SENSE_10:
+        memset(d, 0, 8);
+        d[1] = 8 - 2;
+        d[3] = be->write ? 0x00 : 0x80;
+        msc_respond(msc, 8);
+        break;
+    case USB_SCSI_READ_10:
+        msc_rw(msc, false);
+        return;
+    case USB_SCSI_WRITE_10:
+        msc_rw(msc, true);
+        return;
+    case USB_SCSI_TEST_UNIT_READY:
+    case USB_SCSI_START_STOP_UNIT:
+    case USB_SCSI_PREVENT_ALLOW_REMOVAL:
+    case USB_SCSI_VERIFY_10:
+    case USB_SCSI_SYNCHRONIZE_CACHE_10:
+        msc_finish(msc, msc->residue != 0);
+        return;
+    default:
+        msc_fail(msc, USB_SCSI_SENSE_ILLEGAL_REQUEST, USB_SCSI_ASC_INVALID_COMMAND);
+        return;
+    }
+}
+
+static void msc_rx_cbw(usbd_msc *msc) {
+    int32_t len = usbd_ep_read(msc->dev, msc->rx_ep, &msc->cbw, MSC_CBW_SZ);
+    msc->rx_hold = 0;
+    if (len != MSC_CBW_SZ || msc->cbw.dCBWSignature != USB_MSC_CBW_SIGNATURE) {
+        /* invalid CBW. halt both endpoints until reset recovery */
+        usbd_ep_stall(msc->dev, msc->rx_ep);
+        usbd_ep_stall(msc->dev, msc->tx_ep);
+        msc->state = MSC_RESET;
+        return;
+    }
+    msc->residue = msc->cbw.dCBWDataTransferLength;
+    msc->status = USB_MSC_CSW_PASSED;
+    msc_scsi(msc);
+}
+
+/* runs transport until it stops on the busy endpoint or backend */
+static void msc_process(usbd_msc *msc) {
+    uint8_t state;
+    do {
+        state = msc->state;
+        switch (state) {
+        case MSC_CBW:
+            if (msc->rx_hold) msc_rx_cbw(msc);
+            break;
+        case MSC_DATA_IN:
+            msc_data_in(msc);
+            break;
+        case MSC_READ:
+            msc_read(msc);
+            break;
+        case MSC_WRITE:
+            msc_write(msc);
+            break;
+        case MSC_CSW:
+            msc_csw(msc);
+            break;
+        default:
+            break;
+        }
+    } while (state != msc->state);
+}
+
+static void msc_evt(usbd_device *dev, uint8_t event, uint8_t ep) {
+    usbd_msc *msc = msc_ep[ep & 0x07];
+    (void)dev;
+    /* OUT packet stays in the endpoint, and it is NAKing, until it can be taken */
+    if (event == usbd_evt_eprx) msc->rx_hold = 1;
+    msc_process(msc);
+}
+
+void usbd_msc_init(usbd_msc *msc, usbd_device *dev, uint8_t intf, uint8_t rx_ep, uint8_t tx_ep,
+                   uint8_t ep_size, const usbd_msc_backend *backend, void *buf) {
+    memset(msc, 0, sizeof(usbd_msc));
+    msc->dev = dev;
+    msc->intf = intf;
+    msc->rx_ep = rx_ep;
+    msc->tx_ep = tx_ep;
+    msc->ep_size = ep_size;
+    msc->backend = backend;
+    msc->buf = buf;
+}
+
+void usbd_msc_enable(usbd_msc *msc, bool enable) {
+    usbd_device *dev = msc->dev;
+    msc->state = MSC_CBW;
+    msc->rx_hold = 0;
+    msc->io_busy = 0;
+    msc->sense_key = USB_SCSI_SENSE_NO_SENSE;
+    msc->asc = USB_SCSI_ASC_NONE;
+    if (enable) {
+        msc_ep[msc->rx_ep & 0x07] = msc;
+        msc_ep[msc->tx_ep & 0x07] = msc;
+        usbd_ep_config(dev, msc->rx_ep, USB_EPTYPE_BULK, msc->ep_size);
+        if ((msc->rx_ep & 0x07) != (msc->tx_ep & 0x07)) {
+            usbd_ep_config(dev, msc->tx_ep, USB_EPTYPE_BULK | USB_EPTYPE_DBLBUF, msc->ep_size);
+        } else {
+            usbd_ep_config(dev, msc->tx_ep, USB_EPTYPE_BULK, msc->ep_size);
+        }
+        usbd_reg_endpoint(dev, msc->rx_ep, msc_evt);
+        usbd_reg_endpoint(dev, msc->tx_ep, msc_evt);
+    } else {
+        usbd_ep_deconfig(dev, msc->tx_ep);
+        usbd_ep_deconfig(dev, msc->rx_ep);
+        usbd_reg_endpoint(dev, msc->rx_ep, 0);
+        usbd_reg_endpoint(dev, msc->tx_ep, 0);
+    }
+}
+
+usbd_respond usbd_msc_control(usbd_msc *msc, usbd_ctlreq *req) {
+    switch ((USB_REQ_RECIPIENT | USB_REQ_TYPE) & req->bmRequestType) {
+    case USB_REQ_INTERFACE | USB_REQ_CLASS:
+        if (req->wIndex != msc->intf) return usbd_fail;
+        switch (req->bRequest) {
+        case USB_MSC_BOT_RESET:
+            /* drop the holded packet, endpoints stay halted until host clears them */
+            if (msc->rx_hold) usbd_ep_read(msc->dev, msc->rx_ep, 0, 0);
+            msc->rx_hold = 0;
+            msc->io_busy = 0;
+            msc->state = MSC_CBW;
+            return usbd_ack;
+        case USB_MSC_GET_MAX_LUN:
+            req->data[0] = 0;
+            msc->dev->status.data_count = 1;
+            return usbd_ack;
+        default:
+            return usbd_fail;
+        }
+    case USB_REQ_ENDPOINT | USB_REQ_STANDARD:
+        if (req->bRequest != USB_STD_CLEAR_FEATURE || req->wValue != USB_FEAT_ENDPOINT_HALT ||
+            (req->wIndex != msc->rx_ep && req->wIndex != msc->tx_ep)) {
+            return usbd_fail;
+        }
+        /* halt persists until reset recovery */
+        if (msc->state == MSC_RESET) return usbd_ack;
+        usbd_ep_unstall(msc->dev, req->wIndex);
+        if (msc->state == MSC_STALL) msc_csw(msc);
+        return usbd_ack;
+    default:
+        return usbd_fail;
+    }
+}
+
+void usbd_msc_poll(usbd_msc *msc) {
+    msc_process(msc);
+}
@@ -140,20 +140,38 @@ inline static volatile uint16_t *EPR(uint8_t ep) {
     return (uint16_t*)((ep & 0x07) * 4 + USB_BASE);
 }
 
+/* sizes of the allocated PMA buffers by the endpoint and the buffer table record */
+static uint16_t pma_size[8][2];
+
 /** \brief Helper function. Returns next available PMA buffer.
  *
+ * \param ep uint8_t Endpoint the buffer is allocated for.
+ * \param rec int Buffer table record. 0 for tx, tx0 and rx0, 1 for rx, tx1 and rx1.
  * \param sz uint16_t Requested buffer size.
  * \return uint16_t Buffer address for PMA table.
- * \note PMA buffers grown from top to bottom like stack.
+ * \note PMA buffers grown from top to bottom like stack. The highest gap that fits is taken, so
+ * buffers of the deconfigured endpoints are reused by the next alternate setting.
  */
-static uint16_t get_next_pma(uint16_t sz) {
+static uint16_t get_next_pma(uint8_t ep, int rec, uint16_t sz) {
     unsigned _result = USB_PMASIZE;
-    for (int i = 0; i < 8; i++) {
-        pma_table *tbl = EPT(i);
-        if ((tbl->tx.addr) && (tbl->tx.addr < _result)) _result = tbl->tx.addr;
-        if ((tbl->rx.addr) && (tbl->rx.addr < _result)) _result = tbl->rx.addr;
-    }
-    return (_result < (0x020 + sz)) ? 0 : (_result - sz);
+    bool _fit;
+    do {
+        _fit = true;
+        if (_result < (0x020 + sz)) return 0;
+        for (int i = 0; i < 8; i++) {
+            pma_table *tbl = EPT(i);
+            unsigned _addr[2] = {tbl->tx.addr, tbl->rx.addr};
+            for (int j = 0; j < 2; j++) {
+                /* buffer overlaps the candidate. trying below it */
+                if (_addr[j] && (_addr[j] < _result) && (_addr[j] + pma_size[i][j] > _result - sz)) {
+                    _result = _addr[j];
+                    _fit = false;
+                }
+            }
+        }
+    } while (!_fit);
+    pma_size[ep & 0x07][rec] = sz;
+    return _result - sz;
 }
 
 static uint32_t getinfo(void) {
@@ -292,13 +310,13 @@ static bool ep_config(uint8_t ep, uint8_t eptype, uint16_t epsize) {
     /* if it TX or CONTROL endpoint */
     if ((ep & 0x80) || (eptype == USB_EPTYPE_CONTROL)) {
         uint16_t _pma;
-        _pma = get_next_pma(epsize);
+        _pma = get_next_pma(ep, 0, epsize);
         if (_pma == 0) return false;
         tbl->tx.addr = _pma;
         tbl->tx.cnt  = 0;
         if ((eptype == USB_EPTYPE_ISOCHRONUS) ||
             (eptype == (USB_EPTYPE_BULK | USB_EPTYPE_DBLBUF))) {
-            _pma = get_next_pma(epsize);
+            _pma = get_next_pma(ep, 1, epsize);
             if (_pma == 0) return false;
             tbl->tx1.addr = _pma;
             tbl->tx1.cnt  = 0;
@@ -319,13 +337,13 @@ static bool ep_config(uint8_t ep, uint8_t eptype, uint16_t epsize) {
         } else {
             _rxcnt = epsize << 9;
         }
-        _pma = get_next_pma(epsize);
+        _pma = get_next_pma(ep, 1, epsize);
         if (_pma == 0) return false;
         tbl->rx.addr = _pma;
         tbl->rx.cnt  = _rxcnt;
         if ((eptype == USB_EPTYPE_ISOCHRONUS) ||
             (eptype == (USB_EPTYPE_BULK | USB_EPTYPE_DBLBUF))) {
-            _pma = get_next_pma(epsize);
+            _pma = get_next_pma(ep, 0, epsize);
             if (_pma == 0) return false;
             tbl->rx0.addr = _pma;
             tbl->rx0.cnt  = _rxcnt;
@@ -462,6 +480,14 @@ static uint16_t get_frame (void) {
     return USB->FNR & USB_FNR_FN;
 }
 
+static void resume(bool resume) {
+    if (resume) {
+        USB->CNTR = (USB->CNTR & ~USB_CNTR_FSUSP) | USB_CNTR_RESUME;
+    } else {
+        USB->CNTR &= ~USB_CNTR_RESUME;
+    }
+}
+
 static void evt_poll(usbd_device *dev, usbd_evt_callback callback) {
     uint8_t _ev, _ep;
     uint16_t _istr = USB->ISTR;
@@ -546,6 +572,7 @@ static uint16_t get_serialno_desc(void *buffer) {
     evt_poll,
     get_frame,
     get_serialno_desc,
+    resume,
 };
 
 #endif //USBD_STM32F103
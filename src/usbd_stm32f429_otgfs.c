@@ -29,41 +29,55 @@
 
 #define STATUS_VAL(x)   (USBD_HW_ADDRFST | (x))
 
-static USB_OTG_GlobalTypeDef * const OTG  = (void*)(USB_OTG_FS_PERIPH_BASE + USB_OTG_GLOBAL_BASE);
-static USB_OTG_DeviceTypeDef * const OTGD = (void*)(USB_OTG_FS_PERIPH_BASE + USB_OTG_DEVICE_BASE);
-static volatile uint32_t * const OTGPCTL  = (void*)(USB_OTG_FS_PERIPH_BASE + USB_OTG_PCGCCTL_BASE);
-
-
-inline static uint32_t* EPFIFO(uint32_t ep) {
-    return (uint32_t*)(USB_OTG_FS_PERIPH_BASE + USB_OTG_FIFO_BASE + (ep << 12));
-}
-
-inline static USB_OTG_INEndpointTypeDef* EPIN(uint32_t ep) {
-    return (void*)(USB_OTG_FS_PERIPH_BASE + USB_OTG_IN_ENDPOINT_BASE + (ep << 5));
-}
+#if defined(USBD_DRIVER_CTX)
+/* peripheral base is passed by the core, so the same code serves OTG FS and OTG HS cores. OTG HS
+ * runs with the embedded FS PHY and the OTG FS FIFO and endpoints limits. */
+#define OTG_BASE        ((uintptr_t)base)
+#define CTX             void *base,
+#define CTX0            void *base
+#define BASE            base,
+#define BASE0           base
+#if defined(USB_OTG_HS_PERIPH_BASE)
+#define IS_OTGHS        (OTG_BASE == USB_OTG_HS_PERIPH_BASE)
+#else
+#define IS_OTGHS        0
+#endif
+#else
+#define OTG_BASE        USB_OTG_FS_PERIPH_BASE
+#define CTX
+#define CTX0            void
+#define BASE
+#define BASE0
+#define IS_OTGHS        0
+#endif
 
-inline static USB_OTG_OUTEndpointTypeDef* EPOUT(uint32_t ep) {
-    return (void*)(USB_OTG_FS_PERIPH_BASE + USB_OTG_OUT_ENDPOINT_BASE + (ep << 5));
-}
+#define OTG             ((USB_OTG_GlobalTypeDef*)(OTG_BASE + USB_OTG_GLOBAL_BASE))
+#define OTGD            ((USB_OTG_DeviceTypeDef*)(OTG_BASE + USB_OTG_DEVICE_BASE))
+#define OTGPCTL         ((volatile uint32_t*)(OTG_BASE + USB_OTG_PCGCCTL_BASE))
+#define EPFIFO(ep)      ((uint32_t*)(OTG_BASE + USB_OTG_FIFO_BASE + ((ep) << 12)))
+#define EPIN(ep)        ((USB_OTG_INEndpointTypeDef*)(OTG_BASE + USB_OTG_IN_ENDPOINT_BASE + ((ep) << 5)))
+#define EPOUT(ep)       ((USB_OTG_OUTEndpointTypeDef*)(OTG_BASE + USB_OTG_OUT_ENDPOINT_BASE + ((ep) << 5)))
 
-inline static void Flush_RX(void) {
+inline static void Flush_RX(CTX0) {
     _BST(OTG->GRSTCTL, USB_OTG_GRSTCTL_RXFFLSH);
     _WBC(OTG->GRSTCTL, USB_OTG_GRSTCTL_RXFFLSH);
 }
 
-inline static void Flush_TX(uint8_t ep) {
+inline static void Flush_TX(CTX uint8_t ep) {
     _BMD(OTG->GRSTCTL, USB_OTG_GRSTCTL_TXFNUM,
          _VAL2FLD(USB_OTG_GRSTCTL_TXFNUM, ep) | USB_OTG_GRSTCTL_TXFFLSH);
     _WBC(OTG->GRSTCTL, USB_OTG_GRSTCTL_TXFFLSH);
 }
 
-static uint32_t getinfo(void) {
-    if (!(RCC->AHB2ENR & RCC_AHB2ENR_OTGFSEN)) return STATUS_VAL(0);
+static uint32_t getinfo(CTX0) {
+    if (!(IS_OTGHS ? (RCC->AHB1ENR & RCC_AHB1ENR_OTGHSEN) : (RCC->AHB2ENR & RCC_AHB2ENR_OTGFSEN))) {
+        return STATUS_VAL(0);
+    }
     if (!(OTGD->DCTL & USB_OTG_DCTL_SDIS)) return STATUS_VAL(USBD_HW_ENABLED | USBD_HW_SPEED_FS);
     return STATUS_VAL(USBD_HW_ENABLED);
 }
 
-static void ep_setstall(uint8_t ep, bool stall) {
+static void ep_setstall(CTX uint8_t ep, bool stall) {
     if (ep & 0x80) {
         ep &= 0x7F;
         uint32_t _t = EPIN(ep)->DIEPCTL;
@@ -90,7 +104,7 @@ static void ep_setstall(uint8_t ep, bool stall) {
     }
 }
 
-static bool ep_isstalled(uint8_t ep) {
+static bool ep_isstalled(CTX uint8_t ep) {
     if (ep & 0x80) {
         ep &= 0x7F;
         return (EPIN(ep)->DIEPCTL & USB_OTG_DIEPCTL_STALL) ? true : false;
@@ -99,16 +113,26 @@ static bool ep_isstalled(uint8_t ep) {
     }
 }
 
-static void enable(bool enable) {
+static void enable(CTX bool enable) {
     if (enable) {
         /* enabling USB_OTG in RCC */
-        _BST(RCC->AHB2ENR, RCC_AHB2ENR_OTGFSEN);
+        if (IS_OTGHS) {
+            _BST(RCC->AHB1ENR, RCC_AHB1ENR_OTGHSEN);
+        } else {
+            _BST(RCC->AHB2ENR, RCC_AHB2ENR_OTGFSEN);
+        }
         /* waiting AHB ready */
         _WBS(OTG->GRSTCTL, USB_OTG_GRSTCTL_AHBIDL);
-        /* configure OTG as device */
+        /* configure OTG as device. OTG HS selects the embedded FS PHY */
         _BMD(OTG->GUSBCFG,
              USB_OTG_GUSBCFG_SRPCAP | _VAL2FLD(USB_OTG_GUSBCFG_TRDT, 0x0F),
-             USB_OTG_GUSBCFG_FDMOD  | _VAL2FLD(USB_OTG_GUSBCFG_TRDT, 0x06));
+             USB_OTG_GUSBCFG_FDMOD  | _VAL2FLD(USB_OTG_GUSBCFG_TRDT, 0x06) |
+             (IS_OTGHS ? USB_OTG_GUSBCFG_PHYSEL : 0));
+        if (IS_OTGHS) {
+            /* do core soft reset */
+            _BST(OTG->GRSTCTL, USB_OTG_GRSTCTL_CSRST);
+            _WBC(OTG->GRSTCTL, USB_OTG_GRSTCTL_CSRST);
+        }
         /* configuring Vbus sense and SOF output */
 #if defined (USBD_VBUS_DETECT) && defined(USBD_SOF_OUT)
         OTG->GCCFG = USB_OTG_GCCFG_VBUSBSEN | USB_OTG_GCCFG_SOFOUTEN;
@@ -144,7 +168,13 @@ static void enable(bool enable) {
         /* unmask global interrupt */
         _BST(OTG->GAHBCFG, USB_OTG_GAHBCFG_GINT);
     } else {
-        if (RCC->AHB2ENR & RCC_AHB2ENR_OTGFSEN) {
+        if (IS_OTGHS) {
+            if (RCC->AHB1ENR & RCC_AHB1ENR_OTGHSEN) {
+                _BST(RCC->AHB1RSTR, RCC_AHB1RSTR_OTGHRST);
+                _BCL(RCC->AHB1RSTR, RCC_AHB1RSTR_OTGHRST);
+                _BCL(RCC->AHB1ENR, RCC_AHB1ENR_OTGHSEN);
+            }
+        } else if (RCC->AHB2ENR & RCC_AHB2ENR_OTGFSEN) {
             _BST(RCC->AHB2RSTR, RCC_AHB2RSTR_OTGFSRST);
             _BCL(RCC->AHB2RSTR, RCC_AHB2RSTR_OTGFSRST);
             _BCL(RCC->AHB2ENR, RCC_AHB2ENR_OTGFSEN);
@@ -152,7 +182,7 @@ static void enable(bool enable) {
     }
 }
 
-static uint8_t connect(bool connect) {
+static uint8_t connect(CTX bool connect) {
     if (connect) {
 /* The ST made a strange thing again. Really i dont'understand what is the reason to name
    signal as PWRDWN (Power down PHY) when it works as "Power up" */
@@ -165,7 +195,7 @@ static uint8_t connect(bool connect) {
     return usbd_lane_unk;
 }
 
-static void setaddr (uint8_t addr) {
+static void setaddr (CTX uint8_t addr) {
     _BMD(OTGD->DCFG, USB_OTG_DCFG_DAD, addr << 4);
 }
 
@@ -173,26 +203,33 @@ static void setaddr (uint8_t addr) {
  * \param ep endpoint index
  * \param epsize required max packet size in bytes
  * \return true if TX fifo is successfully set
+ * \note First free gap is taken. Released fifos start at or above MAX_FIFO_SZ, see ep_deconfig()
  */
-static bool set_tx_fifo(uint8_t ep, uint16_t epsize) {
+static bool set_tx_fifo(CTX uint8_t ep, uint16_t epsize) {
     uint32_t _fsa = OTG->DIEPTXF0_HNPTXFSIZ;
-    /* calculating initial TX FIFO address. next from EP0 TX fifo */
-    _fsa = 0xFFFF & (_fsa + (_fsa >> 16));
-    /* looking for next free TX fifo address */
-    for (int i = 0; i < (MAX_EP - 1); i++) {
-        uint32_t _t = OTG->DIEPTXF[i];
-        if ((_t & 0xFFFF) < 0x200) {
-            _t = 0xFFFF & (_t + (_t >> 16));
-            if (_t > _fsa) {
-                _fsa = _t;
-            }
-        }
-    }
+    bool _fit;
     /* calculating requited TX fifo size */
     /* getting in 32 bit terms */
     epsize = (epsize + 0x03) >> 2;
     /* it must be 16 32-bit words minimum */
     if (epsize < 0x10) epsize = 0x10;
+    /* calculating initial TX FIFO address. next from EP0 TX fifo */
+    _fsa = 0xFFFF & (_fsa + (_fsa >> 16));
+    /* looking for the first free gap, so FIFOs of the deconfigured endpoints are reused */
+    do {
+        _fit = true;
+        for (int i = 0; i < (MAX_EP - 1); i++) {
+            uint32_t _t = OTG->DIEPTXF[i];
+            uint32_t _end = 0xFFFF & (_t + (_t >> 16));
+            /* released TX fifos start above the fifo memory */
+            if ((i == ep - 1) || (_t & 0xFFFF) >= MAX_FIFO_SZ) continue;
+            if (((_t & 0xFFFF) < _fsa + epsize) && (_end > _fsa)) {
+                /* overlaps with the candidate. trying after it */
+                _fsa = _end;
+                _fit = false;
+            }
+        }
+    } while (!_fit);
     /* checking for the available fifo */
     if ((_fsa + epsize) > MAX_FIFO_SZ) return false;
     /* programming fifo register */
@@ -201,7 +238,7 @@ static bool set_tx_fifo(uint8_t ep, uint16_t epsize) {
     return true;
 }
 
-static bool ep_config(uint8_t ep, uint8_t eptype, uint16_t epsize) {
+static bool ep_config(CTX uint8_t ep, uint8_t eptype, uint16_t epsize) {
     if (ep == 0) {
         /* configureing control endpoint EP0 */
         uint32_t mpsize;
@@ -236,9 +273,9 @@ static bool ep_config(uint8_t ep, uint8_t eptype, uint16_t epsize) {
         /* setting up TX fifo and size register */
         if ((eptype == USB_EPTYPE_ISOCHRONUS) ||
             (eptype == (USB_EPTYPE_BULK | USB_EPTYPE_DBLBUF))) {
-            if (!set_tx_fifo(ep, epsize << 1)) return false;
+            if (!set_tx_fifo(BASE ep, epsize << 1)) return false;
         } else {
-            if (!set_tx_fifo(ep, epsize)) return false;
+            if (!set_tx_fifo(BASE ep, epsize)) return false;
         }
         /* enabling EP TX interrupt */
         OTGD->DAINTMSK |= (0x0001UL << ep);
@@ -288,7 +325,7 @@ static bool ep_config(uint8_t ep, uint8_t eptype, uint16_t epsize) {
     return true;
 }
 
-static void ep_deconfig(uint8_t ep) {
+static void ep_deconfig(CTX uint8_t ep) {
     ep &= 0x7F;
     volatile USB_OTG_INEndpointTypeDef*  epi = EPIN(ep);
     volatile USB_OTG_OUTEndpointTypeDef* epo = EPOUT(ep);
@@ -298,7 +335,7 @@ static void ep_deconfig(uint8_t ep) {
     /* decativating endpoint */
     _BCL(epi->DIEPCTL, USB_OTG_DIEPCTL_USBAEP);
     /* flushing FIFO */
-    Flush_TX(ep);
+    Flush_TX(BASE ep);
     /* disabling endpoint */
     if ((epi->DIEPCTL & USB_OTG_DIEPCTL_EPENA) && (ep != 0)) {
         epi->DIEPCTL = USB_OTG_DIEPCTL_EPDIS;
@@ -317,7 +354,7 @@ static void ep_deconfig(uint8_t ep) {
     epo->DOEPINT = 0xFF;
 }
 
-static int32_t ep_read(uint8_t ep, void* buf, uint16_t blen) {
+static int32_t ep_read(CTX uint8_t ep, void* buf, uint16_t blen) {
     uint32_t len, tmp;
     volatile uint32_t *fifo = EPFIFO(0);
     /* no data in RX FIFO */
@@ -338,7 +375,7 @@ static int32_t ep_read(uint8_t ep, void* buf, uint16_t blen) {
     return (len < blen) ? len : blen;
 }
 
-static int32_t ep_write(uint8_t ep, void *buf, uint16_t blen) {
+static int32_t ep_write(CTX uint8_t ep, void *buf, uint16_t blen) {
     uint32_t len, tmp;
     ep &= 0x7F;
     volatile uint32_t* fifo = EPFIFO(ep);
@@ -365,11 +402,19 @@ static int32_t ep_write(uint8_t ep, void *buf, uint16_t blen) {
     return blen;
 }
 
-static uint16_t get_frame (void) {
+static uint16_t get_frame (CTX0) {
     return _FLD2VAL(USB_OTG_DSTS_FNSOF, OTGD->DSTS);
 }
 
-static void evt_poll(usbd_device *dev, usbd_evt_callback callback) {
+static void resume(CTX bool resume) {
+    if (resume) {
+        _BST(OTGD->DCTL, USB_OTG_DCTL_RWUSIG);
+    } else {
+        _BCL(OTGD->DCTL, USB_OTG_DCTL_RWUSIG);
+    }
+}
+
+static void evt_poll(CTX usbd_device *dev, usbd_evt_callback callback) {
     uint32_t evt;
     uint32_t ep = 0;
     while (1) {
@@ -378,9 +423,9 @@ static void evt_poll(usbd_device *dev, usbd_evt_callback callback) {
         if (_t & USB_OTG_GINTSTS_USBRST) {
             OTG->GINTSTS = USB_OTG_GINTSTS_USBRST;
             for (uint8_t i = 0; i < MAX_EP; i++ ) {
-                ep_deconfig(i);
+                ep_deconfig(BASE i);
             }
-            Flush_RX();
+            Flush_RX(BASE0);
             continue;
         } else if (_t & USB_OTG_GINTSTS_ENUMDNE) {
             OTG->GINTSTS = USB_OTG_GINTSTS_ENUMDNE;
@@ -406,7 +451,7 @@ static void evt_poll(usbd_device *dev, usbd_evt_callback callback) {
             case 0x06:  /* SETUP recieved */
                 /* flushing TX if sonething stuck in control endpoint */
                 if (EPIN(ep)->DIEPTSIZ & USB_OTG_DIEPTSIZ_PKTCNT) {
-                    Flush_TX(ep);
+                    Flush_TX(BASE ep);
                 }
                 evt = usbd_evt_epsetup;
                 break;
@@ -446,7 +491,7 @@ static uint32_t fnv1a32_turn (uint32_t fnv, uint32_t data ) {
     return fnv;
 }
 
-static uint16_t get_serialno_desc(void *buffer) {
+static uint16_t get_serialno_desc(CTX void *buffer) {
     struct  usb_string_descriptor *dsc = buffer;
     uint16_t *str = dsc->wString;
     uint32_t fnv = 2166136261;
@@ -463,7 +508,11 @@ static uint16_t get_serialno_desc(void *buffer) {
     return 18;
 }
 
+#if defined(USBD_DRIVER_CTX)
+ __attribute__((externally_visible)) const struct usbd_driver_ctx usbd_otgfs_ctx = {
+#else
  __attribute__((externally_visible)) const struct usbd_driver usbd_otgfs = {
+#endif
     getinfo,
     enable,
     connect,
@@ -477,6 +526,7 @@ static uint16_t get_serialno_desc(void *buffer) {
     evt_poll,
     get_frame,
     get_serialno_desc,
+    resume,
 };
 
 #endif //USBD_STM32F429FS
@@ -164,26 +164,33 @@ static void setaddr (uint8_t addr) {
  * \param ep endpoint index
  * \param epsize required max packet size in bytes
  * \return true if TX fifo is successfully set
+ * \note First free gap is taken. Released fifos start at or above MAX_FIFO_SZ, see ep_deconfig()
  */
 static bool set_tx_fifo(uint8_t ep, uint16_t epsize) {
     uint32_t _fsa = OTG->DIEPTXF0_HNPTXFSIZ;
-    /* calculating initial TX FIFO address. next from EP0 TX fifo */
-    _fsa = 0xFFFF & (_fsa + (_fsa >> 16));
-    /* looking for next free TX fifo address */
-    for (int i = 0; i < (MAX_EP - 1); i++) {
-        uint32_t _t = OTG->DIEPTXF[i];
-        if ((_t & 0xFFFF) < 0x200) {
-            _t = 0xFFFF & (_t + (_t >> 16));
-            if (_t > _fsa) {
-                _fsa = _t;
-            }
-        }
-    }
+    bool _fit;
     /* calculating requited TX fifo size */
     /* getting in 32 bit terms */
     epsize = (epsize + 0x03) >> 2;
     /* it must be 16 32-bit words minimum */
     if (epsize < 0x10) epsize = 0x10;
+    /* calculating initial TX FIFO address. next from EP0 TX fifo */
+    _fsa = 0xFFFF & (_fsa + (_fsa >> 16));
+    /* looking for the first free gap, so FIFOs of the deconfigured endpoints are reused */
+    do {
+        _fit = true;
+        for (int i = 0; i < (MAX_EP - 1); i++) {
+            uint32_t _t = OTG->DIEPTXF[i];
+            uint32_t _end = 0xFFFF & (_t + (_t >> 16));
+            /* released TX fifos start above the fifo memory */
+            if ((i == ep - 1) || (_t & 0xFFFF) >= MAX_FIFO_SZ) continue;
+            if (((_t & 0xFFFF) < _fsa + epsize) && (_end > _fsa)) {
+                /* overlaps with the candidate. trying after it */
+                _fsa = _end;
+                _fit = false;
+            }
+        }
+    } while (!_fit);
     /* checking for the available fifo */
     if ((_fsa + epsize) > MAX_FIFO_SZ) return false;
     /* programming fifo register */
@@ -362,6 +369,14 @@ static uint16_t get_frame (void) {
     return _FLD2VAL(USB_OTG_DSTS_FNSOF, OTGD->DSTS);
 }
 
+static void resume(bool resume) {
+    if (resume) {
+        _BST(OTGD->DCTL, USB_OTG_DCTL_RWUSIG);
+    } else {
+        _BCL(OTGD->DCTL, USB_OTG_DCTL_RWUSIG);
+    }
+}
+
 static void evt_poll(usbd_device *dev, usbd_evt_callback callback) {
     uint32_t evt;
     uint32_t ep = 0;
@@ -462,6 +477,7 @@ static uint16_t get_serialno_desc(void *buffer) {
     evt_poll,
     get_frame,
     get_serialno_desc,
+    resume,
 };
 
 #endif //USBD_STM32L446FS
@@ -44,7 +44,16 @@
 #define EP_TX_VALID(epr)    EP_TOGGLE_SET((epr), USB_EP_TX_VALID,                   USB_EPTX_STAT)
 #define EP_RX_VALID(epr)    EP_TOGGLE_SET((epr), USB_EP_RX_VALID,                   USB_EPRX_STAT)
 
-#define STATUS_VAL(x)   (USBD_HW_BC | (x))
+#if defined(USBD_LPM_SUPPORT)
+    #define STATUS_VAL(x)   (USBD_HW_BC | USBD_HW_LPM | (x))
+#else
+    #define STATUS_VAL(x)   (USBD_HW_BC | (x))
+#endif
+
+#if defined(USBD_LPM_SUPPORT)
+/* set by the L1 request, cleared by the wakeup and bus reset */
+static bool l1_state;
+#endif
 
 typedef struct {
     uint16_t    addr;
@@ -81,20 +90,38 @@ inline static volatile uint16_t *EPR(uint8_t ep) {
 }
 
 
+/* sizes of the allocated PMA buffers by the endpoint and the buffer table record */
+static uint16_t pma_size[8][2];
+
 /** \brief Helper function. Returns next available PMA buffer.
  *
+ * \param ep uint8_t Endpoint the buffer is allocated for.
+ * \param rec int Buffer table record. 0 for tx, tx0 and rx0, 1 for rx, tx1 and rx1.
  * \param sz uint16_t Requested buffer size.
  * \return uint16_t Buffer address for PMA table.
- * \note PMA buffers grown from top to bottom like stack.
+ * \note PMA buffers grown from top to bottom like stack. The highest gap that fits is taken, so
+ * buffers of the deconfigured endpoints are reused by the next alternate setting.
  */
-static uint16_t get_next_pma(uint16_t sz) {
+static uint16_t get_next_pma(uint8_t ep, int rec, uint16_t sz) {
     unsigned _result = USB_PMASIZE;
-    for (int i = 0; i < 8; i++) {
-        pma_table *tbl = EPT(i);
-        if ((tbl->rx.addr) && (tbl->rx.addr < _result)) _result = tbl->rx.addr;
-        if ((tbl->tx.addr) && (tbl->tx.addr < _result)) _result = tbl->tx.addr;
-    }
-    return (_result < (0x020 + sz)) ? 0 : (_result - sz);
+    bool _fit;
+    do {
+        _fit = true;
+        if (_result < (0x020 + sz)) return 0;
+        for (int i = 0; i < 8; i++) {
+            pma_table *tbl = EPT(i);
+            unsigned _addr[2] = {tbl->tx.addr, tbl->rx.addr};
+            for (int j = 0; j < 2; j++) {
+                /* buffer overlaps the candidate. trying below it */
+                if (_addr[j] && (_addr[j] < _result) && (_addr[j] + pma_size[i][j] > _result - sz)) {
+                    _result = _addr[j];
+                    _fit = false;
+                }
+            }
+        }
+    } while (!_fit);
+    pma_size[ep & 0x07][rec] = sz;
+    return _result - sz;
 }
 
 static uint32_t getinfo(void) {
@@ -156,8 +183,15 @@ static void enable(bool enable) {
         USB->CNTR = USB_CNTR_CTRM | USB_CNTR_RESETM | USB_CNTR_ERRM |
 #if !defined(USBD_SOF_DISABLED)
         USB_CNTR_SOFM |
+#endif
+#if defined(USBD_LPM_SUPPORT)
+        USB_CNTR_L1REQM |
 #endif
         USB_CNTR_SUSPM | USB_CNTR_WKUPM;
+#if defined(USBD_LPM_SUPPORT)
+        /* enabling LPM and acknowledging L1 requests */
+        USB->LPMCSR = USB_LPMCSR_LMPEN | USB_LPMCSR_LPMACK;
+#endif
     } else if (RCC->APB1ENR1 & RCC_APB1ENR1_USBFSEN) {
         USB->BCDR = 0;
         RCC->APB1RSTR1 |= RCC_APB1RSTR1_USBFSRST;
@@ -219,13 +253,13 @@ static bool ep_config(uint8_t ep, uint8_t eptype, uint16_t epsize) {
     /* if it TX or CONTROL endpoint */
     if ((ep & 0x80) || (eptype == USB_EPTYPE_CONTROL)) {
         uint16_t _pma;
-        _pma = get_next_pma(epsize);
+        _pma = get_next_pma(ep, 0, epsize);
         if (_pma == 0) return false;
         tbl->tx.addr = _pma;
         tbl->tx.cnt  = 0;
         if ((eptype == USB_EPTYPE_ISOCHRONUS) ||
             (eptype == (USB_EPTYPE_BULK | USB_EPTYPE_DBLBUF))) {
-            _pma = get_next_pma(epsize);
+            _pma = get_next_pma(ep, 1, epsize);
             if (_pma == 0) return false;
             tbl->tx1.addr = _pma;
             tbl->tx1.cnt  = 0;
@@ -246,13 +280,13 @@ static bool ep_config(uint8_t ep, uint8_t eptype, uint16_t epsize) {
         } else {
             _rxcnt = epsize << 9;
         }
-        _pma = get_next_pma(epsize);
+        _pma = get_next_pma(ep, 1, epsize);
         if (_pma == 0) return false;
         tbl->rx.addr = _pma;
         tbl->rx.cnt = _rxcnt;
         if ((eptype == USB_EPTYPE_ISOCHRONUS) ||
             (eptype == (USB_EPTYPE_BULK | USB_EPTYPE_DBLBUF))) {
-            _pma = get_next_pma(epsize);
+            _pma = get_next_pma(ep, 0, epsize);
             if (_pma == 0) return false;
             tbl->rx0.addr = _pma;
             tbl->rx0.cnt  = _rxcnt;
@@ -387,6 +421,24 @@ static uint16_t get_frame (void) {
     return USB->FNR & USB_FNR_FN;
 }
 
+static void resume(bool resume) {
+#if defined(USBD_LPM_SUPPORT)
+    /* L1 state. L1 resume signalling is timed by hardware */
+    if (l1_state) {
+        if (resume) {
+            l1_state = false;
+            USB->CNTR = (USB->CNTR & ~(USB_CNTR_FSUSP | USB_CNTR_LPMODE)) | USB_CNTR_L1RESUME;
+        }
+        return;
+    }
+#endif
+    if (resume) {
+        USB->CNTR = (USB->CNTR & ~USB_CNTR_FSUSP) | USB_CNTR_RESUME;
+    } else {
+        USB->CNTR &= ~USB_CNTR_RESUME;
+    }
+}
+
 static void evt_poll(usbd_device *dev, usbd_evt_callback callback) {
     uint8_t _ev, _ep;
     uint16_t _istr = USB->ISTR;
@@ -404,6 +456,9 @@ static void evt_poll(usbd_device *dev, usbd_evt_callback callback) {
     } else if (_istr & USB_ISTR_RESET) {
         USB->ISTR &= ~USB_ISTR_RESET;
         USB->BTABLE = 0;
+#if defined(USBD_LPM_SUPPORT)
+        l1_state = false;
+#endif
         for (int i = 0; i < 8; i++) {
             ep_deconfig(i);
         }
@@ -415,12 +470,23 @@ static void evt_poll(usbd_device *dev, usbd_evt_callback callback) {
 #endif
     } else if (_istr & USB_ISTR_WKUP) {
         _ev = usbd_evt_wkup;
+#if defined(USBD_LPM_SUPPORT)
+        l1_state = false;
+#endif
         USB->CNTR &= ~USB_CNTR_FSUSP;
         USB->ISTR &= ~USB_ISTR_WKUP;
     } else if (_istr & USB_ISTR_SUSP) {
         _ev = usbd_evt_susp;
         USB->CNTR |= USB_CNTR_FSUSP;
         USB->ISTR &= ~USB_ISTR_SUSP;
+#if defined(USBD_LPM_SUPPORT)
+    } else if (_istr & USB_ISTR_L1REQ) {
+        _ev = usbd_evt_l1sleep;
+        _ep = (USB->LPMCSR & USB_LPMCSR_BESL) >> 4;
+        USB->CNTR |= USB_CNTR_FSUSP | USB_CNTR_LPMODE;
+        l1_state = true;
+        USB->ISTR &= ~USB_ISTR_L1REQ;
+#endif
     } else if (_istr & USB_ISTR_ERR) {
         USB->ISTR &= ~USB_ISTR_ERR;
         _ev = usbd_evt_error;
@@ -470,6 +536,7 @@ static uint16_t get_serialno_desc(void *buffer) {
     evt_poll,
     get_frame,
     get_serialno_desc,
+    resume,
 };
 
 #endif //USBD_STM32L052
@@ -0,0 +1,355 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "usb.h"
+#include "usbd_tmc.h"
+
+#define TMC_MAX_PKT         0x40
+#define TMC_HDR_SZ          sizeof(struct usb_tmc_bulk_header)
+
+#define TMC_OUT_HDR         0x00
+#define TMC_OUT_DATA        0x01
+
+#define TMC_IN_IDLE         0x00    /* no request from host */
+#define TMC_IN_REQ          0x01    /* host requested data, waiting for the response */
+#define TMC_IN_BUSY         0x02    /* transfer in progress */
+
+/* endpoint callbacks has no user context, so map endpoint number to the function */
+static usbd_tmc *tmc_ep[8];
+
+static void tmc_event(usbd_tmc *tmc, uint8_t event) {
+    if (tmc->evt_callback) tmc->evt_callback(tmc, event);
+}
+
+static void tmc_out_reset(usbd_tmc *tmc) {
+    tmc->out_state = TMC_OUT_HDR;
+    tmc->hdr_len = 0;
+    tmc->out_remain = 0;
+}
+
+static void tmc_in_reset(usbd_tmc *tmc) {
+    tmc->in_state = TMC_IN_IDLE;
+    tmc->in_remain = 0;
+    tmc->in_total = tmc->in_sent = 0;
+    tmc->in_zlp = 0;
+}
+
+/* sends the next packet of the IN transfer */
+static void tmc_in_next(usbd_tmc *tmc) {
+    uint8_t _b[TMC_MAX_PKT];
+    uint32_t _n = tmc->in_total - tmc->in_sent;
+    uint16_t _p = 0;
+    if (_n == 0) {
+        if (tmc->in_zlp) {
+            tmc->in_zlp = 0;
+            usbd_ep_write(tmc->dev, tmc->tx_ep, 0, 0);
+            return;
+        }
+        tmc->in_state = TMC_IN_IDLE;
+        return;
+    }
+    if (_n > tmc->ep_size) _n = tmc->ep_size;
+    if (tmc->in_sent == 0) {
+        struct usb_tmc_bulk_header *hdr = (void*)_b;
+        hdr->MsgId = USB_TMC_DEV_DEP_MSG_IN;
+        hdr->bTag = tmc->in_tag;
+        hdr->bTagInverse = ~tmc->in_tag;
+        hdr->Reserved = 0;
+        hdr->MsgSpecific.dev_dep_msg_in.TransferSize = tmc->in_size;
+        hdr->MsgSpecific.dev_dep_msg_in.bmTransferAttributes =
+            (tmc->in_size == tmc->in_remain) ? USB_TMC_TRANSFER_ATTR_EOM : 0;
+        memset(hdr->MsgSpecific.dev_dep_msg_in.Reserved, 0, 3);
+        _p = TMC_HDR_SZ;
+    }
+    /* message data */
+    uint32_t _d = TMC_HDR_SZ + tmc->in_size;
+    _d = (_d > tmc->in_sent + _p) ? _d - (tmc->in_sent + _p) : 0;
+    if (_d > _n - _p) _d = _n - _p;
+    if (_d) {
+        tmc->in_callback(tmc, &_b[_p], _d);
+        _p += _d;
+    }
+    /* alignment bytes */
+    memset(&_b[_p], 0, _n - _p);
+    usbd_ep_write(tmc->dev, tmc->tx_ep, _b, _n);
+    tmc->in_sent += _n;
+    /* transfer ends with the short packet */
+    if (tmc->in_sent == tmc->in_total && _n == tmc->ep_size) tmc->in_zlp = 1;
+}
+
+/* starts IN transfer if host requested it and response is ready */
+static void tmc_in_start(usbd_tmc *tmc) {
+    if (tmc->in_state != TMC_IN_REQ || tmc->in_remain == 0) return;
+    tmc->in_size = (tmc->in_remain < tmc->in_max) ? tmc->in_remain : tmc->in_max;
+    tmc->in_total = (TMC_HDR_SZ + tmc->in_size + 3) & ~3UL;
+    tmc->in_sent = 0;
+    tmc->in_zlp = 0;
+    tmc->in_state = TMC_IN_BUSY;
+    tmc_in_next(tmc);
+    tmc->in_remain -= tmc->in_size;
+}
+
+/* processes complete bulk OUT header. returns false if header is invalid */
+static bool tmc_out_header(usbd_tmc *tmc) {
+    const struct usb_tmc_bulk_header *hdr = (const void*)tmc->hdr;
+    if ((uint8_t)(hdr->bTag ^ hdr->bTagInverse) != 0xFF || hdr->bTag == 0) return false;
+    switch (hdr->MsgId) {
+    case USB_TMC_DEV_DEP_MSG_OUT:
+        tmc->out_tag = hdr->bTag;
+        tmc->out_remain = hdr->MsgSpecific.dev_dep_msg_out.TransferSize;
+        tmc->out_eom = hdr->MsgSpecific.dev_dep_msg_out.bmTransferAttributes & USB_TMC_TRANSFER_ATTR_EOM;
+        tmc->out_rxd = 0;
+        tmc->out_state = TMC_OUT_DATA;
+        return true;
+    case USB_TMC_REQUEST_DEV_DEP_MSG_IN:
+        if (tmc->in_state == TMC_IN_BUSY) return false;
+        tmc->in_tag = hdr->bTag;
+        tmc->in_max = hdr->MsgSpecific.request_dev_dep_msg_in.TransferSize;
+        if (tmc->in_max == 0) return false;
+        tmc->in_state = TMC_IN_REQ;
+        tmc_in_start(tmc);
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void tmc_rx(usbd_tmc *tmc) {
+    uint8_t _b[TMC_MAX_PKT];
+    int32_t _n = usbd_ep_read(tmc->dev, tmc->rx_ep, _b, tmc->ep_size);
+    int32_t _pos = 0;
+    while (_pos < _n) {
+        if (tmc->out_state == TMC_OUT_HDR) {
+            uint16_t _c = TMC_HDR_SZ - tmc->hdr_len;
+            if (_c > _n - _pos) _c = _n - _pos;
+            memcpy(&tmc->hdr[tmc->hdr_len], &_b[_pos], _c);
+            tmc->hdr_len += _c;
+            _pos += _c;
+            if (tmc->hdr_len < TMC_HDR_SZ) return;
+            tmc->hdr_len = 0;
+            if (!tmc_out_header(tmc)) {
+                /* invalid header. halt bulk OUT endpoint */
+                tmc_out_reset(tmc);
+                usbd_ep_stall(tmc->dev, tmc->rx_ep);
+                return;
+            }
+            if (tmc->out_state == TMC_OUT_HDR) return;
+            if (tmc->out_remain == 0) {
+                if (tmc->out_callback) tmc->out_callback(tmc, _b, 0, tmc->out_eom);
+                tmc->out_state = TMC_OUT_HDR;
+                return;
+            }
+        } else {
+            uint32_t _c = tmc->out_remain;
+            if (_c > (uint32_t)(_n - _pos)) _c = _n - _pos;
+            tmc->out_remain -= _c;
+            tmc->out_rxd += _c;
+            if (tmc->out_callback) {
+                tmc->out_callback(tmc, &_b[_pos], _c, tmc->out_eom && (tmc->out_remain == 0));
+            }
+            _pos += _c;
+            if (tmc->out_remain == 0) {
+                /* rest of the packet is alignment bytes */
+                tmc->out_state = TMC_OUT_HDR;
+                return;
+            }
+        }
+    }
+}
+
+static void tmc_evt(usbd_device *dev, uint8_t event, uint8_t ep) {
+    usbd_tmc *tmc = tmc_ep[ep & 0x07];
+    (void)dev;
+    if (tmc == 0) return;
+    if (event == usbd_evt_eptx) {
+        tmc_in_next(tmc);
+    } else {
+        tmc_rx(tmc);
+    }
+}
+
+void usbd_tmc_init(usbd_tmc *tmc, usbd_device *dev, uint8_t intf,
+                   uint8_t rx_ep, uint8_t tx_ep, uint8_t ep_size) {
+    memset(tmc, 0, sizeof(usbd_tmc));
+    tmc->dev = dev;
+    tmc->intf = intf;
+    tmc->rx_ep = rx_ep;
+    tmc->tx_ep = tx_ep;
+    tmc->ep_size = (ep_size > TMC_MAX_PKT) ? TMC_MAX_PKT : ep_size;
+}
+
+void usbd_tmc_enable(usbd_tmc *tmc, bool enable) {
+    usbd_device *dev = tmc->dev;
+    tmc_out_reset(tmc);
+    tmc_in_reset(tmc);
+    if (enable) {
+        tmc_ep[tmc->rx_ep & 0x07] = tmc;
+        tmc_ep[tmc->tx_ep & 0x07] = tmc;
+        usbd_ep_config(dev, tmc->rx_ep, USB_EPTYPE_BULK, tmc->ep_size);
+        usbd_ep_config(dev, tmc->tx_ep, USB_EPTYPE_BULK, tmc->ep_size);
+        usbd_reg_endpoint(dev, tmc->rx_ep, tmc_evt);
+        usbd_reg_endpoint(dev, tmc->tx_ep, tmc_evt);
+    } else {
+        usbd_ep_deconfig(dev, tmc->tx_ep);
+        usbd_ep_deconfig(dev, tmc->rx_ep);
+        usbd_reg_endpoint(dev, tmc->rx_ep, 0);
+        usbd_reg_endpoint(dev, tmc->tx_ep, 0);
+    }
+}
+
+/* bulk endpoint abort requests */
+static usbd_respond tmc_control_ep(usbd_tmc *tmc, usbd_ctlreq *req) {
+    uint8_t *resp = req->data;
+    uint32_t _v;
+    if (req->wIndex == tmc->rx_ep) {
+        switch (req->bRequest) {
+        case USB_TMC_REQ_INITIATE_ABORT_BULK_OUT:
+            if (tmc->out_state != TMC_OUT_DATA) {
+                resp[0] = USB_TMC_STATUS_TRANSFER_NOT_IN_PROGRESS;
+            } else if (tmc->out_tag != (req->wValue & 0xFF)) {
+                resp[0] = USB_TMC_STATUS_FAILED;
+            } else {
+                tmc_out_reset(tmc);
+                tmc_event(tmc, USBD_TMC_EVT_ABORT_OUT);
+                resp[0] = USB_TMC_STATUS_SUCCESS;
+            }
+            resp[1] = tmc->out_tag;
+            tmc->dev->status.data_count = 2;
+            return usbd_ack;
+        case USB_TMC_REQ_CHECK_ABORT_BULK_OUT_STATUS:
+            _v = tmc->out_rxd;
+            resp[0] = USB_TMC_STATUS_SUCCESS;
+            resp[1] = resp[2] = resp[3] = 0;
+            memcpy(&resp[4], &_v, 4);
+            tmc->dev->status.data_count = 8;
+            return usbd_ack;
+        default:
+            return usbd_fail;
+        }
+    } else if (req->wIndex == tmc->tx_ep) {
+        switch (req->bRequest) {
+        case USB_TMC_REQ_INITIATE_ABORT_BULK_IN:
+            if (tmc->in_state != TMC_IN_BUSY) {
+                resp[0] = USB_TMC_STATUS_TRANSFER_NOT_IN_PROGRESS;
+            } else if (tmc->in_tag != (req->wValue & 0xFF)) {
+                resp[0] = USB_TMC_STATUS_FAILED;
+            } else {
+                /* stop data. transfer ends with the short packet */
+                tmc->in_zlp = (tmc->in_sent % tmc->ep_size) == 0;
+                tmc->in_total = tmc->in_sent;
+                tmc->in_remain = 0;
+                tmc_event(tmc, USBD_TMC_EVT_ABORT_IN);
+                resp[0] = USB_TMC_STATUS_SUCCESS;
+            }
+            resp[1] = tmc->in_tag;
+            tmc->dev->status.data_count = 2;
+            return usbd_ack;
+        case USB_TMC_REQ_CHECK_ABORT_BULK_IN_STATUS:
+            _v = (tmc->in_sent > TMC_HDR_SZ) ? tmc->in_sent - TMC_HDR_SZ : 0;
+            resp[0] = (tmc->in_state == TMC_IN_BUSY) ? USB_TMC_STATUS_PENDING : USB_TMC_STATUS_SUCCESS;
+            resp[1] = (tmc->in_state == TMC_IN_BUSY) ? 0x01 : 0x00;
+            resp[2] = resp[3] = 0;
+            memcpy(&resp[4], &_v, 4);
+            tmc->dev->status.data_count = 8;
+            return usbd_ack;
+        default:
+            return usbd_fail;
+        }
+    }
+    return usbd_fail;
+}
+
+/* interface requests */
+static usbd_respond tmc_control_if(usbd_tmc *tmc, usbd_ctlreq *req) {
+    uint8_t *resp = req->data;
+    if (req->wIndex != tmc->intf) return usbd_fail;
+    switch (req->bRequest) {
+    case USB_TMC_REQ_INITIATE_CLEAR:
+        tmc_out_reset(tmc);
+        if (tmc->in_state == TMC_IN_BUSY) {
+            tmc->in_zlp = (tmc->in_sent % tmc->ep_size) == 0;
+            tmc->in_total = tmc->in_sent;
+        } else {
+            tmc->in_state = TMC_IN_IDLE;
+        }
+        tmc->in_remain = 0;
+        tmc_event(tmc, USBD_TMC_EVT_CLEAR);
+        resp[0] = USB_TMC_STATUS_SUCCESS;
+        tmc->dev->status.data_count = 1;
+        return usbd_ack;
+    case USB_TMC_REQ_CHECK_CLEAR_STATUS:
+        resp[0] = (tmc->in_state == TMC_IN_BUSY) ? USB_TMC_STATUS_PENDING : USB_TMC_STATUS_SUCCESS;
+        resp[1] = (tmc->in_state == TMC_IN_BUSY) ? 0x01 : 0x00;
+        tmc->dev->status.data_count = 2;
+        return usbd_ack;
+    case USB_TMC_REQ_GET_CAPABILITIES: {
+        struct usb_tmc_usb488_get_capabilities_response *cap = (void*)resp;
+        memset(cap, 0, sizeof(*cap));
+        cap->USBTMC_status = USB_TMC_STATUS_SUCCESS;
+        cap->bcdUSBTMC = VERSION_BCD(1,0,0);
+        cap->InterfaceCapabilities = tmc->evt_callback ? USB_TMC_CAP_INDICATOR_PULSE : 0;
+        cap->bcdUSB488 = VERSION_BCD(1,0,0);
+        cap->USB488InterfaceCapabilities = USBD_TMC_USB488_CAPS;
+        cap->USB488DeviceCapabilities = USBD_TMC_USB488_DEVCAPS;
+        tmc->dev->status.data_count = sizeof(*cap);
+        return usbd_ack;
+    }
+    case USB_TMC_REQ_INDICATOR_PULSE:
+        if (tmc->evt_callback == 0) return usbd_fail;
+        tmc_event(tmc, USBD_TMC_EVT_PULSE);
+        resp[0] = USB_TMC_STATUS_SUCCESS;
+        tmc->dev->status.data_count = 1;
+        return usbd_ack;
+    case USB_TMC_USB488_REQ_READ_STATUS_BYTE:
+        /* no interrupt endpoint. status byte is returned in the response */
+        resp[0] = USB_TMC_STATUS_SUCCESS;
+        resp[1] = req->wValue & 0xFF;
+        resp[2] = tmc->status_byte;
+        tmc->dev->status.data_count = 3;
+        return usbd_ack;
+    case USB_TMC_USB488_REQ_REN_CONTROL:
+        tmc->ren = req->wValue & 0x01;
+        resp[0] = USB_TMC_STATUS_SUCCESS;
+        tmc->dev->status.data_count = 1;
+        return usbd_ack;
+    case USB_TMC_USB488_REQ_GO_TO_LOCAL:
+    case USB_TMC_USB488_REQ_LOCAL_LOCKOUT:
+        tmc_event(tmc, (req->bRequest == USB_TMC_USB488_REQ_GO_TO_LOCAL) ? USBD_TMC_EVT_LOCAL : USBD_TMC_EVT_LOCKOUT);
+        resp[0] = USB_TMC_STATUS_SUCCESS;
+        tmc->dev->status.data_count = 1;
+        return usbd_ack;
+    default:
+        return usbd_fail;
+    }
+}
+
+usbd_respond usbd_tmc_control(usbd_tmc *tmc, usbd_ctlreq *req) {
+    switch ((USB_REQ_RECIPIENT | USB_REQ_TYPE) & req->bmRequestType) {
+    case USB_REQ_ENDPOINT | USB_REQ_CLASS:
+        return tmc_control_ep(tmc, req);
+    case USB_REQ_INTERFACE | USB_REQ_CLASS:
+        return tmc_control_if(tmc, req);
+    default:
+        return usbd_fail;
+    }
+}
+
+void usbd_tmc_respond(usbd_tmc *tmc, uint32_t size) {
+    tmc->in_remain = size;
+    tmc_in_start(tmc);
+}
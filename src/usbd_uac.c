@@ -0,0 +1,396 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "usb.h"
+#include "usbd_uac.h"
+
+#define UAC_FRAME_MASK      0x7FF
+#define UAC_FB_SMOOTH       128     /* measured rate IIR filter divider */
+#define UAC_FB_GAIN         256     /* fill error gain. 1/256 sample per frame per sample */
+#define UAC_VOLUME_MIN      -0x6000 /* -96dB */
+#define UAC_VOLUME_RES      0x0100  /* 1dB */
+
+/* endpoint callbacks has no user context, so map endpoint number to the function */
+static usbd_uac *uac_ep[8];
+
+static void uac_put16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void uac_put32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+static uint32_t uac_get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t ring_fill(const usbd_uac_ring *r) {
+    uint16_t head = r->head;
+    uint16_t tail = r->tail;
+    return (head >= tail) ? head - tail : r->size - tail + head;
+}
+
+static uint16_t ring_free(const usbd_uac_ring *r, uint8_t frame_size) {
+    return r->size - ring_fill(r) - frame_size;
+}
+
+static void ring_push(usbd_uac_ring *r, const uint8_t *src, uint16_t len) {
+    uint16_t head = r->head;
+    uint16_t part = r->size - head;
+    if (part > len) part = len;
+    memcpy(r->buf + head, src, part);
+    memcpy(r->buf, src + part, len - part);
+    head += len;
+    if (head >= r->size) head -= r->size;
+    r->head = head;
+}
+
+static void ring_pop(usbd_uac_ring *r, uint8_t *dst, uint16_t len) {
+    uint16_t tail = r->tail;
+    uint16_t part = r->size - tail;
+    if (part > len) part = len;
+    memcpy(dst, r->buf + tail, part);
+    memcpy(dst + part, r->buf, len - part);
+    tail += len;
+    if (tail >= r->size) tail -= r->size;
+    r->tail = tail;
+}
+
+/* samples per frame in 16.16 without 64-bit division */
+static uint32_t uac_rate(uint32_t cnt, uint32_t div) {
+    return ((cnt / div) << 16) + (((cnt % div) << 16) / div);
+}
+
+static uint32_t uac_clamp(usbd_uac *uac, int32_t v) {
+    int32_t lim = uac->nominal >> 3;
+    if (v > (int32_t)uac->nominal + lim) return uac->nominal + lim;
+    if (v < (int32_t)uac->nominal - lim) return uac->nominal - lim;
+    return v;
+}
+
+static void uac_feedback(usbd_uac *uac, uint32_t cnt, uint16_t elapsed) {
+    int32_t err;
+    /* filter state keeps the fraction of the divided step, so small drift is not lost */
+    uac->rate_acc += uac_clamp(uac, uac_rate(cnt, elapsed)) - uac->rate_acc / UAC_FB_SMOOTH;
+    uac->measured = uac->rate_acc / UAC_FB_SMOOTH;
+    /* pulls the playback buffer fill to the half */
+    err = ((int32_t)(uac->out.size / 2) - ring_fill(&uac->out)) / uac->frame_size;
+    uac->feedback = uac_clamp(uac, uac->measured + err * UAC_FB_GAIN);
+}
+
+static void uac_out_start(usbd_uac *uac) {
+    uac->out.head = uac->out.tail;
+    uac->out.primed = 0;
+    uac->consumed_mark = uac->consumed;
+    uac->fb_frame = usbd_hw_call(uac->dev, frame_no);
+    uac->measured = uac->nominal;
+    uac->rate_acc = uac->nominal * UAC_FB_SMOOTH;
+    uac->feedback = uac->nominal;
+}
+
+static void uac_in_start(usbd_uac *uac) {
+    uac->in.tail = uac->in.head;
+    uac->in.primed = 0;
+    uac->in_acc = 0;
+}
+
+static void uac_tx(usbd_uac *uac, uint8_t *buf) {
+    const usbd_uac_config *cfg = uac->cfg;
+    usbd_uac_ring *r = &uac->in;
+    uint16_t cap = r->size / uac->frame_size;
+    uint16_t fill = ring_fill(r) / uac->frame_size;
+    uint16_t frames, len;
+    uac->in_acc += uac->nominal;
+    frames = uac->in_acc >> 16;
+    uac->in_acc &= 0xFFFF;
+    /* device clock is the master. keeps the capture buffer fill around the half */
+    if (fill > cap - cap / 4) {
+        frames++;
+    } else if (fill < cap / 4 && frames) {
+        frames--;
+    }
+    if (!r->primed) {
+        if (fill >= cap / 2) r->primed = 1; else frames = 0;
+    }
+    if (frames > fill) {
+        r->underruns += frames - fill;
+        r->primed = 0;
+        frames = fill;
+    }
+    len = frames * uac->frame_size;
+    if (len > cfg->ep_in_size) len = cfg->ep_in_size - cfg->ep_in_size % uac->frame_size;
+    if (len > USBD_UAC_MAX_PKT) len = USBD_UAC_MAX_PKT - USBD_UAC_MAX_PKT % uac->frame_size;
+    ring_pop(r, buf, len);
+    usbd_ep_write(uac->dev, cfg->ep_in, buf, len);
+}
+
+static void uac_rx(usbd_device *dev, uint8_t event, uint8_t ep) {
+    usbd_uac *uac = uac_ep[ep & 0x07];
+    uint8_t _t[USBD_UAC_MAX_PKT];
+    int32_t len = usbd_ep_read(dev, ep, _t, sizeof(_t));
+    uint16_t room;
+    (void)event;
+    if (len <= 0 || uac->alt_out == 0) return;
+    len -= len % uac->frame_size;
+    room = ring_free(&uac->out, uac->frame_size);
+    if (len > room) {
+        uac->out.overruns += (len - room) / uac->frame_size;
+        len = room;
+    }
+    ring_push(&uac->out, _t, len);
+}
+
+/* selects streaming interface alternate setting. returns false if interface is not streaming */
+static bool uac_set_alt(usbd_uac *uac, uint8_t intf, uint8_t alt) {
+    const usbd_uac_config *cfg = uac->cfg;
+    if (cfg->ep_out && intf == cfg->intf_out) {
+        uac->alt_out = alt;
+        uac_out_start(uac);
+    } else if (cfg->ep_in && intf == cfg->intf_in) {
+        uac->alt_in = alt;
+        uac_in_start(uac);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#if !defined(USBD_ALTSETTINGS)
+static usbd_respond uac_altsetting(usbd_uac *uac, usbd_ctlreq *req) {
+    const usbd_uac_config *cfg = uac->cfg;
+    uint8_t intf = req->wIndex & 0xFF;
+    uint8_t alt;
+    if (cfg->ep_out && intf == cfg->intf_out) {
+        alt = uac->alt_out;
+    } else if (cfg->ep_in && intf == cfg->intf_in) {
+        alt = uac->alt_in;
+    } else {
+        return usbd_fail;
+    }
+    switch (req->bRequest) {
+    case USB_STD_GET_INTERFACE:
+        req->data[0] = alt;
+        uac->dev->status.data_count = 1;
+        return usbd_ack;
+    case USB_STD_SET_INTERFACE:
+        if (req->wValue > 1) return usbd_fail;
+        uac_set_alt(uac, intf, req->wValue);
+        return usbd_ack;
+    default:
+        return usbd_fail;
+    }
+}
+#else
+void usbd_uac_altsetting(usbd_uac *uac, uint8_t intf, uint8_t alt) {
+    uac_set_alt(uac, intf, alt);
+}
+#endif
+
+static usbd_respond uac_clock(usbd_uac *uac, usbd_ctlreq *req, bool get) {
+    uint32_t rate = uac->cfg->rate;
+    switch (req->wValue >> 8) {
+    case USB_UAC_CS_SAM_FREQ_CONTROL:
+        if (req->bRequest == USB_UAC_CUR) {
+            if (!get) return (uac_get32(req->data) == rate) ? usbd_ack : usbd_fail;
+            uac_put32(req->data, rate);
+            uac->dev->status.data_count = 4;
+            return usbd_ack;
+        }
+        if (req->bRequest == USB_UAC_RANGE && get) {
+            /* single subrange with the fixed rate */
+            uac_put16(&req->data[0], 1);
+            uac_put32(&req->data[2], rate);
+            uac_put32(&req->data[6], rate);
+            uac_put32(&req->data[10], 0);
+            uac->dev->status.data_count = 14;
+            return usbd_ack;
+        }
+        return usbd_fail;
+    case USB_UAC_CS_CLOCK_VALID_CONTROL:
+        if (req->bRequest != USB_UAC_CUR || !get) return usbd_fail;
+        req->data[0] = 1;
+        uac->dev->status.data_count = 1;
+        return usbd_ack;
+    default:
+        return usbd_fail;
+    }
+}
+
+static usbd_respond uac_feature(usbd_uac *uac, usbd_ctlreq *req, bool get) {
+    switch (req->wValue >> 8) {
+    case USB_UAC_FU_MUTE_CONTROL:
+        if (req->bRequest != USB_UAC_CUR) return usbd_fail;
+        if (get) {
+            req->data[0] = uac->mute;
+            uac->dev->status.data_count = 1;
+        } else {
+            uac->mute = req->data[0];
+        }
+        return usbd_ack;
+    case USB_UAC_FU_VOLUME_CONTROL:
+        if (req->bRequest == USB_UAC_CUR) {
+            if (get) {
+                uac_put16(req->data, uac->volume);
+                uac->dev->status.data_count = 2;
+            } else {
+                uac->volume = req->data[0] | (req->data[1] << 8);
+            }
+            return usbd_ack;
+        }
+        if (req->bRequest == USB_UAC_RANGE && get) {
+            uac_put16(&req->data[0], 1);
+            uac_put16(&req->data[2], UAC_VOLUME_MIN);
+            uac_put16(&req->data[4], 0);
+            uac_put16(&req->data[6], UAC_VOLUME_RES);
+            uac->dev->status.data_count = 8;
+            return usbd_ack;
+        }
+        return usbd_fail;
+    default:
+        return usbd_fail;
+    }
+}
+
+void usbd_uac_init(usbd_uac *uac, usbd_device *dev, const usbd_uac_config *cfg,
+                   void *out_buf, uint16_t out_size, void *in_buf, uint16_t in_size) {
+    memset(uac, 0, sizeof(usbd_uac));
+    uac->dev = dev;
+    uac->cfg = cfg;
+    uac->frame_size = cfg->channels * cfg->subslot;
+    uac->out.buf = out_buf;
+    uac->out.size = out_size - out_size % uac->frame_size;
+    uac->in.buf = in_buf;
+    uac->in.size = in_size - in_size % uac->frame_size;
+    uac->nominal = uac_rate(cfg->rate, 1000);
+    uac->measured = uac->nominal;
+    uac->rate_acc = uac->nominal * UAC_FB_SMOOTH;
+    uac->feedback = uac->nominal;
+}
+
+void usbd_uac_enable(usbd_uac *uac, bool enable) {
+    const usbd_uac_config *cfg = uac->cfg;
+    usbd_device *dev = uac->dev;
+    uac->alt_out = 0;
+    uac->alt_in = 0;
+    if (enable) {
+        /* with USBD_ALTSETTINGS streaming endpoints are configured by the core on SET_INTERFACE */
+        if (cfg->ep_out) {
+            uac_ep[cfg->ep_out & 0x07] = uac;
+#if !defined(USBD_ALTSETTINGS)
+            usbd_ep_config(dev, cfg->ep_out, USB_EPTYPE_ISOCHRONUS, cfg->ep_out_size);
+#endif
+            usbd_reg_endpoint(dev, cfg->ep_out, uac_rx);
+        }
+#if !defined(USBD_ALTSETTINGS)
+        if (cfg->ep_fb) usbd_ep_config(dev, cfg->ep_fb, USB_EPTYPE_ISOCHRONUS, cfg->fb_size);
+        if (cfg->ep_in) usbd_ep_config(dev, cfg->ep_in, USB_EPTYPE_ISOCHRONUS, cfg->ep_in_size);
+#endif
+    } else {
+        if (cfg->ep_out) {
+            usbd_ep_deconfig(dev, cfg->ep_out);
+            usbd_reg_endpoint(dev, cfg->ep_out, 0);
+        }
+        if (cfg->ep_fb) usbd_ep_deconfig(dev, cfg->ep_fb);
+        if (cfg->ep_in) usbd_ep_deconfig(dev, cfg->ep_in);
+    }
+}
+
+usbd_respond usbd_uac_control(usbd_uac *uac, usbd_ctlreq *req) {
+    const usbd_uac_config *cfg = uac->cfg;
+    uint8_t entity = req->wIndex >> 8;
+    bool get = (req->bmRequestType & USB_REQ_DIRECTION) == USB_REQ_DEVTOHOST;
+    switch ((USB_REQ_RECIPIENT | USB_REQ_TYPE) & req->bmRequestType) {
+#if !defined(USBD_ALTSETTINGS)
+    case USB_REQ_INTERFACE | USB_REQ_STANDARD:
+        return uac_altsetting(uac, req);
+#endif
+    case USB_REQ_INTERFACE | USB_REQ_CLASS:
+        if ((req->wIndex & 0xFF) != cfg->intf_ac) return usbd_fail;
+        if (entity == cfg->clock_id) return uac_clock(uac, req, get);
+        if (cfg->fu_id && entity == cfg->fu_id) return uac_feature(uac, req, get);
+        return usbd_fail;
+    default:
+        return usbd_fail;
+    }
+}
+
+void usbd_uac_sof(usbd_uac *uac) {
+    const usbd_uac_config *cfg = uac->cfg;
+    uint8_t _t[USBD_UAC_MAX_PKT];
+    if (uac->alt_out) {
+        uint16_t now = usbd_hw_call(uac->dev, frame_no);
+        uint16_t elapsed = (now - uac->fb_frame) & UAC_FRAME_MASK;
+        /* frame counter keeps the period right if some SOFs were missed */
+        if (elapsed >= (1U << cfg->refresh)) {
+            uint32_t cnt = uac->consumed - uac->consumed_mark;
+            uac->consumed_mark += cnt;
+            uac->fb_frame = now;
+            if (cnt) uac_feedback(uac, cnt, elapsed);
+        }
+        if (cfg->ep_fb) {
+            /* full-speed 10.14 feedback is sent as 3 bytes */
+            uac_put32(_t, (cfg->fb_size == 3) ? uac->feedback >> 2 : uac->feedback);
+            usbd_ep_write(uac->dev, cfg->ep_fb, _t, cfg->fb_size);
+        }
+    }
+    if (uac->alt_in) uac_tx(uac, _t);
+}
+
+uint16_t usbd_uac_read(usbd_uac *uac, void *buf, uint16_t frames) {
+    usbd_uac_ring *r = &uac->out;
+    uint32_t len = (uint32_t)frames * uac->frame_size;
+    uint16_t fill = ring_fill(r);
+    uac->consumed += frames;
+    if (!r->primed) {
+        if (fill < r->size / 2) {
+            memset(buf, 0, len);
+            return 0;
+        }
+        r->primed = 1;
+    }
+    if (fill < len) {
+        r->underruns += (len - fill) / uac->frame_size;
+        r->primed = 0;
+        memset((uint8_t*)buf + fill, 0, len - fill);
+        len = fill;
+    }
+    ring_pop(r, buf, len);
+    return len / uac->frame_size;
+}
+
+uint16_t usbd_uac_write(usbd_uac *uac, const void *buf, uint16_t frames) {
+    usbd_uac_ring *r = &uac->in;
+    uint32_t len = (uint32_t)frames * uac->frame_size;
+    uint16_t room = ring_free(r, uac->frame_size);
+    if (len > room) {
+        r->overruns += (len - room) / uac->frame_size;
+        len = room;
+    }
+    ring_push(r, buf, len);
+    return len / uac->frame_size;
+}
+
+int32_t usbd_uac_drift(usbd_uac *uac) {
+    int32_t diff = (int32_t)(uac->measured - uac->nominal);
+    return diff * 1000 / (int32_t)(uac->nominal / 1000);
+}
@@ -0,0 +1,209 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* CDC ACM loopback throughput benchmark. Host tool.
+ * The host streams data to the OUT endpoint of the virtual bus, the application echoes it from
+ * the main loop, and the host checks the data read back from the IN endpoint.
+ *
+ * Build and run:
+ *   cc -std=gnu99 -O2 -Iinc -DUSBD_VIRTUAL tools/acmbench.c tools/vbus.c src/usbd_core.c \
+ *      src/usbd_cdc_acm.c -o acmbench
+ *   ./acmbench [-b <bytes>] [-r <ring size>] [-p <pool blocks>] [-a <app chunk>]
+ *
+ * Each frame the host runs up to 19 bulk transactions of 64 bytes in each direction, which is
+ * the full-speed limit. The application loop runs after every transaction. Bus throughput is the
+ * payload per simulated frame, CPU time is the host time spent in the stack and application.
+ * With -p the port uses the shared blocks pool with the half of blocks quota for each direction.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "usb.h"
+#include "usb_cdc.h"
+#include "usbd_cdc_acm.h"
+#include "vbus.h"
+
+#define EP_SIZE         0x40
+#define FRAME_PACKETS   19      /* full-speed bulk transactions of 64 bytes per frame */
+
+struct cdc_config {
+    struct usb_config_descriptor    config;
+    struct usbd_cdc_acm_desc        acm;
+} __attribute__((packed));
+
+static const struct cdc_config config_desc = {
+    .config = {
+        .bLength                = sizeof(struct usb_config_descriptor),
+        .bDescriptorType        = USB_DTYPE_CONFIGURATION,
+        .wTotalLength           = sizeof(struct cdc_config),
+        .bNumInterfaces         = 2,
+        .bConfigurationValue    = 1,
+        .iConfiguration         = NO_DESCRIPTOR,
+        .bmAttributes           = USB_CFG_ATTR_RESERVED | USB_CFG_ATTR_SELFPOWERED,
+        .bMaxPower              = USB_CFG_POWER_MA(100),
+    },
+    .acm = USBD_CDC_ACM_DESC(0, 0x01, 0x81, 0x82, EP_SIZE, USB_PROTO_NONE),
+};
+
+static usbd_device udev;
+static uint32_t ubuf[0x20];
+static usbd_cdc_acm acm;
+static uint8_t rxbuf[0x1000];
+static uint8_t txbuf[0x1000];
+static usbd_cdc_acm_pool pool;
+static usbd_cdc_acm_blk blocks[0x40];
+static unsigned app_chunk = 0x100;
+
+static usbd_respond app_getdesc(usbd_ctlreq *req, void **address, uint16_t *length) {
+    if ((req->wValue >> 8) != USB_DTYPE_CONFIGURATION) return usbd_fail;
+    *address = (void*)&config_desc;
+    *length = sizeof(config_desc);
+    return usbd_ack;
+}
+
+static usbd_respond app_control(usbd_device *dev, usbd_ctlreq *req, usbd_rqc_callback *callback) {
+    (void)dev; (void)callback;
+    return usbd_cdc_acm_control(&acm, req);
+}
+
+static usbd_respond app_setconf(usbd_device *dev, uint8_t cfg) {
+    (void)dev;
+    if (cfg > 1) return usbd_fail;
+    usbd_cdc_acm_enable(&acm, cfg == 1);
+    return usbd_ack;
+}
+
+/* main loop echo */
+static void app_loop(void) {
+    uint8_t _b[0x1000];
+    uint16_t _n = usbd_cdc_acm_space(&acm);
+    if (_n > app_chunk) _n = app_chunk;
+    _n = usbd_cdc_acm_read(&acm, _b, _n);
+    if (_n) usbd_cdc_acm_write(&acm, _b, _n);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint8_t pattern(unsigned i) {
+    return (uint8_t)(i * 7 + (i >> 8));
+}
+
+int main(int argc, char **argv) {
+    unsigned total = 0x100000, ring = 0x200, nblk = 0;
+    unsigned sent = 0, recv = 0, frames = 0, naks = 0, errors = 0, idle = 0;
+    uint8_t pkt[EP_SIZE];
+    double start;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            total = strtoul(argv[++i], 0, 0);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            ring = strtoul(argv[++i], 0, 0);
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            nblk = strtoul(argv[++i], 0, 0);
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            app_chunk = strtoul(argv[++i], 0, 0);
+        } else {
+            fprintf(stderr, "usage: acmbench [-b <bytes>] [-r <ring size>] [-p <pool blocks>] [-a <app chunk>]\n");
+            return 1;
+        }
+    }
+    if (ring < EP_SIZE || ring > sizeof(rxbuf) || (ring & (ring - 1))) {
+        fprintf(stderr, "acmbench: ring size must be a power of 2 from 64 to 4096\n");
+        return 1;
+    }
+    if (nblk == 1 || nblk > sizeof(blocks) / sizeof(blocks[0])) {
+        fprintf(stderr, "acmbench: pool must have from 2 to 64 blocks\n");
+        return 1;
+    }
+    if (app_chunk == 0 || app_chunk > sizeof(rxbuf)) app_chunk = sizeof(rxbuf);
+
+    if (nblk) {
+        usbd_cdc_acm_pool_init(&pool, blocks, nblk);
+        usbd_cdc_acm_init_pool(&acm, &udev, 0, 0x01, 0x81, 0x82, EP_SIZE, &pool, nblk / 2);
+        ring = nblk * USBD_CDC_ACM_BLK_SZ;
+    } else {
+        usbd_cdc_acm_init(&acm, &udev, 0, 0x01, 0x81, 0x82, EP_SIZE, rxbuf, ring, txbuf, ring);
+    }
+    vbus_init(0, &udev, 0x40, ubuf, sizeof(ubuf));
+    usbd_reg_config(&udev, app_setconf);
+    usbd_reg_control(&udev, app_control);
+    usbd_reg_descr(&udev, app_getdesc);
+    if (!vbus_enumerate(0, 1, 1)) {
+        fprintf(stderr, "acmbench: enumeration failed\n");
+        return 1;
+    }
+
+    start = now_ns();
+    while (recv < total) {
+        unsigned out_pkts = 0, in_pkts = 0;
+        vbus_sof(0);
+        frames++;
+        while (out_pkts < FRAME_PACKETS || in_pkts < FRAME_PACKETS) {
+            bool busy = false;
+            if (out_pkts < FRAME_PACKETS && sent < total) {
+                unsigned _l = (total - sent > EP_SIZE) ? EP_SIZE : total - sent;
+                for (unsigned j = 0; j < _l; j++) pkt[j] = pattern(sent + j);
+                if (vbus_out(0, 0x01, pkt, _l) == (int)_l) {
+                    sent += _l;
+                    out_pkts++;
+                    busy = true;
+                } else {
+                    naks++;
+                }
+                app_loop();
+            }
+            if (in_pkts < FRAME_PACKETS) {
+                int _l = vbus_in(0, 0x81, pkt);
+                if (_l > 0) {
+                    for (int j = 0; j < _l; j++) {
+                        if (pkt[j] != pattern(recv + j)) errors++;
+                    }
+                    recv += _l;
+                    in_pkts++;
+                    busy = true;
+                } else if (_l == 0) {
+                    /* ZLP closing the transfer */
+                    busy = true;
+                } else {
+                    naks++;
+                }
+                app_loop();
+            }
+            if (!busy) break;
+        }
+        /* data is lost or held forever */
+        idle = (out_pkts || in_pkts) ? 0 : idle + 1;
+        if (idle > 100) {
+            fprintf(stderr, "acmbench: transfer stalled at %u bytes\n", recv);
+            break;
+        }
+    }
+
+    double cpu = now_ns() - start;
+    printf("%-10s %8s %8s %8s %8s %10s %10s %8s\n",
+           "bytes", "buffer", "chunk", "frames", "naks", "bus,KB/s", "cpu,MB/s", "errors");
+    printf("%-10u %8u %8u %8u %8u %10.1f %10.1f %8u\n", recv, ring, app_chunk, frames, naks,
+           (double)recv / frames * 1000 / 1024, (double)recv / cpu * 1e3, errors);
+    return (errors || recv != total) ? 1 : 0;
+}
@@ -0,0 +1,981 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Instruction level Cortex-M emulator for the driver benchmarks. Host tool.
+ * Covers the Thumb instruction set of ARMv6-M and the integer Thumb-2 instructions of ARMv7-M
+ * used by the compiled and hand written drivers. Exclusive access, coprocessor, DSP and system
+ * instructions other than the hints, barriers, CPS, MRS and MSR stop the emulation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "armsim.h"
+
+#define PAGE_BITS       12
+#define PAGE_SIZE       (1 << PAGE_BITS)
+#define INSN_LIMIT      10000000
+
+#define N_FLAG          0x80000000
+#define Z_FLAG          0x40000000
+#define C_FLAG          0x20000000
+#define V_FLAG          0x10000000
+
+/* memory */
+
+static uint8_t *mem_byte(struct armsim *sim, uint32_t addr) {
+    uint8_t **p = &sim->pages[addr >> PAGE_BITS];
+    if (*p == NULL) *p = calloc(1, PAGE_SIZE);
+    return *p + (addr & (PAGE_SIZE - 1));
+}
+
+uint32_t armsim_peek(struct armsim *sim, uint32_t addr, int size) {
+    uint32_t v = 0;
+    for (int i = size - 1; i >= 0; i--) v = (v << 8) | *mem_byte(sim, addr + i);
+    return v;
+}
+
+void armsim_poke(struct armsim *sim, uint32_t addr, int size, uint32_t value) {
+    for (int i = 0; i < size; i++, value >>= 8) *mem_byte(sim, addr + i) = value;
+}
+
+static void stop(struct armsim *sim, const char *reason) {
+    if (sim->fault == NULL) {
+        sim->fault = reason;
+        sim->fault_pc = sim->r[15] - 4;
+    }
+}
+
+/* unaligned access faults on ARMv6-M and for the multiple transfers on ARMv7-M */
+static uint32_t rd(struct armsim *sim, uint32_t addr, int size, bool strict) {
+    uint32_t v;
+    if ((addr & (size - 1)) && (strict || sim->core == ARMSIM_M0P)) {
+        stop(sim, "unaligned read");
+        return 0;
+    }
+    if (sim->io && sim->io(sim->io_ctx, addr, size, &v, false)) return v;
+    return armsim_peek(sim, addr, size);
+}
+
+static void wr(struct armsim *sim, uint32_t addr, int size, uint32_t v, bool strict) {
+    if ((addr & (size - 1)) && (strict || sim->core == ARMSIM_M0P)) {
+        stop(sim, "unaligned write");
+        return;
+    }
+    if (size < 4) v &= (1u << (size * 8)) - 1;
+    if (sim->io && sim->io(sim->io_ctx, addr, size, &v, true)) return;
+    armsim_poke(sim, addr, size, v);
+}
+
+/* timing */
+
+static unsigned refill(struct armsim *sim) {
+    return (sim->core == ARMSIM_M0P) ? 1 : 2;
+}
+
+static void tick(struct armsim *sim, unsigned cycles) {
+    sim->cycles += cycles;
+}
+
+/* single load or store takes 2 cycles. Neighbouring ones pipeline the address phase on M3/M4 */
+static void tick_ls(struct armsim *sim) {
+    sim->ls = true;
+    if (sim->core == ARMSIM_M0P || !sim->pipelined) tick(sim, 1);
+}
+
+static void branch(struct armsim *sim, uint32_t target) {
+    sim->next = target & ~1u;
+    tick(sim, refill(sim));
+}
+
+/* interworking branch. Cortex-M has no ARM state */
+static void branch_x(struct armsim *sim, uint32_t target) {
+    if ((target & 1) == 0) stop(sim, "branch to ARM state");
+    branch(sim, target);
+}
+
+/* writes register. PC write is the branch */
+static void wreg(struct armsim *sim, unsigned r, uint32_t v) {
+    if (r == 15) {
+        branch(sim, v);
+    } else {
+        sim->r[r] = v;
+    }
+}
+
+/* flags */
+
+static void set_nz(struct armsim *sim, uint32_t v) {
+    sim->apsr &= ~(N_FLAG | Z_FLAG);
+    if (v & 0x80000000) sim->apsr |= N_FLAG;
+    if (v == 0) sim->apsr |= Z_FLAG;
+}
+
+static void set_c(struct armsim *sim, bool c) {
+    sim->apsr = c ? (sim->apsr | C_FLAG) : (sim->apsr & ~C_FLAG);
+}
+
+static void set_v(struct armsim *sim, bool v) {
+    sim->apsr = v ? (sim->apsr | V_FLAG) : (sim->apsr & ~V_FLAG);
+}
+
+static bool carry(struct armsim *sim) {
+    return (sim->apsr & C_FLAG) != 0;
+}
+
+static uint32_t add_c(struct armsim *sim, uint32_t x, uint32_t y, bool cin, bool flags) {
+    uint64_t u = (uint64_t)x + y + cin;
+    uint32_t r = (uint32_t)u;
+    if (flags) {
+        set_nz(sim, r);
+        set_c(sim, u >> 32);
+        set_v(sim, ((x ^ r) & (y ^ r)) >> 31);
+    }
+    return r;
+}
+
+static bool cond_pass(struct armsim *sim, unsigned cond) {
+    uint32_t f = sim->apsr;
+    bool n = f & N_FLAG, z = f & Z_FLAG, c = f & C_FLAG, v = f & V_FLAG;
+    bool r;
+    switch (cond >> 1) {
+    case 0:  r = z; break;
+    case 1:  r = c; break;
+    case 2:  r = n; break;
+    case 3:  r = v; break;
+    case 4:  r = c && !z; break;
+    case 5:  r = (n == v); break;
+    case 6:  r = !z && (n == v); break;
+    default: return true;
+    }
+    return (cond & 1) ? !r : r;
+}
+
+/* shifts. type 0 LSL, 1 LSR, 2 ASR, 3 ROR, 4 RRX */
+static uint32_t shift_c(uint32_t v, unsigned type, unsigned n, bool *c) {
+    if (type == 4) {
+        uint32_t r = ((uint32_t)*c << 31) | (v >> 1);
+        *c = v & 1;
+        return r;
+    }
+    if (n == 0) return v;
+    switch (type) {
+    case 0:
+        if (n > 32) {
+            *c = false;
+            return 0;
+        }
+        *c = (v >> (32 - n)) & 1;
+        return (n == 32) ? 0 : v << n;
+    case 1:
+        if (n > 32) {
+            *c = false;
+            return 0;
+        }
+        *c = (v >> (n - 1)) & 1;
+        return (n == 32) ? 0 : v >> n;
+    case 2:
+        if (n >= 32) {
+            *c = v >> 31;
+            return (uint32_t)((int32_t)v >> 31);
+        }
+        *c = (v >> (n - 1)) & 1;
+        return (uint32_t)((int32_t)v >> n);
+    default:
+        n &= 31;
+        v = n ? (v >> n) | (v << (32 - n)) : v;
+        *c = v >> 31;
+        return v;
+    }
+}
+
+/* immediate shift of the register operand */
+static uint32_t shift_imm(uint32_t v, unsigned type, unsigned imm5, bool *c) {
+    if (type == 3 && imm5 == 0) return shift_c(v, 4, 1, c);
+    if ((type == 1 || type == 2) && imm5 == 0) imm5 = 32;
+    return shift_c(v, type, imm5, c);
+}
+
+/* ThumbExpandImm_C() */
+static uint32_t expand_imm(uint32_t imm12, bool *c) {
+    uint32_t b = imm12 & 0xFF;
+    if ((imm12 >> 10) == 0) {
+        switch ((imm12 >> 8) & 3) {
+        case 0:  return b;
+        case 1:  return (b << 16) | b;
+        case 2:  return (b << 24) | (b << 8);
+        default: return b * 0x01010101;
+        }
+    }
+    uint32_t n = imm12 >> 7;
+    uint32_t v = 0x80 | (imm12 & 0x7F);
+    v = (v >> n) | (v << (32 - n));
+    *c = v >> 31;
+    return v;
+}
+
+static uint32_t sext(uint32_t v, unsigned bits) {
+    uint32_t m = 1u << (bits - 1);
+    v &= (m << 1) - 1;
+    return (v ^ m) - m;
+}
+
+static unsigned bitcount(uint32_t v) {
+    unsigned n = 0;
+    for (; v; v &= v - 1) n++;
+    return n;
+}
+
+/* multiple transfers. ascending registers at ascending addresses */
+static void ldm(struct armsim *sim, unsigned rn, uint32_t addr, uint16_t list, bool wback, uint32_t wb_addr) {
+    unsigned n = bitcount(list);
+    bool pc = list & 0x8000;
+    if (wback && !(list & (1 << rn))) sim->r[rn] = wb_addr;
+    for (unsigned i = 0; i < 15; i++) {
+        if (list & (1 << i)) {
+            sim->r[i] = rd(sim, addr, 4, true);
+            addr += 4;
+        }
+    }
+    tick(sim, 1 + n);
+    if (pc) {
+        uint32_t target = rd(sim, addr, 4, true);
+        branch_x(sim, target);
+        if (sim->core == ARMSIM_M0P) tick(sim, 1);
+    }
+}
+
+static void stm(struct armsim *sim, unsigned rn, uint32_t addr, uint16_t list, bool wback, uint32_t wb_addr) {
+    tick(sim, 1 + bitcount(list));
+    for (unsigned i = 0; i < 15; i++) {
+        if (list & (1 << i)) {
+            wr(sim, addr, 4, sim->r[i], true);
+            addr += 4;
+        }
+    }
+    if (wback) sim->r[rn] = wb_addr;
+}
+
+/* single transfers. size 1, 2, 4; signed loads extend */
+static void load(struct armsim *sim, unsigned rt, uint32_t addr, int size, bool sign) {
+    uint32_t v = rd(sim, addr, size, false);
+    if (sign) v = sext(v, size * 8);
+    tick_ls(sim);
+    if (rt == 15) {
+        branch_x(sim, v);
+    } else {
+        sim->r[rt] = v;
+    }
+}
+
+static void store(struct armsim *sim, unsigned rt, uint32_t addr, int size) {
+    wr(sim, addr, size, sim->r[rt], false);
+    tick_ls(sim);
+}
+
+static uint32_t ror(uint32_t v, unsigned n) {
+    n &= 31;
+    return n ? (v >> n) | (v << (32 - n)) : v;
+}
+
+static uint32_t extend(uint32_t v, unsigned rot, unsigned kind) {
+    v = ror(v, rot * 8);
+    switch (kind) {
+    case 0:  return sext(v, 16);    /* SXTH */
+    case 1:  return v & 0xFFFF;     /* UXTH */
+    case 2:  return sext(v, 8);     /* SXTB */
+    default: return v & 0xFF;       /* UXTB */
+    }
+}
+
+static uint32_t rbit(uint32_t v) {
+    uint32_t r = 0;
+    for (int i = 0; i < 32; i++, v >>= 1) r = (r << 1) | (v & 1);
+    return r;
+}
+
+static uint32_t rev16(uint32_t v) {
+    return ((v & 0x00FF00FF) << 8) | ((v >> 8) & 0x00FF00FF);
+}
+
+/* 16-bit instructions */
+
+static void exec16(struct armsim *sim, uint16_t op) {
+    uint32_t *r = sim->r;
+    bool flags = (sim->itstate == 0);
+    bool c = carry(sim);
+    unsigned rd_ = op & 7, rn = (op >> 3) & 7, rm = (op >> 6) & 7;
+    uint32_t v;
+
+    tick(sim, 1);
+    switch (op >> 11) {
+    case 0x00: case 0x01: case 0x02:
+        /* LSL, LSR, ASR immediate */
+        v = shift_imm(r[rn], op >> 11, (op >> 6) & 31, &c);
+        r[rd_] = v;
+        if (flags) {
+            set_nz(sim, v);
+            set_c(sim, c);
+        }
+        return;
+    case 0x03:
+        /* ADD, SUB register or 3-bit immediate */
+        v = (op & 0x0400) ? rm : r[rm];
+        r[rd_] = (op & 0x0200) ? add_c(sim, r[rn], ~v, true, flags) : add_c(sim, r[rn], v, false, flags);
+        return;
+    case 0x04:
+        r[(op >> 8) & 7] = op & 0xFF;
+        if (flags) set_nz(sim, op & 0xFF);
+        return;
+    case 0x05:
+        add_c(sim, r[(op >> 8) & 7], ~(op & 0xFFu), true, true);
+        return;
+    case 0x06:
+        r[(op >> 8) & 7] = add_c(sim, r[(op >> 8) & 7], op & 0xFF, false, flags);
+        return;
+    case 0x07:
+        r[(op >> 8) & 7] = add_c(sim, r[(op >> 8) & 7], ~(op & 0xFFu), true, flags);
+        return;
+    case 0x08:
+        if ((op & 0x0400) == 0) {
+            /* data processing */
+            uint32_t a = r[rd_], b = r[rn];
+            switch ((op >> 6) & 0x0F) {
+            case 0x0: v = a & b; break;
+            case 0x1: v = a ^ b; break;
+            case 0x2: v = shift_c(a, 0, b & 0xFF, &c); break;
+            case 0x3: v = shift_c(a, 1, b & 0xFF, &c); break;
+            case 0x4: v = shift_c(a, 2, b & 0xFF, &c); break;
+            case 0x5: r[rd_] = add_c(sim, a, b, c, flags); return;
+            case 0x6: r[rd_] = add_c(sim, a, ~b, c, flags); return;
+            case 0x7: v = shift_c(a, 3, b & 0xFF, &c); break;
+            case 0x8:
+                set_nz(sim, a & b);
+                return;
+            case 0x9: r[rd_] = add_c(sim, ~b, 0, true, flags); return;
+            case 0xA: add_c(sim, a, ~b, true, true); return;
+            case 0xB: add_c(sim, a, b, false, true); return;
+            case 0xC: v = a | b; break;
+            case 0xD: v = a * b; break;
+            case 0xE: v = a & ~b; break;
+            default:  v = ~b; break;
+            }
+            r[rd_] = v;
+            if (flags) {
+                set_nz(sim, v);
+                set_c(sim, c);
+            }
+            return;
+        }
+        /* special data processing and branch exchange */
+        rd_ = (op & 7) | ((op >> 4) & 8);
+        rm = (op >> 3) & 0x0F;
+        switch ((op >> 8) & 3) {
+        case 0:
+            wreg(sim, rd_, r[rd_] + r[rm]);
+            return;
+        case 1:
+            add_c(sim, r[rd_], ~r[rm], true, true);
+            return;
+        case 2:
+            wreg(sim, rd_, r[rm]);
+            return;
+        default:
+            v = r[rm];
+            if (op & 0x80) r[14] = (r[15] - 2) | 1;
+            branch_x(sim, v);
+            return;
+        }
+    case 0x09:
+        load(sim, (op >> 8) & 7, ((r[15] & ~3u) + (op & 0xFF) * 4), 4, false);
+        return;
+    case 0x0A: case 0x0B:
+        {
+            static const int8_t size[8] = {4, 2, 1, -1, 4, 2, 1, -2};
+            unsigned opb = (op >> 9) & 7;
+            uint32_t addr = r[rn] + r[rm];
+            if (opb < 3) {
+                store(sim, rd_, addr, size[opb]);
+            } else {
+                int s = size[opb] < 0 ? -size[opb] : size[opb];
+                load(sim, rd_, addr, s, size[opb] < 0);
+            }
+        }
+        return;
+    case 0x0C:
+        store(sim, rd_, r[rn] + ((op >> 6) & 31) * 4, 4);
+        return;
+    case 0x0D:
+        load(sim, rd_, r[rn] + ((op >> 6) & 31) * 4, 4, false);
+        return;
+    case 0x0E:
+        store(sim, rd_, r[rn] + ((op >> 6) & 31), 1);
+        return;
+    case 0x0F:
+        load(sim, rd_, r[rn] + ((op >> 6) & 31), 1, false);
+        return;
+    case 0x10:
+        store(sim, rd_, r[rn] + ((op >> 6) & 31) * 2, 2);
+        return;
+    case 0x11:
+        load(sim, rd_, r[rn] + ((op >> 6) & 31) * 2, 2, false);
+        return;
+    case 0x12:
+        store(sim, (op >> 8) & 7, r[13] + (op & 0xFF) * 4, 4);
+        return;
+    case 0x13:
+        load(sim, (op >> 8) & 7, r[13] + (op & 0xFF) * 4, 4, false);
+        return;
+    case 0x14:
+        r[(op >> 8) & 7] = (r[15] & ~3u) + (op & 0xFF) * 4;
+        return;
+    case 0x15:
+        r[(op >> 8) & 7] = r[13] + (op & 0xFF) * 4;
+        return;
+    case 0x16: case 0x17:
+        /* miscellaneous */
+        if ((op & 0xFF00) == 0xB000) {
+            r[13] += (op & 0x80) ? -(uint32_t)((op & 0x7F) * 4) : (op & 0x7F) * 4;
+        } else if ((op & 0xF500) == 0xB100) {
+            if (sim->core == ARMSIM_M0P) break;
+            bool nz = op & 0x0800;
+            if ((r[rd_] != 0) == nz) branch(sim, r[15] + (((op >> 3) & 0x1F) << 1) + ((op & 0x0200) >> 3));
+        } else if ((op & 0xFF00) == 0xB200) {
+            static const uint8_t kind[4] = {0, 2, 1, 3};
+            r[rd_] = extend(r[rn], 0, kind[(op >> 6) & 3]);
+        } else if ((op & 0xFE00) == 0xB400) {
+            uint16_t list = (op & 0xFF) | ((op & 0x100) ? 0x4000 : 0);
+            uint32_t addr = r[13] - 4 * bitcount(list);
+            sim->cycles--;
+            stm(sim, 13, addr, list, true, addr);
+        } else if ((op & 0xFE00) == 0xBC00) {
+            uint16_t list = (op & 0xFF) | ((op & 0x100) ? 0x8000 : 0);
+            sim->cycles--;
+            ldm(sim, 13, r[13], list, true, r[13] + 4 * bitcount(list));
+        } else if ((op & 0xFFE8) == 0xB660) {
+            /* CPS */
+        } else if ((op & 0xFF00) == 0xBA00) {
+            switch ((op >> 6) & 3) {
+            case 0:  r[rd_] = __builtin_bswap32(r[rn]); break;
+            case 1:  r[rd_] = rev16(r[rn]); break;
+            case 3:  r[rd_] = sext(__builtin_bswap16(r[rn] & 0xFFFF), 16); break;
+            default: stop(sim, "undefined instruction"); break;
+            }
+        } else if ((op & 0xFF00) == 0xBF00) {
+            if ((op & 0x0F) && sim->core != ARMSIM_M0P) sim->itstate = op & 0xFF;
+        } else {
+            stop(sim, "unsupported instruction");
+        }
+        return;
+    case 0x18: case 0x19:
+        {
+            uint16_t list = op & 0xFF;
+            unsigned rb = (op >> 8) & 7;
+            uint32_t end = r[rb] + 4 * bitcount(list);
+            sim->cycles--;
+            if (op & 0x0800) {
+                ldm(sim, rb, r[rb], list, true, end);
+            } else {
+                stm(sim, rb, r[rb], list, true, end);
+            }
+        }
+        return;
+    case 0x1A: case 0x1B:
+        if (((op >> 8) & 0x0F) >= 0x0E) break;
+        if (cond_pass(sim, (op >> 8) & 0x0F)) branch(sim, r[15] + sext((op & 0xFF) << 1, 9));
+        return;
+    case 0x1C:
+        branch(sim, r[15] + sext((op & 0x7FF) << 1, 12));
+        return;
+    default:
+        break;
+    }
+    stop(sim, "unsupported instruction");
+}
+
+/* 32-bit instructions */
+
+static void dp_op(struct armsim *sim, unsigned opc, unsigned rd_, unsigned rn, uint32_t a, uint32_t b,
+                  bool s, bool c) {
+    uint32_t v;
+    switch (opc) {
+    case 0x0:
+        v = a & b;
+        break;
+    case 0x1:
+        v = a & ~b;
+        break;
+    case 0x2:
+        v = (rn == 15) ? b : a | b;
+        break;
+    case 0x3:
+        v = (rn == 15) ? ~b : a | ~b;
+        break;
+    case 0x4:
+        v = a ^ b;
+        break;
+    case 0x8:
+        v = add_c(sim, a, b, false, s);
+        if (rd_ != 15) sim->r[rd_] = v;
+        return;
+    case 0xA:
+        sim->r[rd_] = add_c(sim, a, b, carry(sim), s);
+        return;
+    case 0xB:
+        sim->r[rd_] = add_c(sim, a, ~b, carry(sim), s);
+        return;
+    case 0xD:
+        v = add_c(sim, a, ~b, true, s);
+        if (rd_ != 15) sim->r[rd_] = v;
+        return;
+    case 0xE:
+        sim->r[rd_] = add_c(sim, b, ~a, true, s);
+        return;
+    default:
+        stop(sim, "unsupported data processing");
+        return;
+    }
+    if (s) {
+        set_nz(sim, v);
+        set_c(sim, c);
+    }
+    /* TST and TEQ */
+    if (rd_ != 15) sim->r[rd_] = v;
+}
+
+static void exec32_ls(struct armsim *sim, uint16_t hw1, uint16_t hw2) {
+    uint32_t *r = sim->r;
+    unsigned rn = hw1 & 0x0F, rt = hw2 >> 12;
+    unsigned size = 1u << ((hw1 >> 5) & 3);
+    bool load_ = hw1 & 0x0010;
+    bool sign = hw1 & 0x0100;
+    uint32_t addr, base = (rn == 15) ? (r[15] & ~3u) : r[rn];
+
+    if (size > 4) {
+        stop(sim, "unsupported load/store");
+        return;
+    }
+    if (rn == 15) {
+        /* literal */
+        addr = (hw1 & 0x0080) ? base + (hw2 & 0xFFF) : base - (hw2 & 0xFFF);
+    } else if (hw1 & 0x0080) {
+        addr = base + (hw2 & 0xFFF);
+    } else if (hw2 & 0x0800) {
+        /* 8-bit immediate with the index, add and writeback bits */
+        uint32_t offs = (hw2 & 0x0200) ? (hw2 & 0xFF) : -(uint32_t)(hw2 & 0xFF);
+        uint32_t ea = base + offs;
+        addr = (hw2 & 0x0400) ? ea : base;
+        if (hw2 & 0x0100) r[rn] = ea;
+    } else {
+        addr = base + (r[hw2 & 0x0F] << ((hw2 >> 4) & 3));
+    }
+    if (load_) {
+        if (rt == 15 && size == 1) return;  /* PLD */
+        load(sim, rt, addr, size, sign);
+    } else {
+        store(sim, rt, addr, size);
+    }
+}
+
+static void exec32(struct armsim *sim, uint16_t hw1, uint16_t hw2) {
+    uint32_t *r = sim->r;
+    unsigned rn = hw1 & 0x0F, rd_ = (hw2 >> 8) & 0x0F, rm = hw2 & 0x0F;
+    bool s = hw1 & 0x0010;
+    bool c = carry(sim);
+
+    if (sim->core == ARMSIM_M0P && (hw1 & 0xF800) != 0xF000) {
+        stop(sim, "ARMv7-M instruction");
+        return;
+    }
+    tick(sim, 1);
+    switch ((hw1 >> 11) & 3) {
+    case 1:
+        if ((hw1 & 0x0640) == 0x0000) {
+            /* load/store multiple */
+            uint16_t list = hw2;
+            uint32_t n = 4 * bitcount(list);
+            bool w = hw1 & 0x0020;
+            sim->cycles--;
+            switch ((hw1 >> 7) & 3) {
+            case 1:
+                if (s) {
+                    ldm(sim, rn, r[rn], list, w, r[rn] + n);
+                } else {
+                    stm(sim, rn, r[rn], list, w, r[rn] + n);
+                }
+                return;
+            case 2:
+                if (s) {
+                    ldm(sim, rn, r[rn] - n, list, w, r[rn] - n);
+                } else {
+                    stm(sim, rn, r[rn] - n, list, w, r[rn] - n);
+                }
+                return;
+            default:
+                break;
+            }
+        } else if ((hw1 & 0x0640) == 0x0040) {
+            /* load/store dual, table branch */
+            bool p = hw1 & 0x0100, u = hw1 & 0x0080, w = hw1 & 0x0020;
+            if (p || w) {
+                unsigned rt = hw2 >> 12, rt2 = (hw2 >> 8) & 0x0F;
+                uint32_t base = (rn == 15) ? (r[15] & ~3u) : r[rn];
+                uint32_t offs = (hw2 & 0xFF) * 4;
+                uint32_t ea = u ? base + offs : base - offs;
+                uint32_t addr = p ? ea : base;
+                if (s) {
+                    r[rt] = rd(sim, addr, 4, true);
+                    r[rt2] = rd(sim, addr + 4, 4, true);
+                } else {
+                    wr(sim, addr, 4, r[rt], true);
+                    wr(sim, addr + 4, 4, r[rt2], true);
+                }
+                if (w) r[rn] = ea;
+                tick(sim, 2);
+                return;
+            }
+            if ((hw1 & 0xFFF0) == 0xE8D0 && (hw2 & 0xFFE0) == 0xF000) {
+                uint32_t base = (rn == 15) ? r[15] : r[rn];
+                uint32_t offs = (hw2 & 0x10) ? 2 * rd(sim, base + 2 * r[rm], 2, false)
+                                             : 2 * rd(sim, base + r[rm], 1, false);
+                tick(sim, 1);
+                branch(sim, r[15] + offs);
+                return;
+            }
+        } else if ((hw1 & 0x0600) == 0x0200) {
+            /* data processing, shifted register */
+            unsigned imm5 = ((hw2 >> 10) & 0x1C) | ((hw2 >> 6) & 3);
+            uint32_t b = shift_imm(r[rm], (hw2 >> 4) & 3, imm5, &c);
+            dp_op(sim, (hw1 >> 5) & 0x0F, rd_, rn, r[rn], b, s, c);
+            return;
+        }
+        break;
+    case 2:
+        if ((hw2 & 0x8000) == 0) {
+            if ((hw1 & 0x0200) == 0) {
+                /* data processing, modified immediate */
+                unsigned imm12 = ((hw1 & 0x0400) << 1) | ((hw2 >> 4) & 0x0700) | (hw2 & 0xFF);
+                uint32_t b = expand_imm(imm12, &c);
+                dp_op(sim, (hw1 >> 5) & 0x0F, rd_, rn, (rn == 15) ? 0 : r[rn], b, s, c);
+                return;
+            }
+            /* plain binary immediate */
+            unsigned imm12 = ((hw1 & 0x0400) << 1) | ((hw2 >> 4) & 0x0700) | (hw2 & 0xFF);
+            unsigned lsb = ((hw2 >> 10) & 0x1C) | ((hw2 >> 6) & 3);
+            unsigned width = (hw2 & 0x1F) + 1;
+            uint32_t base = (rn == 15) ? (r[15] & ~3u) : r[rn];
+            switch ((hw1 >> 4) & 0x1F) {
+            case 0x00:
+                r[rd_] = base + imm12;
+                return;
+            case 0x0A:
+                r[rd_] = base - imm12;
+                return;
+            case 0x04:
+                r[rd_] = imm12 | ((hw1 & 0x0F) << 12);
+                return;
+            case 0x0C:
+                r[rd_] = (r[rd_] & 0xFFFF) | ((imm12 | ((hw1 & 0x0F) << 12)) << 16);
+                return;
+            case 0x14:
+                r[rd_] = sext(r[rn] >> lsb, width);
+                return;
+            case 0x1C:
+                r[rd_] = (r[rn] >> lsb) & (uint32_t)((1ull << width) - 1);
+                return;
+            case 0x16:
+                {
+                    /* BFI, BFC. width field is msb here */
+                    unsigned msb = hw2 & 0x1F;
+                    uint32_t mask = (uint32_t)(((1ull << (msb - lsb + 1)) - 1) << lsb);
+                    uint32_t src = (rn == 15) ? 0 : r[rn] << lsb;
+                    r[rd_] = (r[rd_] & ~mask) | (src & mask);
+                }
+                return;
+            default:
+                break;
+            }
+            break;
+        }
+        /* branches and miscellaneous control */
+        switch ((hw2 >> 12) & 5) {
+        case 0:
+            if (((hw1 >> 6) & 0x0E) != 0x0E) {
+                uint32_t imm = ((hw1 & 0x0400) << 10) | ((hw2 & 0x0800) << 8) | ((hw2 & 0x2000) << 5) |
+                               ((hw1 & 0x3F) << 12) | ((hw2 & 0x7FF) << 1);
+                if (cond_pass(sim, (hw1 >> 6) & 0x0F)) branch(sim, r[15] + sext(imm, 21));
+                return;
+            }
+            if ((hw1 & 0xFFE0) == 0xF3E0) {
+                r[rd_] = 0;                     /* MRS */
+                return;
+            }
+            if ((hw1 & 0xFFE0) == 0xF380 || (hw1 & 0xFFF0) == 0xF3A0 || (hw1 & 0xFFF0) == 0xF3B0) {
+                return;                         /* MSR, hints, barriers */
+            }
+            break;
+        case 1: case 5:
+            {
+                bool sb = hw1 & 0x0400;
+                uint32_t i1 = !(((hw2 >> 13) & 1) ^ sb), i2 = !(((hw2 >> 11) & 1) ^ sb);
+                uint32_t imm = ((uint32_t)sb << 24) | (i1 << 23) | (i2 << 22) | ((hw1 & 0x3FF) << 12) |
+                               ((hw2 & 0x7FF) << 1);
+                if (hw2 & 0x4000) {
+                    r[14] = r[15] | 1;
+                    if (sim->core == ARMSIM_M0P) tick(sim, 1);
+                }
+                branch(sim, r[15] + sext(imm, 25));
+                return;
+            }
+        default:
+            break;
+        }
+        break;
+    case 3:
+        if ((hw1 & 0x0600) == 0x0000) {
+            /* load/store single. signed stores are undefined */
+            if ((hw1 & 0x0110) == 0x0100) break;
+            exec32_ls(sim, hw1, hw2);
+            return;
+        }
+        if ((hw1 & 0x0700) == 0x0200) {
+            /* data processing, register */
+            unsigned op1 = (hw1 >> 4) & 0x0F, op2 = (hw2 >> 4) & 0x0F;
+            uint32_t v;
+            if ((op1 & 0x08) == 0 && op2 == 0) {
+                v = shift_c(r[rn], op1 >> 1, r[rm] & 0xFF, &c);
+                r[rd_] = v;
+                if (s) {
+                    set_nz(sim, v);
+                    set_c(sim, c);
+                }
+                return;
+            }
+            if ((op1 & 0x08) == 0 && (op2 & 0x08)) {
+                /* SXTH, UXTH, SXTB, UXTB with the optional add */
+                static const uint8_t kind[8] = {0, 1, 0xFF, 0xFF, 2, 3, 0xFF, 0xFF};
+                if (kind[op1 & 7] == 0xFF) break;
+                v = extend(r[rm], (hw2 >> 4) & 3, kind[op1 & 7]);
+                r[rd_] = (rn == 15) ? v : r[rn] + v;
+                return;
+            }
+            if ((op1 & 0x0C) == 0x08 && (op2 & 0x0C) == 0x08) {
+                switch (((op1 & 3) << 2) | (op2 & 3)) {
+                case 0x4: r[rd_] = __builtin_bswap32(r[rm]); return;
+                case 0x5: r[rd_] = rev16(r[rm]); return;
+                case 0x6: r[rd_] = rbit(r[rm]); return;
+                case 0x7: r[rd_] = sext(__builtin_bswap16(r[rm] & 0xFFFF), 16); return;
+                case 0xC: r[rd_] = r[rm] ? __builtin_clz(r[rm]) : 32; return;
+                default: break;
+                }
+            }
+            break;
+        }
+        if ((hw1 & 0x0780) == 0x0300) {
+            /* multiply and multiply accumulate */
+            unsigned ra = hw2 >> 12;
+            if ((hw1 & 0x0070) == 0 && (hw2 & 0x00F0) == 0x0000) {
+                r[rd_] = r[rn] * r[rm] + ((ra == 15) ? 0 : r[ra]);
+                if (ra != 15 && sim->core == ARMSIM_M3) tick(sim, 1);
+                return;
+            }
+            if ((hw1 & 0x0070) == 0 && (hw2 & 0x00F0) == 0x0010) {
+                r[rd_] = r[ra] - r[rn] * r[rm];
+                if (sim->core == ARMSIM_M3) tick(sim, 1);
+                return;
+            }
+            break;
+        }
+        if ((hw1 & 0x0780) == 0x0380) {
+            /* long multiply and divide */
+            unsigned rdlo = hw2 >> 12;
+            switch ((hw1 >> 4) & 7) {
+            case 0: case 2:
+                {
+                    uint64_t p = ((hw1 >> 4) & 7) ? (uint64_t)r[rn] * r[rm]
+                                                 : (uint64_t)((int64_t)(int32_t)r[rn] * (int32_t)r[rm]);
+                    r[rdlo] = (uint32_t)p;
+                    r[rd_] = (uint32_t)(p >> 32);
+                    if (sim->core == ARMSIM_M3) tick(sim, 3);
+                    return;
+                }
+            case 1: case 3:
+                {
+                    /* early terminating divider. 2 to 12 cycles */
+                    bool sg = !((hw1 >> 5) & 1);
+                    uint32_t a = r[rn], b = r[rm], q;
+                    if (b == 0) {
+                        q = 0;
+                    } else if (sg) {
+                        q = (a == 0x80000000 && b == 0xFFFFFFFF) ? a : (uint32_t)((int32_t)a / (int32_t)b);
+                    } else {
+                        q = a / b;
+                    }
+                    r[rd_] = q;
+                    tick(sim, 1 + (q ? (32 - __builtin_clz(q) + 3) / 4 : 0));
+                    return;
+                }
+            default:
+                break;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    stop(sim, "unsupported instruction");
+}
+
+static void step(struct armsim *sim) {
+    uint32_t pc = sim->r[15];
+    uint16_t hw1 = armsim_peek(sim, pc, 2);
+    bool wide = (hw1 >> 11) >= 0x1D;
+    uint16_t hw2 = wide ? armsim_peek(sim, pc + 2, 2) : 0;
+    uint8_t it = sim->itstate;
+    bool is_it = !wide && (hw1 & 0xFF00) == 0xBF00 && (hw1 & 0x0F);
+
+    sim->next = pc + (wide ? 4 : 2);
+    sim->r[15] = pc + 4;
+    sim->ls = false;
+    sim->insns++;
+    if (it && !is_it && !cond_pass(sim, it >> 4)) {
+        /* skipped conditional instruction */
+        tick(sim, 1);
+    } else if (wide) {
+        exec32(sim, hw1, hw2);
+    } else {
+        exec16(sim, hw1);
+    }
+    if (it && !is_it) {
+        sim->itstate = (it & 0x07) ? (it & 0xE0) | ((it << 1) & 0x1F) : 0;
+    }
+    sim->pipelined = sim->ls;
+    sim->r[15] = sim->next;
+}
+
+uint32_t armsim_call(struct armsim *sim, uint32_t fn, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3) {
+    uint64_t limit = sim->insns + INSN_LIMIT;
+    sim->r[0] = a0;
+    sim->r[1] = a1;
+    sim->r[2] = a2;
+    sim->r[3] = a3;
+    sim->r[13] = ARMSIM_STACK;
+    sim->r[14] = ARMSIM_RETURN | 1;
+    sim->r[15] = fn & ~1u;
+    sim->itstate = 0;
+    sim->pipelined = false;
+    sim->fault = NULL;
+    while (sim->fault == NULL) {
+        uint32_t pc = sim->r[15];
+        if (pc == ARMSIM_RETURN) break;
+        if (pc >= ARMSIM_HOSTBASE && pc < ARMSIM_HOSTBASE + 2 * ARMSIM_HOSTFNS) {
+            unsigned i = (pc - ARMSIM_HOSTBASE) / 2;
+            if (i >= sim->hosts) {
+                stop(sim, "call to unregistered host function");
+                break;
+            }
+            sim->host[i](sim, sim->host_ctx[i]);
+            sim->r[15] = sim->r[14] & ~1u;
+            continue;
+        }
+        if (sim->insns >= limit) {
+            stop(sim, "instruction limit");
+            break;
+        }
+        step(sim);
+    }
+    return sim->r[0];
+}
+
+/* setup */
+
+void armsim_init(struct armsim *sim, uint8_t core) {
+    memset(sim, 0, sizeof(*sim));
+    sim->core = core;
+    sim->pages = calloc(1u << (32 - PAGE_BITS), sizeof(uint8_t*));
+}
+
+void armsim_free(struct armsim *sim) {
+    if (sim->pages) {
+        for (unsigned i = 0; i < (1u << (32 - PAGE_BITS)); i++) free(sim->pages[i]);
+        free(sim->pages);
+    }
+    free(sim->image);
+    memset(sim, 0, sizeof(*sim));
+}
+
+void armsim_set_io(struct armsim *sim, armsim_io_fn io, void *ctx) {
+    sim->io = io;
+    sim->io_ctx = ctx;
+}
+
+uint32_t armsim_host(struct armsim *sim, armsim_host_fn fn, void *ctx) {
+    if (sim->hosts >= ARMSIM_HOSTFNS) return 0;
+    sim->host[sim->hosts] = fn;
+    sim->host_ctx[sim->hosts] = ctx;
+    return (ARMSIM_HOSTBASE + 2 * sim->hosts++) | 1;
+}
+
+/* ELF32 little endian image */
+
+static uint32_t le16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *p) {
+    return le16(p) | (le16(p + 2) << 16);
+}
+
+bool armsim_load(struct armsim *sim, const char *path) {
+    FILE *f = fopen(path, "rb");
+    uint8_t *e;
+    if (f == NULL) return false;
+    fseek(f, 0, SEEK_END);
+    sim->image_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    sim->image = e = malloc(sim->image_size);
+    if (e == NULL || fread(e, 1, sim->image_size, f) != (size_t)sim->image_size) {
+        fclose(f);
+        return false;
+    }
+    fclose(f);
+    if (sim->image_size < 52 || memcmp(e, "\177ELF\1\1", 6) != 0 || le16(e + 18) != 40) return false;
+    for (unsigned i = 0; i < le16(e + 44); i++) {
+        const uint8_t *ph = e + le32(e + 28) + i * le16(e + 42);
+        uint32_t off = le32(ph + 4), vaddr = le32(ph + 8), filesz = le32(ph + 16), memsz = le32(ph + 20);
+        if (le32(ph) != 1) continue;    /* PT_LOAD */
+        if ((long)(off + filesz) > sim->image_size) return false;
+        for (uint32_t j = 0; j < memsz; j++) {
+            *mem_byte(sim, vaddr + j) = (j < filesz) ? e[off + j] : 0;
+        }
+    }
+    return true;
+}
+
+uint32_t armsim_symbol(struct armsim *sim, const char *name) {
+    const uint8_t *e = sim->image;
+    if (e == NULL) return 0;
+    for (unsigned i = 0; i < le16(e + 48); i++) {
+        const uint8_t *sh = e + le32(e + 32) + i * le16(e + 46);
+        if (le32(sh + 4) != 2) continue;    /* SHT_SYMTAB */
+        const uint8_t *strsh = e + le32(e + 32) + le32(sh + 24) * le16(e + 46);
+        const char *str = (const char*)e + le32(strsh + 16);
+        for (uint32_t j = 0; j < le32(sh + 20); j += 16) {
+            const uint8_t *sym = e + le32(sh + 16) + j;
+            if (strcmp(str + le32(sym), name) == 0) return le32(sym + 4);
+        }
+    }
+    return 0;
+}
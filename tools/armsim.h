@@ -0,0 +1,96 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Instruction level Cortex-M emulator for the driver benchmarks. Host tool.
+ * Runs ARMv6-M and ARMv7-M Thumb code of the statically linked ELF image. Memory is flat and
+ * zero filled; the application may take over any access through the io hook to model the
+ * peripheral registers. Functions are called with up to 4 arguments and return to the host.
+ *
+ * Cycles are estimated from the instruction timing of the Cortex-M0+ and Cortex-M3/M4 technical
+ * reference manuals with zero wait state memory and bus. Taken branch refills the pipeline with
+ * 1 (M0+) or 2 (M3/M4) cycles; neighbouring single loads and stores pipeline on M3/M4.
+ */
+
+#ifndef _ARMSIM_H_
+#define _ARMSIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ARMSIM_M0P      0       /* ARMv6-M, Cortex-M0+ timing */
+#define ARMSIM_M3       1       /* ARMv7-M, Cortex-M3 timing */
+#define ARMSIM_M4       2       /* ARMv7E-M, Cortex-M4 timing */
+
+#define ARMSIM_HOSTFNS  8       /* host functions callable from the emulated code */
+#define ARMSIM_HOSTBASE 0xF0000000
+#define ARMSIM_RETURN   0xF0000100  /* return address of armsim_call() */
+#define ARMSIM_STACK    0x20010000  /* initial stack pointer */
+
+struct armsim;
+
+/* peripheral access hook. returns true if the access is handled */
+typedef bool (*armsim_io_fn)(void *ctx, uint32_t addr, int size, uint32_t *value, bool write);
+
+/* host function. arguments in r[0]..r[3], result in r[0] */
+typedef void (*armsim_host_fn)(struct armsim *sim, void *ctx);
+
+struct armsim {
+    uint32_t        r[16];
+    uint32_t        apsr;       /* N, Z, C, V flags in the bits 31..28 */
+    uint8_t         itstate;
+    uint8_t         core;
+    bool            pipelined;  /* previous instruction was a single load or store */
+    bool            ls;         /* current instruction is a single load or store */
+    uint32_t        next;       /* address of the next instruction */
+    const char      *fault;     /* reason of the stop, NULL if running or returned */
+    uint32_t        fault_pc;
+    uint64_t        insns;      /* executed instructions */
+    uint64_t        cycles;     /* estimated cycles */
+    uint8_t         **pages;
+    armsim_io_fn    io;
+    void            *io_ctx;
+    armsim_host_fn  host[ARMSIM_HOSTFNS];
+    void            *host_ctx[ARMSIM_HOSTFNS];
+    unsigned        hosts;
+    uint8_t         *image;     /* loaded ELF file */
+    long            image_size;
+};
+
+/* initializes the emulator for the given core timing */
+void armsim_init(struct armsim *sim, uint8_t core);
+
+/* releases memory and the loaded image */
+void armsim_free(struct armsim *sim);
+
+/* loads the segments of the statically linked ELF file. returns false on error */
+bool armsim_load(struct armsim *sim, const char *path);
+
+/* returns the value of the ELF symbol or 0 */
+uint32_t armsim_symbol(struct armsim *sim, const char *name);
+
+/* registers the peripheral access hook */
+void armsim_set_io(struct armsim *sim, armsim_io_fn io, void *ctx);
+
+/* returns the Thumb address that calls the host function. Time spent there is not counted */
+uint32_t armsim_host(struct armsim *sim, armsim_host_fn fn, void *ctx);
+
+/* raw memory access bypassing the io hook */
+uint32_t armsim_peek(struct armsim *sim, uint32_t addr, int size);
+void armsim_poke(struct armsim *sim, uint32_t addr, int size, uint32_t value);
+
+/* calls the function with the arguments. Returns r0, sim->fault is set on error */
+uint32_t armsim_call(struct armsim *sim, uint32_t fn, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3);
+
+#endif /* _ARMSIM_H_ */
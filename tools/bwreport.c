@@ -0,0 +1,148 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Periodic bandwidth report. Host tool.
+ * Runs the core bandwidth model (usbd_bw_check) over the configuration descriptors and prints
+ * the per-endpoint frame and buffer demand for the descriptor review.
+ *
+ * Input is a binary file with the descriptors, i.e. /sys/bus/usb/devices/<dev>/descriptors on
+ * Linux, or hex text (-x) like "09 02 4B 00 ..." copied from the sniffer. Device descriptor
+ * is skipped, all following configuration descriptors are checked.
+ *   cc -std=gnu99 -Iinc -DUSBD_VIRTUAL -DUSBD_BW_CHECK tools/bwreport.c src/usbd_core.c -o bwreport
+ *   ./bwreport [-hs] [-b <bufsize>] [-x] <descriptors>
+ * Returns 1 if any configuration fails the check.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "usb.h"
+
+static const char *const type_name[] = {"control", "isoc", "bulk", "interrupt"};
+
+static void fail(const char *msg) {
+    fprintf(stderr, "bwreport: %s\n", msg);
+    exit(2);
+}
+
+static long read_hex(FILE *f, uint8_t *buf, long size) {
+    long len = 0;
+    int c, nib = -1;
+    while ((c = fgetc(f)) != EOF) {
+        if (c == '0' && nib < 0) {
+            int x = fgetc(f);
+            if (x == 'x' || x == 'X') continue;
+            ungetc(x, f);
+        }
+        if (!isxdigit(c)) {
+            if (nib >= 0) {
+                if (len == size) fail("descriptors are too long");
+                buf[len++] = nib;
+                nib = -1;
+            }
+            continue;
+        }
+        c = isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10);
+        if (nib < 0) {
+            nib = c;
+        } else {
+            if (len == size) fail("descriptors are too long");
+            buf[len++] = (nib << 4) | c;
+            nib = -1;
+        }
+    }
+    if (nib >= 0 && len < size) buf[len++] = nib;
+    return len;
+}
+
+static bool report(const uint8_t *cfg, uint16_t len, bool hs, uint16_t bufsize) {
+    usbd_bw_report rep;
+    uint8_t status = usbd_bw_check(cfg, len, hs, bufsize, &rep);
+    char name[8];
+
+    printf("configuration %u, %s speed\n", cfg[5], hs ? "high" : "full");
+    printf("  %-4s %-9s %4s %4s %6s %8s %6s\n", "ep", "type", "intf", "alt", "size", "bus,B", "buf,B");
+    for (int i = 0; i < rep.count; i++) {
+        const usbd_bw_ep *e = &rep.ep[i];
+        snprintf(name, sizeof(name), "0x%02X", e->ep);
+        printf("  %-4s %-9s %4u %4u %6u ", name, type_name[e->type & 0x03], e->intf, e->alt, e->size);
+        if (e->frame) printf("%8u", e->frame); else printf("%8s", "-");
+        printf(" %6u\n", e->buf);
+    }
+    printf("  periodic %u of %u bytes per %sframe (%u%%)\n", (unsigned)rep.frame, rep.budget,
+           hs ? "micro" : "", (unsigned)(rep.frame * 100U / rep.budget));
+    if (bufsize) {
+        printf("  buffers  %u of %u bytes\n", (unsigned)rep.buf, bufsize);
+    } else {
+        printf("  buffers  %u bytes\n", (unsigned)rep.buf);
+    }
+    if (status & USBD_BW_OVER_FRAME) printf("  FAIL: periodic endpoints exceed the frame budget\n");
+    if (status & USBD_BW_OVER_BUF) printf("  FAIL: endpoints exceed the driver buffer capacity\n");
+    if (status & USBD_BW_BAD_DESC) printf("  FAIL: broken configuration descriptor\n");
+    if (status == 0) printf("  OK\n");
+    printf("\n");
+    return status == 0;
+}
+
+int main(int argc, char **argv) {
+    static uint8_t buf[0x10000];
+    const char *path = NULL;
+    bool hs = false, hex = false, ok = true;
+    uint16_t bufsize = 0;
+    long len, pos = 0;
+    int configs = 0;
+    FILE *f;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-hs") == 0) {
+            hs = true;
+        } else if (strcmp(argv[i], "-x") == 0) {
+            hex = true;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            bufsize = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (path == NULL) fail("usage: bwreport [-hs] [-b <bufsize>] [-x] <descriptors>");
+    f = fopen(path, hex ? "r" : "rb");
+    if (f == NULL) fail("can't open descriptors file");
+    len = hex ? read_hex(f, buf, sizeof(buf)) : (long)fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+
+    while (pos + 2 <= len) {
+        uint8_t dlen = buf[pos];
+        if (dlen < 2) fail("broken descriptor");
+        if (buf[pos + 1] == USB_DTYPE_CONFIGURATION) {
+            uint16_t total = buf[pos + 2] | (buf[pos + 3] << 8);
+            if (dlen < 9 || total < dlen) fail("broken configuration descriptor");
+            if (pos + total > len) fail("configuration descriptor is truncated");
+            ok &= report(buf + pos, total, hs, bufsize);
+            configs++;
+            pos += total;
+        } else {
+            /* device, device qualifier or BOS descriptors */
+            pos += dlen;
+        }
+    }
+    if (configs == 0) fail("no configuration descriptors found");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,250 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* DFU function test. Host tool.
+ * Downloads images to usbd_dfu.c on the virtual bus with a flash model in RAM and checks the
+ * memory contents, the upload, the error states and the erase pipelining.
+ *
+ * Build and run:
+ *   cc -std=gnu99 -Iinc -DUSBD_VIRTUAL tools/dfutest.c tools/vbus.c src/usbd_core.c \
+ *      src/usbd_dfu.c -o dfutest
+ *   ./dfutest
+ *
+ * The flash model is erased to 0xFF and programming can only clear bits. Erase and program run
+ * for the fixed time of a simulated millisecond clock. The host advances the clock by the
+ * bwPollTimeout and by the control transfer time of each block, like dfu-util does. Erase
+ * in advance overlaps the transfer of the next block only, so the gain is small with the fast
+ * host and grows with the host delay between the blocks.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "usb.h"
+#include "usb_dfu.h"
+#include "usbd_dfu.h"
+#include "vbus.h"
+
+#define FLASH_START     0x08004000
+#define FLASH_SIZE      0x4000
+#define PAGE_SIZE       0x400
+#define ERASE_MS        20
+#define PROGRAM_MS      4       /* per transfer block */
+#define XFER_MS         1       /* control transfer of one block */
+#define XFER_SIZE       0x200
+
+#define DFU_IN          (USB_REQ_DEVTOHOST | USB_REQ_CLASS | USB_REQ_INTERFACE)
+#define DFU_OUT         (USB_REQ_CLASS | USB_REQ_INTERFACE)
+
+/* flash model */
+
+static struct {
+    uint8_t     mem[FLASH_SIZE];
+    uint32_t    now;            /* simulated clock, ms */
+    uint32_t    busy_until;
+    unsigned    erases;
+    unsigned    overlaps;       /* operations started while busy */
+    unsigned    dirty;          /* programming of not erased bytes */
+    uint32_t    fail_addr;      /* erase of this page fails */
+} flash;
+
+static uint8_t flash_start(uint32_t ms, uint32_t *timeout) {
+    if (flash.now < flash.busy_until) flash.overlaps++;
+    flash.busy_until = flash.now + ms;
+    *timeout = ms;
+    return USB_DFU_STATUS_OK;
+}
+
+static uint8_t flash_erase(uint32_t addr, uint32_t *timeout) {
+    if ((addr - FLASH_START) % PAGE_SIZE || addr - FLASH_START >= FLASH_SIZE) {
+        return USB_DFU_STATUS_ERR_ADDRESS;
+    }
+    if (addr == flash.fail_addr) return USB_DFU_STATUS_ERR_ERASE;
+    memset(&flash.mem[addr - FLASH_START], 0xFF, PAGE_SIZE);
+    flash.erases++;
+    return flash_start(ERASE_MS, timeout);
+}
+
+static uint8_t flash_program(uint32_t addr, const void *data, uint16_t len, uint32_t *timeout) {
+    uint8_t *p = &flash.mem[addr - FLASH_START];
+    for (unsigned i = 0; i < len; i++) {
+        if (p[i] != 0xFF) flash.dirty++;
+        p[i] &= ((const uint8_t*)data)[i];
+    }
+    return flash_start(PROGRAM_MS, timeout);
+}
+
+static uint8_t flash_status(uint32_t *timeout) {
+    *timeout = (flash.now < flash.busy_until) ? flash.busy_until - flash.now : 0;
+    return USB_DFU_STATUS_OK;
+}
+
+static uint16_t flash_read(uint32_t addr, void *buf, uint16_t len) {
+    memcpy(buf, &flash.mem[addr - FLASH_START], len);
+    return len;
+}
+
+static const usbd_dfu_backend backend = {
+    .start      = FLASH_START,
+    .size       = FLASH_SIZE,
+    .page_size  = PAGE_SIZE,
+    .erase      = flash_erase,
+    .program    = flash_program,
+    .status     = flash_status,
+    .read       = flash_read,
+};
+
+/* device */
+
+static usbd_device udev;
+static uint32_t ubuf[(XFER_SIZE + 0x10) / 4];
+static usbd_dfu dfu;
+static uint8_t dfu_buf[XFER_SIZE];
+
+static usbd_respond app_control(usbd_device *dev, usbd_ctlreq *req, usbd_rqc_callback *callback) {
+    (void)dev; (void)callback;
+    return usbd_dfu_control(&dfu, req);
+}
+
+static usbd_respond app_setconf(usbd_device *dev, uint8_t cfg) {
+    (void)dev;
+    return (cfg <= 1) ? usbd_ack : usbd_fail;
+}
+
+static void setup(void) {
+    memset(&flash, 0, sizeof(flash));
+    memset(flash.mem, 0x5A, sizeof(flash.mem));
+    usbd_dfu_init(&dfu, &udev, 0, &backend, dfu_buf, XFER_SIZE);
+    vbus_init(0, &udev, 0x40, ubuf, sizeof(ubuf));
+    usbd_reg_config(&udev, app_setconf);
+    usbd_reg_control(&udev, app_control);
+    VBUS_CHECK(vbus_enumerate(0, 1, 1));
+}
+
+/* host */
+
+static uint8_t get_status(uint8_t *status) {
+    uint8_t s[6];
+    VBUS_CHECK(vbus_control(0, DFU_IN, USB_DFU_GETSTATUS, 0, 0, 6, s) == 6);
+    flash.now += s[1] | (s[2] << 8) | (s[3] << 16);
+    if (status) *status = s[0];
+    return s[4];
+}
+
+/* polls until the block is programmed or error */
+static uint8_t wait_idle(void) {
+    uint8_t state;
+    do {
+        state = get_status(0);
+    } while (state == USB_DFU_STATE_DFU_DNBUSY || state == USB_DFU_STATE_DFU_MANIFEST);
+    return state;
+}
+
+static void image_fill(uint8_t *img, unsigned len, uint8_t seed) {
+    for (unsigned i = 0; i < len; i++) img[i] = (uint8_t)(seed + i * 13 + (i >> 9));
+}
+
+/* downloads and manifests the image. returns final state */
+static uint8_t download(const uint8_t *img, unsigned len, uint16_t first_block) {
+    uint16_t blk = first_block;
+    for (unsigned pos = 0; pos < len; pos += XFER_SIZE, blk++) {
+        uint16_t _l = (len - pos > XFER_SIZE) ? XFER_SIZE : len - pos;
+        flash.now += XFER_MS;
+        if (vbus_control(0, DFU_OUT, USB_DFU_DNLOAD, blk, 0, _l, (void*)&img[pos]) < 0) {
+            return get_status(0);
+        }
+        if (wait_idle() != USB_DFU_STATE_DFU_DNLOADIDLE) return get_status(0);
+    }
+    VBUS_CHECK(vbus_control(0, DFU_OUT, USB_DFU_DNLOAD, 0, 0, 0, 0) == 0);
+    return wait_idle();
+}
+
+static void test_download(unsigned len) {
+    static uint8_t img[FLASH_SIZE], up[XFER_SIZE];
+    unsigned pages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+    unsigned blocks = (len + XFER_SIZE - 1) / XFER_SIZE;
+    uint16_t blk = 0;
+    int _l;
+    setup();
+    image_fill(img, len, len);
+    VBUS_CHECK(download(img, len, 0) == USB_DFU_STATE_DFU_IDLE);
+    VBUS_CHECK(memcmp(flash.mem, img, len) == 0);
+    VBUS_CHECK(flash.dirty == 0 && flash.overlaps == 0);
+    /* erase in advance takes at most one page after the image */
+    VBUS_CHECK(flash.erases == pages || flash.erases == pages + 1);
+    /* sequential time is the sum of all erase, program and transfer times */
+    printf("dfutest: %5u bytes, %2u erases, %4u ms, sequential %4u ms\n", len, flash.erases,
+           flash.now, flash.erases * ERASE_MS + blocks * (PROGRAM_MS + XFER_MS));
+    /* upload returns the memory and ends with the short frame */
+    for (unsigned pos = 0;; pos += XFER_SIZE, blk++) {
+        _l = vbus_control(0, DFU_IN, USB_DFU_UPLOAD, blk, 0, XFER_SIZE, up);
+        VBUS_CHECK(_l >= 0);
+        if (_l <= 0) break;
+        VBUS_CHECK(memcmp(up, &flash.mem[pos], _l) == 0);
+        if (_l < XFER_SIZE) break;
+    }
+    VBUS_CHECK(blk == FLASH_SIZE / XFER_SIZE);
+    VBUS_CHECK(get_status(0) == USB_DFU_STATE_DFU_IDLE);
+}
+
+static void test_errors(void) {
+    static uint8_t img[XFER_SIZE * 2];
+    uint8_t status;
+    image_fill(img, sizeof(img), 1);
+
+    /* block beyond the memory */
+    setup();
+    VBUS_CHECK(vbus_control(0, DFU_OUT, USB_DFU_DNLOAD, FLASH_SIZE / XFER_SIZE, 0, XFER_SIZE, img) == VBUS_STALL);
+    VBUS_CHECK(get_status(&status) == USB_DFU_STATE_DFU_ERROR && status == USB_DFU_STATUS_ERR_ADDRESS);
+    VBUS_CHECK(vbus_control(0, DFU_OUT, USB_DFU_CLRSTATUS, 0, 0, 0, 0) == 0);
+    VBUS_CHECK(get_status(&status) == USB_DFU_STATE_DFU_IDLE && status == USB_DFU_STATUS_OK);
+
+    /* zero length download without the image */
+    VBUS_CHECK(vbus_control(0, DFU_OUT, USB_DFU_DNLOAD, 0, 0, 0, 0) == VBUS_STALL);
+    VBUS_CHECK(get_status(&status) == USB_DFU_STATE_DFU_ERROR && status == USB_DFU_STATUS_ERR_NOTDONE);
+    VBUS_CHECK(vbus_control(0, DFU_OUT, USB_DFU_CLRSTATUS, 0, 0, 0, 0) == 0);
+
+    /* block larger than the transfer size */
+    VBUS_CHECK(vbus_control(0, DFU_OUT, USB_DFU_DNLOAD, 0, 0, XFER_SIZE + 1, img) == VBUS_STALL);
+    VBUS_CHECK(vbus_control(0, DFU_OUT, USB_DFU_CLRSTATUS, 0, 0, 0, 0) == 0);
+
+    /* erase failure of the second page */
+    setup();
+    flash.fail_addr = FLASH_START + PAGE_SIZE;
+    VBUS_CHECK(download(img, sizeof(img), 1) == USB_DFU_STATE_DFU_ERROR);
+    get_status(&status);
+    VBUS_CHECK(status == USB_DFU_STATUS_ERR_ERASE);
+
+    /* abort returns to idle and the next download starts a new erased area */
+    setup();
+    VBUS_CHECK(vbus_control(0, DFU_OUT, USB_DFU_DNLOAD, 4, 0, XFER_SIZE, img) == XFER_SIZE);
+    VBUS_CHECK(wait_idle() == USB_DFU_STATE_DFU_DNLOADIDLE);
+    VBUS_CHECK(vbus_control(0, DFU_OUT, USB_DFU_ABORT, 0, 0, 0, 0) == 0);
+    VBUS_CHECK(get_status(0) == USB_DFU_STATE_DFU_IDLE);
+    VBUS_CHECK(download(img, sizeof(img), 0) == USB_DFU_STATE_DFU_IDLE);
+    VBUS_CHECK(memcmp(flash.mem, img, sizeof(img)) == 0 && flash.dirty == 0);
+}
+
+int main(void) {
+    test_download(100);
+    test_download(XFER_SIZE);
+    test_download(PAGE_SIZE * 3);
+    test_download(PAGE_SIZE * 5 + 17);
+    test_download(FLASH_SIZE);
+    test_errors();
+    printf("dfutest: %s\n", vbus_failed ? "FAILED" : "passed");
+    return vbus_failed ? 1 : 0;
+}
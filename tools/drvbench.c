@@ -0,0 +1,655 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* HW driver benchmark. Host tool.
+ * Runs the hooks of the C or assembly driver linked into a standalone ELF image on the
+ * instruction level emulator against the register model of the USB peripheral and reports
+ * executed instructions and estimated cycles per operation. Data moved by the driver and the
+ * resulting register state are checked, so the numbers are taken from the working paths only.
+ * Device FS drivers (usbd_devfs, usbd_devfs_asm) and OTG FS drivers (usbd_otgfs, usbd_otgfs_asm)
+ * are supported.
+ *
+ * Build and run:
+ *   cc -std=gnu99 -Iinc -DUSBD_VIRTUAL tools/drvbench.c tools/armsim.c -o drvbench
+ *   ./drvbench [-c m0p|m3|m4] [-s 1|2] [-p] driver.elf
+ *
+ *   -c     core timing, Cortex-M3 by default
+ *   -s     PMA stride. 2 for the 16-bit PMA of the STM32F103x6..xE and STM32L1, 1 otherwise
+ *   -p     packet copy cycles of ep_read and ep_write by the length, for the halfword aligned
+ *          and the odd user buffer. PMA copy for the device FS, FIFO copy for the OTG FS
+ *
+ * Driver image is built from the single driver object, i.e.
+ *   arm-none-eabi-gcc -mcpu=cortex-m0plus -mthumb --specs=nano.specs -nostartfiles
+ *     -Wl,-Ttext=0x08000000 -Wl,-Tdata=0x20000000 -Wl,-e,0 usbd_stm32l052_devfs.o -o l052.elf
+ * Returns 2 if the image has no driver table.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "usb.h"
+#include "armsim.h"
+
+/* hook offsets in the struct usbd_driver */
+#define HW_EP_CONFIG    0x10
+#define HW_EP_DECONFIG  0x14
+#define HW_EP_READ      0x18
+#define HW_EP_WRITE     0x1C
+#define HW_POLL         0x28
+
+/* device FS peripheral */
+#define DEVFS_BASE      0x40005C00
+#define DEVFS_ISTR      0x40005C44
+#define DEVFS_PMA       0x40006000
+
+#define EP_CTR_RX       0x8000
+#define EP_STAT_RX      0x3000
+#define EP_RX_NAK       0x2000
+#define EP_RX_VALID     0x3000
+#define EP_CTR_TX       0x0080
+#define EP_STAT_TX      0x0030
+#define EP_TX_NAK       0x0020
+#define EP_TX_VALID     0x0030
+
+#define ISTR_CTR        0x8000
+#define ISTR_SOF        0x0200
+#define ISTR_DIR        0x0010
+
+/* OTG FS core */
+#define OTG_BASE        0x50000000
+#define OTG_GRSTCTL     0x010
+#define OTG_GINTSTS     0x014
+#define OTG_GRXSTSR     0x01C
+#define OTG_GRXSTSP     0x020
+#define OTG_DIEPTXF0    0x028
+#define OTG_DIEPTXF     0x100   /* + 4 * ep */
+#define OTG_DAINT       0x818
+#define OTG_DAINTMSK    0x81C
+#define OTG_DIEPCTL     0x900   /* + 0x20 * ep */
+#define OTG_DIEPINT     0x908
+#define OTG_DIEPTSIZ    0x910
+#define OTG_DTXFSTS     0x918
+#define OTG_DOEPCTL     0xB00   /* + 0x20 * ep */
+#define OTG_DOEPINT     0xB08
+#define OTG_EPFIFO      0x1000  /* + 0x1000 * ep */
+#define OTG_EPS         4
+
+#define GRSTCTL_RXFFLSH 0x00000010
+#define GRSTCTL_TXFFLSH 0x00000020
+#define GRSTCTL_AHBIDL  0x80000000
+#define GINT_SOF        0x00000008
+#define GINT_RXFLVL     0x00000010
+#define GINT_USBRST     0x00001000
+#define GINT_IEPINT     0x00040000
+#define EPCTL_USBAEP    0x00008000
+#define EPCTL_EPENA     0x80000000
+#define PKTSTS_OUT      (0x02 << 17)
+#define PKTSTS_OUT_CPLT (0x03 << 17)
+#define PKTSTS_SETUP    (0x06 << 17)
+#define TX_FIFO_WORDS   0x40
+
+/* emulated RAM */
+#define RAM_BUF         0x20002000
+#define RAM_DEV         0x20004000
+
+#define EP_SIZE         0x40
+
+static struct armsim sim;
+
+static struct {
+    uint32_t    table;
+    uint64_t    insns;
+    uint64_t    cycles;
+    unsigned    events;
+    uint32_t    ev_dev;
+    uint8_t     ev;
+    uint8_t     ep;
+    bool        sweep;
+    bool        failed;
+} bench;
+
+static struct {
+    uint16_t    epr[8];
+    uint16_t    istr;           /* interrupt flags, CTR and EP_ID are taken from the EPR */
+    unsigned    stride;
+    uint16_t    rxaddr[8];
+    uint16_t    txaddr[8];
+} devfs = {
+    .stride = 1,
+};
+
+/* EPR bits: CTR rc_w0, DTOG and STAT toggle, SETUP read only */
+static uint16_t epr_write(uint16_t old, uint16_t val) {
+    return (val & 0x070F) | (old & 0x0800) | (old & val & 0x8080) | ((old ^ val) & 0x7070);
+}
+
+static uint16_t istr_read(void) {
+    for (int i = 0; i < 8; i++) {
+        if (devfs.epr[i] & (EP_CTR_RX | EP_CTR_TX)) {
+            return devfs.istr | ISTR_CTR | ((devfs.epr[i] & EP_CTR_RX) ? ISTR_DIR : 0) | i;
+        }
+    }
+    return devfs.istr;
+}
+
+static bool devfs_io(void *ctx, uint32_t addr, int size, uint32_t *value, bool write) {
+    (void)ctx;
+    (void)size;
+    if (addr >= DEVFS_BASE && addr < DEVFS_BASE + 0x20) {
+        uint16_t *epr = &devfs.epr[(addr - DEVFS_BASE) / 4];
+        if (write) {
+            *epr = epr_write(*epr, *value);
+        } else {
+            *value = *epr;
+        }
+        return true;
+    }
+    if (addr == DEVFS_ISTR) {
+        if (write) {
+            devfs.istr &= *value;
+        } else {
+            *value = istr_read();
+        }
+        return true;
+    }
+    return false;
+}
+
+/* OTG FS core. RX FIFO is the status queue with the packet data, TX FIFO keeps written words */
+static struct {
+    uint32_t    gintsts;        /* rc_w1, RXFLVL and IEPINT are taken from the FIFO and DIEPINT */
+    uint32_t    grstctl;
+    uint32_t    diepint[OTG_EPS];
+    uint32_t    doepint[OTG_EPS];
+    uint32_t    rxsts[8];
+    unsigned    rxsts_n;
+    uint32_t    rxdata[0x80];
+    unsigned    rxhead, rxtail;
+    uint32_t    txdata[OTG_EPS][TX_FIFO_WORDS];
+    unsigned    txlen[OTG_EPS];
+    unsigned    txflush;        /* TXFNUM of the last TX FIFO flush + 1 */
+    unsigned    rxflush;
+} otg;
+
+static uint32_t otg_reg(uint32_t reg) {
+    return armsim_peek(&sim, OTG_BASE + reg, 4);
+}
+
+static uint32_t otg_daint(void) {
+    uint32_t daint = 0;
+    for (int i = 0; i < OTG_EPS; i++) {
+        if (otg.diepint[i]) daint |= 1 << i;
+        if (otg.doepint[i]) daint |= 0x10000 << i;
+    }
+    return daint;
+}
+
+static uint32_t otg_gintsts(void) {
+    uint32_t gintsts = otg.gintsts;
+    if (otg.rxsts_n) gintsts |= GINT_RXFLVL;
+    if (otg_daint() & otg_reg(OTG_DAINTMSK) & 0xFFFF) gintsts |= GINT_IEPINT;
+    return gintsts;
+}
+
+static bool otg_io(void *ctx, uint32_t addr, int size, uint32_t *value, bool write) {
+    uint32_t reg = addr - OTG_BASE;
+    unsigned ep = ((reg & 0xFF) >> 5);
+    (void)ctx;
+    (void)size;
+    if (addr < OTG_BASE || reg >= OTG_EPFIFO + 0x1000 * OTG_EPS) return false;
+    if (reg >= OTG_EPFIFO) {
+        if (write) {
+            ep = (reg - OTG_EPFIFO) >> 12;
+            if (otg.txlen[ep] < TX_FIFO_WORDS) otg.txdata[ep][otg.txlen[ep]++] = *value;
+        } else {
+            /* reads from any window pop the RX FIFO */
+            *value = (otg.rxhead != otg.rxtail) ? otg.rxdata[otg.rxhead++ % 0x80] : 0xDEADBEEF;
+        }
+        return true;
+    }
+    switch (reg) {
+    case OTG_GRSTCTL:
+        if (write) {
+            /* flushes are done immediately */
+            if (*value & GRSTCTL_TXFFLSH) {
+                otg.txflush = ((*value >> 6) & 0x1F) + 1;
+                otg.txlen[(*value >> 6) & (OTG_EPS - 1)] = 0;
+            }
+            if (*value & GRSTCTL_RXFFLSH) otg.rxflush++;
+            otg.grstctl = *value & ~(GRSTCTL_TXFFLSH | GRSTCTL_RXFFLSH);
+        } else {
+            *value = otg.grstctl | GRSTCTL_AHBIDL;
+        }
+        return true;
+    case OTG_GINTSTS:
+        if (write) {
+            otg.gintsts &= ~*value;
+        } else {
+            *value = otg_gintsts();
+        }
+        return true;
+    case OTG_GRXSTSR:
+    case OTG_GRXSTSP:
+        if (write) return true;
+        *value = otg.rxsts_n ? otg.rxsts[0] : 0;
+        if (reg == OTG_GRXSTSP && otg.rxsts_n) {
+            memmove(&otg.rxsts[0], &otg.rxsts[1], --otg.rxsts_n * sizeof(otg.rxsts[0]));
+        }
+        return true;
+    case OTG_DAINT:
+        if (!write) *value = otg_daint();
+        return true;
+    }
+    /* DIEPx and DOEPx register blocks */
+    if (ep < OTG_EPS && reg == OTG_DIEPINT + 0x20 * ep) {
+        if (write) {
+            otg.diepint[ep] &= ~*value;
+        } else {
+            *value = otg.diepint[ep];
+        }
+        return true;
+    }
+    if (ep < OTG_EPS && reg == OTG_DOEPINT + 0x20 * ep) {
+        if (write) {
+            otg.doepint[ep] &= ~*value;
+        } else {
+            *value = otg.doepint[ep];
+        }
+        return true;
+    }
+    if (ep < OTG_EPS && reg == OTG_DTXFSTS + 0x20 * ep) {
+        if (!write) *value = TX_FIFO_WORDS - otg.txlen[ep];
+        return true;
+    }
+    return false;
+}
+
+/* buffer table and packet memory as seen by the peripheral */
+static uint32_t pma_byte(unsigned addr) {
+    return DEVFS_PMA + addr * devfs.stride;
+}
+
+static uint32_t ept_field(uint8_t ep, unsigned field) {
+    return pma_byte((ep & 0x07) * 8 + field * 2);
+}
+
+/* driver calls */
+
+static void poll_callback(struct armsim *s, void *ctx) {
+    (void)ctx;
+    bench.events++;
+    bench.ev_dev = s->r[0];
+    bench.ev = s->r[1];
+    bench.ep = s->r[2];
+}
+
+static uint32_t call(unsigned hook, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3) {
+    uint64_t insns = sim.insns, cycles = sim.cycles;
+    uint32_t res = armsim_call(&sim, armsim_peek(&sim, bench.table + hook, 4), a0, a1, a2, a3);
+    bench.insns = sim.insns - insns;
+    bench.cycles = sim.cycles - cycles;
+    return res;
+}
+
+static void report(const char *name, bool ok) {
+    if (sim.fault) {
+        printf("  %-26s %s at 0x%08X\n", name, sim.fault, (unsigned)sim.fault_pc);
+        ok = false;
+    } else {
+        printf("  %-26s %6u %7u%s\n", name, (unsigned)bench.insns, (unsigned)bench.cycles,
+               ok ? "" : "  FAILED");
+    }
+    if (!ok) bench.failed = true;
+}
+
+static uint8_t pattern(unsigned seq, unsigned i) {
+    return (uint8_t)(seq * 5 + i * 3 + 1);
+}
+
+/* device FS benchmarks */
+
+static void devfs_config(const char *name, uint8_t ep, uint8_t eptype, uint16_t epsize) {
+    bool ok = call(HW_EP_CONFIG, ep, eptype, epsize, 0) & 0xFF;
+    uint16_t epr = devfs.epr[ep & 0x07];
+    if (ep & 0x80 || eptype == USB_EPTYPE_CONTROL) {
+        devfs.txaddr[ep & 0x07] = armsim_peek(&sim, ept_field(ep, 0), 2);
+        ok = ok && devfs.txaddr[ep & 0x07] && (epr & EP_STAT_TX) == EP_TX_NAK;
+    }
+    if (!(ep & 0x80)) {
+        devfs.rxaddr[ep & 0x07] = armsim_peek(&sim, ept_field(ep, 2), 2);
+        ok = ok && devfs.rxaddr[ep & 0x07] && (epr & EP_STAT_RX) == EP_RX_VALID;
+    }
+    report(name, ok && (epr & 0x0F) == (ep & 0x0F));
+}
+
+static bool devfs_read(uint8_t ep, uint32_t buf, uint16_t len, uint16_t blen) {
+    static unsigned seq;
+    uint16_t addr = devfs.rxaddr[ep];
+    uint16_t n = (blen < len) ? blen : len;
+    int32_t res;
+    bool ok;
+    seq++;
+    /* received packet */
+    for (unsigned i = 0; i < len; i += 2) {
+        armsim_poke(&sim, pma_byte(addr + i), 2, pattern(seq, i) | (pattern(seq, i + 1) << 8));
+    }
+    armsim_poke(&sim, ept_field(ep, 3), 2, (armsim_peek(&sim, ept_field(ep, 3), 2) & ~0x3FF) | len);
+    devfs.epr[ep] = (devfs.epr[ep] & ~EP_STAT_RX) | EP_RX_NAK | EP_CTR_RX;
+    for (unsigned i = 0; i < EP_SIZE + 2; i++) armsim_poke(&sim, buf + i, 1, 0xEE);
+
+    /* assembly drivers return the received size of the truncated packet, C drivers the copied one */
+    res = call(HW_EP_READ, ep, buf, blen, 0);
+    ok = (res == n || res == len);
+    for (unsigned i = 0; ok && i < n; i++) ok = (armsim_peek(&sim, buf + i, 1) == pattern(seq, i));
+    ok = ok && armsim_peek(&sim, buf + n, 1) == 0xEE;
+    ok = ok && (devfs.epr[ep] & EP_STAT_RX) == EP_RX_VALID;
+    devfs.epr[ep] &= ~EP_CTR_RX;
+    return ok;
+}
+
+static bool devfs_write(uint8_t ep, uint32_t buf, uint16_t len) {
+    static unsigned seq = 0x80;
+    uint16_t addr = devfs.txaddr[ep & 0x07];
+    bool ok;
+    seq++;
+    for (unsigned i = 0; i < len; i++) armsim_poke(&sim, buf + i, 1, pattern(seq, i));
+
+    ok = ((int32_t)call(HW_EP_WRITE, ep, buf, len, 0) == len);
+    ok = ok && (armsim_peek(&sim, ept_field(ep, 1), 2) & 0x3FF) == len;
+    for (unsigned i = 0; ok && i < len; i++) {
+        uint16_t w = armsim_peek(&sim, pma_byte(addr + (i & ~1u)), 2);
+        ok = ((i & 1) ? (w >> 8) : (w & 0xFF)) == pattern(seq, i);
+    }
+    ok = ok && (devfs.epr[ep & 0x07] & EP_STAT_TX) == EP_TX_VALID;
+    /* transmitted */
+    devfs.epr[ep & 0x07] = (devfs.epr[ep & 0x07] & ~EP_STAT_TX) | EP_TX_NAK;
+    return ok;
+}
+
+static void devfs_poll(const char *name, uint8_t ev, uint8_t ep) {
+    uint32_t cb = armsim_host(&sim, poll_callback, NULL);
+    bool ok;
+    bench.events = 0;
+    call(HW_POLL, RAM_DEV, cb, 0, 0);
+    if (ev == 0xFF) {
+        ok = (bench.events == 0);
+    } else {
+        ok = (bench.events == 1 && bench.ev_dev == RAM_DEV && bench.ev == ev && bench.ep == ep);
+    }
+    ok = ok && (istr_read() & (ISTR_CTR | ISTR_SOF)) == 0;
+    sim.hosts = 0;
+    report(name, ok);
+}
+
+/* cycles of the packet copy by the length and buffer alignment */
+static void sweep(const char *name, bool (*rd)(uint8_t, uint32_t, uint16_t, uint16_t),
+                  bool (*wr)(uint8_t, uint32_t, uint16_t), uint8_t rxep, uint8_t txep) {
+    static const uint16_t lens[] = {0, 1, 2, 8, 16, 32, 63, 64};
+    unsigned c[4], c0[4];
+    printf("  %-26s %7s %7s %7s %7s\n", name, "read", "odd", "write", "odd");
+    for (unsigned i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        bool ok = true;
+        for (unsigned j = 0; j < 4; j++) {
+            uint32_t buf = RAM_BUF + (j & 1);
+            ok = ((j < 2) ? rd(rxep, buf, lens[i], EP_SIZE) : wr(txep, buf, lens[i])) && ok;
+            ok = ok && !sim.fault;
+            c[j] = bench.cycles;
+            if (lens[i] == 0) c0[j] = c[j];
+        }
+        printf("  len %-22u %7u %7u %7u %7u%s\n", lens[i], c[0], c[1], c[2], c[3], ok ? "" : "  FAILED");
+        if (!ok) bench.failed = true;
+    }
+    /* the last row is the full packet */
+    printf("  %-26s", "per byte");
+    for (unsigned j = 0; j < 4; j++) printf(" %7.2f", (double)(c[j] - c0[j]) / EP_SIZE);
+    printf("\n");
+}
+
+static void bench_devfs(void) {
+    armsim_set_io(&sim, devfs_io, NULL);
+    printf("  %-26s %6s %7s\n", "operation", "insns", "cycles");
+    devfs_config("ep_config control 0x00", 0x00, USB_EPTYPE_CONTROL, EP_SIZE);
+    devfs_config("ep_config bulk 0x01", 0x01, USB_EPTYPE_BULK, EP_SIZE);
+    devfs_config("ep_config bulk 0x82", 0x82, USB_EPTYPE_BULK, EP_SIZE);
+
+    report("ep_read 8", devfs_read(0x01, RAM_BUF, 8, EP_SIZE));
+    report("ep_read 64", devfs_read(0x01, RAM_BUF, 64, EP_SIZE));
+    report("ep_read 64 odd buffer", devfs_read(0x01, RAM_BUF + 1, 64, EP_SIZE));
+    report("ep_read 63", devfs_read(0x01, RAM_BUF, 63, EP_SIZE));
+    report("ep_read 64 to 16 buffer", devfs_read(0x01, RAM_BUF, 64, 16));
+
+    report("ep_write 8", devfs_write(0x82, RAM_BUF, 8));
+    report("ep_write 64", devfs_write(0x82, RAM_BUF, 64));
+    report("ep_write 64 odd buffer", devfs_write(0x82, RAM_BUF + 1, 64));
+    report("ep_write 63", devfs_write(0x82, RAM_BUF, 63));
+
+    devfs.epr[1] |= EP_CTR_RX;
+    devfs_poll("evt_poll ctr rx", usbd_evt_eprx, 0x01);
+    devfs.epr[2] |= EP_CTR_TX;
+    devfs_poll("evt_poll ctr tx", usbd_evt_eptx, 0x82);
+    devfs.istr |= ISTR_SOF;
+    devfs_poll("evt_poll sof", usbd_evt_sof, 0);
+    devfs_poll("evt_poll no event", 0xFF, 0);
+    if (bench.sweep) sweep("pma copy, cycles", devfs_read, devfs_write, 0x01, 0x82);
+}
+
+/* OTG FS benchmarks */
+
+static void otg_rxpush(uint32_t sts, uint8_t seq) {
+    unsigned len = (sts >> 4) & 0x7FF;
+    otg.rxsts[otg.rxsts_n++] = sts;
+    for (unsigned i = 0; i < len; i += 4) {
+        uint32_t w = 0;
+        for (unsigned j = 0; j < 4; j++) w |= (uint32_t)pattern(seq, i + j) << (j * 8);
+        otg.rxdata[otg.rxtail++ % 0x80] = w;
+    }
+}
+
+static void otgfs_config(const char *name, uint8_t ep, uint8_t eptype, uint16_t epsize) {
+    bool ok = call(HW_EP_CONFIG, ep, eptype, epsize, 0) & 0xFF;
+    uint8_t n = ep & 0x7F;
+    if (n == 0) {
+        ok = ok && (otg_reg(OTG_DOEPCTL) & EPCTL_EPENA) && (otg_reg(OTG_DAINTMSK) & 0x10001) == 0x10001;
+    } else if (ep & 0x80) {
+        uint32_t txf0 = otg_reg(OTG_DIEPTXF0);
+        uint32_t txf = otg_reg(OTG_DIEPTXF + 4 * (n - 1));
+        /* TX FIFO follows the EP0 one and holds the packet */
+        ok = ok && (txf & 0xFFFF) >= (txf0 & 0xFFFF) + (txf0 >> 16) && (txf >> 16) >= epsize / 4;
+        ok = ok && (otg_reg(OTG_DIEPCTL + 0x20 * n) & (EPCTL_USBAEP | 0x7FF)) == (EPCTL_USBAEP | epsize);
+        ok = ok && (otg_reg(OTG_DAINTMSK) & (1 << n));
+    } else {
+        ok = ok && (otg_reg(OTG_DOEPCTL + 0x20 * n) & (EPCTL_USBAEP | EPCTL_EPENA | 0x7FF)) ==
+                   (EPCTL_USBAEP | EPCTL_EPENA | epsize);
+    }
+    report(name, ok);
+}
+
+static void otgfs_deconfig(const char *name, uint8_t ep) {
+    uint8_t n = ep & 0x7F;
+    bool ok;
+    otg.txflush = 0;
+    call(HW_EP_DECONFIG, ep, 0, 0, 0);
+    ok = (otg.txflush == n + 1u) && (otg_reg(OTG_DAINTMSK) & (0x10001 << n)) == 0;
+    ok = ok && (otg_reg(OTG_DIEPCTL + 0x20 * n) & EPCTL_USBAEP) == 0;
+    ok = ok && (otg_reg(OTG_DOEPCTL + 0x20 * n) & EPCTL_USBAEP) == 0;
+    /* released TX FIFO is above the FIFO memory */
+    ok = ok && (n == 0 || (otg_reg(OTG_DIEPTXF + 4 * (n - 1)) & 0xFFFF) >= 0x200);
+    report(name, ok);
+}
+
+static bool otgfs_read(uint8_t ep, uint32_t buf, uint16_t len, uint16_t blen) {
+    static unsigned seq;
+    uint16_t n = (blen < len) ? blen : len;
+    int32_t res;
+    bool ok;
+    seq++;
+    otg_rxpush(PKTSTS_OUT | (len << 4) | ep, seq);
+    for (unsigned i = 0; i < EP_SIZE + 2; i++) armsim_poke(&sim, buf + i, 1, 0xEE);
+
+    /* assembly drivers return the received size of the truncated packet, C drivers the copied one */
+    res = call(HW_EP_READ, ep, buf, blen, 0);
+    ok = (res == n || res == len);
+    for (unsigned i = 0; ok && i < n; i++) ok = (armsim_peek(&sim, buf + i, 1) == pattern(seq, i));
+    ok = ok && armsim_peek(&sim, buf + n, 1) == 0xEE;
+    /* status and the whole packet are popped */
+    ok = ok && otg.rxsts_n == 0 && otg.rxhead == otg.rxtail;
+    otg.rxsts_n = 0;
+    otg.rxhead = otg.rxtail;
+    return ok;
+}
+
+static bool otgfs_write(uint8_t ep, uint32_t buf, uint16_t len) {
+    static unsigned seq = 0x80;
+    uint8_t n = ep & 0x7F;
+    bool ok;
+    seq++;
+    for (unsigned i = 0; i < len; i++) armsim_poke(&sim, buf + i, 1, pattern(seq, i));
+
+    ok = ((int32_t)call(HW_EP_WRITE, ep, buf, len, 0) == len);
+    ok = ok && otg_reg(OTG_DIEPTSIZ + 0x20 * n) == ((1 << 19) | len);
+    ok = ok && (otg_reg(OTG_DIEPCTL + 0x20 * n) & EPCTL_EPENA);
+    ok = ok && otg.txlen[n] == (len + 3u) / 4;
+    for (unsigned i = 0; ok && i < len; i++) {
+        ok = (uint8_t)(otg.txdata[n][i / 4] >> ((i & 3) * 8)) == pattern(seq, i);
+    }
+    /* transmitted */
+    armsim_poke(&sim, OTG_BASE + OTG_DIEPCTL + 0x20 * n, 4, otg_reg(OTG_DIEPCTL + 0x20 * n) & ~EPCTL_EPENA);
+    otg.txlen[n] = 0;
+    return ok;
+}
+
+/* pending is the GINTSTS flags left for the application */
+static void otgfs_poll(const char *name, uint8_t ev, uint8_t ep, uint32_t pending) {
+    uint32_t cb = armsim_host(&sim, poll_callback, NULL);
+    bool ok;
+    bench.events = 0;
+    call(HW_POLL, RAM_DEV, cb, 0, 0);
+    if (ev == 0xFF) {
+        ok = (bench.events == 0);
+    } else {
+        ok = (bench.events == 1 && bench.ev_dev == RAM_DEV && bench.ev == ev && bench.ep == ep);
+    }
+    ok = ok && otg_gintsts() == pending;
+    otg.rxsts_n = 0;
+    otg.rxhead = otg.rxtail;
+    sim.hosts = 0;
+    report(name, ok);
+}
+
+static void bench_otgfs(void) {
+    armsim_set_io(&sim, otg_io, NULL);
+    /* FIFO layout of the enable(): RX FIFO, then 16 words of the EP0 TX FIFO, others released */
+    armsim_poke(&sim, OTG_BASE + OTG_DIEPTXF0, 4, (0x10 << 16) | 0x40);
+    for (unsigned i = 1; i < OTG_EPS; i++) {
+        armsim_poke(&sim, OTG_BASE + OTG_DIEPTXF + 4 * (i - 1), 4, 0x02000200 + 0x200 * i);
+    }
+    printf("  %-26s %6s %7s\n", "operation", "insns", "cycles");
+    otgfs_config("ep_config control 0x00", 0x00, USB_EPTYPE_CONTROL, EP_SIZE);
+    otgfs_config("ep_config bulk 0x01", 0x01, USB_EPTYPE_BULK, EP_SIZE);
+    otgfs_config("ep_config bulk 0x82", 0x82, USB_EPTYPE_BULK, EP_SIZE);
+
+    report("ep_read 8", otgfs_read(0x01, RAM_BUF, 8, EP_SIZE));
+    report("ep_read 64", otgfs_read(0x01, RAM_BUF, 64, EP_SIZE));
+    report("ep_read 64 odd buffer", otgfs_read(0x01, RAM_BUF + 1, 64, EP_SIZE));
+    report("ep_read 63", otgfs_read(0x01, RAM_BUF, 63, EP_SIZE));
+    report("ep_read 64 to 16 buffer", otgfs_read(0x01, RAM_BUF, 64, 16));
+
+    report("ep_write 8", otgfs_write(0x82, RAM_BUF, 8));
+    report("ep_write 64", otgfs_write(0x82, RAM_BUF, 64));
+    report("ep_write 64 odd buffer", otgfs_write(0x82, RAM_BUF + 1, 64));
+    report("ep_write 63", otgfs_write(0x82, RAM_BUF, 63));
+
+    /* received packet stays in the FIFO for the ep_read() */
+    otg_rxpush(PKTSTS_OUT | (EP_SIZE << 4) | 0x01, 0);
+    otgfs_poll("evt_poll out rx", usbd_evt_eprx, 0x01, GINT_RXFLVL);
+    otg_rxpush(PKTSTS_SETUP | (8 << 4) | 0x00, 0);
+    otgfs_poll("evt_poll setup rx", usbd_evt_epsetup, 0x00, GINT_RXFLVL);
+    otg_rxpush(PKTSTS_OUT_CPLT | 0x01, 0);
+    otgfs_poll("evt_poll out completed", 0xFF, 0, 0);
+    otg.diepint[2] = 0x01;
+    otgfs_poll("evt_poll in xfrc", usbd_evt_eptx, 0x82, 0);
+    otg.gintsts |= GINT_SOF;
+    otgfs_poll("evt_poll sof", usbd_evt_sof, 0, 0);
+    otgfs_poll("evt_poll no event", 0xFF, 0, 0);
+
+    otgfs_deconfig("ep_deconfig 0x82", 0x82);
+    otgfs_deconfig("ep_deconfig 0x01", 0x01);
+    otg.rxflush = 0;
+    otg.gintsts |= GINT_USBRST;
+    otgfs_poll("evt_poll bus reset", 0xFF, 0, 0);
+    if (otg.rxflush != 1 || (otg_reg(OTG_DAINTMSK) & 0x000F000F)) {
+        printf("  %-26s FAILED\n", "bus reset state");
+        bench.failed = true;
+    }
+    if (bench.sweep) {
+        otgfs_config("ep_config bulk 0x82", 0x82, USB_EPTYPE_BULK, EP_SIZE);
+        sweep("fifo copy, cycles", otgfs_read, otgfs_write, 0x01, 0x82);
+    }
+}
+
+int main(int argc, char **argv) {
+    static const struct {
+        const char  *name;
+        void        (*run)(void);
+    } drivers[] = {
+        {"usbd_devfs_asm",  bench_devfs},
+        {"usbd_devfs",      bench_devfs},
+        {"usbd_otgfs_asm",  bench_otgfs},
+        {"usbd_otgfs",      bench_otgfs},
+    };
+    static const char *cores[] = {"cortex-m0+", "cortex-m3", "cortex-m4"};
+    uint8_t core = ARMSIM_M3;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "m0p") == 0) {
+                core = ARMSIM_M0P;
+            } else if (strcmp(argv[i], "m4") == 0) {
+                core = ARMSIM_M4;
+            } else {
+                core = ARMSIM_M3;
+            }
+        } else if (strcmp(argv[i], "-p") == 0) {
+            bench.sweep = true;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            devfs.stride = (atoi(argv[++i]) == 2) ? 2 : 1;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL) {
+        fprintf(stderr, "usage: drvbench [-c m0p|m3|m4] [-s 1|2] [-p] driver.elf\n");
+        return 1;
+    }
+    armsim_init(&sim, core);
+    if (!armsim_load(&sim, path)) {
+        fprintf(stderr, "drvbench: can't load %s\n", path);
+        return 1;
+    }
+    for (unsigned i = 0; i < sizeof(drivers) / sizeof(drivers[0]); i++) {
+        bench.table = armsim_symbol(&sim, drivers[i].name);
+        if (bench.table == 0) continue;
+        printf("%s %s %s\n", path, drivers[i].name, cores[core]);
+        drivers[i].run();
+        armsim_free(&sim);
+        return bench.failed ? 1 : 0;
+    }
+    armsim_free(&sim);
+    return 2;
+}
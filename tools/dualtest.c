@@ -0,0 +1,292 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Two device instances test. Host tool.
+ * Runs two usbd_device instances on the two virtual buses with the same endpoint addresses and
+ * interleaves their bulk, control and bus state traffic, so each transaction of one device
+ * happens while the other one is in the middle of its own transfer. Devices echo the bulk data
+ * XORed with their own key, so data delivered to the wrong device is detected.
+ *
+ * Build and run:
+ *   cc -std=gnu99 -Iinc -DUSBD_VIRTUAL tools/dualtest.c tools/vbus.c src/usbd_core.c -o dualtest
+ *   ./dualtest
+ *
+ * With -DUSBD_DRIVER_CTX both devices share one driver call table and differ by the bus base
+ * only, like the context driver of the OTG FS and OTG HS cores does.
+ *
+ * Built with tools/otgbus.c instead of tools/vbus.c, both devices run the real OTG FS context
+ * driver on their own register blocks, and every register access is checked to hit the block
+ * of the device being served:
+ *   cc -std=gnu99 -Iinc -Itools/mock -DSTM32F4 -DSTM32F429xx -DUSBD_DRIVER_CTX tools/dualtest.c \
+ *      tools/otgbus.c src/usbd_core.c src/usbd_stm32f429_otgfs.c -o dualtest_otgfs
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "usb.h"
+#include "vbus.h"
+#if defined(USBD_STM32F429FS)
+#include "otgbus.h"
+#endif
+
+#define EP_SIZE         0x40
+#define STEPS           2000
+
+struct dual_config {
+    struct usb_config_descriptor    config;
+    struct usb_interface_descriptor intf;
+    struct usb_endpoint_descriptor  rx;
+    struct usb_endpoint_descriptor  tx;
+} __attribute__((packed));
+
+static const struct dual_config config_desc = {
+    .config = {
+        .bLength                = sizeof(struct usb_config_descriptor),
+        .bDescriptorType        = USB_DTYPE_CONFIGURATION,
+        .wTotalLength           = sizeof(struct dual_config),
+        .bNumInterfaces         = 1,
+        .bConfigurationValue    = 1,
+        .iConfiguration         = NO_DESCRIPTOR,
+        .bmAttributes           = USB_CFG_ATTR_RESERVED | USB_CFG_ATTR_SELFPOWERED,
+        .bMaxPower              = USB_CFG_POWER_MA(100),
+    },
+    .intf = {
+        .bLength                = sizeof(struct usb_interface_descriptor),
+        .bDescriptorType        = USB_DTYPE_INTERFACE,
+        .bInterfaceNumber       = 0,
+        .bAlternateSetting      = 0,
+        .bNumEndpoints          = 2,
+        .bInterfaceClass        = USB_CLASS_VENDOR,
+        .bInterfaceSubClass     = USB_SUBCLASS_VENDOR,
+        .bInterfaceProtocol     = USB_PROTO_VENDOR,
+        .iInterface             = NO_DESCRIPTOR,
+    },
+    .rx = {
+        .bLength                = sizeof(struct usb_endpoint_descriptor),
+        .bDescriptorType        = USB_DTYPE_ENDPOINT,
+        .bEndpointAddress       = 0x01,
+        .bmAttributes           = USB_EPTYPE_BULK,
+        .wMaxPacketSize         = EP_SIZE,
+        .bInterval              = 0,
+    },
+    .tx = {
+        .bLength                = sizeof(struct usb_endpoint_descriptor),
+        .bDescriptorType        = USB_DTYPE_ENDPOINT,
+        .bEndpointAddress       = 0x81,
+        .bmAttributes           = USB_EPTYPE_BULK,
+        .wMaxPacketSize         = EP_SIZE,
+        .bInterval              = 0,
+    },
+};
+
+/* device instances */
+
+static struct {
+    usbd_device                 dev;
+    uint32_t                    buf[0x20];
+    struct usb_device_descriptor desc;
+    uint8_t                     key;
+    unsigned                    echoed;
+    unsigned                    errors;     /* echo could not be written */
+} dual[VBUS_COUNT];
+
+static int dual_index(usbd_device *dev) {
+    for (int i = 0; i < VBUS_COUNT; i++) {
+        if (dev == &dual[i].dev) return i;
+    }
+    return -1;
+}
+
+/* descriptor callback has no device argument, so each device registers its own one */
+static usbd_respond dual_getdesc(int n, usbd_ctlreq *req, void **address, uint16_t *length) {
+    switch (req->wValue >> 8) {
+    case USB_DTYPE_DEVICE:
+        *address = &dual[n].desc;
+        *length = sizeof(dual[n].desc);
+        return usbd_ack;
+    case USB_DTYPE_CONFIGURATION:
+        *address = (void*)&config_desc;
+        *length = sizeof(config_desc);
+        return usbd_ack;
+    default:
+        return usbd_fail;
+    }
+}
+
+static usbd_respond app_getdesc0(usbd_ctlreq *req, void **address, uint16_t *length) {
+    return dual_getdesc(0, req, address, length);
+}
+
+static usbd_respond app_getdesc1(usbd_ctlreq *req, void **address, uint16_t *length) {
+    return dual_getdesc(1, req, address, length);
+}
+
+static void app_rx(usbd_device *dev, uint8_t event, uint8_t ep) {
+    int n = dual_index(dev);
+    uint8_t _b[EP_SIZE];
+    (void)event;
+    int32_t _l = usbd_ep_read(dev, ep, _b, sizeof(_b));
+    if (n < 0 || _l < 0) return;
+    for (int i = 0; i < _l; i++) _b[i] ^= dual[n].key;
+    if (usbd_ep_write(dev, 0x81, _b, _l) == _l) {
+        dual[n].echoed++;
+    } else {
+        dual[n].errors++;
+    }
+}
+
+static usbd_respond app_setconf(usbd_device *dev, uint8_t cfg) {
+    switch (cfg) {
+    case 0:
+        usbd_ep_deconfig(dev, 0x01);
+        usbd_ep_deconfig(dev, 0x81);
+        usbd_reg_endpoint(dev, 0x01, 0);
+        return usbd_ack;
+    case 1:
+        usbd_ep_config(dev, 0x01, USB_EPTYPE_BULK, EP_SIZE);
+        usbd_ep_config(dev, 0x81, USB_EPTYPE_BULK, EP_SIZE);
+        usbd_reg_endpoint(dev, 0x01, app_rx);
+        return usbd_ack;
+    default:
+        return usbd_fail;
+    }
+}
+
+static void dual_init(int n) {
+    dual[n].desc = (struct usb_device_descriptor){
+        .bLength            = sizeof(struct usb_device_descriptor),
+        .bDescriptorType    = USB_DTYPE_DEVICE,
+        .bcdUSB             = VERSION_BCD(2, 0, 0),
+        .bDeviceClass       = USB_CLASS_PER_INTERFACE,
+        .bMaxPacketSize0    = 0x40,
+        .idVendor           = 0x0483,
+        .idProduct          = 0x5740 + n,
+        .bcdDevice          = VERSION_BCD(1, 0, 0),
+        .iManufacturer      = NO_DESCRIPTOR,
+        .iProduct           = NO_DESCRIPTOR,
+        .iSerialNumber      = NO_DESCRIPTOR,
+        .bNumConfigurations = 1,
+    };
+    dual[n].key = 0x5A + n * 0x11;
+    vbus_init(n, &dual[n].dev, 0x40, dual[n].buf, sizeof(dual[n].buf));
+    usbd_reg_config(&dual[n].dev, app_setconf);
+    usbd_reg_descr(&dual[n].dev, n ? app_getdesc1 : app_getdesc0);
+}
+
+/* host */
+
+static uint8_t pattern(int n, unsigned seq, unsigned i) {
+    return (uint8_t)(seq * 3 + i * 7 + n * 0x40);
+}
+
+static uint16_t packet_len(unsigned seq) {
+    return 1 + (seq * 13) % EP_SIZE;
+}
+
+static void send(int n, unsigned seq) {
+    uint8_t pkt[EP_SIZE];
+    uint16_t len = packet_len(seq);
+    for (unsigned i = 0; i < len; i++) pkt[i] = pattern(n, seq, i);
+    VBUS_CHECK(vbus_out(n, 0x01, pkt, len) == len);
+}
+
+static void receive(int n, unsigned seq) {
+    uint8_t pkt[VBUS_EPSIZE];
+    uint16_t len = packet_len(seq);
+    bool ok = (vbus_in(n, 0x81, pkt) == len);
+    for (unsigned i = 0; ok && i < len; i++) {
+        ok = (pkt[i] == (pattern(n, seq, i) ^ dual[n].key));
+    }
+    VBUS_CHECK(ok);
+}
+
+static void get_device(int n) {
+    struct usb_device_descriptor desc;
+    VBUS_CHECK(vbus_control(n, USB_REQ_DEVTOHOST | USB_REQ_STANDARD | USB_REQ_DEVICE,
+                            USB_STD_GET_DESCRIPTOR, USB_DTYPE_DEVICE << 8, 0,
+                            sizeof(desc), &desc) == sizeof(desc));
+    VBUS_CHECK(desc.idProduct == 0x5740 + n);
+}
+
+static uint8_t get_config(int n) {
+    uint8_t cfg = 0xFF;
+    VBUS_CHECK(vbus_control(n, USB_REQ_DEVTOHOST | USB_REQ_STANDARD | USB_REQ_DEVICE,
+                            USB_STD_GET_CONFIG, 0, 0, 1, &cfg) == 1);
+    return cfg;
+}
+
+/* each transaction of one device runs inside the bulk and control transfers of the other */
+static void test_interleaved(void) {
+    for (unsigned seq = 0; seq < STEPS; seq++) {
+        int a = seq & 1, b = a ^ 1;
+        send(a, seq);
+        send(b, seq);
+        get_device(a);
+        receive(b, seq);
+        get_device(b);
+        receive(a, seq);
+        if (seq % 19 == 0) {
+            vbus_sof(a);
+            vbus_sof(b);
+        }
+    }
+    for (int n = 0; n < VBUS_COUNT; n++) {
+        VBUS_CHECK(dual[n].echoed == STEPS && dual[n].errors == 0);
+    }
+}
+
+/* bus reset and configuration change of one device do not touch the other */
+static void test_state(void) {
+    unsigned seq = STEPS;
+    send(0, seq);
+    VBUS_CHECK(vbus_enumerate(1, 5, 1));
+    VBUS_CHECK(vbus[0].addr == 1 && vbus[1].addr == 5);
+    receive(0, seq++);
+    send(0, seq);
+    VBUS_CHECK(vbus_control(1, USB_REQ_STANDARD | USB_REQ_DEVICE, USB_STD_SET_CONFIG, 0, 0, 0, 0) == 0);
+    VBUS_CHECK(get_config(1) == 0 && get_config(0) == 1);
+    VBUS_CHECK(vbus_out(1, 0x01, "x", 1) == VBUS_NAK);
+    receive(0, seq++);
+    /* the other device keeps the halt state of its own endpoint */
+    VBUS_CHECK(vbus_control(1, USB_REQ_STANDARD | USB_REQ_DEVICE, USB_STD_SET_CONFIG, 1, 0, 0, 0) == 0);
+    VBUS_CHECK(vbus_control(1, USB_REQ_STANDARD | USB_REQ_ENDPOINT, USB_STD_SET_FEATURE,
+                            USB_FEAT_ENDPOINT_HALT, 0x01, 0, 0) == 0);
+    VBUS_CHECK(vbus_out(1, 0x01, "x", 1) == VBUS_STALL);
+    send(0, seq);
+    receive(0, seq++);
+    VBUS_CHECK(vbus_control(1, USB_REQ_STANDARD | USB_REQ_ENDPOINT, USB_STD_CLEAR_FEATURE,
+                            USB_FEAT_ENDPOINT_HALT, 0x01, 0, 0) == 0);
+    send(1, seq);
+    receive(1, seq);
+}
+
+int main(void) {
+    for (int n = 0; n < VBUS_COUNT; n++) {
+        dual_init(n);
+        VBUS_CHECK(vbus_enumerate(n, n + 1, 1));
+    }
+    test_interleaved();
+    test_state();
+#if defined(USBD_STM32F429FS)
+    /* each driver call touches the registers and FIFOs of its own core only */
+    for (int n = 0; n < VBUS_COUNT; n++) {
+        VBUS_CHECK(otgbus_accesses(n) != 0 && otgbus_foreign(n) == 0);
+    }
+#endif
+    printf("dualtest: %s\n", vbus_failed ? "FAILED" : "passed");
+    return vbus_failed ? 1 : 0;
+}
@@ -0,0 +1,503 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* USB enumeration benchmark. Host tool.
+ * Replays Linux, Windows and macOS style enumeration request sequences against usbd_core.c
+ * through a virtual driver and reports the core CPU time per request and the simulated
+ * full-speed bus time for each control endpoint size.
+ *
+ * Build and run:
+ *   cc -std=gnu99 -O2 -Iinc -DUSBD_VIRTUAL tools/enumbench.c src/usbd_core.c -o enumbench
+ *   ./enumbench [-e <ep0size>] [-n <iterations>] [-s <sequence>] [-v]
+ *
+ * The application is a CDC ACM device with strings and a serial number, like the demo.
+ * Bus time counts token, data and handshake packets with the inter-packet gaps. Bus resets
+ * and host delays between the requests are not counted.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "usb.h"
+#include "usb_cdc.h"
+#include "usbd_cdc_acm.h"
+
+/* full-speed packet sizes in bit times without bit stuffing */
+#define BIT_TOKEN       35      /* SYNC, PID, ADDR, ENDP, CRC5, EOP */
+#define BIT_DATA        35      /* SYNC, PID, CRC16, EOP. Payload is added */
+#define BIT_HANDSHAKE   19      /* SYNC, PID, EOP */
+#define BIT_GAP         8       /* inter-packet delay and bus turnaround */
+#define BIT_RATE        12      /* bits per microsecond */
+
+#define REQ_RESET       0x01    /* bus reset before the request */
+#define REQ_ABORT       0x02    /* host resets the bus after the first data packet */
+#define REQ_TOTAL       0x04    /* wLength is the configuration total length */
+
+#define GET_DESC(t, i, l)   0x80, USB_STD_GET_DESCRIPTOR, ((t) << 8) | (i), 0, (l)
+#define DEVICE_DESC(l)      GET_DESC(USB_DTYPE_DEVICE, 0, l)
+#define CONFIG_DESC(l)      GET_DESC(USB_DTYPE_CONFIGURATION, 0, l)
+#define STRING_DESC(i, l)   GET_DESC(USB_DTYPE_STRING, i, l)
+#define SET_ADDRESS(a)      0x00, USB_STD_SET_ADDRESS, (a), 0, 0
+#define SET_CONFIG(c)       0x00, USB_STD_SET_CONFIG, (c), 0, 0
+#define GET_STATUS()        0x80, USB_STD_GET_STATUS, 0, 0, 2
+#define SERIAL              INTSERIALNO_DESCRIPTOR
+#define MSOS                0xEE
+
+struct enum_req {
+    uint8_t     bmRequestType;
+    uint8_t     bRequest;
+    uint16_t    wValue;
+    uint16_t    wIndex;
+    uint16_t    wLength;
+    uint8_t     flags;
+};
+
+struct enum_seq {
+    const char              *name;
+    const struct enum_req   *req;
+};
+
+struct result {
+    unsigned    bytes;
+    unsigned    packets;
+    unsigned    bits;
+    unsigned    stalls;
+    double      core_ns;
+};
+
+#define END     {0, 0, 0, 0, 0, 0xFF}
+
+static const struct enum_req linux_seq[] = {
+    {DEVICE_DESC(64),           REQ_RESET},
+    {SET_ADDRESS(1),            REQ_RESET},
+    {DEVICE_DESC(18),           0},
+    {CONFIG_DESC(9),            0},
+    {CONFIG_DESC(0),            REQ_TOTAL},
+    {STRING_DESC(0, 255),       0},
+    {STRING_DESC(2, 255),       0},
+    {STRING_DESC(1, 255),       0},
+    {STRING_DESC(SERIAL, 255),  0},
+    {SET_CONFIG(1),             0},
+    END,
+};
+
+static const struct enum_req windows_seq[] = {
+    {DEVICE_DESC(64),           REQ_RESET | REQ_ABORT},
+    {SET_ADDRESS(1),            REQ_RESET},
+    {DEVICE_DESC(18),           0},
+    {CONFIG_DESC(255),          0},
+    {STRING_DESC(SERIAL, 255),  0},
+    {STRING_DESC(MSOS, 18),     0},
+    {STRING_DESC(0, 255),       0},
+    {STRING_DESC(2, 255),       0},
+    {DEVICE_DESC(18),           0},
+    {CONFIG_DESC(9),            0},
+    {CONFIG_DESC(0),            REQ_TOTAL},
+    {GET_STATUS(),              0},
+    {SET_CONFIG(1),             0},
+    {STRING_DESC(2, 255),       0},
+    END,
+};
+
+static const struct enum_req macos_seq[] = {
+    {DEVICE_DESC(8),            REQ_RESET},
+    {SET_ADDRESS(1),            REQ_RESET},
+    {DEVICE_DESC(18),           0},
+    {CONFIG_DESC(9),            0},
+    {CONFIG_DESC(0),            REQ_TOTAL},
+    {STRING_DESC(0, 2),         0},
+    {STRING_DESC(0, 255),       0},
+    {STRING_DESC(2, 2),         0},
+    {STRING_DESC(2, 255),       0},
+    {STRING_DESC(1, 2),         0},
+    {STRING_DESC(1, 255),       0},
+    {STRING_DESC(SERIAL, 2),    0},
+    {STRING_DESC(SERIAL, 255),  0},
+    {GET_STATUS(),              0},
+    {SET_CONFIG(1),             0},
+    END,
+};
+
+static const struct enum_req sweep_seq[] = {
+    {SET_ADDRESS(1),            REQ_RESET},
+    {STRING_DESC(0, 255),       0},
+    {STRING_DESC(1, 255),       0},
+    {STRING_DESC(2, 255),       0},
+    {STRING_DESC(3, 255),       0},
+    {STRING_DESC(4, 255),       0},
+    {STRING_DESC(5, 255),       0},
+    {STRING_DESC(SERIAL, 255),  0},
+    {STRING_DESC(MSOS, 255),    0},
+    {STRING_DESC(1, 4),         0},
+    {STRING_DESC(1, 16),        0},
+    {STRING_DESC(1, 64),        0},
+    END,
+};
+
+static const struct enum_seq sequences[] = {
+    {"linux",   linux_seq},
+    {"windows", windows_seq},
+    {"macos",   macos_seq},
+    {"sweep",   sweep_seq},
+};
+
+/* application */
+
+struct cdc_config {
+    struct usb_config_descriptor    config;
+    struct usbd_cdc_acm_desc        acm;
+} __attribute__((packed));
+
+static struct usb_device_descriptor device_desc = {
+    .bLength            = sizeof(struct usb_device_descriptor),
+    .bDescriptorType    = USB_DTYPE_DEVICE,
+    .bcdUSB             = VERSION_BCD(2,0,0),
+    .bDeviceClass       = USB_CLASS_IAD,
+    .bDeviceSubClass    = USB_SUBCLASS_IAD,
+    .bDeviceProtocol    = USB_PROTO_IAD,
+    .bMaxPacketSize0    = 8,
+    .idVendor           = 0x0483,
+    .idProduct          = 0x5740,
+    .bcdDevice          = VERSION_BCD(1,0,0),
+    .iManufacturer      = 1,
+    .iProduct           = 2,
+    .iSerialNumber      = INTSERIALNO_DESCRIPTOR,
+    .bNumConfigurations = 1,
+};
+
+static const struct cdc_config config_desc = {
+    .config = {
+        .bLength                = sizeof(struct usb_config_descriptor),
+        .bDescriptorType        = USB_DTYPE_CONFIGURATION,
+        .wTotalLength           = sizeof(struct cdc_config),
+        .bNumInterfaces         = 2,
+        .bConfigurationValue    = 1,
+        .iConfiguration         = NO_DESCRIPTOR,
+        .bmAttributes           = USB_CFG_ATTR_RESERVED | USB_CFG_ATTR_SELFPOWERED,
+        .bMaxPower              = USB_CFG_POWER_MA(100),
+    },
+    .acm = USBD_CDC_ACM_DESC(0, 0x01, 0x81, 0x82, 0x40, USB_PROTO_NONE),
+};
+
+static const struct usb_string_descriptor lang_desc     = USB_ARRAY_DESC(USB_LANGID_ENG_US);
+static const struct usb_string_descriptor manuf_desc_en = USB_STRING_DESC("Open source USB stack for STM32");
+static const struct usb_string_descriptor prod_desc_en  = USB_STRING_DESC("CDC Loopback demo");
+static const struct usb_string_descriptor *const dtable[] = {
+    &lang_desc,
+    &manuf_desc_en,
+    &prod_desc_en,
+};
+
+static usbd_respond app_getdesc(usbd_ctlreq *req, void **address, uint16_t *length) {
+    const uint8_t dtype = req->wValue >> 8;
+    const uint8_t dnumber = req->wValue & 0xFF;
+    const void* desc;
+    uint16_t len = 0;
+    switch (dtype) {
+    case USB_DTYPE_DEVICE:
+        desc = &device_desc;
+        break;
+    case USB_DTYPE_CONFIGURATION:
+        desc = &config_desc;
+        len = sizeof(config_desc);
+        break;
+    case USB_DTYPE_STRING:
+        if (dnumber < 3) {
+            desc = dtable[dnumber];
+        } else {
+            return usbd_fail;
+        }
+        break;
+    default:
+        return usbd_fail;
+    }
+    if (len == 0) {
+        len = ((struct usb_header_descriptor*)desc)->bLength;
+    }
+    *address = (void*)desc;
+    *length = len;
+    return usbd_ack;
+}
+
+static usbd_respond app_setconf(usbd_device *dev, uint8_t cfg) {
+    (void)dev;
+    return (cfg <= 1) ? usbd_ack : usbd_fail;
+}
+
+/* virtual driver */
+
+static struct {
+    uint8_t     evt;
+    uint8_t     ep;
+    uint8_t     setup[8];
+    bool        setup_ready;
+    uint8_t     in[0x40];
+    uint16_t    in_len;
+    bool        in_ready;
+    bool        stalled;
+} vbus;
+
+static usbd_device udev;
+static uint32_t ubuf[0x20];
+
+static uint32_t vdrv_getinfo(void) {
+    return USBD_HW_ENABLED | USBD_HW_SPEED_FS;
+}
+
+static void vdrv_enable(bool enable) {
+    (void)enable;
+}
+
+static uint8_t vdrv_connect(bool connect) {
+    return connect ? usbd_lane_sdp : usbd_lane_dsc;
+}
+
+static void vdrv_setaddr(uint8_t addr) {
+    (void)addr;
+}
+
+static bool vdrv_ep_config(uint8_t ep, uint8_t eptype, uint16_t epsize) {
+    (void)ep; (void)eptype; (void)epsize;
+    return true;
+}
+
+static void vdrv_ep_deconfig(uint8_t ep) {
+    (void)ep;
+}
+
+static int32_t vdrv_ep_read(uint8_t ep, void *buf, uint16_t blen) {
+    (void)ep;
+    if (vbus.setup_ready) {
+        vbus.setup_ready = false;
+        if (blen > 8) blen = 8;
+        memcpy(buf, vbus.setup, blen);
+        return blen;
+    }
+    return 0;
+}
+
+static int32_t vdrv_ep_write(uint8_t ep, void *buf, uint16_t blen) {
+    (void)ep;
+    if (blen > sizeof(vbus.in)) blen = sizeof(vbus.in);
+    memcpy(vbus.in, buf, blen);
+    vbus.in_len = blen;
+    vbus.in_ready = true;
+    return blen;
+}
+
+static void vdrv_ep_setstall(uint8_t ep, bool stall) {
+    if ((ep & 0x07) == 0 && stall) vbus.stalled = true;
+}
+
+static bool vdrv_ep_isstalled(uint8_t ep) {
+    (void)ep;
+    return false;
+}
+
+static void vdrv_poll(usbd_device *dev, usbd_evt_callback callback) {
+    callback(dev, vbus.evt, vbus.ep);
+}
+
+static uint16_t vdrv_frame_no(void) {
+    return 0;
+}
+
+static uint16_t vdrv_get_serialno_desc(void *buffer) {
+    static const struct usb_string_descriptor serial = USB_STRING_DESC("0123456789AB");
+    memcpy(buffer, &serial, serial.bLength);
+    return serial.bLength;
+}
+
+static void vdrv_resume(bool resume) {
+    (void)resume;
+}
+
+static const struct usbd_driver vdrv = {
+    vdrv_getinfo,
+    vdrv_enable,
+    vdrv_connect,
+    vdrv_setaddr,
+    vdrv_ep_config,
+    vdrv_ep_deconfig,
+    vdrv_ep_read,
+    vdrv_ep_write,
+    vdrv_ep_setstall,
+    vdrv_ep_isstalled,
+    vdrv_poll,
+    vdrv_frame_no,
+    vdrv_get_serialno_desc,
+    vdrv_resume,
+};
+
+/* host */
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bus_event(struct result *res, uint8_t evt, uint8_t ep) {
+    double start;
+    vbus.evt = evt;
+    vbus.ep = ep;
+    start = now_ns();
+    usbd_poll(&udev);
+    res->core_ns += now_ns() - start;
+}
+
+static void bus_xact(struct result *res, unsigned payload) {
+    res->bits += BIT_TOKEN + BIT_GAP + BIT_DATA + 8 * payload + BIT_GAP + BIT_HANDSHAKE + BIT_GAP;
+    res->packets++;
+}
+
+/* transaction answered by STALL handshake */
+static void bus_stall(struct result *res) {
+    res->bits += BIT_TOKEN + BIT_GAP + BIT_HANDSHAKE + BIT_GAP;
+    res->stalls++;
+}
+
+/* takes DATA IN packet from the device. returns false if device has nothing to send */
+static bool bus_in(struct result *res, uint16_t *len) {
+    if (vbus.stalled) {
+        bus_stall(res);
+        return false;
+    }
+    if (!vbus.in_ready) return false;
+    vbus.in_ready = false;
+    *len = vbus.in_len;
+    bus_xact(res, *len);
+    bus_event(res, usbd_evt_eptx, 0x80);
+    return true;
+}
+
+static void run_request(const struct enum_req *r, uint8_t ep0size, struct result *res) {
+    uint16_t wlength = (r->flags & REQ_TOTAL) ? sizeof(config_desc) : r->wLength;
+    uint16_t len;
+    if (r->flags & REQ_RESET) bus_event(res, usbd_evt_reset, 0);
+    vbus.setup[0] = r->bmRequestType;
+    vbus.setup[1] = r->bRequest;
+    vbus.setup[2] = r->wValue & 0xFF;
+    vbus.setup[3] = r->wValue >> 8;
+    vbus.setup[4] = r->wIndex & 0xFF;
+    vbus.setup[5] = r->wIndex >> 8;
+    vbus.setup[6] = wlength & 0xFF;
+    vbus.setup[7] = wlength >> 8;
+    vbus.setup_ready = true;
+    vbus.in_ready = false;
+    vbus.stalled = false;
+    bus_xact(res, 8);
+    bus_event(res, usbd_evt_epsetup, 0);
+    if ((r->bmRequestType & USB_REQ_DEVTOHOST) && wlength) {
+        /* DATA IN stage until the short packet or wLength */
+        unsigned total = 0;
+        while (bus_in(res, &len)) {
+            total += len;
+            if ((r->flags & REQ_ABORT) || len < ep0size || total >= wlength) break;
+        }
+        res->bytes += total;
+        if (vbus.stalled || (r->flags & REQ_ABORT)) return;
+        /* STATUS OUT stage */
+        bus_xact(res, 0);
+        bus_event(res, usbd_evt_eprx, 0x00);
+    } else {
+        /* STATUS IN stage */
+        bus_in(res, &len);
+    }
+}
+
+static void run_sequence(const struct enum_seq *seq, uint8_t ep0size, unsigned iter,
+                         bool verbose, struct result *total) {
+    struct result res[0x20];
+    unsigned n;
+    memset(res, 0, sizeof(res));
+    memset(total, 0, sizeof(*total));
+    device_desc.bMaxPacketSize0 = ep0size;
+    for (unsigned i = 0; i < iter; i++) {
+        usbd_init(&udev, &vdrv, ep0size, ubuf, sizeof(ubuf));
+        usbd_reg_config(&udev, app_setconf);
+        usbd_reg_descr(&udev, app_getdesc);
+        for (n = 0; seq->req[n].flags != 0xFF; n++) {
+            run_request(&seq->req[n], ep0size, &res[n]);
+        }
+    }
+    if (verbose) {
+        printf("\n%s, ep0size %u\n", seq->name, ep0size);
+        printf("  %-4s %-6s %-6s %7s %7s %7s %6s %10s %10s\n",
+               "req", "value", "index", "length", "bytes", "packets", "stall", "bus,us", "core,ns");
+    }
+    for (n = 0; seq->req[n].flags != 0xFF; n++) {
+        const struct enum_req *r = &seq->req[n];
+        if (verbose) {
+            printf("  0x%02X 0x%04X 0x%04X %7u %7u %7u %6u %10.1f %10.1f\n",
+                   r->bRequest, r->wValue, r->wIndex,
+                   (r->flags & REQ_TOTAL) ? (unsigned)sizeof(config_desc) : r->wLength,
+                   res[n].bytes / iter, res[n].packets / iter, res[n].stalls / iter,
+                   (double)res[n].bits / iter / BIT_RATE, res[n].core_ns / iter);
+        }
+        total->bytes += res[n].bytes / iter;
+        total->packets += res[n].packets / iter;
+        total->stalls += res[n].stalls / iter;
+        total->bits += res[n].bits / iter;
+        total->core_ns += res[n].core_ns / iter;
+    }
+}
+
+int main(int argc, char **argv) {
+    static const uint8_t ep0sizes[] = {8, 16, 32, 64};
+    unsigned iter = 1000;
+    int ep0size = 0;
+    const char *only = NULL;
+    bool verbose = false;
+    struct result total;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            ep0size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iter = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else {
+            fprintf(stderr, "usage: enumbench [-e <ep0size>] [-n <iterations>] [-s <sequence>] [-v]\n");
+            return 1;
+        }
+    }
+    if (iter == 0) iter = 1;
+    if (ep0size != 0 && ep0size != 8 && ep0size != 16 && ep0size != 32 && ep0size != 64) {
+        fprintf(stderr, "enumbench: ep0size must be 8, 16, 32 or 64\n");
+        return 1;
+    }
+
+    printf("%-8s %7s %8s %8s %6s %10s %10s\n",
+           "sequence", "ep0size", "bytes", "packets", "stall", "bus,us", "core,ns");
+    for (unsigned s = 0; s < sizeof(sequences) / sizeof(sequences[0]); s++) {
+        if (only && strcmp(only, sequences[s].name) != 0) continue;
+        for (unsigned e = 0; e < sizeof(ep0sizes); e++) {
+            if (ep0size && ep0size != ep0sizes[e]) continue;
+            run_sequence(&sequences[s], ep0sizes[e], iter, verbose, &total);
+            if (verbose) printf("\n");
+            printf("%-8s %7u %8u %8u %6u %10.1f %10.1f\n", sequences[s].name, ep0sizes[e],
+                   total.bytes, total.packets, total.stalls, (double)total.bits / BIT_RATE,
+                   total.core_ns);
+        }
+    }
+    return 0;
+}
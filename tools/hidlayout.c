@@ -0,0 +1,357 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* HID report descriptor analyzer. Host tool.
+ * Walks the report descriptor built with usb_hid.h macros and generates a header with the
+ * report sizes, field bit offsets and accessors for each usage, so the report layout is never
+ * hand-written and nothing is parsed on the device.
+ *
+ * Build with the header that holds the descriptor array forcibly included:
+ *   cc -Iinc -include demo/hid_mouse.h -DHID_DESC=hid_report_desc tools/hidlayout.c -o hidlayout
+ *   ./hidlayout HID_MOUSE > demo/hid_mouse_layout.h
+ *
+ * Field offsets are counted from the start of the report data, excluding report ID byte.
+ * This is the layout used by usbd_hid_report.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#if !defined(HID_DESC)
+    #error HID_DESC must be defined as a name of the report descriptor array
+#endif
+
+#define MAX_USAGES  0x40
+#define MAX_FIELDS  0x100
+#define MAX_STACK   0x04
+#define MAX_NAME    0x20
+
+#define RPT_IN      0x00
+#define RPT_OUT     0x01
+#define RPT_FEATURE 0x02
+
+struct globals {
+    uint32_t    page;
+    int32_t     lmin;
+    uint32_t    size;
+    uint32_t    count;
+    uint32_t    id;
+};
+
+struct field {
+    char        name[MAX_NAME];
+    char        base[MAX_NAME]; /* usage name without duplicate suffix */
+    uint8_t     type;
+    uint8_t     id;
+    uint32_t    offset;
+    uint32_t    bits;
+    uint32_t    count;      /* >1 for the array fields */
+    bool        sign;
+    bool        rel;
+};
+
+static struct field fields[MAX_FIELDS];
+static unsigned nfields;
+static uint32_t rsize[3][0x100];    /* report sizes in bits by type and ID */
+static uint32_t rpad[3][0x100];     /* constant (padding) bits */
+static bool rused[3][0x100];
+static bool use_ids;
+
+static const char *const type_name[] = {"IN", "OUT", "FEATURE"};
+
+static void fail(const char *msg, unsigned pos) {
+    fprintf(stderr, "hidlayout: %s at offset %u\n", msg, pos);
+    exit(1);
+}
+
+static void usage_name(char *buf, uint32_t usage) {
+    uint16_t page = usage >> 16;
+    uint16_t id = usage & 0xFFFF;
+    static const char *const desktop[] = {"X", "Y", "Z", "RX", "RY", "RZ", "SLIDER", "DIAL",
+                                          "WHEEL", "HATSWITCH"};
+    if (page == 0x01 && id >= 0x30 && id <= 0x39) {
+        snprintf(buf, MAX_NAME, "%s", desktop[id - 0x30]);
+    } else if (page == 0x09) {
+        snprintf(buf, MAX_NAME, "BUTTON%u", id);
+    } else if (page == 0x07) {
+        snprintf(buf, MAX_NAME, "KEY%02X", id);
+    } else if (page == 0x08) {
+        snprintf(buf, MAX_NAME, "LED%u", id);
+    } else {
+        snprintf(buf, MAX_NAME, "U%04X_%04X", page, id);
+    }
+}
+
+static void add_field(uint8_t type, const struct globals *g, uint32_t usage, uint32_t offset,
+                      uint32_t count, bool rel) {
+    struct field *f;
+    char name[MAX_NAME];
+    unsigned dup = 1;
+    if (nfields == MAX_FIELDS) fail("too many fields", 0);
+    if (count > 1) {
+        snprintf(name, MAX_NAME, "ARRAY");
+    } else {
+        usage_name(name, usage);
+    }
+    /* the same usage may appear in several collections */
+    for (unsigned i = 0; i < nfields; i++) {
+        if (fields[i].type == type && fields[i].id == g->id &&
+            strcmp(fields[i].base, name) == 0) dup++;
+    }
+    f = &fields[nfields++];
+    snprintf(f->base, MAX_NAME, "%s", name);
+    if (dup > 1) {
+        snprintf(f->name, MAX_NAME, "%.20s_%u", name, dup & 0xFF);
+    } else {
+        snprintf(f->name, MAX_NAME, "%s", name);
+    }
+    f->type = type;
+    f->id = g->id;
+    f->offset = offset;
+    f->bits = g->size;
+    f->count = count;
+    f->sign = g->lmin < 0;
+    f->rel = rel;
+}
+
+static void parse(const uint8_t *d, unsigned len) {
+    struct globals g = {0}, stack[MAX_STACK];
+    uint32_t usages[MAX_USAGES];
+    unsigned nusages = 0, sp = 0;
+    uint32_t umin = 0, umax = 0;
+    bool range = false;
+    unsigned pos = 0;
+    while (pos < len) {
+        uint8_t prefix = d[pos];
+        unsigned sz = prefix & 0x03;
+        uint32_t u = 0;
+        int32_t s;
+        if (prefix == 0xFE) {
+            /* long item */
+            if (pos + 2 >= len) fail("truncated long item", pos);
+            pos += 3 + d[pos + 1];
+            continue;
+        }
+        if (sz == 3) sz = 4;
+        if (pos + 1 + sz > len) fail("truncated item", pos);
+        for (unsigned i = 0; i < sz; i++) u |= (uint32_t)d[pos + 1 + i] << (8 * i);
+        s = (sz == 1) ? (int8_t)u : (sz == 2) ? (int16_t)u : (int32_t)u;
+        switch (prefix & 0xFC) {
+        /* main items */
+        case 0x80:
+        case 0x90:
+        case 0xB0: {
+            uint8_t type = (prefix & 0xF0) == 0x80 ? RPT_IN : (prefix & 0xF0) == 0x90 ? RPT_OUT : RPT_FEATURE;
+            uint32_t off = rsize[type][g.id];
+            bool rel = (u & 0x04) != 0;
+            rused[type][g.id] = true;
+            if (u & 0x01) {
+                /* constant, padding only */
+                rpad[type][g.id] += g.size * g.count;
+            } else if (u & 0x02) {
+                for (unsigned i = 0; i < g.count; i++) {
+                    uint32_t usage;
+                    if (range) {
+                        usage = umin + i;
+                        if (usage > umax) usage = umax;
+                    } else if (nusages) {
+                        usage = usages[i < nusages ? i : nusages - 1];
+                    } else {
+                        continue;
+                    }
+                    add_field(type, &g, usage, off + i * g.size, 1, rel);
+                }
+            } else {
+                uint32_t usage = range ? umin : nusages ? usages[0] : g.page << 16;
+                add_field(type, &g, usage, off, g.count, rel);
+            }
+            rsize[type][g.id] += g.size * g.count;
+            nusages = 0;
+            range = false;
+            break;
+        }
+        case 0xA0:
+        case 0xC0:
+            nusages = 0;
+            range = false;
+            break;
+        /* global items */
+        case 0x04: g.page = u; break;
+        case 0x14: g.lmin = s; break;
+        case 0x74: g.size = u; break;
+        case 0x84:
+            if (u == 0 || u > 0xFF) fail("invalid report ID", pos);
+            g.id = u;
+            use_ids = true;
+            break;
+        case 0x94: g.count = u; break;
+        case 0xA4:
+            if (sp == MAX_STACK) fail("PUSH stack overflow", pos);
+            stack[sp++] = g;
+            break;
+        case 0xB4:
+            if (sp == 0) fail("POP without PUSH", pos);
+            g = stack[--sp];
+            break;
+        /* local items */
+        case 0x08:
+            if (nusages == MAX_USAGES) fail("too many usages", pos);
+            usages[nusages++] = (sz == 4) ? u : (g.page << 16) | u;
+            break;
+        case 0x18: umin = (sz == 4) ? u : (g.page << 16) | u; range = true; break;
+        case 0x28: umax = (sz == 4) ? u : (g.page << 16) | u; range = true; break;
+        default:
+            break;
+        }
+        pos += 1 + sz;
+    }
+    if (sp) fail("PUSH without POP", pos);
+}
+
+static void lower(char *dst, const char *src) {
+    while (*src) *dst++ = tolower((unsigned char)*src++);
+    *dst = '\0';
+}
+
+static void report_name(char *buf, const char *prefix, uint8_t type, uint8_t id) {
+    if (use_ids) {
+        snprintf(buf, 0x40, "%s_%s%u", prefix, type_name[type], id);
+    } else {
+        snprintf(buf, 0x40, "%s_%s", prefix, type_name[type]);
+    }
+}
+
+/* prints " >> n" or " << n" for non-zero shifts */
+static const char *shift(const char *op, uint32_t n) {
+    static char buf[2][0x10];
+    static unsigned idx;
+    char *b = buf[idx++ & 1];
+    if (n) {
+        snprintf(b, 0x10, " %s %u", op, n);
+    } else {
+        b[0] = '\0';
+    }
+    return b;
+}
+
+/* emits byte by byte accessors, so the compiler gets constant indices and masks only */
+static void emit_accessors(const char *pfx, const struct field *f) {
+    char lname[0x80], lpfx[0x40];
+    bool arr = f->count > 1;
+    lower(lpfx, pfx);
+    snprintf(lname, sizeof(lname), "%s_%s", lpfx, f->name);
+    lower(lname, lname);
+    /* setter */
+    printf("inline static void %s_set(uint8_t *r%s, int32_t v) {\n", lname, arr ? ", uint8_t i" : "");
+    if (arr) {
+        printf("    uint32_t o = %uU + (uint32_t)i * %uU;\n", f->offset, f->bits);
+        printf("    for (uint32_t b = 0; b < %uU; b++, o++) {\n", f->bits);
+        printf("        r[o >> 3] = (r[o >> 3] & ~(1U << (o & 7))) | ((((uint32_t)v >> b) & 1U) << (o & 7));\n");
+        printf("    }\n");
+    } else {
+        for (uint32_t lo = f->offset; lo < f->offset + f->bits; ) {
+            uint32_t byte = lo / 8;
+            uint32_t hi = (byte + 1) * 8;
+            uint32_t mask;
+            if (hi > f->offset + f->bits) hi = f->offset + f->bits;
+            mask = ((1U << (hi - lo)) - 1) << (lo - byte * 8);
+            if (mask == 0xFF) {
+                printf("    r[%u] = (uint8_t)((uint32_t)v%s);\n", byte, shift(">>", lo - f->offset));
+            } else {
+                printf("    r[%u] = (r[%u] & 0x%02X) | (((uint32_t)v%s%s) & 0x%02X);\n",
+                       byte, byte, ~mask & 0xFF, shift(">>", lo - f->offset),
+                       shift("<<", lo - byte * 8), mask);
+            }
+            lo = hi;
+        }
+    }
+    printf("}\n");
+    /* getter */
+    printf("inline static int32_t %s_get(const uint8_t *r%s) {\n", lname, arr ? ", uint8_t i" : "");
+    printf("    uint32_t v = 0;\n");
+    if (arr) {
+        printf("    uint32_t o = %uU + (uint32_t)i * %uU;\n", f->offset, f->bits);
+        printf("    for (uint32_t b = 0; b < %uU; b++, o++) {\n", f->bits);
+        printf("        v |= ((uint32_t)(r[o >> 3] >> (o & 7)) & 1U) << b;\n");
+        printf("    }\n");
+    } else {
+        for (uint32_t lo = f->offset; lo < f->offset + f->bits; ) {
+            uint32_t byte = lo / 8;
+            uint32_t hi = (byte + 1) * 8;
+            uint32_t mask;
+            if (hi > f->offset + f->bits) hi = f->offset + f->bits;
+            mask = ((1U << (hi - lo)) - 1) << (lo - byte * 8);
+            printf("    v |= (uint32_t)(r[%u] & 0x%02X)%s%s;\n",
+                   byte, mask, shift(">>", lo - byte * 8), shift("<<", lo - f->offset));
+            lo = hi;
+        }
+    }
+    if (f->sign && f->bits < 32) {
+        printf("    return (int32_t)(v << %u) >> %u;\n", 32 - f->bits, 32 - f->bits);
+    } else {
+        printf("    return (int32_t)v;\n");
+    }
+    printf("}\n");
+}
+
+int main(int argc, char **argv) {
+    const char *pfx = (argc > 1) ? argv[1] : "HID";
+    parse(HID_DESC, sizeof(HID_DESC));
+    printf("/* Generated by tools/hidlayout.c from %s. Do not edit. */\n\n", argc > 2 ? argv[2] : "report descriptor");
+    printf("#ifndef _%s_LAYOUT_H_\n#define _%s_LAYOUT_H_\n\n#include <stdint.h>\n\n", pfx, pfx);
+    printf("#define %s_DESC_SIZE %u\n", pfx, (unsigned)sizeof(HID_DESC));
+    for (uint8_t type = 0; type < 3; type++) {
+        for (unsigned id = 0; id < 0x100; id++) {
+            char rname[0x40];
+            uint32_t rel8 = 0, rel16 = 0;
+            uint32_t bits = rsize[type][id];
+            if (!rused[type][id]) continue;
+            report_name(rname, pfx, type, id);
+            printf("\n/* %s report %u: %u bits, %u padding bits", type_name[type], id, bits, rpad[type][id]);
+            if (bits % 8) {
+                printf(", NOT BYTE ALIGNED: %u padding bits required", 8 - bits % 8);
+                fprintf(stderr, "hidlayout: %s report %u is not byte aligned\n", type_name[type], id);
+            }
+            printf(" */\n");
+            printf("#define %s_SIZE %u\n", rname, (bits + 7) / 8);
+            for (unsigned i = 0; i < nfields; i++) {
+                const struct field *f = &fields[i];
+                if (f->type != type || f->id != id) continue;
+                if (f->rel && f->count == 1 && f->offset % 8 == 0 && f->offset < 256) {
+                    if (f->bits == 8) rel8 |= 1UL << (f->offset / 8);
+                    if (f->bits == 16) rel16 |= 1UL << (f->offset / 8);
+                }
+                printf("#define %s_%s_OFFSET %u\n", rname, f->name, f->offset);
+                printf("#define %s_%s_BITS %u\n", rname, f->name, f->bits);
+                if (f->count > 1) printf("#define %s_%s_COUNT %u\n", rname, f->name, f->count);
+            }
+            if (use_ids) printf("#define %s_ID %u\n", rname, id);
+            if (type == RPT_IN) {
+                printf("#define %s_REL8 0x%08lX\n", rname, (unsigned long)rel8);
+                printf("#define %s_REL16 0x%08lX\n", rname, (unsigned long)rel16);
+            }
+            for (unsigned i = 0; i < nfields; i++) {
+                if (fields[i].type != type || fields[i].id != id) continue;
+                emit_accessors(rname, &fields[i]);
+            }
+        }
+    }
+    printf("\n#endif //_%s_LAYOUT_H_\n", pfx);
+    return 0;
+}
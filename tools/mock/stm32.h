@@ -0,0 +1,197 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Mock of the CMSIS device header for the host builds of the OTG FS driver. Host tool.
+ * Provides the OTG register layout of the STM32F4 reference manual and the bit definitions used
+ * by src/usbd_stm32f429_otgfs.c. RCC and the unique ID are plain host variables. The OTG cores
+ * are the register blocks passed as the driver context, see tools/otgbus.c.
+ * USB_OTG_HS_PERIPH_BASE is not defined, so every block is driven as the OTG FS core.
+ */
+
+#ifndef _STM32_MOCK_H_
+#define _STM32_MOCK_H_
+
+#include <stdint.h>
+
+#define _BST(reg, bits)         ((reg) |= (bits))
+#define _BCL(reg, bits)         ((reg) &= ~(bits))
+#define _BMD(reg, mask, bits)   ((reg) = ((reg) & ~(mask)) | (bits))
+#define _WBS(reg, bits)         while (((reg) & (bits)) == 0) {}
+#define _WBC(reg, bits)         while (((reg) & (bits)) != 0) {}
+#define _VAL2FLD(field, value)  (((uint32_t)(value) << field##_Pos) & field##_Msk)
+#define _FLD2VAL(field, value)  (((uint32_t)(value) & field##_Msk) >> field##_Pos)
+
+typedef struct {
+    volatile uint32_t AHB1ENR;
+    volatile uint32_t AHB2ENR;
+    volatile uint32_t AHB1RSTR;
+    volatile uint32_t AHB2RSTR;
+} RCC_TypeDef;
+
+extern RCC_TypeDef mock_rcc;
+extern uint32_t mock_uid[3];
+
+#define RCC                             (&mock_rcc)
+#define UID_BASE                        ((uintptr_t)mock_uid)
+
+#define RCC_AHB1ENR_OTGHSEN             (1UL << 29)
+#define RCC_AHB1RSTR_OTGHRST            (1UL << 29)
+#define RCC_AHB2ENR_OTGFSEN             (1UL << 7)
+#define RCC_AHB2RSTR_OTGFSRST           (1UL << 7)
+
+typedef struct {
+    volatile uint32_t GOTGCTL;              /* 0x000 */
+    volatile uint32_t GOTGINT;              /* 0x004 */
+    volatile uint32_t GAHBCFG;              /* 0x008 */
+    volatile uint32_t GUSBCFG;              /* 0x00C */
+    volatile uint32_t GRSTCTL;              /* 0x010 */
+    volatile uint32_t GINTSTS;              /* 0x014 */
+    volatile uint32_t GINTMSK;              /* 0x018 */
+    volatile uint32_t GRXSTSR;              /* 0x01C */
+    volatile uint32_t GRXSTSP;              /* 0x020 */
+    volatile uint32_t GRXFSIZ;              /* 0x024 */
+    volatile uint32_t DIEPTXF0_HNPTXFSIZ;   /* 0x028 */
+    volatile uint32_t HNPTXSTS;             /* 0x02C */
+    uint32_t          Reserved30[2];
+    volatile uint32_t GCCFG;                /* 0x038 */
+    volatile uint32_t CID;                  /* 0x03C */
+    uint32_t          Reserved40[48];
+    volatile uint32_t HPTXFSIZ;             /* 0x100 */
+    volatile uint32_t DIEPTXF[0x0F];        /* 0x104 */
+} USB_OTG_GlobalTypeDef;
+
+typedef struct {
+    volatile uint32_t DCFG;                 /* 0x800 */
+    volatile uint32_t DCTL;                 /* 0x804 */
+    volatile uint32_t DSTS;                 /* 0x808 */
+    uint32_t          Reserved0C;
+    volatile uint32_t DIEPMSK;              /* 0x810 */
+    volatile uint32_t DOEPMSK;              /* 0x814 */
+    volatile uint32_t DAINT;                /* 0x818 */
+    volatile uint32_t DAINTMSK;             /* 0x81C */
+} USB_OTG_DeviceTypeDef;
+
+typedef struct {
+    volatile uint32_t DIEPCTL;              /* 0x900 + 0x20 * ep */
+    uint32_t          Reserved04;
+    volatile uint32_t DIEPINT;
+    uint32_t          Reserved0C;
+    volatile uint32_t DIEPTSIZ;
+    volatile uint32_t DIEPDMA;
+    volatile uint32_t DTXFSTS;
+    uint32_t          Reserved1C;
+} USB_OTG_INEndpointTypeDef;
+
+typedef struct {
+    volatile uint32_t DOEPCTL;              /* 0xB00 + 0x20 * ep */
+    uint32_t          Reserved04;
+    volatile uint32_t DOEPINT;
+    uint32_t          Reserved0C;
+    volatile uint32_t DOEPTSIZ;
+    volatile uint32_t DOEPDMA;
+    uint32_t          Reserved18[2];
+} USB_OTG_OUTEndpointTypeDef;
+
+#define USB_OTG_FS_PERIPH_BASE          0x50000000UL
+#define USB_OTG_GLOBAL_BASE             0x000UL
+#define USB_OTG_DEVICE_BASE             0x800UL
+#define USB_OTG_IN_ENDPOINT_BASE        0x900UL
+#define USB_OTG_OUT_ENDPOINT_BASE       0xB00UL
+#define USB_OTG_PCGCCTL_BASE            0xE00UL
+#define USB_OTG_FIFO_BASE               0x1000UL
+
+#define USB_OTG_GAHBCFG_GINT            (1UL << 0)
+
+#define USB_OTG_GUSBCFG_PHYSEL          (1UL << 6)
+#define USB_OTG_GUSBCFG_SRPCAP          (1UL << 8)
+#define USB_OTG_GUSBCFG_TRDT_Pos        10
+#define USB_OTG_GUSBCFG_TRDT_Msk        (0x0FUL << USB_OTG_GUSBCFG_TRDT_Pos)
+#define USB_OTG_GUSBCFG_TRDT            USB_OTG_GUSBCFG_TRDT_Msk
+#define USB_OTG_GUSBCFG_FDMOD           (1UL << 30)
+
+#define USB_OTG_GRSTCTL_CSRST           (1UL << 0)
+#define USB_OTG_GRSTCTL_RXFFLSH         (1UL << 4)
+#define USB_OTG_GRSTCTL_TXFFLSH         (1UL << 5)
+#define USB_OTG_GRSTCTL_TXFNUM_Pos      6
+#define USB_OTG_GRSTCTL_TXFNUM_Msk      (0x1FUL << USB_OTG_GRSTCTL_TXFNUM_Pos)
+#define USB_OTG_GRSTCTL_TXFNUM          USB_OTG_GRSTCTL_TXFNUM_Msk
+#define USB_OTG_GRSTCTL_AHBIDL          (1UL << 31)
+
+#define USB_OTG_GINTSTS_SOF             (1UL << 3)
+#define USB_OTG_GINTSTS_RXFLVL          (1UL << 4)
+#define USB_OTG_GINTSTS_USBSUSP         (1UL << 11)
+#define USB_OTG_GINTSTS_USBRST          (1UL << 12)
+#define USB_OTG_GINTSTS_ENUMDNE         (1UL << 13)
+#define USB_OTG_GINTSTS_IEPINT          (1UL << 18)
+#define USB_OTG_GINTSTS_WKUINT          (1UL << 31)
+
+#define USB_OTG_GINTMSK_SOFM            (1UL << 3)
+#define USB_OTG_GINTMSK_RXFLVLM         (1UL << 4)
+#define USB_OTG_GINTMSK_USBSUSPM        (1UL << 11)
+#define USB_OTG_GINTMSK_USBRST          (1UL << 12)
+#define USB_OTG_GINTMSK_ENUMDNEM        (1UL << 13)
+#define USB_OTG_GINTMSK_IEPINT          (1UL << 18)
+#define USB_OTG_GINTMSK_WUIM            (1UL << 31)
+
+#define USB_OTG_GRXSTSP_EPNUM           (0x0FUL << 0)
+#define USB_OTG_GRXSTSP_BCNT_Pos        4
+#define USB_OTG_GRXSTSP_BCNT_Msk        (0x7FFUL << USB_OTG_GRXSTSP_BCNT_Pos)
+#define USB_OTG_GRXSTSP_BCNT            USB_OTG_GRXSTSP_BCNT_Msk
+#define USB_OTG_GRXSTSP_PKTSTS_Pos      17
+#define USB_OTG_GRXSTSP_PKTSTS_Msk      (0x0FUL << USB_OTG_GRXSTSP_PKTSTS_Pos)
+#define USB_OTG_GRXSTSP_PKTSTS          USB_OTG_GRXSTSP_PKTSTS_Msk
+
+#define USB_OTG_GCCFG_PWRDWN            (1UL << 16)
+#define USB_OTG_GCCFG_VBUSBSEN          (1UL << 19)
+#define USB_OTG_GCCFG_SOFOUTEN          (1UL << 20)
+#define USB_OTG_GCCFG_NOVBUSSENS        (1UL << 21)
+
+#define USB_OTG_DCFG_DSPD_Pos           0
+#define USB_OTG_DCFG_DSPD_Msk           (0x03UL << USB_OTG_DCFG_DSPD_Pos)
+#define USB_OTG_DCFG_DSPD               USB_OTG_DCFG_DSPD_Msk
+#define USB_OTG_DCFG_DAD                (0x7FUL << 4)
+#define USB_OTG_DCFG_PERSCHIVL_Pos      24
+#define USB_OTG_DCFG_PERSCHIVL_Msk      (0x03UL << USB_OTG_DCFG_PERSCHIVL_Pos)
+#define USB_OTG_DCFG_PERSCHIVL          USB_OTG_DCFG_PERSCHIVL_Msk
+
+#define USB_OTG_DCTL_RWUSIG             (1UL << 0)
+#define USB_OTG_DCTL_SDIS               (1UL << 1)
+
+#define USB_OTG_DSTS_FNSOF_Pos          8
+#define USB_OTG_DSTS_FNSOF_Msk          (0x3FFFUL << USB_OTG_DSTS_FNSOF_Pos)
+#define USB_OTG_DSTS_FNSOF              USB_OTG_DSTS_FNSOF_Msk
+
+#define USB_OTG_DIEPMSK_XFRCM           (1UL << 0)
+
+#define USB_OTG_DIEPCTL_USBAEP          (1UL << 15)
+#define USB_OTG_DIEPCTL_STALL           (1UL << 21)
+#define USB_OTG_DIEPCTL_CNAK            (1UL << 26)
+#define USB_OTG_DIEPCTL_SNAK            (1UL << 27)
+#define USB_OTG_DIEPCTL_SD0PID_SEVNFRM  (1UL << 28)
+#define USB_OTG_DIEPCTL_EPDIS           (1UL << 30)
+#define USB_OTG_DIEPCTL_EPENA           (1UL << 31)
+
+#define USB_OTG_DIEPINT_XFRC            (1UL << 0)
+#define USB_OTG_DIEPTSIZ_PKTCNT         (0x03UL << 19)
+
+#define USB_OTG_DOEPCTL_USBAEP          (1UL << 15)
+#define USB_OTG_DOEPCTL_STALL           (1UL << 21)
+#define USB_OTG_DOEPCTL_CNAK            (1UL << 26)
+#define USB_OTG_DOEPCTL_SNAK            (1UL << 27)
+#define USB_OTG_DOEPCTL_SD0PID_SEVNFRM  (1UL << 28)
+#define USB_OTG_DOEPCTL_EPDIS           (1UL << 30)
+#define USB_OTG_DOEPCTL_EPENA           (1UL << 31)
+
+#endif /* _STM32_MOCK_H_ */
@@ -0,0 +1,267 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* MSC RAM disk throughput benchmark. Host tool.
+ * The host runs Bulk-Only Transport commands against usbd_msc.c on the virtual bus, writes the
+ * RAM disk with WRITE(10), reads it back with READ(10) and checks the data and every CSW.
+ *
+ * Build and run:
+ *   cc -std=gnu99 -O2 -Iinc -DUSBD_VIRTUAL tools/mscbench.c tools/vbus.c src/usbd_core.c \
+ *      src/usbd_msc.c -o mscbench
+ *   ./mscbench [-b <bytes>] [-n <blocks per command>] [-l <backend latency>]
+ *
+ * Each frame has 19 bulk transaction slots of 64 bytes, which is the full-speed limit. The
+ * application loop calls usbd_msc_poll() after every slot. With -l every backend operation stays
+ * busy for the given number of slots. Bus throughput is the payload per simulated frame, CPU time
+ * is the host time spent in the stack, RAM disk and host side of the bus.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "usb.h"
+#include "usb_msc.h"
+#include "usbd_msc.h"
+#include "vbus.h"
+
+#define EP_SIZE         0x40
+#define FRAME_PACKETS   19      /* full-speed bulk transactions of 64 bytes per frame */
+#define BLOCK_SIZE      512
+#define BLOCK_COUNT     2048    /* 1 MB */
+#define MAX_NAKS        100000  /* transfer is stuck */
+
+/* RAM disk */
+
+static uint8_t disk[BLOCK_COUNT * BLOCK_SIZE];
+static unsigned latency, busy;
+
+static uint8_t ram_start(void) {
+    busy = latency;
+    return busy ? USBD_MSC_BUSY : USBD_MSC_OK;
+}
+
+static uint8_t ram_read(uint32_t lba, void *buf) {
+    memcpy(buf, &disk[lba * BLOCK_SIZE], BLOCK_SIZE);
+    return ram_start();
+}
+
+static uint8_t ram_write(uint32_t lba, const void *buf) {
+    memcpy(&disk[lba * BLOCK_SIZE], buf, BLOCK_SIZE);
+    return ram_start();
+}
+
+static uint8_t ram_status(void) {
+    return busy ? USBD_MSC_BUSY : USBD_MSC_OK;
+}
+
+static const usbd_msc_backend backend = {
+    .block_count    = BLOCK_COUNT,
+    .block_size     = BLOCK_SIZE,
+    .read           = ram_read,
+    .write          = ram_write,
+    .status         = ram_status,
+};
+
+/* device */
+
+static usbd_device udev;
+static uint32_t ubuf[0x20];
+static usbd_msc msc;
+static uint8_t msc_buf[2 * BLOCK_SIZE];
+
+static usbd_respond app_control(usbd_device *dev, usbd_ctlreq *req, usbd_rqc_callback *callback) {
+    (void)dev; (void)callback;
+    return usbd_msc_control(&msc, req);
+}
+
+static usbd_respond app_setconf(usbd_device *dev, uint8_t cfg) {
+    (void)dev;
+    if (cfg > 1) return usbd_fail;
+    usbd_msc_enable(&msc, cfg == 1);
+    return usbd_ack;
+}
+
+/* host */
+
+static unsigned slots, naks, stalls, errors;
+
+/* one bus transaction slot. Backend and application loop run between the transactions */
+static void bus_slot(void) {
+    if (++slots % FRAME_PACKETS == 0) vbus_sof(0);
+    if (busy) busy--;
+    usbd_msc_poll(&msc);
+}
+
+static bool host_out(const void *data, uint16_t len) {
+    for (unsigned i = 0; i < MAX_NAKS; i++) {
+        int r = vbus_out(0, 0x01, data, len);
+        bus_slot();
+        if (r == len) return true;
+        if (r == VBUS_STALL) {
+            stalls++;
+            return false;
+        }
+        naks++;
+    }
+    return false;
+}
+
+static int host_in(void *data) {
+    for (unsigned i = 0; i < MAX_NAKS; i++) {
+        int r = vbus_in(0, 0x81, data);
+        bus_slot();
+        if (r >= 0) return r;
+        if (r == VBUS_STALL) {
+            stalls++;
+            return r;
+        }
+        naks++;
+    }
+    return VBUS_NAK;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* runs the command with the data phase. returns CSW status or -1 on transport error */
+static int bot_command(const uint8_t *cb, uint8_t cblen, bool dir_in, void *data, uint32_t len) {
+    static uint32_t tag;
+    struct usb_msc_cbw cbw = {
+        .dCBWSignature          = USB_MSC_CBW_SIGNATURE,
+        .dCBWTag                = ++tag,
+        .dCBWDataTransferLength = len,
+        .bmCBWFlags             = dir_in ? USB_MSC_CBW_DIR_IN : 0,
+        .bCBWCBLength           = cblen,
+    };
+    struct usb_msc_csw csw;
+    uint8_t *p = data;
+    memcpy(cbw.CBWCB, cb, cblen);
+    if (!host_out(&cbw, sizeof(cbw))) return -1;
+    for (uint32_t pos = 0; pos < len;) {
+        if (dir_in) {
+            int r = host_in(p + pos);
+            if (r < 0) return -1;
+            pos += r;
+            if (r < EP_SIZE) break;
+        } else {
+            uint16_t _l = (len - pos > EP_SIZE) ? EP_SIZE : len - pos;
+            if (!host_out(p + pos, _l)) return -1;
+            pos += _l;
+        }
+    }
+    if (host_in(&csw) != sizeof(csw)) return -1;
+    if (csw.dCSWSignature != USB_MSC_CSW_SIGNATURE || csw.dCSWTag != tag) return -1;
+    return csw.bCSWStatus;
+}
+
+static int rw10(bool write, uint32_t lba, uint16_t blocks, void *data) {
+    uint8_t cb[10] = {write ? USB_SCSI_WRITE_10 : USB_SCSI_READ_10};
+    put32(&cb[2], lba);
+    cb[7] = blocks >> 8;
+    cb[8] = blocks;
+    return bot_command(cb, sizeof(cb), !write, data, (uint32_t)blocks * BLOCK_SIZE);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint8_t pattern(unsigned i) {
+    return (uint8_t)(i * 7 + (i >> 9));
+}
+
+/* streams the data through the RAM disk in the commands of nblk blocks */
+static void run(bool write, uint8_t *data, unsigned total, unsigned nblk) {
+    unsigned done = 0, lba = 0;
+    naks = stalls = slots = 0;
+    double start = now_ns();
+    while (done < total) {
+        unsigned _n = (total - done) / BLOCK_SIZE;
+        if (_n > nblk) _n = nblk;
+        if (rw10(write, lba, _n, data + done) != USB_MSC_CSW_PASSED) {
+            fprintf(stderr, "mscbench: %s failed at %u bytes\n", write ? "write" : "read", done);
+            errors++;
+            break;
+        }
+        done += _n * BLOCK_SIZE;
+        lba += _n;
+    }
+    double cpu = now_ns() - start;
+    unsigned frames = (slots + FRAME_PACKETS - 1) / FRAME_PACKETS;
+    printf("%-6s %10u %8u %8u %8u %8u %8u %10.1f %10.1f\n", write ? "write" : "read", done,
+           nblk, latency, frames, naks, stalls, (double)done / frames * 1000 / 1024,
+           (double)done / cpu * 1e3);
+}
+
+int main(int argc, char **argv) {
+    static uint8_t wdata[sizeof(disk)], rdata[sizeof(disk)];
+    unsigned total = sizeof(disk), nblk = 64;
+    uint8_t cap[8];
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            total = strtoul(argv[++i], 0, 0);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            nblk = strtoul(argv[++i], 0, 0);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            latency = strtoul(argv[++i], 0, 0);
+        } else {
+            fprintf(stderr, "usage: mscbench [-b <bytes>] [-n <blocks per command>] [-l <backend latency>]\n");
+            return 1;
+        }
+    }
+    if (total < BLOCK_SIZE || total > sizeof(wdata) || (total % BLOCK_SIZE)) {
+        fprintf(stderr, "mscbench: size must be a multiple of 512 up to %u\n", (unsigned)sizeof(wdata));
+        return 1;
+    }
+    if (nblk == 0 || nblk > BLOCK_COUNT) {
+        fprintf(stderr, "mscbench: command must have from 1 to %u blocks\n", BLOCK_COUNT);
+        return 1;
+    }
+
+    usbd_msc_init(&msc, &udev, 0, 0x01, 0x81, EP_SIZE, &backend, msc_buf);
+    vbus_init(0, &udev, 0x40, ubuf, sizeof(ubuf));
+    usbd_reg_config(&udev, app_setconf);
+    usbd_reg_control(&udev, app_control);
+    if (!vbus_enumerate(0, 1, 1)) {
+        fprintf(stderr, "mscbench: enumeration failed\n");
+        return 1;
+    }
+    const uint8_t rcap[10] = {USB_SCSI_READ_CAPACITY_10};
+    if (bot_command(rcap, sizeof(rcap), true, cap, sizeof(cap)) != USB_MSC_CSW_PASSED ||
+        cap[2] != ((BLOCK_COUNT - 1) >> 8) || cap[3] != (uint8_t)(BLOCK_COUNT - 1) ||
+        cap[6] != (BLOCK_SIZE >> 8)) {
+        fprintf(stderr, "mscbench: READ CAPACITY failed\n");
+        return 1;
+    }
+
+    for (unsigned i = 0; i < total; i++) wdata[i] = pattern(i);
+    printf("%-6s %10s %8s %8s %8s %8s %8s %10s %10s\n",
+           "op", "bytes", "blocks", "latency", "frames", "naks", "stalls", "bus,KB/s", "cpu,MB/s");
+    run(true, wdata, total, nblk);
+    run(false, rdata, total, nblk);
+    if (memcmp(rdata, wdata, total) != 0) errors++;
+    printf("mscbench: %s\n", (errors || stalls) ? "FAILED" : "passed");
+    return (errors || stalls) ? 1 : 0;
+}
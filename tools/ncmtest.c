@@ -0,0 +1,480 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* CDC NCM function test. Host tool.
+ * Sends well-formed and broken OUT NTBs to usbd_cdc_ncm.c on the virtual bus and checks the
+ * datagrams returned to the application, then checks the IN NTBs built from the datagrams
+ * queued by the application.
+ *
+ * Build and run:
+ *   cc -std=gnu99 -Iinc -DUSBD_VIRTUAL tools/ncmtest.c tools/vbus.c src/usbd_core.c \
+ *      src/usbd_cdc_ncm.c -o ncmtest
+ *   ./ncmtest
+ *
+ * With -DUSBD_ALTSETTINGS=2 the core selects the data interface alternate setting and configures
+ * the data endpoints from the configuration descriptor.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "usb.h"
+#include "usb_cdce.h"
+#include "usbd_cdc_ncm.h"
+#include "vbus.h"
+
+#define COMM_IF     0
+#define DATA_IF     1
+#define RX_EP       0x01
+#define TX_EP       0x81
+#define NTF_EP      0x82
+#define EP_SIZE     0x40
+#define NTB_SIZE    0x800
+
+#define NTH_SIZE    sizeof(struct usb_cdc_ncm_nth16)
+#define NDP_SIZE(n) (sizeof(struct usb_cdc_ncm_ndp16) + (n) * sizeof(struct usb_cdc_ncm_dpe16))
+
+static usbd_device udev;
+static uint32_t ubuf[0x20];
+static usbd_cdc_ncm ncm;
+static uint32_t rxbuf[NTB_SIZE / 4];
+static uint32_t txbuf[NTB_SIZE * 2 / 4];
+static unsigned rx_ntbs;
+
+#if defined(USBD_ALTSETTINGS)
+/* the core walks interface and endpoint descriptors only, class descriptors are omitted */
+struct ncm_config {
+    struct usb_config_descriptor    config;
+    struct usb_interface_descriptor comm;
+    struct usb_endpoint_descriptor  ntf;
+    struct usb_interface_descriptor data0;
+    struct usb_interface_descriptor data1;
+    struct usb_endpoint_descriptor  rx;
+    struct usb_endpoint_descriptor  tx;
+} __attribute__((packed));
+
+static const struct ncm_config config_desc = {
+    .config = {
+        .bLength                = sizeof(struct usb_config_descriptor),
+        .bDescriptorType        = USB_DTYPE_CONFIGURATION,
+        .wTotalLength           = sizeof(struct ncm_config),
+        .bNumInterfaces         = 2,
+        .bConfigurationValue    = 1,
+        .iConfiguration         = NO_DESCRIPTOR,
+        .bmAttributes           = USB_CFG_ATTR_RESERVED | USB_CFG_ATTR_SELFPOWERED,
+        .bMaxPower              = USB_CFG_POWER_MA(100),
+    },
+    .comm = {
+        .bLength                = sizeof(struct usb_interface_descriptor),
+        .bDescriptorType        = USB_DTYPE_INTERFACE,
+        .bInterfaceNumber       = COMM_IF,
+        .bAlternateSetting      = 0,
+        .bNumEndpoints          = 1,
+        .bInterfaceClass        = USB_CLASS_CDC,
+        .bInterfaceSubClass     = USB_CDC_SUBCLASS_NCM,
+        .bInterfaceProtocol     = USB_PROTO_NONE,
+        .iInterface             = NO_DESCRIPTOR,
+    },
+    .ntf = {
+        .bLength                = sizeof(struct usb_endpoint_descriptor),
+        .bDescriptorType        = USB_DTYPE_ENDPOINT,
+        .bEndpointAddress       = NTF_EP,
+        .bmAttributes           = USB_EPTYPE_INTERRUPT,
+        .wMaxPacketSize         = 0x10,
+        .bInterval              = 0x20,
+    },
+    .data0 = {
+        .bLength                = sizeof(struct usb_interface_descriptor),
+        .bDescriptorType        = USB_DTYPE_INTERFACE,
+        .bInterfaceNumber       = DATA_IF,
+        .bAlternateSetting      = 0,
+        .bNumEndpoints          = 0,
+        .bInterfaceClass        = USB_CLASS_CDC_DATA,
+        .bInterfaceSubClass     = USB_SUBCLASS_NONE,
+        .bInterfaceProtocol     = USB_CDC_PROTO_NTB,
+        .iInterface             = NO_DESCRIPTOR,
+    },
+    .data1 = {
+        .bLength                = sizeof(struct usb_interface_descriptor),
+        .bDescriptorType        = USB_DTYPE_INTERFACE,
+        .bInterfaceNumber       = DATA_IF,
+        .bAlternateSetting      = 1,
+        .bNumEndpoints          = 2,
+        .bInterfaceClass        = USB_CLASS_CDC_DATA,
+        .bInterfaceSubClass     = USB_SUBCLASS_NONE,
+        .bInterfaceProtocol     = USB_CDC_PROTO_NTB,
+        .iInterface             = NO_DESCRIPTOR,
+    },
+    .rx = {
+        .bLength                = sizeof(struct usb_endpoint_descriptor),
+        .bDescriptorType        = USB_DTYPE_ENDPOINT,
+        .bEndpointAddress       = RX_EP,
+        .bmAttributes           = USB_EPTYPE_BULK,
+        .wMaxPacketSize         = EP_SIZE,
+        .bInterval              = 0,
+    },
+    .tx = {
+        .bLength                = sizeof(struct usb_endpoint_descriptor),
+        .bDescriptorType        = USB_DTYPE_ENDPOINT,
+        .bEndpointAddress       = TX_EP,
+        .bmAttributes           = USB_EPTYPE_BULK,
+        .wMaxPacketSize         = EP_SIZE,
+        .bInterval              = 0,
+    },
+};
+
+static usbd_respond app_getdesc(usbd_ctlreq *req, void **address, uint16_t *length) {
+    if ((req->wValue >> 8) != USB_DTYPE_CONFIGURATION) return usbd_fail;
+    *address = (void*)&config_desc;
+    *length = sizeof(config_desc);
+    return usbd_ack;
+}
+
+static void app_altsetting(usbd_device *dev, uint8_t intf, uint8_t alt) {
+    (void)dev;
+    usbd_cdc_ncm_altsetting(&ncm, intf, alt);
+}
+#endif
+
+static usbd_respond app_control(usbd_device *dev, usbd_ctlreq *req, usbd_rqc_callback *callback) {
+    (void)dev; (void)callback;
+    return usbd_cdc_ncm_control(&ncm, req);
+}
+
+static usbd_respond app_setconf(usbd_device *dev, uint8_t cfg) {
+    (void)dev;
+    if (cfg > 1) return usbd_fail;
+    usbd_cdc_ncm_enable(&ncm, cfg == 1);
+    return usbd_ack;
+}
+
+static void app_rx(usbd_cdc_ncm *n) {
+    (void)n;
+    rx_ntbs++;
+}
+
+/* host side NTB builder */
+
+struct ntb {
+    uint8_t     data[NTB_SIZE * 2];
+    uint16_t    len;
+};
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v & 0xFFFF);
+    put16(p + 2, v >> 16);
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+static void dgram_fill(uint8_t *p, uint16_t len, uint8_t seed) {
+    for (unsigned i = 0; i < len; i++) p[i] = seed + i;
+}
+
+static bool dgram_check(const uint8_t *p, uint16_t len, uint8_t seed) {
+    for (unsigned i = 0; i < len; i++) {
+        if (p[i] != (uint8_t)(seed + i)) return false;
+    }
+    return true;
+}
+
+/* builds NTB with NTH, datagrams of the given lengths and NDP at the end */
+static void ntb_build(struct ntb *b, const uint16_t *len, unsigned count) {
+    uint16_t pos = NTH_SIZE, ndp;
+    uint16_t index[8];
+    memset(b, 0, sizeof(*b));
+    for (unsigned i = 0; i < count; i++) {
+        pos = (pos + 3) & ~3;
+        index[i] = pos;
+        dgram_fill(&b->data[pos], len[i], i * 0x10);
+        pos += len[i];
+    }
+    ndp = (pos + 3) & ~3;
+    put32(&b->data[ndp], USB_CDC_NCM_NDP16_NOCRC_SIGN);
+    put16(&b->data[ndp + 4], NDP_SIZE(count + 1));
+    put16(&b->data[ndp + 6], 0);
+    for (unsigned i = 0; i < count; i++) {
+        put16(&b->data[ndp + 8 + 4 * i], index[i]);
+        put16(&b->data[ndp + 10 + 4 * i], len[i]);
+    }
+    b->len = ndp + NDP_SIZE(count + 1);
+    put32(&b->data[0], USB_CDC_NCM_NTH16_SIGN);
+    put16(&b->data[4], NTH_SIZE);
+    put16(&b->data[6], 0);
+    put16(&b->data[8], b->len);
+    put16(&b->data[10], ndp);
+}
+
+/* sends NTB as the bulk transfer. Returns number of packets accepted */
+static unsigned ntb_send(const uint8_t *data, uint16_t len) {
+    unsigned pos = 0, pkts = 0;
+    do {
+        uint16_t _l = (len - pos > EP_SIZE) ? EP_SIZE : len - pos;
+        if (vbus_out(0, RX_EP, &data[pos], _l) != _l) break;
+        pos += _l;
+        pkts++;
+        if (_l < EP_SIZE) break;
+    } while (1);
+    return pkts;
+}
+
+/* receives IN NTB transfer */
+static uint16_t ntb_recv(uint8_t *data) {
+    uint16_t pos = 0;
+    int _l;
+    while ((_l = vbus_in(0, TX_EP, &data[pos])) >= 0) {
+        pos += _l;
+        if (_l < EP_SIZE) break;
+    }
+    return pos;
+}
+
+static unsigned rx_count(uint16_t *len, unsigned max) {
+    const uint8_t *frame;
+    unsigned n = 0;
+    uint16_t _l;
+    while ((_l = usbd_cdc_ncm_rx_frame(&ncm, &frame)) != 0) {
+        if (n < max) {
+            VBUS_CHECK(dgram_check(frame, _l, n * 0x10));
+            len[n] = _l;
+        }
+        n++;
+        usbd_cdc_ncm_rx_release(&ncm);
+    }
+    return n;
+}
+
+static void setup(void) {
+    uint8_t ntf[0x10];
+    usbd_cdc_ncm_init(&ncm, &udev, COMM_IF, DATA_IF, RX_EP, TX_EP, NTF_EP, EP_SIZE,
+                      rxbuf, sizeof(rxbuf), txbuf, sizeof(txbuf));
+    ncm.rx_callback = app_rx;
+    vbus_init(0, &udev, 0x40, ubuf, sizeof(ubuf));
+    usbd_reg_config(&udev, app_setconf);
+    usbd_reg_control(&udev, app_control);
+#if defined(USBD_ALTSETTINGS)
+    usbd_reg_descr(&udev, app_getdesc);
+    usbd_reg_altsetting(&udev, app_altsetting);
+#endif
+    VBUS_CHECK(vbus_enumerate(0, 1, 1));
+    VBUS_CHECK(vbus_control(0, USB_REQ_INTERFACE, USB_STD_SET_INTERFACE, 1, DATA_IF, 0, 0) == 0);
+    /* link state notifications follow alternate setting 1 */
+    VBUS_CHECK(vbus_in(0, NTF_EP, ntf) == 16 && ntf[1] == USB_CDC_NTF_SPEED_CHANGE);
+    VBUS_CHECK(vbus_in(0, NTF_EP, ntf) == 8 && ntf[1] == USB_CDC_NTF_NETWORK_CONNECTION);
+    rx_ntbs = 0;
+}
+
+static void test_params(void) {
+    uint8_t p[sizeof(struct usb_cdc_ncm_ntb_params)];
+    setup();
+    VBUS_CHECK(vbus_control(0, USB_REQ_DEVTOHOST | USB_REQ_CLASS | USB_REQ_INTERFACE,
+                            USB_CDC_GET_NTB_PARAMETERS, 0, COMM_IF, sizeof(p), p) == sizeof(p));
+    VBUS_CHECK(get16(&p[2]) & USB_CDC_NCM_NTB16_SUPPORTED);
+    VBUS_CHECK(get32(&p[4]) == NTB_SIZE);
+    VBUS_CHECK(get32(&p[16]) == NTB_SIZE);
+    /* too small IN NTB size is refused */
+    put32(p, 16);
+    VBUS_CHECK(vbus_control(0, USB_REQ_CLASS | USB_REQ_INTERFACE,
+                            USB_CDC_SET_NTB_INPUT_SIZE, 0, COMM_IF, 4, p) == VBUS_STALL);
+    VBUS_CHECK(vbus_control(0, USB_REQ_CLASS | USB_REQ_INTERFACE,
+                            USB_CDC_SET_NTB_FORMAT, 1, COMM_IF, 0, 0) == VBUS_STALL);
+}
+
+static void test_rx(void) {
+    static const uint16_t len[] = {60, 1514, 64, 3};
+    uint16_t got[4];
+    struct ntb b;
+    setup();
+    ntb_build(&b, len, 4);
+    VBUS_CHECK(ntb_send(b.data, b.len) == (b.len / EP_SIZE) + 1u);
+    VBUS_CHECK(rx_ntbs == 1);
+    VBUS_CHECK(rx_count(got, 4) == 4);
+    for (int i = 0; i < 4; i++) VBUS_CHECK(got[i] == len[i]);
+    /* released NTB returns nothing */
+    VBUS_CHECK(rx_count(got, 4) == 0);
+}
+
+static void test_rx_hold(void) {
+    /* 132 bytes NTB, not terminated by ZLP */
+    static const uint16_t len[] = {101};
+    uint16_t got[1];
+    struct ntb b;
+    setup();
+    ntb_build(&b, len, 1);
+    ntb_send(b.data, b.len);
+    VBUS_CHECK(rx_ntbs == 1);
+    /* next NTB waits in the endpoint until the first one is released */
+    VBUS_CHECK(vbus_out(0, RX_EP, b.data, EP_SIZE) == EP_SIZE);
+    VBUS_CHECK(vbus_out(0, RX_EP, b.data, EP_SIZE) == VBUS_NAK);
+    VBUS_CHECK(rx_count(got, 1) == 1);
+    VBUS_CHECK(ntb_send(&b.data[EP_SIZE], b.len - EP_SIZE) == (b.len - EP_SIZE) / EP_SIZE + 1u);
+    VBUS_CHECK(rx_ntbs == 2);
+    VBUS_CHECK(rx_count(got, 1) == 1 && got[0] == 101);
+}
+
+static void test_rx_broken(void) {
+    static const uint16_t len[] = {40, 40};
+    uint16_t got[2];
+    struct ntb b;
+    uint16_t ndp;
+
+    /* wrong NTH signature. NTB is dropped */
+    setup();
+    ntb_build(&b, len, 2);
+    b.data[0] ^= 0xFF;
+    ntb_send(b.data, b.len);
+    VBUS_CHECK(rx_ntbs == 0);
+    VBUS_CHECK(rx_count(got, 2) == 0);
+
+    /* NDP index out of the block */
+    setup();
+    ntb_build(&b, len, 2);
+    put16(&b.data[10], b.len);
+    ntb_send(b.data, b.len);
+    VBUS_CHECK(rx_count(got, 2) == 0);
+
+    /* datagram beyond the block is skipped */
+    setup();
+    ntb_build(&b, len, 2);
+    ndp = get16(&b.data[10]);
+    put16(&b.data[ndp + 12], b.len - 8);
+    ntb_send(b.data, b.len);
+    VBUS_CHECK(rx_count(got, 2) == 1 && got[0] == 40);
+
+    /* NDP pointing to itself does not loop */
+    setup();
+    ntb_build(&b, len, 2);
+    ndp = get16(&b.data[10]);
+    put16(&b.data[ndp + 6], ndp);
+    ntb_send(b.data, b.len);
+    VBUS_CHECK(rx_count(got, 2) == 2);
+
+    /* oversized NTB is dropped up to the short packet, the next one is received */
+    setup();
+    ntb_build(&b, len, 2);
+    put16(&b.data[8], NTB_SIZE + EP_SIZE + 10);
+    ntb_send(b.data, NTB_SIZE + EP_SIZE + 10);
+    VBUS_CHECK(rx_ntbs == 0);
+    VBUS_CHECK(rx_count(got, 2) == 0);
+    ntb_build(&b, len, 2);
+    ntb_send(b.data, b.len);
+    VBUS_CHECK(rx_ntbs == 1);
+    VBUS_CHECK(rx_count(got, 2) == 2);
+}
+
+/* parses IN NTB and checks datagrams. Returns datagram count */
+static unsigned tx_parse(const uint8_t *data, uint16_t len, uint16_t seq) {
+    uint16_t ndp = get16(&data[10]);
+    unsigned n;
+    VBUS_CHECK(get32(&data[0]) == USB_CDC_NCM_NTH16_SIGN);
+    VBUS_CHECK(get16(&data[6]) == seq);
+    VBUS_CHECK(get16(&data[8]) == len);
+    VBUS_CHECK(ndp + 8u <= len && get32(&data[ndp]) == USB_CDC_NCM_NDP16_NOCRC_SIGN);
+    for (n = 0; ndp + 12 + 4 * n <= len; n++) {
+        uint16_t _i = get16(&data[ndp + 8 + 4 * n]);
+        uint16_t _l = get16(&data[ndp + 10 + 4 * n]);
+        if (_i == 0 || _l == 0) break;
+        VBUS_CHECK((_i & 3) == 0 && _i + _l <= len);
+        VBUS_CHECK(dgram_check(&data[_i], _l, n * 0x10));
+    }
+    return n;
+}
+
+static void tx_queue(unsigned n, uint16_t len) {
+    uint8_t *p = usbd_cdc_ncm_tx_alloc(&ncm, len);
+    VBUS_CHECK(p != 0);
+    if (p == 0) return;
+    dgram_fill(p, len, n * 0x10);
+    usbd_cdc_ncm_tx_commit(&ncm, len);
+}
+
+static void test_tx(void) {
+    static uint8_t in[NTB_SIZE];
+    uint16_t len;
+    setup();
+    /* first datagram is sent at once, next ones are collected meanwhile */
+    tx_queue(0, 100);
+    tx_queue(0, 1514);
+    tx_queue(1, 60);
+    len = ntb_recv(in);
+    VBUS_CHECK(tx_parse(in, len, 0) == 1);
+    len = ntb_recv(in);
+    VBUS_CHECK(tx_parse(in, len, 1) == 2);
+    VBUS_CHECK(ntb_recv(in) == 0);
+    /* no room for the datagram in the NTB */
+    tx_queue(0, 1000);
+    VBUS_CHECK(usbd_cdc_ncm_tx_alloc(&ncm, NTB_SIZE) == 0);
+    len = ntb_recv(in);
+    VBUS_CHECK(tx_parse(in, len, 2) == 1);
+}
+
+static void test_tx_zlp(void) {
+    static uint8_t in[NTB_SIZE];
+    /* NTH 12 + pad 0 + datagram 36 + NDP 16 = 64 bytes */
+    setup();
+    tx_queue(0, 36);
+    VBUS_CHECK(vbus_in(0, TX_EP, in) == EP_SIZE);
+    VBUS_CHECK(vbus_in(0, TX_EP, in) == 0);
+    VBUS_CHECK(vbus_in(0, TX_EP, in) == VBUS_NAK);
+}
+
+#if defined(USBD_ALTSETTINGS)
+/* core selects the alternate setting, configures the data endpoints and reports to the function */
+static void test_altsetting(void) {
+    static const uint16_t len[] = {60};
+    uint16_t got[1];
+    uint8_t alt = 0xFF, ntf[0x10];
+    struct ntb b;
+    setup();
+    VBUS_CHECK(vbus_control(0, USB_REQ_DEVTOHOST | USB_REQ_INTERFACE, USB_STD_GET_INTERFACE,
+                            0, DATA_IF, 1, &alt) == 1 && alt == 1);
+    VBUS_CHECK(vbus_control(0, USB_REQ_INTERFACE, USB_STD_SET_INTERFACE, 0, DATA_IF, 0, 0) == 0);
+    VBUS_CHECK(ncm.alt == 0);
+    VBUS_CHECK(vbus_out(0, RX_EP, "x", 1) == VBUS_NAK);
+    VBUS_CHECK(vbus_control(0, USB_REQ_INTERFACE, USB_STD_SET_INTERFACE, 2, DATA_IF, 0, 0) == VBUS_STALL);
+    VBUS_CHECK(vbus_control(0, USB_REQ_INTERFACE, USB_STD_SET_INTERFACE, 1, DATA_IF, 0, 0) == 0);
+    VBUS_CHECK(vbus_in(0, NTF_EP, ntf) == 16 && ntf[1] == USB_CDC_NTF_SPEED_CHANGE);
+    VBUS_CHECK(vbus_in(0, NTF_EP, ntf) == 8 && ntf[1] == USB_CDC_NTF_NETWORK_CONNECTION);
+    ntb_build(&b, len, 1);
+    ntb_send(b.data, b.len);
+    VBUS_CHECK(rx_count(got, 1) == 1 && got[0] == 60);
+}
+#endif
+
+int main(void) {
+    test_params();
+    test_rx();
+    test_rx_hold();
+    test_rx_broken();
+    test_tx();
+    test_tx_zlp();
+#if defined(USBD_ALTSETTINGS)
+    test_altsetting();
+#endif
+    printf("ncmtest: %s\n", vbus_failed ? "FAILED" : "passed");
+    return vbus_failed ? 1 : 0;
+}
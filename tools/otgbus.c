@@ -0,0 +1,413 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Virtual USB bus on the OTG FS register model. Host tool. See otgbus.h */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "stm32.h"
+#include "otgbus.h"
+
+#if !defined(__linux__) || !defined(__x86_64__)
+#error otgbus needs x86-64 Linux to trap the register accesses
+#endif
+
+#define OTG_SIZE        0x5000  /* registers and 4 FIFO windows */
+#define OTG_EPS         4
+#define OTG_GRSTCTL     0x010
+#define OTG_GINTSTS     0x014
+#define OTG_GRXSTSR     0x01C
+#define OTG_GRXSTSP     0x020
+#define OTG_DCFG        0x800
+#define OTG_DSTS        0x808
+#define OTG_DAINT       0x818
+#define OTG_DAINTMSK    0x81C
+#define OTG_DIEPCTL     0x900   /* + 0x20 * ep */
+#define OTG_DIEPINT     0x908
+#define OTG_DIEPTSIZ    0x910
+#define OTG_DTXFSTS     0x918
+#define OTG_DOEPCTL     0xB00   /* + 0x20 * ep */
+#define OTG_DOEPINT     0xB08
+#define OTG_EPFIFO      0x1000  /* + 0x1000 * ep */
+#define OTG_DIEPTXF0    0x028
+#define OTG_DIEPTXF     0x100   /* + 4 * ep */
+
+#define RXQ_SIZE        8
+#define RX_WORDS        0x10    /* 64 bytes packet */
+#define TX_WORDS        0x40
+
+#define PKT_OUT         0x02
+#define PKT_OUT_DONE    0x03
+#define PKT_SETUP_DONE  0x04
+#define PKT_SETUP       0x06
+
+#define EFL_TF          0x100   /* single step trap flag */
+#define PF_WRITE        0x02    /* page fault error code */
+
+struct otg_rx {
+    uint32_t    sts;
+    uint32_t    data[RX_WORDS];
+};
+
+struct otg_core {
+    uint8_t         *regs;      /* driver view. No access outside the trapped instruction */
+    uint8_t         *hw;        /* model view of the same pages */
+    struct otg_rx   rxq[RXQ_SIZE];
+    unsigned        rx_head;
+    unsigned        rx_count;
+    struct otg_rx   rx;         /* popped status and its data */
+    unsigned        rx_rd;
+    uint32_t        gintsts;
+    uint32_t        diepint[OTG_EPS];
+    uint32_t        tx[OTG_EPS][TX_WORDS];
+    unsigned        txlen[OTG_EPS];
+    unsigned long   accesses;
+    unsigned long   foreign;
+};
+
+struct vbus vbus[VBUS_COUNT];
+unsigned vbus_failed;
+
+RCC_TypeDef mock_rcc;
+uint32_t mock_uid[3] = {0x00470028, 0x3138510B, 0x32313733};
+
+static struct otg_core otg[VBUS_COUNT];
+static int otg_active = -1;     /* bus of the device being served */
+static struct {
+    int         n;
+    uint32_t    off;
+    bool        write;
+} otg_step;
+
+/* register model */
+
+static uint32_t *otg_reg(int n, uint32_t off) {
+    return (uint32_t*)(otg[n].hw + off);
+}
+
+static uint32_t otg_daint(int n) {
+    uint32_t daint = 0;
+    for (int i = 0; i < OTG_EPS; i++) {
+        if (otg[n].diepint[i] & USB_OTG_DIEPINT_XFRC) daint |= 1 << i;
+    }
+    return daint;
+}
+
+static uint32_t otg_gintsts(int n) {
+    uint32_t gintsts = otg[n].gintsts;
+    if (otg[n].rx_count) gintsts |= USB_OTG_GINTSTS_RXFLVL;
+    if (otg_daint(n) & *otg_reg(n, OTG_DAINTMSK) & 0xFFFF) gintsts |= USB_OTG_GINTSTS_IEPINT;
+    return gintsts;
+}
+
+static uint32_t otg_txfree(int n, int ep) {
+    uint32_t depth = *otg_reg(n, ep ? OTG_DIEPTXF + 4 * ep : OTG_DIEPTXF0) >> 16;
+    return (depth > otg[n].txlen[ep]) ? depth - otg[n].txlen[ep] : 0;
+}
+
+static void otg_epctl(uint32_t *ctl, int ep) {
+    uint32_t v = *ctl;
+    /* endpoint disable completes at once */
+    if (v & USB_OTG_DIEPCTL_EPDIS) v &= ~(USB_OTG_DIEPCTL_EPENA | USB_OTG_DIEPCTL_EPDIS);
+    /* write only bits */
+    v &= ~(USB_OTG_DIEPCTL_CNAK | USB_OTG_DIEPCTL_SNAK | USB_OTG_DIEPCTL_SD0PID_SEVNFRM);
+    /* control endpoint is always active */
+    if (ep == 0) v |= USB_OTG_DIEPCTL_USBAEP;
+    *ctl = v;
+}
+
+/* prepares the value of the register before the driver reads it */
+static void otg_before(int n, uint32_t off, bool write) {
+    struct otg_core *c = &otg[n];
+    uint32_t *r = otg_reg(n, off);
+    unsigned ep = (off & 0xFF) >> 5;
+    if (off >= OTG_EPFIFO) {
+        if (!write) *r = (c->rx_rd < RX_WORDS) ? c->rx.data[c->rx_rd++] : 0;
+        return;
+    }
+    switch (off) {
+    case OTG_GINTSTS:
+        *r = otg_gintsts(n);
+        return;
+    case OTG_GRXSTSR:
+    case OTG_GRXSTSP:
+        *r = c->rx_count ? c->rxq[c->rx_head].sts : 0;
+        if (off == OTG_GRXSTSP && !write && c->rx_count) {
+            c->rx = c->rxq[c->rx_head];
+            c->rx_rd = 0;
+            c->rx_head = (c->rx_head + 1) % RXQ_SIZE;
+            c->rx_count--;
+        }
+        return;
+    case OTG_DAINT:
+        *r = otg_daint(n);
+        return;
+    }
+    if (ep < OTG_EPS && off == OTG_DIEPINT + 0x20 * ep) *r = c->diepint[ep];
+    if (ep < OTG_EPS && off == OTG_DTXFSTS + 0x20 * ep) *r = otg_txfree(n, ep);
+}
+
+/* applies the side effects of the register write */
+static void otg_after(int n, uint32_t off, bool write) {
+    struct otg_core *c = &otg[n];
+    uint32_t *r = otg_reg(n, off);
+    uint32_t v = *r;
+    unsigned ep = (off & 0xFF) >> 5;
+    if (!write) return;
+    if (off >= OTG_EPFIFO) {
+        ep = (off - OTG_EPFIFO) >> 12;
+        if (c->txlen[ep] < TX_WORDS) c->tx[ep][c->txlen[ep]++] = v;
+        return;
+    }
+    switch (off) {
+    case OTG_GINTSTS:
+        c->gintsts &= ~v;
+        return;
+    case OTG_GRSTCTL:
+        if (v & USB_OTG_GRSTCTL_TXFFLSH) {
+            uint32_t f = _FLD2VAL(USB_OTG_GRSTCTL_TXFNUM, v);
+            for (int i = 0; i < OTG_EPS; i++) {
+                if (f == 0x10 || f == (uint32_t)i) c->txlen[i] = 0;
+            }
+        }
+        if (v & USB_OTG_GRSTCTL_RXFFLSH) c->rx_count = 0;
+        /* flushes and the core reset complete at once */
+        *r = (v & ~(USB_OTG_GRSTCTL_TXFFLSH | USB_OTG_GRSTCTL_RXFFLSH | USB_OTG_GRSTCTL_CSRST)) |
+             USB_OTG_GRSTCTL_AHBIDL;
+        return;
+    }
+    if (ep >= OTG_EPS) return;
+    if (off == OTG_DIEPCTL + 0x20 * ep || off == OTG_DOEPCTL + 0x20 * ep) {
+        otg_epctl(r, ep);
+    } else if (off == OTG_DIEPINT + 0x20 * ep) {
+        c->diepint[ep] &= ~v;
+        *r = c->diepint[ep];
+    } else if (off == OTG_DOEPINT + 0x20 * ep) {
+        *r = 0;
+    }
+}
+
+static void otg_segv(int sig, siginfo_t *si, void *context) {
+    ucontext_t *uc = context;
+    uint8_t *addr = si->si_addr;
+    (void)sig;
+    for (int n = 0; n < VBUS_COUNT; n++) {
+        if (otg[n].regs == 0 || addr < otg[n].regs || addr >= otg[n].regs + OTG_SIZE) continue;
+        otg_step.n = n;
+        otg_step.off = (addr - otg[n].regs) & ~0x03;
+        otg_step.write = (uc->uc_mcontext.gregs[REG_ERR] & PF_WRITE) != 0;
+        otg[n].accesses++;
+        if (n != otg_active) otg[n].foreign++;
+        otg_before(n, otg_step.off, otg_step.write);
+        /* lets the access through for one instruction */
+        mprotect(otg[n].regs, OTG_SIZE, PROT_READ | PROT_WRITE);
+        uc->uc_mcontext.gregs[REG_EFL] |= EFL_TF;
+        return;
+    }
+    /* not a register access. faults again with the default action */
+    signal(SIGSEGV, SIG_DFL);
+}
+
+static void otg_trap(int sig, siginfo_t *si, void *context) {
+    ucontext_t *uc = context;
+    (void)sig; (void)si;
+    otg_after(otg_step.n, otg_step.off, otg_step.write);
+    mprotect(otg[otg_step.n].regs, OTG_SIZE, PROT_NONE);
+    uc->uc_mcontext.gregs[REG_EFL] &= ~EFL_TF;
+}
+
+/* host side */
+
+static bool otg_map(struct otg_core *c) {
+    struct sigaction sa = {.sa_flags = SA_SIGINFO};
+    int fd = memfd_create("otgbus", 0);
+    if (fd < 0 || ftruncate(fd, OTG_SIZE) < 0) return false;
+    c->regs = mmap(0, OTG_SIZE, PROT_NONE, MAP_SHARED, fd, 0);
+    c->hw = mmap(0, OTG_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (c->regs == MAP_FAILED || c->hw == MAP_FAILED) return false;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_sigaction = otg_segv;
+    sigaction(SIGSEGV, &sa, 0);
+    sa.sa_sigaction = otg_trap;
+    sigaction(SIGTRAP, &sa, 0);
+    return true;
+}
+
+/* serves the device until the core has no pending events */
+static void otg_poll(int n) {
+    otg_active = n;
+    for (int i = 0; i < 0x40 && otg_gintsts(n); i++) usbd_poll(vbus[n].dev);
+    otg_active = -1;
+    vbus[n].addr = (*otg_reg(n, OTG_DCFG) & USB_OTG_DCFG_DAD) >> 4;
+}
+
+static void otg_rxpush(int n, uint8_t ep, uint8_t pktsts, const void *data, uint16_t len) {
+    struct otg_core *c = &otg[n];
+    struct otg_rx *rx = &c->rxq[(c->rx_head + c->rx_count++) % RXQ_SIZE];
+    const uint8_t *p = data;
+    memset(rx, 0, sizeof(*rx));
+    rx->sts = ep | (len << USB_OTG_GRXSTSP_BCNT_Pos) | ((uint32_t)pktsts << USB_OTG_GRXSTSP_PKTSTS_Pos);
+    for (unsigned i = 0; i < len; i++) rx->data[i >> 2] |= (uint32_t)p[i] << ((i & 0x03) << 3);
+}
+
+static uint16_t otg_mps(int n, uint8_t ep) {
+    uint32_t ctl = *otg_reg(n, OTG_DOEPCTL + 0x20 * ep);
+    return ep ? (ctl & 0x7FF) : (0x40U >> (ctl & 0x03));
+}
+
+unsigned long otgbus_accesses(int n) {
+    return otg[n].accesses;
+}
+
+unsigned long otgbus_foreign(int n) {
+    return otg[n].foreign;
+}
+
+void vbus_init(int n, usbd_device *dev, uint8_t ep0size, uint32_t *buffer, uint16_t bsize) {
+    struct otg_core *c = &otg[n];
+    if (c->regs == 0 && !otg_map(c)) {
+        printf("otgbus: can't map the register block\n");
+        exit(1);
+    }
+    memset(c->hw, 0, OTG_SIZE);
+    memset(&c->rxq, 0, sizeof(*c) - offsetof(struct otg_core, rxq));
+    *otg_reg(n, OTG_GRSTCTL) = USB_OTG_GRSTCTL_AHBIDL;
+    *otg_reg(n, OTG_DIEPCTL) = USB_OTG_DIEPCTL_USBAEP;
+    *otg_reg(n, OTG_DOEPCTL) = USB_OTG_DOEPCTL_USBAEP;
+    memset(&vbus[n], 0, sizeof(vbus[n]));
+    vbus[n].dev = dev;
+    usbd_init_ctx(dev, &usbd_otgfs_ctx, c->regs, ep0size, buffer, bsize);
+    otg_active = n;
+    usbd_enable(dev, true);
+    usbd_connect(dev, true);
+    otg_active = -1;
+}
+
+void vbus_event(int n, uint8_t evt, uint8_t ep) {
+    (void)ep;
+    switch (evt) {
+    case usbd_evt_reset:
+        otg[n].gintsts |= USB_OTG_GINTSTS_USBRST | USB_OTG_GINTSTS_ENUMDNE;
+        break;
+    case usbd_evt_sof:
+        otg[n].gintsts |= USB_OTG_GINTSTS_SOF;
+        break;
+    case usbd_evt_susp:
+        otg[n].gintsts |= USB_OTG_GINTSTS_USBSUSP;
+        break;
+    case usbd_evt_wkup:
+        otg[n].gintsts |= USB_OTG_GINTSTS_WKUINT;
+        break;
+    default:
+        /* endpoint events come from the traffic only */
+        return;
+    }
+    otg_poll(n);
+}
+
+int vbus_out(int n, uint8_t ep, const void *data, uint16_t len) {
+    uint32_t *ctl;
+    ep &= 0x7F;
+    if (ep >= OTG_EPS) return VBUS_NAK;
+    ctl = otg_reg(n, OTG_DOEPCTL + 0x20 * ep);
+    if (*ctl & USB_OTG_DOEPCTL_STALL) return VBUS_STALL;
+    if (!(*ctl & USB_OTG_DOEPCTL_USBAEP) || !(*ctl & USB_OTG_DOEPCTL_EPENA) ||
+        len > otg_mps(n, ep) || otg[n].rx_count > RXQ_SIZE - 2) return VBUS_NAK;
+    /* endpoint is disabled by the transfer complete until the driver enables it again */
+    *ctl &= ~USB_OTG_DOEPCTL_EPENA;
+    otg_rxpush(n, ep, PKT_OUT, data, len);
+    otg_rxpush(n, ep, PKT_OUT_DONE, 0, 0);
+    otg_poll(n);
+    return len;
+}
+
+int vbus_in(int n, uint8_t ep, void *data) {
+    struct otg_core *c = &otg[n];
+    uint32_t *ctl, *tsiz;
+    uint8_t *p = data;
+    uint16_t len;
+    ep &= 0x7F;
+    if (ep >= OTG_EPS) return VBUS_NAK;
+    ctl = otg_reg(n, OTG_DIEPCTL + 0x20 * ep);
+    tsiz = otg_reg(n, OTG_DIEPTSIZ + 0x20 * ep);
+    if (*ctl & USB_OTG_DIEPCTL_STALL) return VBUS_STALL;
+    if (!(*ctl & USB_OTG_DIEPCTL_USBAEP) || !(*ctl & USB_OTG_DIEPCTL_EPENA)) return VBUS_NAK;
+    len = *tsiz & 0x7FFFF;
+    if (len > c->txlen[ep] * 4) return VBUS_NAK;
+    for (unsigned i = 0; p && i < len; i++) p[i] = c->tx[ep][i >> 2] >> ((i & 0x03) << 3);
+    c->txlen[ep] = 0;
+    *tsiz = 0;
+    *ctl &= ~USB_OTG_DIEPCTL_EPENA;
+    c->diepint[ep] |= USB_OTG_DIEPINT_XFRC;
+    otg_poll(n);
+    return len;
+}
+
+void vbus_sof(int n) {
+    uint32_t *dsts = otg_reg(n, OTG_DSTS);
+    vbus[n].frame = (vbus[n].frame + 1) & 0x7FF;
+    *dsts = (*dsts & ~USB_OTG_DSTS_FNSOF) | _VAL2FLD(USB_OTG_DSTS_FNSOF, vbus[n].frame);
+    vbus_event(n, usbd_evt_sof, 0);
+}
+
+int vbus_control(int n, uint8_t type, uint8_t request, uint16_t value, uint16_t index,
+                 uint16_t length, void *data) {
+    uint8_t setup[8] = {type, request, value & 0xFF, value >> 8, index & 0xFF, index >> 8,
+                        length & 0xFF, length >> 8};
+    uint8_t *p = data;
+    uint16_t ep0size = otg_mps(n, 0);
+    int total = 0, r;
+    /* SETUP is always accepted and clears the control endpoint stall */
+    *otg_reg(n, OTG_DIEPCTL) &= ~USB_OTG_DIEPCTL_STALL;
+    *otg_reg(n, OTG_DOEPCTL) &= ~USB_OTG_DOEPCTL_STALL;
+    otg_rxpush(n, 0, PKT_SETUP, setup, sizeof(setup));
+    otg_rxpush(n, 0, PKT_SETUP_DONE, 0, 0);
+    otg_poll(n);
+    if ((type & USB_REQ_DEVTOHOST) && length) {
+        /* DATA IN stage until the short packet or wLength */
+        while (total < length) {
+            r = vbus_in(n, 0x80, p + total);
+            if (r < 0) return VBUS_STALL;
+            total += r;
+            if (r < ep0size) break;
+        }
+        /* STATUS OUT stage */
+        return (vbus_out(n, 0x00, 0, 0) < 0) ? VBUS_STALL : total;
+    }
+    /* DATA OUT stage */
+    while (total < length) {
+        uint16_t len = (length - total > ep0size) ? ep0size : length - total;
+        if (vbus_out(n, 0x00, p + total, len) < 0) return VBUS_STALL;
+        total += len;
+    }
+    /* STATUS IN stage */
+    return (vbus_in(n, 0x80, 0) == 0) ? total : VBUS_STALL;
+}
+
+bool vbus_enumerate(int n, uint8_t addr, uint8_t config) {
+    vbus_event(n, usbd_evt_reset, 0);
+    if (vbus_control(n, 0x00, USB_STD_SET_ADDRESS, addr, 0, 0, 0) < 0) return false;
+    return vbus_control(n, 0x00, USB_STD_SET_CONFIG, config, 0, 0, 0) == 0;
+}
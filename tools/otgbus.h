@@ -0,0 +1,37 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Virtual USB bus on the OTG FS register model. Host tool. x86-64 Linux only.
+ * Implements the vbus.h host side for the real src/usbd_stm32f429_otgfs.c driver built with
+ * USBD_DRIVER_CTX against tools/mock/stm32.h. Each bus owns the RAM register block with the
+ * endpoint FIFO windows that is passed to the driver as the base. Blocks are not accessible to
+ * the driver, so every register access faults and is single-stepped with the register model
+ * around it: FIFO pops and pushes, receive status queue, rc_w1 interrupt flags and the self
+ * clearing flush bits. Accesses are counted per block and per device being served.
+ */
+
+#ifndef _OTGBUS_H_
+#define _OTGBUS_H_
+
+#include "vbus.h"
+
+/* returns the number of the driver accesses to the register block of the bus n */
+unsigned long otgbus_accesses(int n);
+
+/* returns the number of the accesses to the register block of the bus n made while the other
+ * device was served */
+unsigned long otgbus_foreign(int n);
+
+#endif /* _OTGBUS_H_ */
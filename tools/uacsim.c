@@ -0,0 +1,331 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* UAC2 clock drift simulation. Host tool.
+ * Streams 48kHz stereo playback and capture through usbd_uac.c on the virtual bus while the
+ * codec runs at the drifting clock, and checks that the ring buffer fill stays stable.
+ *
+ * Build and run:
+ *   cc -std=gnu99 -Iinc -DUSBD_VIRTUAL tools/uacsim.c tools/vbus.c src/usbd_core.c \
+ *      src/usbd_uac.c -o uacsim
+ *   ./uacsim [-s <seconds>] [<drift ppm> ...]
+ *
+ * The host sends each frame as many OUT samples as the last 10.14 feedback value asks for, and
+ * reads the capture packet. The codec takes and puts the samples in 1ms chunks of its own clock.
+ * Samples carry the running counter, so the codec and the host check that no sample is lost or
+ * repeated after the stream has started. The first 10 seconds are the settling time of the
+ * measured rate filter and are excluded from the fill and drift statistics.
+ *
+ * With -DUSBD_ALTSETTINGS=3 the core selects the streaming alternate settings and configures the
+ * streaming endpoints from the configuration descriptor.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "usb.h"
+#include "usb_uac.h"
+#include "usbd_uac.h"
+#include "vbus.h"
+
+#define RATE            48000
+#define FRAME_SIZE      4       /* stereo, 16 bit */
+#define RING_FRAMES     192     /* 4ms ring buffers */
+#define MAX_FILL_ERR    8       /* allowed fill deviation from the half, sample frames */
+#define MAX_DRIFT_ERR   20      /* allowed error of the reported drift, ppm */
+#define SETTLE_MS       10000   /* about 5 time constants of the measured rate filter */
+
+static const usbd_uac_config uac_cfg = {
+    .rate           = RATE,
+    .channels       = 2,
+    .subslot        = 2,
+    .intf_ac        = 0,
+    .intf_out       = 1,
+    .intf_in        = 2,
+    .clock_id       = 0x10,
+    .fu_id          = 0,
+    .ep_out         = 0x01,
+    .ep_fb          = 0x81,
+    .ep_in          = 0x82,
+    .ep_out_size    = 0xC4,
+    .ep_in_size     = 0xC4,
+    .fb_size        = 3,
+    .refresh        = 4,
+};
+
+static usbd_device udev;
+static uint32_t ubuf[0x20];
+static usbd_uac uac;
+static uint8_t out_ring[RING_FRAMES * FRAME_SIZE];
+static uint8_t in_ring[RING_FRAMES * FRAME_SIZE];
+
+#if defined(USBD_ALTSETTINGS)
+/* the core walks interface and endpoint descriptors only, class descriptors are omitted */
+struct uac_config {
+    struct usb_config_descriptor    config;
+    struct usb_interface_descriptor ac;
+    struct usb_interface_descriptor out0;
+    struct usb_interface_descriptor out1;
+    struct usb_endpoint_descriptor  ep_out;
+    struct usb_endpoint_descriptor  ep_fb;
+    struct usb_interface_descriptor in0;
+    struct usb_interface_descriptor in1;
+    struct usb_endpoint_descriptor  ep_in;
+} __attribute__((packed));
+
+static const struct uac_config config_desc = {
+    .config = {
+        .bLength                = sizeof(struct usb_config_descriptor),
+        .bDescriptorType        = USB_DTYPE_CONFIGURATION,
+        .wTotalLength           = sizeof(struct uac_config),
+        .bNumInterfaces         = 3,
+        .bConfigurationValue    = 1,
+        .iConfiguration         = NO_DESCRIPTOR,
+        .bmAttributes           = USB_CFG_ATTR_RESERVED | USB_CFG_ATTR_SELFPOWERED,
+        .bMaxPower              = USB_CFG_POWER_MA(100),
+    },
+    .ac = {
+        .bLength                = sizeof(struct usb_interface_descriptor),
+        .bDescriptorType        = USB_DTYPE_INTERFACE,
+        .bInterfaceNumber       = 0,
+        .bAlternateSetting      = 0,
+        .bNumEndpoints          = 0,
+        .bInterfaceClass        = USB_CLASS_AUDIO,
+        .bInterfaceSubClass     = USB_UAC_SUBCLASS_AUDIOCONTROL,
+        .bInterfaceProtocol     = USB_UAC_PROTO_IP_VERSION_02_00,
+        .iInterface             = NO_DESCRIPTOR,
+    },
+    .out0 = {
+        .bLength                = sizeof(struct usb_interface_descriptor),
+        .bDescriptorType        = USB_DTYPE_INTERFACE,
+        .bInterfaceNumber       = 1,
+        .bAlternateSetting      = 0,
+        .bNumEndpoints          = 0,
+        .bInterfaceClass        = USB_CLASS_AUDIO,
+        .bInterfaceSubClass     = USB_UAC_SUBCLASS_AUDIOSTREAMING,
+        .bInterfaceProtocol     = USB_UAC_PROTO_IP_VERSION_02_00,
+        .iInterface             = NO_DESCRIPTOR,
+    },
+    .out1 = {
+        .bLength                = sizeof(struct usb_interface_descriptor),
+        .bDescriptorType        = USB_DTYPE_INTERFACE,
+        .bInterfaceNumber       = 1,
+        .bAlternateSetting      = 1,
+        .bNumEndpoints          = 2,
+        .bInterfaceClass        = USB_CLASS_AUDIO,
+        .bInterfaceSubClass     = USB_UAC_SUBCLASS_AUDIOSTREAMING,
+        .bInterfaceProtocol     = USB_UAC_PROTO_IP_VERSION_02_00,
+        .iInterface             = NO_DESCRIPTOR,
+    },
+    .ep_out = {
+        .bLength                = sizeof(struct usb_endpoint_descriptor),
+        .bDescriptorType        = USB_DTYPE_ENDPOINT,
+        .bEndpointAddress       = 0x01,
+        .bmAttributes           = USB_EPTYPE_ISOCHRONUS | USB_EPATTR_ASYNC,
+        .wMaxPacketSize         = 0xC4,
+        .bInterval              = 1,
+    },
+    .ep_fb = {
+        .bLength                = sizeof(struct usb_endpoint_descriptor),
+        .bDescriptorType        = USB_DTYPE_ENDPOINT,
+        .bEndpointAddress       = 0x81,
+        .bmAttributes           = USB_EPTYPE_ISOCHRONUS | USB_EPUSAGE_FEEDBACK,
+        .wMaxPacketSize         = 3,
+        .bInterval              = 1,
+    },
+    .in0 = {
+        .bLength                = sizeof(struct usb_interface_descriptor),
+        .bDescriptorType        = USB_DTYPE_INTERFACE,
+        .bInterfaceNumber       = 2,
+        .bAlternateSetting      = 0,
+        .bNumEndpoints          = 0,
+        .bInterfaceClass        = USB_CLASS_AUDIO,
+        .bInterfaceSubClass     = USB_UAC_SUBCLASS_AUDIOSTREAMING,
+        .bInterfaceProtocol     = USB_UAC_PROTO_IP_VERSION_02_00,
+        .iInterface             = NO_DESCRIPTOR,
+    },
+    .in1 = {
+        .bLength                = sizeof(struct usb_interface_descriptor),
+        .bDescriptorType        = USB_DTYPE_INTERFACE,
+        .bInterfaceNumber       = 2,
+        .bAlternateSetting      = 1,
+        .bNumEndpoints          = 1,
+        .bInterfaceClass        = USB_CLASS_AUDIO,
+        .bInterfaceSubClass     = USB_UAC_SUBCLASS_AUDIOSTREAMING,
+        .bInterfaceProtocol     = USB_UAC_PROTO_IP_VERSION_02_00,
+        .iInterface             = NO_DESCRIPTOR,
+    },
+    .ep_in = {
+        .bLength                = sizeof(struct usb_endpoint_descriptor),
+        .bDescriptorType        = USB_DTYPE_ENDPOINT,
+        .bEndpointAddress       = 0x82,
+        .bmAttributes           = USB_EPTYPE_ISOCHRONUS | USB_EPATTR_ASYNC,
+        .wMaxPacketSize         = 0xC4,
+        .bInterval              = 1,
+    },
+};
+
+static usbd_respond app_getdesc(usbd_ctlreq *req, void **address, uint16_t *length) {
+    if ((req->wValue >> 8) != USB_DTYPE_CONFIGURATION) return usbd_fail;
+    *address = (void*)&config_desc;
+    *length = sizeof(config_desc);
+    return usbd_ack;
+}
+
+static void app_altsetting(usbd_device *dev, uint8_t intf, uint8_t alt) {
+    (void)dev;
+    usbd_uac_altsetting(&uac, intf, alt);
+}
+#endif
+
+static usbd_respond app_control(usbd_device *dev, usbd_ctlreq *req, usbd_rqc_callback *callback) {
+    (void)dev; (void)callback;
+    return usbd_uac_control(&uac, req);
+}
+
+static usbd_respond app_setconf(usbd_device *dev, uint8_t cfg) {
+    (void)dev;
+    if (cfg > 1) return usbd_fail;
+    usbd_uac_enable(&uac, cfg == 1);
+    return usbd_ack;
+}
+
+static void app_sof(usbd_device *dev, uint8_t event, uint8_t ep) {
+    (void)dev; (void)event; (void)ep;
+    usbd_uac_sof(&uac);
+}
+
+/* sample frames carry the running counter */
+
+struct stream {
+    uint32_t    next;       /* next expected counter */
+    bool        started;
+    unsigned    errors;
+};
+
+static void stream_check(struct stream *s, const uint8_t *buf, unsigned frames) {
+    for (unsigned i = 0; i < frames; i++) {
+        uint32_t v;
+        memcpy(&v, buf + i * FRAME_SIZE, FRAME_SIZE);
+        if (s->started && v != s->next) s->errors++;
+        s->started = true;
+        s->next = v + 1;
+    }
+}
+
+static void stream_fill(uint32_t *counter, uint8_t *buf, unsigned frames) {
+    for (unsigned i = 0; i < frames; i++, (*counter)++) {
+        memcpy(buf + i * FRAME_SIZE, counter, FRAME_SIZE);
+    }
+}
+
+static int simulate(int ppm, unsigned seconds) {
+    uint8_t pkt[VBUS_EPSIZE], chunk[USBD_UAC_MAX_PKT];
+    struct stream play = {0}, capture = {0};
+    uint32_t fb = 0, host_acc = 0, host_cnt = 1, codec_cnt = 1;
+    double codec_acc = 0, codec_rate = RATE * (1.0 + ppm * 1e-6) / 1000;
+    int out_min = RING_FRAMES, out_max = 0, in_min = RING_FRAMES, in_max = 0;
+    int drift_min = 1000000, drift_max = -1000000;
+    unsigned frames = seconds * 1000;
+
+    usbd_uac_init(&uac, &udev, &uac_cfg, out_ring, sizeof(out_ring), in_ring, sizeof(in_ring));
+    vbus_init(0, &udev, 0x40, ubuf, sizeof(ubuf));
+    usbd_reg_config(&udev, app_setconf);
+    usbd_reg_control(&udev, app_control);
+    usbd_reg_event(&udev, usbd_evt_sof, app_sof);
+#if defined(USBD_ALTSETTINGS)
+    usbd_reg_descr(&udev, app_getdesc);
+    usbd_reg_altsetting(&udev, app_altsetting);
+#endif
+    VBUS_CHECK(vbus_enumerate(0, 1, 1));
+    VBUS_CHECK(vbus_control(0, USB_REQ_INTERFACE, USB_STD_SET_INTERFACE, 1, uac_cfg.intf_out, 0, 0) == 0);
+    VBUS_CHECK(vbus_control(0, USB_REQ_INTERFACE, USB_STD_SET_INTERFACE, 1, uac_cfg.intf_in, 0, 0) == 0);
+
+    for (unsigned f = 0; f < frames; f++) {
+        unsigned n;
+        int _l;
+        vbus_sof(0);
+        /* 10.14 feedback in 3 bytes */
+        if (vbus_in(0, uac_cfg.ep_fb, pkt) == 3) {
+            fb = (pkt[0] | (pkt[1] << 8) | ((uint32_t)pkt[2] << 16)) << 2;
+        }
+        _l = vbus_in(0, uac_cfg.ep_in, pkt);
+        if (_l > 0) stream_check(&capture, pkt, _l / FRAME_SIZE);
+        /* host sends as many samples as the device asks for */
+        host_acc += fb ? fb : uac.nominal;
+        n = host_acc >> 16;
+        host_acc &= 0xFFFF;
+        stream_fill(&host_cnt, pkt, n);
+        VBUS_CHECK(vbus_out(0, uac_cfg.ep_out, pkt, n * FRAME_SIZE) == (int)(n * FRAME_SIZE));
+        /* codec runs 1ms of its own clock */
+        codec_acc += codec_rate;
+        n = (unsigned)codec_acc;
+        codec_acc -= n;
+        if (usbd_uac_read(&uac, chunk, n) == n) stream_check(&play, chunk, n);
+        stream_fill(&codec_cnt, chunk, n);
+        usbd_uac_write(&uac, chunk, n);
+        if (f >= SETTLE_MS) {
+            int out = ((uac.out.head - uac.out.tail + sizeof(out_ring)) % sizeof(out_ring)) / FRAME_SIZE;
+            int in = ((uac.in.head - uac.in.tail + sizeof(in_ring)) % sizeof(in_ring)) / FRAME_SIZE;
+            int drift = usbd_uac_drift(&uac);
+            if (out < out_min) out_min = out;
+            if (out > out_max) out_max = out;
+            if (in < in_min) in_min = in;
+            if (in > in_max) in_max = in;
+            if (drift < drift_min) drift_min = drift;
+            if (drift > drift_max) drift_max = drift;
+        }
+    }
+    printf("%+6d %6d..%-6d %5d..%-5d %5d..%-5d %5u %5u %5u %5u %6u\n", ppm, drift_min, drift_max,
+           out_min, out_max, in_min, in_max, uac.out.underruns, uac.out.overruns,
+           uac.in.underruns, uac.in.overruns, play.errors + capture.errors);
+
+    int failed = vbus_failed;
+    /* playback fill is regulated by the feedback, capture fill by the packet size */
+    VBUS_CHECK(out_min >= RING_FRAMES / 2 - MAX_FILL_ERR && out_max <= RING_FRAMES / 2 + MAX_FILL_ERR);
+    VBUS_CHECK(in_min > 0 && in_max < RING_FRAMES - 1);
+    VBUS_CHECK(drift_min >= ppm - MAX_DRIFT_ERR && drift_max <= ppm + MAX_DRIFT_ERR);
+    VBUS_CHECK(play.started && capture.started && play.errors == 0 && capture.errors == 0);
+    VBUS_CHECK(uac.out.overruns == 0 && uac.in.overruns == 0);
+    /* underruns are allowed only before the stream has started */
+    VBUS_CHECK(uac.out.underruns <= RATE / 1000 && uac.in.underruns <= RATE / 1000);
+    return vbus_failed - failed;
+}
+
+int main(int argc, char **argv) {
+    static const int drifts[] = {0, 200, -500, 1000, 30, -1000};
+    unsigned seconds = 20, count = 0;
+    int list[16];
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seconds = strtoul(argv[++i], 0, 0);
+        } else if (count < sizeof(list) / sizeof(list[0])) {
+            list[count++] = strtol(argv[i], 0, 0);
+        }
+    }
+    if (seconds <= SETTLE_MS / 1000) seconds = SETTLE_MS / 1000 + 1;
+    if (count == 0) {
+        count = sizeof(drifts) / sizeof(drifts[0]);
+        memcpy(list, drifts, sizeof(drifts));
+    }
+    printf("%6s %14s %12s %12s %5s %5s %5s %5s %6s\n", "ppm", "reported", "out fill",
+           "in fill", "o.und", "o.ovr", "i.und", "i.ovr", "errors");
+    for (unsigned i = 0; i < count; i++) simulate(list[i], seconds);
+    printf("uacsim: %s\n", vbus_failed ? "FAILED" : "passed");
+    return vbus_failed ? 1 : 0;
+}
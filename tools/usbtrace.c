@@ -0,0 +1,244 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* USB core event trace decoder. Host tool.
+ * Finds the usbd_trace buffer in a RAM dump by the signature and prints the recorded events
+ * as a timeline followed by the per-endpoint transfer latencies.
+ *
+ * Build the firmware with USBD_TRACE=<records> and dump the RAM, e.g. with gdb:
+ *   dump binary memory trace.bin &usbd_trace (char*)&usbd_trace + sizeof(usbd_trace)
+ * Then decode it:
+ *   cc -std=gnu99 tools/usbtrace.c -o usbtrace
+ *   ./usbtrace trace.bin
+ *
+ * Latencies are measured as follows:
+ *   control  SETUP packet to the STATUS stage completion
+ *   IN       data written to the endpoint to the TX completion (host pick-up time)
+ *   OUT      RX event to the data read from the endpoint (device service time)
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAGIC     0x43525455
+#define TRACE_HDR       0x14
+#define NO_COUNT        0xFFFF
+
+#define EVT_EPTX        0x04
+#define EVT_EPRX        0x05
+#define EVT_EPSETUP     0x06
+#define TRC_READ        0x0C
+#define TRC_WRITE       0x0D
+#define TRC_STALL       0x0E
+
+#define CTL_STATUSIN    0x05
+#define CTL_STATUSOUT   0x06
+
+struct stat {
+    unsigned    xfers;
+    unsigned    busy;
+    uint64_t    bytes;
+    double      min;
+    double      max;
+    double      sum;
+};
+
+struct pend {
+    bool        active;
+    double      time;
+};
+
+static const char *const evt_name[0x10] = {
+    "reset", "sof", "susp", "wkup", "eptx", "eprx", "setup", "error",
+    "l1sleep", "?", "?", "?", "read", "write", "stall", "?",
+};
+
+static const char *const ctl_name[0x10] = {
+    "idle", "rxdata", "txdata", "ztxdata", "lastdata", "statusin", "statusout",
+    "?", "?", "?", "?", "?", "?", "?", "?", "?",
+};
+
+static struct stat ctl_stat;
+static struct stat ep_stat[2][8];   /* OUT, IN */
+static struct pend ep_pend[2][8];
+static struct pend ctl_pend;
+static unsigned ctl_stalls;
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static void fail(const char *msg) {
+    fprintf(stderr, "usbtrace: %s\n", msg);
+    exit(1);
+}
+
+static void stat_add(struct stat *s, double lat, unsigned bytes) {
+    if (s->xfers == 0 || lat < s->min) s->min = lat;
+    if (s->xfers == 0 || lat > s->max) s->max = lat;
+    s->sum += lat;
+    s->bytes += bytes;
+    s->xfers++;
+}
+
+static void stat_print(const char *name, const struct stat *s) {
+    if (s->xfers == 0) {
+        printf("%-10s %8u %10llu %6u %10s %10s %10s\n", name, 0, (unsigned long long)s->bytes,
+               s->busy, "-", "-", "-");
+        return;
+    }
+    printf("%-10s %8u %10llu %6u %10.1f %10.1f %10.1f\n", name, s->xfers,
+           (unsigned long long)s->bytes, s->busy, s->min, s->sum / s->xfers, s->max);
+}
+
+/* returns the latency of the completed transfer or negative value */
+static double track(uint8_t evt, uint8_t ctl, uint8_t ep, uint16_t count, double now) {
+    uint8_t num = ep & 0x07;
+    double lat = -1;
+    if (num == 0) {
+        /* control transfers */
+        if (evt == EVT_EPSETUP) {
+            ctl_pend.active = true;
+            ctl_pend.time = now;
+        } else if (evt == TRC_STALL) {
+            ctl_pend.active = false;
+            ctl_stalls++;
+        } else if (ctl_pend.active && ((evt == EVT_EPTX && ctl == CTL_STATUSIN) ||
+                                       (evt == EVT_EPRX && ctl == CTL_STATUSOUT))) {
+            ctl_pend.active = false;
+            lat = now - ctl_pend.time;
+            stat_add(&ctl_stat, lat, 0);
+        }
+        return lat;
+    }
+    switch (evt) {
+    case TRC_WRITE:
+        if (count == NO_COUNT) {
+            ep_stat[1][num].busy++;
+        } else {
+            ep_stat[1][num].bytes += count;
+            ep_pend[1][num].active = true;
+            ep_pend[1][num].time = now;
+        }
+        break;
+    case EVT_EPTX:
+        if (ep_pend[1][num].active) {
+            ep_pend[1][num].active = false;
+            lat = now - ep_pend[1][num].time;
+            stat_add(&ep_stat[1][num], lat, 0);
+        }
+        break;
+    case EVT_EPRX:
+        ep_pend[0][num].active = true;
+        ep_pend[0][num].time = now;
+        break;
+    case TRC_READ:
+        if (count == NO_COUNT) {
+            ep_stat[0][num].busy++;
+        } else if (ep_pend[0][num].active) {
+            ep_pend[0][num].active = false;
+            lat = now - ep_pend[0][num].time;
+            stat_add(&ep_stat[0][num], lat, count);
+        }
+        break;
+    default:
+        break;
+    }
+    return lat;
+}
+
+int main(int argc, char **argv) {
+    FILE *f;
+    uint8_t *dump;
+    long len, pos;
+    uint32_t size, rec_size, clock, mask, head, first, n;
+    uint32_t prev = 0;
+    double us = 0, tick;
+    char name[8];
+
+    if (argc < 2) fail("usage: usbtrace <ram dump>");
+    f = fopen(argv[1], "rb");
+    if (f == NULL) fail("can't open dump file");
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    dump = malloc(len);
+    if (dump == NULL || fread(dump, 1, len, f) != (size_t)len) fail("can't read dump file");
+    fclose(f);
+
+    for (pos = 0; pos + TRACE_HDR <= len; pos += 4) {
+        if (get32(dump + pos) == TRACE_MAGIC) break;
+    }
+    if (pos + TRACE_HDR > len) fail("trace signature not found");
+    size = get16(dump + pos + 0x04);
+    rec_size = get16(dump + pos + 0x06);
+    clock = get32(dump + pos + 0x08);
+    mask = get32(dump + pos + 0x0C);
+    head = get32(dump + pos + 0x10);
+    if (size == 0 || (size & (size - 1)) || rec_size < 8 || clock == 0) fail("broken trace header");
+    if (pos + TRACE_HDR + (long)(size * rec_size) > len) fail("trace is truncated");
+
+    n = (head < size) ? head : size;
+    first = head - n;
+    tick = 1e6 / clock;
+    printf("trace at 0x%lx: %u of %u records, %u ticks/s\n\n", pos, n, head, clock);
+    printf("%8s %12s %10s  %-8s %-4s %-10s %6s %10s\n",
+           "#", "time,us", "delta,us", "event", "ep", "ctl", "bytes", "latency");
+
+    for (uint32_t i = first; i < head; i++) {
+        const uint8_t *r = dump + pos + TRACE_HDR + (i & (size - 1)) * rec_size;
+        uint32_t time = get32(r);
+        uint8_t evt = r[4] & 0x0F;
+        uint8_t ctl = r[4] >> 4;
+        uint8_t ep = r[5];
+        uint16_t count = get16(r + 6);
+        double delta = (i == first) ? 0 : ((time - prev) & mask) * tick;
+        double lat;
+        prev = time;
+        us += delta;
+        lat = track(evt, ctl, ep, count, us);
+        snprintf(name, sizeof(name), "0x%02X", ep);
+        printf("%8u %12.1f %10.1f  %-8s %-4s %-10s ", i, us, delta, evt_name[evt], name, ctl_name[ctl]);
+        if (evt == TRC_READ || evt == TRC_WRITE) {
+            if (count == NO_COUNT) printf("%6s", "busy"); else printf("%6u", count);
+        } else {
+            printf("%6s", "");
+        }
+        if (lat >= 0) printf(" %10.1f", lat);
+        printf("\n");
+    }
+
+    printf("\n%-10s %8s %10s %6s %10s %10s %10s\n",
+           "transfer", "count", "bytes", "busy", "min,us", "avg,us", "max,us");
+    stat_print("control", &ctl_stat);
+    for (int i = 1; i < 8; i++) {
+        for (int d = 1; d >= 0; d--) {
+            const struct stat *s = &ep_stat[d][i];
+            if (s->xfers == 0 && s->busy == 0 && s->bytes == 0) continue;
+            snprintf(name, sizeof(name), "0x%02X", i | (d << 7));
+            stat_print(name, s);
+        }
+    }
+    if (ctl_stalls) printf("\ncontrol transfers stalled: %u\n", ctl_stalls);
+    free(dump);
+    return 0;
+}
@@ -0,0 +1,270 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Virtual USB bus for the host tests. Host tool. See vbus.h */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "vbus.h"
+
+struct vbus vbus[VBUS_COUNT];
+unsigned vbus_failed;
+
+/* driver side. Every hook gets the bus as the base */
+
+static struct vbus_ep *vb_ep(struct vbus *b, uint8_t ep) {
+    return (ep & 0x80) ? &b->in[ep & 0x07] : &b->out[ep & 0x07];
+}
+
+static uint32_t vb_getinfo(void *base) {
+    (void)base;
+    return USBD_HW_ENABLED | USBD_HW_SPEED_FS;
+}
+
+static void vb_enable(void *base, bool enable) {
+    struct vbus *b = base;
+    if (!enable) {
+        memset(b->in, 0, sizeof(b->in));
+        memset(b->out, 0, sizeof(b->out));
+    }
+}
+
+static uint8_t vb_connect(void *base, bool connect) {
+    (void)base;
+    return connect ? usbd_lane_sdp : usbd_lane_dsc;
+}
+
+static void vb_setaddr(void *base, uint8_t addr) {
+    ((struct vbus*)base)->addr = addr;
+}
+
+static bool vb_ep_config(void *base, uint8_t ep, uint8_t eptype, uint16_t epsize) {
+    struct vbus *b = base;
+    if ((ep & 0x7F) >= VBUS_EPCOUNT || epsize > VBUS_EPSIZE) return false;
+    if (eptype == USB_EPTYPE_CONTROL) {
+        b->out[0] = (struct vbus_ep){.size = epsize, .type = eptype, .enabled = true};
+        b->in[0] = b->out[0];
+    } else {
+        *vb_ep(b, ep) = (struct vbus_ep){.size = epsize, .type = eptype & 0x03, .enabled = true};
+    }
+    return true;
+}
+
+static void vb_ep_deconfig(void *base, uint8_t ep) {
+    *vb_ep(base, ep) = (struct vbus_ep){0};
+}
+
+static int32_t vb_ep_read(void *base, uint8_t ep, void *buf, uint16_t blen) {
+    struct vbus *b = base;
+    struct vbus_ep *e = &b->out[ep & 0x07];
+    if ((ep & 0x07) == 0 && b->setup_ready) {
+        b->setup_ready = false;
+        if (blen > 8) blen = 8;
+        memcpy(buf, b->setup, blen);
+        return blen;
+    }
+    if (!e->ready) return -1;
+    e->ready = false;
+    if (blen > e->len) blen = e->len;
+    if (blen) memcpy(buf, e->data, blen);
+    return blen;
+}
+
+static int32_t vb_ep_write(void *base, uint8_t ep, void *buf, uint16_t blen) {
+    struct vbus_ep *e = &((struct vbus*)base)->in[ep & 0x07];
+    if (!e->enabled || e->ready) return -1;
+    if (blen > e->size) blen = e->size;
+    if (blen) memcpy(e->data, buf, blen);
+    e->len = blen;
+    e->ready = true;
+    return blen;
+}
+
+static void vb_ep_setstall(void *base, uint8_t ep, bool stall) {
+    struct vbus_ep *e = vb_ep(base, ep);
+    if (e->enabled) e->stall = stall;
+}
+
+static bool vb_ep_isstalled(void *base, uint8_t ep) {
+    return vb_ep(base, ep)->stall;
+}
+
+static void vb_poll(void *base, usbd_device *dev, usbd_evt_callback callback) {
+    struct vbus *b = base;
+    if (!b->pending) return;
+    b->pending = false;
+    callback(dev, b->evt, b->ep);
+}
+
+static uint16_t vb_frame_no(void *base) {
+    return ((struct vbus*)base)->frame & 0x7FF;
+}
+
+static uint16_t vb_get_serialno_desc(void *base, void *buffer) {
+    static const struct usb_string_descriptor serial = USB_STRING_DESC("0123456789AB");
+    (void)base;
+    memcpy(buffer, &serial, serial.bLength);
+    return serial.bLength;
+}
+
+static void vb_resume(void *base, bool resume) {
+    struct vbus *b = base;
+    if (resume && !b->resume) b->resumes++;
+    b->resume = resume;
+}
+
+#if defined(USBD_DRIVER_CTX)
+static const struct usbd_driver_ctx vbus_drv = {
+    vb_getinfo,
+    vb_enable,
+    vb_connect,
+    vb_setaddr,
+    vb_ep_config,
+    vb_ep_deconfig,
+    vb_ep_read,
+    vb_ep_write,
+    vb_ep_setstall,
+    vb_ep_isstalled,
+    vb_poll,
+    vb_frame_no,
+    vb_get_serialno_desc,
+    vb_resume,
+};
+#else
+/* static driver tables, one per bus */
+#define VBUS_DRIVER(n)                                                                          \
+static uint32_t getinfo##n(void) { return vb_getinfo(&vbus[n]); }                               \
+static void enable##n(bool e) { vb_enable(&vbus[n], e); }                                       \
+static uint8_t connect##n(bool c) { return vb_connect(&vbus[n], c); }                           \
+static void setaddr##n(uint8_t a) { vb_setaddr(&vbus[n], a); }                                  \
+static bool ep_config##n(uint8_t ep, uint8_t t, uint16_t s) { return vb_ep_config(&vbus[n], ep, t, s); } \
+static void ep_deconfig##n(uint8_t ep) { vb_ep_deconfig(&vbus[n], ep); }                        \
+static int32_t ep_read##n(uint8_t ep, void *buf, uint16_t l) { return vb_ep_read(&vbus[n], ep, buf, l); } \
+static int32_t ep_write##n(uint8_t ep, void *buf, uint16_t l) { return vb_ep_write(&vbus[n], ep, buf, l); } \
+static void ep_setstall##n(uint8_t ep, bool s) { vb_ep_setstall(&vbus[n], ep, s); }             \
+static bool ep_isstalled##n(uint8_t ep) { return vb_ep_isstalled(&vbus[n], ep); }               \
+static void poll##n(usbd_device *dev, usbd_evt_callback cb) { vb_poll(&vbus[n], dev, cb); }     \
+static uint16_t frame_no##n(void) { return vb_frame_no(&vbus[n]); }                             \
+static uint16_t serialno##n(void *buf) { return vb_get_serialno_desc(&vbus[n], buf); }          \
+static void resume##n(bool r) { vb_resume(&vbus[n], r); }
+
+VBUS_DRIVER(0)
+VBUS_DRIVER(1)
+
+#define VBUS_TABLE(n) {                                                 \
+    getinfo##n, enable##n, connect##n, setaddr##n, ep_config##n,        \
+    ep_deconfig##n, ep_read##n, ep_write##n, ep_setstall##n,            \
+    ep_isstalled##n, poll##n, frame_no##n, serialno##n, resume##n,      \
+}
+
+static const struct usbd_driver vbus_drv[VBUS_COUNT] = {
+    VBUS_TABLE(0),
+    VBUS_TABLE(1),
+};
+#endif
+
+/* host side */
+
+void vbus_init(int n, usbd_device *dev, uint8_t ep0size, uint32_t *buffer, uint16_t bsize) {
+    memset(&vbus[n], 0, sizeof(vbus[n]));
+    vbus[n].dev = dev;
+#if defined(USBD_DRIVER_CTX)
+    usbd_init_ctx(dev, &vbus_drv, &vbus[n], ep0size, buffer, bsize);
+#else
+    usbd_init(dev, &vbus_drv[n], ep0size, buffer, bsize);
+#endif
+}
+
+void vbus_event(int n, uint8_t evt, uint8_t ep) {
+    vbus[n].evt = evt;
+    vbus[n].ep = ep;
+    vbus[n].pending = true;
+    usbd_poll(vbus[n].dev);
+}
+
+int vbus_out(int n, uint8_t ep, const void *data, uint16_t len) {
+    struct vbus_ep *e = &vbus[n].out[ep & 0x07];
+    if (e->stall) return VBUS_STALL;
+    if (!e->enabled || e->ready || len > e->size) return VBUS_NAK;
+    if (len) memcpy(e->data, data, len);
+    e->len = len;
+    e->ready = true;
+    vbus_event(n, usbd_evt_eprx, ep & 0x07);
+    return len;
+}
+
+int vbus_in(int n, uint8_t ep, void *data) {
+    struct vbus_ep *e = &vbus[n].in[ep & 0x07];
+    if (e->stall) return VBUS_STALL;
+    uint16_t len = e->len;
+    if (!e->ready) return VBUS_NAK;
+    e->ready = false;
+    if (data && len) memcpy(data, e->data, len);
+    /* device may write the next packet on this event */
+    vbus_event(n, usbd_evt_eptx, ep | 0x80);
+    return len;
+}
+
+void vbus_sof(int n) {
+    vbus[n].frame = (vbus[n].frame + 1) & 0x7FF;
+    vbus_event(n, usbd_evt_sof, 0);
+}
+
+int vbus_control(int n, uint8_t type, uint8_t request, uint16_t value, uint16_t index,
+                 uint16_t length, void *data) {
+    struct vbus *b = &vbus[n];
+    uint8_t *p = data;
+    uint16_t ep0size = b->in[0].size;
+    int total = 0, r;
+    b->setup[0] = type;
+    b->setup[1] = request;
+    b->setup[2] = value & 0xFF;
+    b->setup[3] = value >> 8;
+    b->setup[4] = index & 0xFF;
+    b->setup[5] = index >> 8;
+    b->setup[6] = length & 0xFF;
+    b->setup[7] = length >> 8;
+    b->setup_ready = true;
+    /* SETUP clears the control endpoint stall and the pending data */
+    b->in[0].stall = b->out[0].stall = false;
+    b->in[0].ready = b->out[0].ready = false;
+    vbus_event(n, usbd_evt_epsetup, 0);
+    if ((type & USB_REQ_DEVTOHOST) && length) {
+        /* DATA IN stage until the short packet or wLength */
+        while (total < length) {
+            r = vbus_in(n, 0x80, p + total);
+            if (r < 0) return VBUS_STALL;
+            total += r;
+            if (r < ep0size) break;
+        }
+        /* STATUS OUT stage */
+        return (vbus_out(n, 0x00, 0, 0) < 0) ? VBUS_STALL : total;
+    }
+    /* DATA OUT stage */
+    while (total < length) {
+        uint16_t len = (length - total > ep0size) ? ep0size : length - total;
+        if (vbus_out(n, 0x00, p + total, len) < 0) return VBUS_STALL;
+        total += len;
+    }
+    /* STATUS IN stage */
+    return (vbus_in(n, 0x80, 0) == 0) ? total : VBUS_STALL;
+}
+
+bool vbus_enumerate(int n, uint8_t addr, uint8_t config) {
+    vbus_event(n, usbd_evt_reset, 0);
+    if (vbus_control(n, 0x00, USB_STD_SET_ADDRESS, addr, 0, 0, 0) < 0) return false;
+    return vbus_control(n, 0x00, USB_STD_SET_CONFIG, config, 0, 0, 0) == 0;
+}
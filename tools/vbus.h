@@ -0,0 +1,96 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Virtual USB bus for the host tests. Host tool.
+ * Each bus is a full-speed device controller with 8 bidirectional endpoint buffers and a host
+ * side that runs control transfers and moves single packets. Events are delivered to the core
+ * one at a time through usbd_poll(), like the interrupt handler of the real driver does.
+ * With USBD_DRIVER_CTX all buses share one call table and the bus is passed as the base.
+ */
+
+#ifndef _VBUS_H_
+#define _VBUS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "usb.h"
+
+#define VBUS_COUNT      2
+#define VBUS_EPCOUNT    8
+#define VBUS_EPSIZE     1023    /* full-speed isochronous maximum */
+
+#define VBUS_STALL      (-1)    /* transaction answered by STALL */
+#define VBUS_NAK        (-2)    /* transaction answered by NAK */
+
+struct vbus_ep {
+    uint8_t     data[VBUS_EPSIZE];
+    uint16_t    len;
+    uint16_t    size;
+    uint8_t     type;
+    bool        enabled;
+    bool        ready;      /* IN: written by the device, OUT: not yet read by the device */
+    bool        stall;
+};
+
+struct vbus {
+    struct vbus_ep  in[VBUS_EPCOUNT];
+    struct vbus_ep  out[VBUS_EPCOUNT];
+    uint8_t     setup[8];
+    bool        setup_ready;
+    bool        pending;
+    uint8_t     evt;
+    uint8_t     ep;
+    uint16_t    frame;
+    uint8_t     addr;
+    bool        resume;     /* resume signalling is active */
+    unsigned    resumes;    /* resume signalling starts */
+    usbd_device *dev;
+};
+
+extern struct vbus vbus[VBUS_COUNT];
+extern unsigned vbus_failed;
+
+/* counts and prints the failed check, the test continues */
+#define VBUS_CHECK(cond) do {                                               \
+        if (!(cond)) {                                                      \
+            vbus_failed++;                                                  \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        }                                                                   \
+    } while (0)
+
+/* initializes the bus n and the device attached to it */
+void vbus_init(int n, usbd_device *dev, uint8_t ep0size, uint32_t *buffer, uint16_t bsize);
+
+/* delivers the event to the device through usbd_poll() */
+void vbus_event(int n, uint8_t evt, uint8_t ep);
+
+/* bus reset, SET_ADDRESS and SET_CONFIGURATION */
+bool vbus_enumerate(int n, uint8_t addr, uint8_t config);
+
+/* runs the control transfer. Returns the number of the data stage bytes or VBUS_STALL */
+int vbus_control(int n, uint8_t type, uint8_t request, uint16_t value, uint16_t index,
+                 uint16_t length, void *data);
+
+/* sends the OUT packet. Returns length, VBUS_NAK or VBUS_STALL */
+int vbus_out(int n, uint8_t ep, const void *data, uint16_t len);
+
+/* takes the IN packet. Returns length, VBUS_NAK or VBUS_STALL */
+int vbus_in(int n, uint8_t ep, void *data);
+
+/* starts the next frame */
+void vbus_sof(int n);
+
+#endif /* _VBUS_H_ */
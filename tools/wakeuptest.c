@@ -0,0 +1,154 @@
+/* This file is the part of the Lightweight USB device Stack for STM32 microcontrollers
+ *
+ * Copyright ©2016 Dmitry Filimonchuk <dmitrystu[at]gmail[dot]com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Remote wakeup test. Host tool.
+ * Runs DEVICE_REMOTE_WAKEUP feature requests against usbd_core.c on the virtual bus and
+ * checks when usbd_remote_wakeup() reaches the driver resume hook.
+ *
+ * Build and run:
+ *   cc -std=gnu99 -Iinc -DUSBD_VIRTUAL tools/wakeuptest.c tools/vbus.c src/usbd_core.c -o wakeuptest
+ *   ./wakeuptest
+ *
+ * Driver register sequences are not covered, the hooks are checked on the core side only.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "usb.h"
+#include "vbus.h"
+
+static struct usb_config_descriptor config_desc = {
+    .bLength                = sizeof(struct usb_config_descriptor),
+    .bDescriptorType        = USB_DTYPE_CONFIGURATION,
+    .wTotalLength           = sizeof(struct usb_config_descriptor),
+    .bNumInterfaces         = 0,
+    .bConfigurationValue    = 1,
+    .iConfiguration         = NO_DESCRIPTOR,
+    .bmAttributes           = USB_CFG_ATTR_RESERVED,
+    .bMaxPower              = USB_CFG_POWER_MA(100),
+};
+
+static usbd_device udev;
+static uint32_t ubuf[0x20];
+
+static usbd_respond app_getdesc(usbd_ctlreq *req, void **address, uint16_t *length) {
+    if ((req->wValue >> 8) != USB_DTYPE_CONFIGURATION) return usbd_fail;
+    *address = &config_desc;
+    *length = sizeof(config_desc);
+    return usbd_ack;
+}
+
+static usbd_respond app_setconf(usbd_device *dev, uint8_t cfg) {
+    (void)dev;
+    return (cfg <= 1) ? usbd_ack : usbd_fail;
+}
+
+static int set_feature(bool set) {
+    return vbus_control(0, USB_REQ_STANDARD | USB_REQ_DEVICE,
+                        set ? USB_STD_SET_FEATURE : USB_STD_CLEAR_FEATURE,
+                        USB_FEAT_REMOTE_WKUP, 0, 0, 0);
+}
+
+static uint8_t get_status(void) {
+    uint8_t status[2] = {0xFF, 0xFF};
+    VBUS_CHECK(vbus_control(0, USB_REQ_DEVTOHOST | USB_REQ_STANDARD | USB_REQ_DEVICE,
+                            USB_STD_GET_STATUS, 0, 0, 2, status) == 2);
+    return status[0];
+}
+
+static void setup(uint8_t attributes) {
+    config_desc.bmAttributes = USB_CFG_ATTR_RESERVED | attributes;
+    vbus_init(0, &udev, 0x08, ubuf, sizeof(ubuf));
+    usbd_reg_config(&udev, app_setconf);
+    usbd_reg_descr(&udev, app_getdesc);
+    VBUS_CHECK(vbus_enumerate(0, 1, 1));
+}
+
+static void test_unsupported(void) {
+    setup(0);
+    VBUS_CHECK(set_feature(true) == VBUS_STALL);
+    VBUS_CHECK(get_status() == 0);
+    VBUS_CHECK(!usbd_remote_wakeup(&udev, true));
+    VBUS_CHECK(vbus[0].resumes == 0);
+}
+
+static void test_supported(void) {
+    setup(USB_CFG_ATTR_REMOTEWAKEUP);
+    /* disabled by default */
+    VBUS_CHECK(!usbd_remote_wakeup(&udev, true));
+    VBUS_CHECK(vbus[0].resumes == 0);
+    VBUS_CHECK(set_feature(true) == 0);
+    VBUS_CHECK(get_status() == 0x02);
+    /* bus is not suspended */
+    VBUS_CHECK(!usbd_remote_wakeup(&udev, true));
+    VBUS_CHECK(vbus[0].resumes == 0);
+    vbus_event(0, usbd_evt_susp, 0);
+    VBUS_CHECK(usbd_remote_wakeup(&udev, true));
+    VBUS_CHECK(vbus[0].resume && vbus[0].resumes == 1);
+    VBUS_CHECK(usbd_remote_wakeup(&udev, false));
+    VBUS_CHECK(!vbus[0].resume);
+    vbus_event(0, usbd_evt_wkup, 0);
+    /* host resumed the bus */
+    vbus_event(0, usbd_evt_susp, 0);
+    vbus_event(0, usbd_evt_wkup, 0);
+    VBUS_CHECK(!usbd_remote_wakeup(&udev, true));
+    VBUS_CHECK(vbus[0].resumes == 1);
+    /* LPM L1 sleep */
+    vbus_event(0, usbd_evt_l1sleep, 0);
+    VBUS_CHECK(usbd_remote_wakeup(&udev, true));
+    VBUS_CHECK(usbd_remote_wakeup(&udev, false));
+    VBUS_CHECK(vbus[0].resumes == 2);
+    /* host disables the feature */
+    VBUS_CHECK(set_feature(false) == 0);
+    VBUS_CHECK(get_status() == 0);
+    vbus_event(0, usbd_evt_susp, 0);
+    VBUS_CHECK(!usbd_remote_wakeup(&udev, true));
+    VBUS_CHECK(vbus[0].resumes == 2);
+    /* bus reset disables the feature and leaves the suspend */
+    VBUS_CHECK(set_feature(true) == 0);
+    vbus_event(0, usbd_evt_susp, 0);
+    vbus_event(0, usbd_evt_reset, 0);
+    VBUS_CHECK(!usbd_remote_wakeup(&udev, true));
+    VBUS_CHECK(vbus[0].resumes == 2);
+}
+
+static void test_addressed(void) {
+    /* addressed device is checked against the first configuration */
+    setup(USB_CFG_ATTR_REMOTEWAKEUP);
+    VBUS_CHECK(vbus_control(0, 0x00, USB_STD_SET_CONFIG, 0, 0, 0, 0) == 0);
+    VBUS_CHECK(set_feature(true) == 0);
+    setup(0);
+    VBUS_CHECK(vbus_control(0, 0x00, USB_STD_SET_CONFIG, 0, 0, 0, 0) == 0);
+    VBUS_CHECK(set_feature(true) == VBUS_STALL);
+}
+
+static void test_truncated(void) {
+    /* descriptor data shorter than wTotalLength is not used */
+    setup(USB_CFG_ATTR_REMOTEWAKEUP);
+    config_desc.wTotalLength = sizeof(config_desc) + sizeof(struct usb_interface_descriptor);
+    VBUS_CHECK(set_feature(true) == VBUS_STALL);
+    config_desc.wTotalLength = sizeof(config_desc);
+    VBUS_CHECK(set_feature(true) == 0);
+}
+
+int main(void) {
+    test_unsupported();
+    test_supported();
+    test_addressed();
+    test_truncated();
+    printf("wakeuptest: %s\n", vbus_failed ? "FAILED" : "passed");
+    return vbus_failed ? 1 : 0;
+}